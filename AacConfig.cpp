@@ -0,0 +1,46 @@
+#include "AacConfig.h"
+
+namespace Aac {
+
+static const int kRates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350};
+static const int kRateCount = sizeof(kRates) / sizeof(kRates[0]);
+
+bool parseAsc(const uint8_t* data, size_t size, AscInfo& info) {
+    if (!data || size < 2) return false;
+    uint64_t bits = 0;
+    for (size_t i = 0; i < 8; ++i) bits = (bits << 8) | (i < size ? data[i] : 0);
+    int pos = 0;
+    auto read = [&bits, &pos](int n) {
+        uint32_t v = static_cast<uint32_t>((bits >> (64 - pos - n)) & ((1u << n) - 1));
+        pos += n;
+        return v;
+    };
+
+    info.objectType = static_cast<int>(read(5));
+    if (info.objectType == 31) info.objectType = 32 + static_cast<int>(read(6));
+    uint32_t index = read(4);
+    if (index == 15) {
+        if (size < 5) return false;
+        info.sampleRate = static_cast<int>(read(24));
+    } else if (index < static_cast<uint32_t>(kRateCount)) {
+        info.sampleRate = kRates[index];
+    } else {
+        return false;
+    }
+    info.channels = static_cast<int>(read(4));
+    return info.sampleRate > 0;
+}
+
+bool buildAsc(int sampleRate, int channels, std::vector<uint8_t>& out) {
+    int index = -1;
+    for (int i = 0; i < kRateCount; ++i) {
+        if (kRates[i] == sampleRate) index = i;
+    }
+    if (index < 0 || channels <= 0 || channels > 7) return false;
+    const int objectType = 2;
+    out = {static_cast<uint8_t>((objectType << 3) | (index >> 1)),
+           static_cast<uint8_t>(((index & 1) << 7) | (channels << 3))};
+    return true;
+}
+
+} // namespace Aac
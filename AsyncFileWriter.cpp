@@ -0,0 +1,240 @@
+#include "AsyncFileWriter.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "Logger.h"
+#include "ThreadPolicy.h"
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AsyncFileWriter::AsyncFileWriter(const Config& config)
+    : bufferBytes_((std::max<size_t>(config.bufferBytes, kAlign) + kAlign - 1) / kAlign * kAlign),
+      current_(-1), fill_(0), fileOpen_(false), queued_(0), isRunning_(false),
+      fd_(-1), direct_(false), fileFailed_(false), fileSize_(0) {
+    for (size_t i = 0; i < std::max<size_t>(config.bufferCount, 2); ++i) {
+        void* p = nullptr;
+        if (posix_memalign(&p, kAlign, bufferBytes_) != 0) break;
+        buffers_.push_back(static_cast<uint8_t*>(p));
+        free_.push_back(static_cast<int>(i));
+    }
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    stop();
+    for (uint8_t* b : buffers_) free(b);
+}
+
+void AsyncFileWriter::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (isRunning_) return;
+    isRunning_ = true;
+    ioThread_ = std::thread(&AsyncFileWriter::ioLoop, this);
+}
+
+void AsyncFileWriter::stop() {
+    if (fileOpen_) close();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        isRunning_ = false;
+    }
+    cv_.notify_one();
+    if (ioThread_.joinable()) ioThread_.join();
+}
+
+void AsyncFileWriter::submit(Op op) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (op.type == OpType::DATA) ++queued_;
+        ops_.push_back(std::move(op));
+    }
+    cv_.notify_one();
+}
+
+// ---------------- Producer ----------------
+void AsyncFileWriter::open(const std::string& path) {
+    if (fileOpen_) close();
+    fileOpen_ = true;
+    submit({OpType::OPEN, path});
+}
+
+bool AsyncFileWriter::write(const iovec* parts, size_t count) {
+    if (!fileOpen_) return false;
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) total += parts[i].iov_len;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t room = (current_ >= 0 ? bufferBytes_ - fill_ : 0) + free_.size() * bufferBytes_;
+        if (total > room) {
+            droppedWrites_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    // Enough buffers are reserved by the check above; only this thread takes them
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t* src = static_cast<const uint8_t*>(parts[i].iov_base);
+        size_t left = parts[i].iov_len;
+        while (left > 0) {
+            if (current_ < 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                current_ = free_.back();
+                free_.pop_back();
+                fill_ = 0;
+            }
+            size_t n = std::min(left, bufferBytes_ - fill_);
+            memcpy(buffers_[current_] + fill_, src, n);
+            fill_ += n;
+            src += n;
+            left -= n;
+            if (fill_ == bufferBytes_) {
+                submit({OpType::DATA, std::string(), current_, fill_});
+                current_ = -1;
+            }
+        }
+    }
+    return true;
+}
+
+void AsyncFileWriter::close() {
+    if (!fileOpen_) return;
+    fileOpen_ = false;
+    if (current_ >= 0) {
+        if (fill_ > 0) {
+            submit({OpType::DATA, std::string(), current_, fill_});
+        } else {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(current_);
+        }
+        current_ = -1;
+    }
+    submit({OpType::CLOSE, std::string()});
+}
+
+void AsyncFileWriter::remove(const std::string& path) {
+    submit({OpType::REMOVE, path});
+}
+
+AsyncFileWriterStats AsyncFileWriter::stats() const {
+    AsyncFileWriterStats s;
+    s.bytesWritten = bytesWritten_.load(std::memory_order_relaxed);
+    s.droppedWrites = droppedWrites_.load(std::memory_order_relaxed);
+    s.errors = errors_.load(std::memory_order_relaxed);
+    s.maxWriteUs = maxWriteUs_.load(std::memory_order_relaxed);
+    s.bufferCount = buffers_.size();
+    std::lock_guard<std::mutex> lock(mutex_);
+    s.buffersQueued = queued_;
+    return s;
+}
+
+// ---------------- I/O thread ----------------
+void AsyncFileWriter::ioLoop() {
+    ThreadPolicy::instance().enter("file-writer");
+
+    for (;;) {
+        Op op;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return !ops_.empty() || !isRunning_; });
+            if (ops_.empty()) break;
+            op = std::move(ops_.front());
+            ops_.pop_front();
+        }
+
+        switch (op.type) {
+        case OpType::OPEN:
+            openFile(op.path);
+            break;
+        case OpType::DATA: {
+            writeBuffer(op.buffer, op.size);
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_.push_back(op.buffer);
+            --queued_;
+            break;
+        }
+        case OpType::CLOSE:
+            closeFile();
+            break;
+        case OpType::REMOVE:
+            if (unlink(op.path.c_str()) < 0 && errno != ENOENT) {
+                logWithTime(LEVEL_WARN, "[FileWriter] Cannot remove " + op.path + ": " + strerror(errno));
+            }
+            break;
+        }
+    }
+    closeFile();
+    ThreadPolicy::instance().leave();
+}
+
+/**
+ * O_DIRECT is refused by some filesystems (tmpfs, some FUSE mounts) with
+ * EINVAL; those get buffered I/O.
+ */
+void AsyncFileWriter::openFile(const std::string& path) {
+    closeFile();
+    path_ = path;
+    fileSize_ = 0;
+    fileFailed_ = false;
+    direct_ = true;
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    if (fd_ < 0 && errno == EINVAL) {
+        direct_ = false;
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd_ < 0) {
+        fileFailed_ = true;
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        logWithTime(LEVEL_ERROR, "[FileWriter] Cannot open " + path + ": " + strerror(errno));
+    }
+}
+
+/**
+ * Only the last buffer of a file is partial. With O_DIRECT it is written
+ * zero-padded to the alignment and the file is truncated back on close.
+ */
+void AsyncFileWriter::writeBuffer(int buffer, size_t size) {
+    if (fd_ < 0 || fileFailed_) return;
+
+    uint8_t* data = buffers_[buffer];
+    size_t length = size;
+    if (direct_ && size % kAlign != 0) {
+        length = (size + kAlign - 1) / kAlign * kAlign;
+        memset(data + size, 0, length - size);
+    }
+
+    int64_t begin = now_us();
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::write(fd_, data + done, length - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fileFailed_ = true;
+            errors_.fetch_add(1, std::memory_order_relaxed);
+            logWithTime(LEVEL_ERROR, "[FileWriter] Write failed on " + path_ + ": " +
+                        (n < 0 ? strerror(errno) : "no progress") + "; rest of the file discarded");
+            return;
+        }
+        done += static_cast<size_t>(n);
+    }
+    int64_t elapsed = now_us() - begin;
+    if (elapsed > maxWriteUs_.load(std::memory_order_relaxed)) maxWriteUs_.store(elapsed, std::memory_order_relaxed);
+    fileSize_ += size;
+    bytesWritten_.fetch_add(size, std::memory_order_relaxed);
+}
+
+void AsyncFileWriter::closeFile() {
+    if (fd_ < 0) return;
+    if (direct_ && ftruncate(fd_, static_cast<off_t>(fileSize_)) < 0) {
+        logWithTime(LEVEL_WARN, "[FileWriter] Cannot trim " + path_ + ": " + strerror(errno));
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
@@ -0,0 +1,130 @@
+#include "BitrateController.h"
+#include <algorithm>
+
+BitrateController::BitrateController(const Config& config)
+    : config_(config), bitrateBps_(config.startBps) {
+    if (config_.floorBps > config_.ceilingBps) std::swap(config_.floorBps, config_.ceilingBps);
+    bitrateBps_ = std::min(std::max(bitrateBps_, config_.floorBps), config_.ceilingBps);
+}
+
+void BitrateController::update(const Sample& sample, int64_t nowMs) {
+    if (!havePrev_) {
+        prev_ = sample;
+        prevMs_ = lastChangeMs_ = nowMs;
+        havePrev_ = true;
+        return;
+    }
+
+    const int64_t dt = nowMs - prevMs_;
+    if (dt < config_.intervalMs) return;
+
+    const uint64_t drops = sample.drops - prev_.drops;
+    const uint64_t packets = sample.packetsSent - prev_.packetsSent;
+    const int64_t writeUs = sample.writeUsTotal - prev_.writeUsTotal;
+    const double throughput = static_cast<double>(sample.bytesSent - prev_.bytesSent) * 8000.0 / dt;
+    const int64_t avgWriteUs = packets ? writeUs / static_cast<int64_t>(packets) : 0;
+    prev_ = sample;
+    prevMs_ = nowMs;
+
+    int64_t unsentMs = 0, rttRiseMs = 0;
+    if (sample.tcpValid && sample.tcpRttUs > 0) {
+        if (minRttUs_ == 0 || sample.tcpRttUs < minRttUs_) minRttUs_ = sample.tcpRttUs;
+        unsentMs = static_cast<int64_t>(sample.tcpUnsentBytes * 8000 / std::max(bitrateBps_, 1));
+        rttRiseMs = (sample.tcpRttUs - minRttUs_) / 1000;
+    } else {
+        // A new connection may take another path; its RTT floor starts over
+        minRttUs_ = 0;
+    }
+    const bool socketBacklog = unsentMs >= config_.highUnsentMs;
+    const bool rttRise = rttRiseMs >= config_.highRttRiseMs;
+
+    const bool congested = sample.queueDepth >= config_.highQueueDepth || drops > 0 ||
+                           avgWriteUs >= config_.highWriteUs || socketBacklog || rttRise;
+    const bool clean = sample.queueDepth <= config_.lowQueueDepth && drops == 0 &&
+                       avgWriteUs < config_.highWriteUs / 2 && unsentMs < config_.highUnsentMs / 2 &&
+                       rttRiseMs < config_.highRttRiseMs / 2;
+
+    if (congested) {
+        cleanSinceMs_ = -1;
+
+        // Give the previous change one interval to take effect in the encoder
+        if (nowMs - lastChangeMs_ >= 2 * config_.intervalMs && bitrateBps_ > config_.floorBps) {
+            double target = bitrateBps_ * config_.decreaseFactor;
+            // What actually left the socket is the best estimate of the link
+            if (throughput > 0) target = std::min(target, throughput * 0.85);
+            int next = std::max(static_cast<int>(target), config_.floorBps);
+            std::string reason = drops ? "drops" :
+                                 sample.queueDepth >= config_.highQueueDepth ? "queue" :
+                                 socketBacklog ? "socket-backlog" :
+                                 rttRise ? "rtt" : "write-latency";
+            apply(nowMs, next, fpsStep_, scaleStep_, throughput, sample.queueDepth, reason);
+        }
+
+        if (bitrateBps_ <= config_.floorBps) {
+            if (floorCongestedSinceMs_ < 0) {
+                floorCongestedSinceMs_ = nowMs;
+            } else if (nowMs - floorCongestedSinceMs_ >= config_.fpsStepDownAfterMs) {
+                const bool fpsLeft = config_.allowFpsStepDown && fpsStep_ + 1 < config_.fpsSteps.size();
+                if (fpsLeft) {
+                    apply(nowMs, bitrateBps_, fpsStep_ + 1, scaleStep_, throughput, sample.queueDepth,
+                          "fps-step-down");
+                } else if (config_.allowScaleStepDown && scaleStep_ + 1 < config_.scaleSteps.size()) {
+                    apply(nowMs, bitrateBps_, fpsStep_, scaleStep_ + 1, throughput, sample.queueDepth,
+                          "scale-step-down");
+                }
+                floorCongestedSinceMs_ = nowMs;
+            }
+        }
+        return;
+    }
+
+    floorCongestedSinceMs_ = -1;
+    if (!clean) {
+        cleanSinceMs_ = -1;
+        return;
+    }
+    if (cleanSinceMs_ < 0) {
+        cleanSinceMs_ = nowMs;
+        return;
+    }
+    if (nowMs - cleanSinceMs_ < config_.increaseHoldMs || nowMs - lastChangeMs_ < config_.increaseHoldMs) return;
+
+    // Restore picture size, then frame rate, before spending headroom on bitrate
+    if (scaleStep_ > 0 && bitrateBps_ >= 2 * config_.floorBps) {
+        apply(nowMs, bitrateBps_, fpsStep_, scaleStep_ - 1, throughput, sample.queueDepth, "scale-step-up");
+    } else if (fpsStep_ > 0 && bitrateBps_ >= 2 * config_.floorBps) {
+        apply(nowMs, bitrateBps_, fpsStep_ - 1, scaleStep_, throughput, sample.queueDepth, "fps-step-up");
+    } else if (bitrateBps_ < config_.ceilingBps) {
+        int next = std::min(static_cast<int>(bitrateBps_ * config_.increaseFactor), config_.ceilingBps);
+        apply(nowMs, next, fpsStep_, scaleStep_, throughput, sample.queueDepth, "probe");
+    }
+}
+
+void BitrateController::setFpsSteps(const std::vector<int>& fpsSteps) {
+    config_.fpsSteps = fpsSteps;
+    fpsStep_ = 0;
+    scaleStep_ = 0;
+    floorCongestedSinceMs_ = -1;
+}
+
+void BitrateController::apply(int64_t nowMs, int bitrateBps, size_t fpsStep, size_t scaleStep, double throughputBps,
+                              size_t queueDepth, const std::string& reason) {
+    Decision d;
+    d.timeMs = nowMs;
+    d.prevBitrateBps = bitrateBps_;
+    d.bitrateBps = bitrateBps;
+    d.prevFps = fps();
+    d.prevScale = scale();
+    d.throughputBps = throughputBps;
+    d.queueDepth = queueDepth;
+    d.reason = reason;
+
+    bitrateBps_ = bitrateBps;
+    fpsStep_ = fpsStep;
+    scaleStep_ = scaleStep;
+    lastChangeMs_ = nowMs;
+    d.fps = fps();
+    d.scale = scale();
+
+    if (onDecision_) onDecision_(d);
+}
@@ -0,0 +1,138 @@
+#include "CaptureTimeSei.h"
+#include <cstring>
+#include <ctime>
+#include "H264Bitstream.h"
+#include "H265Bitstream.h"
+
+namespace CaptureTimeSei {
+
+static const uint8_t kUuid[16] = {0x52, 0x54, 0x4d, 0x50, 0x2d, 0x63, 0x61, 0x70,
+                                  0x74, 0x75, 0x72, 0x65, 0xc1, 0x0c, 0x4b, 0x31};
+static const uint8_t kPayloadUserDataUnregistered = 5;
+static const size_t kPayloadSize = sizeof(kUuid) + 8;
+
+/** Appends with emulation prevention: 0x03 after two zeros if the next byte is <= 3. */
+static void append_escaped(std::vector<uint8_t>& out, const uint8_t* p, size_t n) {
+    int zeros = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (zeros >= 2 && p[i] <= 3) {
+            out.push_back(0x03);
+            zeros = 0;
+        }
+        out.push_back(p[i]);
+        zeros = p[i] == 0 ? zeros + 1 : 0;
+    }
+}
+
+void appendNal(bool hevc, int64_t captureUs, std::vector<uint8_t>& out) {
+    static const uint8_t kStartCode[4] = {0, 0, 0, 1};
+    out.insert(out.end(), kStartCode, kStartCode + 4);
+    if (hevc) {
+        out.push_back(H265::NAL_PREFIX_SEI << 1);
+        out.push_back(1);   // nuh_layer_id 0, nuh_temporal_id_plus1 1
+    } else {
+        out.push_back(H264::NAL_SEI);
+    }
+
+    uint8_t rbsp[2 + kPayloadSize];
+    rbsp[0] = kPayloadUserDataUnregistered;
+    rbsp[1] = static_cast<uint8_t>(kPayloadSize);
+    memcpy(rbsp + 2, kUuid, sizeof(kUuid));
+    uint64_t us = static_cast<uint64_t>(captureUs);
+    for (int i = 0; i < 8; ++i) rbsp[2 + sizeof(kUuid) + i] = static_cast<uint8_t>(us >> (56 - 8 * i));
+    append_escaped(out, rbsp, sizeof(rbsp));
+    out.push_back(0x80);    // rbsp_trailing_bits
+}
+
+bool insertOffset(bool hevc, const uint8_t* au, size_t size, size_t& offset) {
+    const uint8_t* slice = hevc ? H265::findFirstSlice(au, size) : H264::findFirstSlice(au, size);
+    if (!slice) return false;
+    // The start code of the slice; a zero in front of it stays with the NAL before
+    offset = static_cast<size_t>(slice - au) - 3;
+    return true;
+}
+
+bool insert(bool hevc, const uint8_t* au, size_t size, int64_t captureUs, std::vector<uint8_t>& out) {
+    size_t at = 0;
+    if (!insertOffset(hevc, au, size, at)) return false;
+    out.clear();
+    out.reserve(size + 48);
+    out.insert(out.end(), au, au + at);
+    appendNal(hevc, captureUs, out);
+    out.insert(out.end(), au + at, au + size);
+    return true;
+}
+
+/** Walks the SEI messages of one NAL (header excluded) for ours. */
+static bool parse_sei(const uint8_t* p, size_t n, int64_t& captureUs) {
+    // Only the first messages are of interest; unescape a bounded prefix
+    uint8_t rbsp[256];
+    size_t len = 0;
+    int zeros = 0;
+    for (size_t i = 0; i < n && len < sizeof(rbsp); ++i) {
+        if (zeros >= 2 && p[i] == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        rbsp[len++] = p[i];
+        zeros = p[i] == 0 ? zeros + 1 : 0;
+    }
+
+    size_t pos = 0;
+    while (pos < len && rbsp[pos] != 0x80) {
+        size_t type = 0, payloadSize = 0;
+        while (pos < len && rbsp[pos] == 0xFF) type += rbsp[pos++];
+        if (pos >= len) return false;
+        type += rbsp[pos++];
+        while (pos < len && rbsp[pos] == 0xFF) payloadSize += rbsp[pos++];
+        if (pos >= len) return false;
+        payloadSize += rbsp[pos++];
+        if (pos + payloadSize > len) return false;
+        if (type == kPayloadUserDataUnregistered && payloadSize >= kPayloadSize &&
+            memcmp(rbsp + pos, kUuid, sizeof(kUuid)) == 0) {
+            uint64_t us = 0;
+            for (int i = 0; i < 8; ++i) us = (us << 8) | rbsp[pos + sizeof(kUuid) + i];
+            captureUs = static_cast<int64_t>(us);
+            return true;
+        }
+        pos += payloadSize;
+    }
+    return false;
+}
+
+static bool check_nal(bool hevc, const uint8_t* nal, size_t n, int64_t& captureUs) {
+    if (hevc) {
+        return n > 2 && H265::nalType(nal[0]) == H265::NAL_PREFIX_SEI && parse_sei(nal + 2, n - 2, captureUs);
+    }
+    return n > 1 && (nal[0] & 0x1F) == H264::NAL_SEI && parse_sei(nal + 1, n - 1, captureUs);
+}
+
+bool extract(bool hevc, const uint8_t* data, size_t size, int lengthSize, int64_t& captureUs) {
+    const uint8_t* end = data + size;
+    if (lengthSize == 0) {
+        for (const uint8_t* sc = H264::findStartCode(data, end); sc; ) {
+            const uint8_t* nal = sc + 3;
+            const uint8_t* next = H264::findStartCode(nal, end);
+            if (check_nal(hevc, nal, (next ? next : end) - nal, captureUs)) return true;
+            sc = next;
+        }
+        return false;
+    }
+    for (const uint8_t* p = data; end - p > lengthSize;) {
+        size_t n = 0;
+        for (int i = 0; i < lengthSize; ++i) n = (n << 8) | p[i];
+        p += lengthSize;
+        if (n > static_cast<size_t>(end - p)) return false;
+        if (check_nal(hevc, p, n, captureUs)) return true;
+        p += n;
+    }
+    return false;
+}
+
+int64_t wallclockUs() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+} // namespace CaptureTimeSei
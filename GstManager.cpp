@@ -1,22 +1,173 @@
 #include "GstManager.h"
-#include <gst/app/gstappsrc.h>
 #include <gst/app/gstappsink.h>
 #include <iostream>
 #include <chrono> 
 #include <ctime>
+#include <future>
+#include <algorithm>
+#include <cstring>
+#include "AacConfig.h"
+#include "CaptureTimeSei.h"
 #include "Logger.h"
+#include "ThreadPolicy.h"
+
+struct PadCounters {
+    Metrics::Counter* buffers;
+    Metrics::Counter* bytes;   // optional
+};
+
+struct EncoderOutput {
+    Metrics::StageTimer* timer;
+    Metrics::Counter* keyframes;
+};
+
+// ---------------- Metrics probes (streaming threads, a few atomics each) ----------------
+static GstPadProbeReturn count_buffers(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer user_data) {
+    PadCounters* c = static_cast<PadCounters*>(user_data);
+    c->buffers->add();
+    if (c->bytes) c->bytes->add(gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info)));
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn encoder_input(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer user_data) {
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) {
+        static_cast<Metrics::StageTimer*>(user_data)->begin(GST_BUFFER_PTS(buffer));
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn encoder_output(GstPad* /*pad*/, GstPadProbeInfo* info, gpointer user_data) {
+    EncoderOutput* out = static_cast<EncoderOutput*>(user_data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) out->timer->end(GST_BUFFER_PTS(buffer));
+    if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) out->keyframes->add();
+    return GST_PAD_PROBE_OK;
+}
+
+static void free_pad_counters(gpointer data) { delete static_cast<PadCounters*>(data); }
+static void free_encoder_output(gpointer data) { delete static_cast<EncoderOutput*>(data); }
+
+struct RawValve {
+    const std::atomic<bool>* hold;
+    Metrics::Counter* held;
+};
+
+/** Raw frames that would only deepen a send backlog are dropped before the encoder spends time on them. */
+static GstPadProbeReturn hold_raw(GstPad* /*pad*/, GstPadProbeInfo* /*info*/, gpointer user_data) {
+    RawValve* v = static_cast<RawValve*>(user_data);
+    if (!v->hold->load(std::memory_order_relaxed)) return GST_PAD_PROBE_OK;
+    v->held->add();
+    return GST_PAD_PROBE_DROP;
+}
+
+static void free_raw_valve(gpointer data) { delete static_cast<RawValve*>(data); }
+
+struct SeiInserter {
+    bool hevc;
+    std::vector<uint8_t> nal;   // streaming thread only
+};
+
+/**
+ * The parser's output still carries the capture PTS; PTS + base time is on the
+ * monotonic system clock, shifted to the wallclock here. The access unit is
+ * not copied: the output buffer shares its memory, split at the first slice,
+ * with the SEI NAL as a small memory of its own in between.
+ */
+static GstPadProbeReturn insert_capture_time(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    SeiInserter* s = static_cast<SeiInserter*>(user_data);
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) return GST_PAD_PROBE_OK;
+    int64_t captureNs = GST_BUFFER_PTS(buffer) + gst_element_get_base_time(GST_ELEMENT(GST_PAD_PARENT(pad)));
+    int64_t captureUs = CaptureTimeSei::wallclockUs() - (Metrics::nowNs() - captureNs) / 1000;
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) return GST_PAD_PROBE_OK;
+    size_t at = 0;
+    const size_t size = map.size;
+    bool found = CaptureTimeSei::insertOffset(s->hevc, map.data, map.size, at);
+    gst_buffer_unmap(buffer, &map);
+    if (!found) return GST_PAD_PROBE_OK;
+
+    s->nal.clear();
+    CaptureTimeSei::appendNal(s->hevc, captureUs, s->nal);
+    uint8_t* nal = static_cast<uint8_t*>(g_malloc(s->nal.size()));
+    memcpy(nal, s->nal.data(), s->nal.size());
+
+    // Shallow copies: both halves reference the parser's memory
+    GstBuffer* out = gst_buffer_copy_region(buffer, GST_BUFFER_COPY_ALL, 0, at);
+    GstBuffer* tail = gst_buffer_copy_region(buffer, GST_BUFFER_COPY_MEMORY, at, size - at);
+    gst_buffer_insert_memory(out, -1, gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, nal, s->nal.size(), 0,
+                                                             s->nal.size(), nal, g_free));
+    out = gst_buffer_append(out, tail);
+    gst_buffer_unref(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = out;
+    return GST_PAD_PROBE_OK;
+}
+
+static void free_sei_inserter(gpointer data) { delete static_cast<SeiInserter*>(data); }
+
+/** current-level-buffers / -bytes of a queue element */
+static guint queue_level(GstElement* queue, const char* property) {
+    guint level = 0;
+    g_object_get(queue, property, &level, NULL);
+    return level;
+}
+
+static size_t queue_bytes(GstElement* bin, const char* name) {
+    GstElement* queue = bin ? gst_bin_get_by_name(GST_BIN(bin), name) : nullptr;
+    if (!queue) return 0;
+    size_t bytes = queue_level(queue, "current-level-bytes");
+    gst_object_unref(queue);
+    return bytes;
+}
+
+struct BranchUnlink {
+    GstPad* peer;
+    std::promise<void> done;
+};
+
+/** Runs once the tee pad is between buffers, so no buffer is cut off mid-push. */
+static GstPadProbeReturn unlink_branch(GstPad* pad, GstPadProbeInfo* /*info*/, gpointer user_data) {
+    BranchUnlink* req = static_cast<BranchUnlink*>(user_data);
+    gst_pad_unlink(pad, req->peer);
+    req->done.set_value();
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void free_branch_unlink(gpointer data) { delete static_cast<BranchUnlink*>(data); }
+
+static GstPad* request_tee_pad(GstElement* tee) {
+#if GST_CHECK_VERSION(1, 20, 0)
+    return gst_element_request_pad_simple(tee, "src_%u");
+#else
+    return gst_element_get_request_pad(tee, "src_%u");
+#endif
+}
+
+const GstManager::BranchInfo GstManager::kBranches[BRANCH_COUNT] = {
+    {"h264_branch", "t_video", "h264sink", "h264_q", nullptr, true,
+     &GstManager::onVideoAnnexBFrame_, &GstManager::onVideoAnnexBSample},
+    {"video_rtp_branch", "t_video", "rtpsink", "rtp_q", nullptr, true,
+     &GstManager::onVideoRTPFrame_, &GstManager::onVideoRTPSample},
+    {"aac_branch", "t_audio", "aacsink", "aac_q", "aenc", false,
+     &GstManager::onAudioAACFrame_, &GstManager::onAudioAACSample},
+    {"audio_rtp_branch", "t_audio", "rtpsink", "rtp_q", nullptr, false,
+     &GstManager::onAudioRTPFrame_, &GstManager::onAudioRTPSample},
+};
 
 GstManager::GstManager(int width, int height, int fps, int videoBitrate,
                         uint32_t videoSSRC, uint32_t audioSSRC)
     : width_(width), height_(height), fps_(fps), videoBitrate_(videoBitrate),
       videoSSRC_(videoSSRC), audioSSRC_(audioSSRC),
-      videoPipeline_(nullptr), audioPipeline_(nullptr), audioPlayerPipeline_(nullptr),
-      audioAppSrc_(nullptr), mainLoop_(nullptr) {
+      videoPipeline_(nullptr), audioPipeline_(nullptr) {
     
     // Initialize GStreamer once
     if (!gst_is_initialized()) {
         gst_init(nullptr, nullptr);
     }
+    registerMetrics();
+    talkback_.reset(new TalkbackPlayer(talkbackConfig_, metricLabels({})));
 }
 
 GstManager::~GstManager() {
@@ -24,18 +175,48 @@ GstManager::~GstManager() {
     stopAudio();
     stopAudioPlayer();
 
-    if (mainLoop_) {
-        g_main_loop_quit(mainLoop_);
-    }
+    // Probes are gone with the pipelines; the counters they referenced can go too
+    Metrics::Registry::instance().remove(this);
+}
 
-    if (mainThread_.joinable()) {
-        mainThread_.join();
-    }
+void GstManager::registerMetrics() {
+    Metrics::Registry& reg = Metrics::Registry::instance();
+    const Metrics::Labels labels = metricLabels({{"pipeline", "video"}});
+    encTimer_.reset(new Metrics::StageTimer(reg.histogram(
+        "gst_encoder_latency_ms", "Time from encoder input to output per frame", Metrics::latencyBucketsMs(),
+        labels, this)));
+    encKeyframes_ = &reg.counter("gst_encoder_keyframes_total", "Keyframes produced by the video encoder",
+                                 labels, this);
+    keyframeRequests_ = &reg.counter("gst_encoder_keyframe_requests_total", "Keyframes forced on the video encoder",
+                                     labels, this);
+    rawHeld_ = &reg.counter("gst_raw_frames_held_total",
+                            "Raw video frames not encoded while the send queue was over its memory budget",
+                            labels, this);
+}
 
-    if (mainLoop_) {
-        g_main_loop_unref(mainLoop_);
-        mainLoop_ = nullptr;
-    }
+Metrics::Labels GstManager::metricLabels(const Metrics::Labels& labels) const {
+    if (sessionName_.empty()) return labels;
+    Metrics::Labels out = {{"session", sessionName_}};
+    out.insert(out.end(), labels.begin(), labels.end());
+    return out;
+}
+
+/**
+ * The registry hands out the existing metric for a repeated name and label
+ * set, so two unlabelled instances would share (and one would free) counters.
+ */
+void GstManager::setSessionName(const std::string& name) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (videoPipeline_ || audioPipeline_ || talkback_->isRunning() || name == sessionName_) return;
+    Metrics::Registry::instance().remove(this);
+    sessionName_ = name;
+    registerMetrics();
+    talkback_.reset(new TalkbackPlayer(talkbackConfig_, metricLabels({})));
+}
+
+void GstManager::setSource(const MediaSource& source) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    source_ = source;
 }
 
 // ---------------- Helper ----------------
@@ -47,51 +228,461 @@ void GstManager::setupSink(GstElement* pipeline, const std::string& name, GCallb
     }
 }
 
-// ---------------- Video ----------------
-void GstManager::startVideo() {
+/** @brief Probe on a pad of a named element; notify(data) runs even if there is no such pad */
+bool GstManager::addProbe(GstElement* pipeline, const std::string& element, const std::string& pad,
+                          GstPadProbeType type, GstPadProbeCallback cb, gpointer data, GDestroyNotify notify) {
+    GstElement* el = gst_bin_get_by_name(GST_BIN(pipeline), element.c_str());
+    GstPad* p = el ? gst_element_get_static_pad(el, pad.c_str()) : nullptr;
+    if (el) gst_object_unref(el);
+    if (!p) {
+        notify(data);
+        return false;
+    }
+    gst_pad_add_probe(p, type, cb, data, notify);
+    gst_object_unref(p);
+    return true;
+}
+
+void GstManager::instrumentElement(GstElement* pipeline, const std::string& pipelineName,
+                                   const std::string& element, Stage stage) {
+    Metrics::Registry& reg = Metrics::Registry::instance();
+    Metrics::Labels labels = metricLabels({{"pipeline", pipelineName}, {"element", element}});
+    Metrics::Counter& in = reg.counter("gst_element_buffers_in_total", "Buffers entering the element", labels, this);
+    Metrics::Counter& out = reg.counter("gst_element_buffers_out_total", "Buffers leaving the element", labels, this);
+    Metrics::Counter& bytes = reg.counter("gst_element_bytes_out_total", "Bytes leaving the element", labels, this);
+
+    // Derived at scrape time; nothing extra per buffer. A queue is asked for its
+    // level, since a leaky one drops without the buffer ever leaving its src pad.
+    GstElement* el = stage == Stage::QUEUE ? gst_bin_get_by_name(GST_BIN(pipeline), element.c_str()) : nullptr;
+    if (el) {
+        std::shared_ptr<GstElement> queue(el, [](GstElement* e) { gst_object_unref(e); });
+        reg.callback("gst_queue_level_buffers", "Buffers currently held by the queue", Metrics::Type::GAUGE,
+                     [queue]() { return static_cast<double>(queue_level(queue.get(), "current-level-buffers")); },
+                     labels, this);
+        reg.callback("gst_queue_level_bytes", "Bytes currently held by the queue", Metrics::Type::GAUGE,
+                     [queue]() { return static_cast<double>(queue_level(queue.get(), "current-level-bytes")); },
+                     labels, this);
+        reg.callback("gst_element_dropped_total", "Buffers dropped by the element", Metrics::Type::COUNTER,
+                     [queue, &in, &out]() {
+                         double held = queue_level(queue.get(), "current-level-buffers");
+                         return std::max(0.0, static_cast<double>(in.value() - out.value()) - held);
+                     }, labels, this);
+    } else if (stage == Stage::DROPPER) {
+        reg.callback("gst_element_dropped_total", "Buffers dropped by the element", Metrics::Type::COUNTER,
+                     [&in, &out]() { return static_cast<double>(in.value() - out.value()); }, labels, this);
+    }
+
+    addProbe(pipeline, element, "sink", GST_PAD_PROBE_TYPE_BUFFER, count_buffers,
+             new PadCounters{&in, nullptr}, free_pad_counters);
+    addProbe(pipeline, element, "src", GST_PAD_PROBE_TYPE_BUFFER, count_buffers,
+             new PadCounters{&out, &bytes}, free_pad_counters);
+}
+
+void GstManager::instrumentEncoder(GstElement* pipeline, const std::string& element) {
+    addProbe(pipeline, element, "sink", GST_PAD_PROBE_TYPE_BUFFER, encoder_input, encTimer_.get(),
+             [](gpointer) {});
+    addProbe(pipeline, element, "src", GST_PAD_PROBE_TYPE_BUFFER, encoder_output,
+             new EncoderOutput{encTimer_.get(), encKeyframes_}, free_encoder_output);
+}
+
+/**
+ * Both pipelines run on the monotonic system clock so that base time + running
+ * time of video and audio buffers land on one comparable timeline.
+ * (pulsesrc would otherwise provide its own clock on x86.)
+ */
+void GstManager::useSharedClock(GstElement* pipeline) {
+    GstClock* clock = gst_system_clock_obtain();
+    gst_pipeline_use_clock(GST_PIPELINE(pipeline), clock);
+    gst_object_unref(clock);
+}
+
+/**
+ * A sync handler runs on the posting thread, and STREAM_STATUS ENTER/LEAVE
+ * are posted by the streaming thread itself as its task starts and stops, so
+ * the thread is named and placed before it handles its first buffer. EOS and
+ * errors only raise a flag; whoever owns the instance polls it.
+ */
+GstBusSyncReply GstManager::onBusMessage(GstBus* /*bus*/, GstMessage* msg, gpointer user_data) {
+    GstManager* self = static_cast<GstManager*>(user_data);
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_STREAM_STATUS: {
+        GstStreamStatusType type;
+        GstElement* owner = nullptr;
+        gst_message_parse_stream_status(msg, &type, &owner);
+        if (type == GST_STREAM_STATUS_TYPE_ENTER && owner) {
+            gchar* name = gst_element_get_name(owner);
+            ThreadPolicy::instance().enter(name);
+            g_free(name);
+        } else if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+            ThreadPolicy::instance().leave();
+        }
+        return GST_BUS_DROP;
+    }
+    case GST_MESSAGE_EOS:
+        logWithTime("[GstManager] End of stream");
+        self->ended_ = true;
+        return GST_BUS_DROP;
+    case GST_MESSAGE_ERROR: {
+        GError* error = nullptr;
+        gst_message_parse_error(msg, &error, nullptr);
+        logWithTime(LEVEL_ERROR, std::string("[GstManager] ") + GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)) + ": " +
+                    (error ? error->message : "Unknown error"));
+        if (error) g_error_free(error);
+        self->failed_ = true;
+        return GST_BUS_DROP;
+    }
+    default:
+        return GST_BUS_PASS;
+    }
+}
+
+void GstManager::watchBus(GstElement* pipeline) {
+    ended_ = false;
+    failed_ = false;
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_set_sync_handler(bus, onBusMessage, this, nullptr);
+    gst_object_unref(bus);
+}
+
+// ---------------- Branches ----------------
+/**
+ * Swapping a callback first takes the old branch out, so the streaming thread
+ * never reads the callback while it is being replaced.
+ */
+void GstManager::setCallback(BranchId id, FrameCallback cb) {
     std::lock_guard<std::mutex> lk(mutex_);
-    if (videoPipeline_) return;
+    removeBranch(id);
+    this->*kBranches[id].callback = std::move(cb);
+    if (this->*kBranches[id].callback) addBranch(id);
+}
 
-    std::string videoPipelineDesc;
+/**
+ * AAC encoder fed straight from the S16LE trunk. voaacenc and fdkaacenc take
+ * the captured samples as they are; avenc_aac only accepts float, which costs
+ * the one audioconvert left in the graph. All of them encode 48 kHz, so
+ * nothing resamples.
+ */
+static std::string aac_encoder_description() {
+#if PLATFORM_NUM == 0x610
+    static const char* const kEncoders[] = {"fdkaacenc", "voaacenc"};
+#else
+    static const char* const kEncoders[] = {"voaacenc", "fdkaacenc"};
+#endif
+    for (const char* name : kEncoders) {
+        GstElementFactory* factory = gst_element_factory_find(name);
+        if (factory) {
+            gst_object_unref(factory);
+            return std::string(name) + " name=aenc";
+        }
+    }
+    return "audioconvert ! avenc_aac name=aenc";
+}
 
+std::string GstManager::branchDescription(BranchId id) const {
+    // Only the audio sinks may drop: every audio frame decodes on its own, a video frame does not
+    const std::string sink = kBranches[id].video ? "" : appsinkOptions();
+    switch (id) {
+    case BRANCH_VIDEO_H264:
 #if PLATFORM_NUM == 0x610
-    // QCS610 Hardware Encoding
-    videoPipelineDesc =
-        "qtiqmmfsrc ! video/x-raw,format=NV12,width=" + std::to_string(width_) + ",height=" + std::to_string(height_) +
-        ",framerate=" + std::to_string(fps_) + "/1 ! "
-        "omxh264enc periodicity-idr=1 interval-intraframes=29 control-rate=2 target-bitrate=" + std::to_string(videoBitrate_) + 
-        " b-frames=0 entropy-mode=0 ! " 
-        "video/x-h264,profile=baseline ! "
-        "h264parse config-interval=1 ! " 
-        "video/x-h264,stream-format=byte-stream,alignment=au ! tee name=t_video "
-        "t_video. ! queue ! appsink name=h264sink emit-signals=true sync=true "
-        "t_video. ! queue ! rtph264pay config-interval=1 pt=96 ssrc=" + std::to_string(videoSSRC_) +
-        " mtu=1200 ! appsink name=rtpsink emit-signals=true sync=false";
+        return queueDescription("h264_q", QueueKind::ENCODED) + " ! appsink name=h264sink emit-signals=true sync=true" + sink;
 #else
-    // x86 Video - Enabled textoverlay only for x86 benchmarking
-    videoPipelineDesc =
-        "videotestsrc is-live=true pattern=ball do-timestamp=true ! "
-        "video/x-raw,width=" + std::to_string(width_) + ",height=" + std::to_string(height_) +
-        ",framerate=" + std::to_string(fps_) + "/1 ! "
-        "videoconvert ! "
-        "textoverlay name=time_overlay halignment=right valignment=bottom font-desc=\"Sans, 24\" ! "
-        "videoconvert ! queue ! video/x-raw,format=I420 ! "
-        "x264enc tune=zerolatency key-int-max=30 speed-preset=ultrafast bitrate=" + std::to_string(videoBitrate_ / 1000) + " ! "
-        "h264parse config-interval=1 ! video/x-h264,stream-format=byte-stream,alignment=au ! tee name=t_video "
-        "t_video. ! queue ! appsink name=h264sink emit-signals=true sync=false "
-        "t_video. ! queue ! rtph264pay config-interval=1 pt=96 ssrc=" + std::to_string(videoSSRC_) +
-        " mtu=1200 ! appsink name=rtpsink emit-signals=true sync=false";
+        return queueDescription("h264_q", QueueKind::ENCODED) + " ! appsink name=h264sink emit-signals=true sync=false" + sink;
 #endif
+    case BRANCH_VIDEO_RTP:
+        return queueDescription("rtp_q", QueueKind::ENCODED) + " ! " +
+               (videoCodec_ == VideoCodec::H265 ? "rtph265pay" : "rtph264pay") + " config-interval=1 pt=96 ssrc=" + std::to_string(videoSSRC_) +
+               " mtu=1200 ! appsink name=rtpsink emit-signals=true sync=false" + sink;
+    case BRANCH_AUDIO_AAC:
+        if (encodedAudio()) {
+            return queueDescription("aac_q", QueueKind::ENCODED) + " ! appsink name=aacsink emit-signals=true sync=false" + sink;
+        }
+        // Raw (not ADTS) output puts the AudioSpecificConfig into the caps as codec_data
+        return queueDescription("aac_q", QueueKind::RAW_AUDIO) + " ! " + aac_encoder_description() +
+               " ! aacparse ! audio/mpeg,mpegversion=4,stream-format=raw ! "
+               "appsink name=aacsink emit-signals=true sync=false" + sink;
+    case BRANCH_AUDIO_RTP:
+        if (encodedAudio()) {
+            return queueDescription("rtp_q", QueueKind::ENCODED) + " ! avdec_aac ! audioconvert ! audioresample ! "
+                   "audio/x-raw,rate=48000 ! opusenc ! rtpopuspay pt=111 ssrc=" + std::to_string(audioSSRC_) +
+                   " ! appsink name=rtpsink emit-signals=true sync=false" + sink;
+        }
+        return queueDescription("rtp_q", QueueKind::RAW_AUDIO) + " ! opusenc ! rtpopuspay pt=111 ssrc=" + std::to_string(audioSSRC_) +
+               " ! appsink name=rtpsink emit-signals=true sync=false" + sink;
+    default:
+        return "";
+    }
+}
+
+/**
+ * Builds the branch as a bin with a ghost sink pad and hangs it off a new tee
+ * pad. The bin is brought up to the pipeline state before it is linked, so the
+ * first buffer it sees can already flow. A no-op while the pipeline is down;
+ * start*() adds the branch then.
+ */
+void GstManager::addBranch(BranchId id) {
+    const BranchInfo& info = kBranches[id];
+    Branch& branch = branches_[id];
+    GstElement* pipeline = info.video ? videoPipeline_ : audioPipeline_;
+    if (!pipeline || branch.bin) return;
 
+    std::string desc = branchDescription(id);
     GError* error = nullptr;
-    logWithTime("Video Pipeline = " + videoPipelineDesc);
-    videoPipeline_ = gst_parse_launch(videoPipelineDesc.c_str(), &error);
-    if (!videoPipeline_ || error) {
-        std::cerr << "[GstManager] Failed to create video pipeline: " << (error ? error->message : "Unknown") << std::endl;
+    GstElement* bin = gst_parse_bin_from_description(desc.c_str(), TRUE, &error);
+    if (!bin || error) {
+        logWithTime(LEVEL_ERROR, std::string("[GstManager] Failed to create branch ") + info.bin + ": " +
+                    (error ? error->message : "Unknown"));
         if (error) g_error_free(error);
+        if (bin) gst_object_unref(bin);
         return;
     }
+    gst_object_set_name(GST_OBJECT(bin), info.bin);
+    gst_bin_add(GST_BIN(pipeline), bin);
+
+    const char* pipelineName = info.video ? "video" : "audio";
+    setupSink(bin, info.sink, G_CALLBACK(info.onSample));
+    instrumentElement(bin, pipelineName, info.queue, Stage::QUEUE);
+    if (info.encoder) instrumentElement(bin, pipelineName, info.encoder, Stage::PLAIN);
+    gst_element_sync_state_with_parent(bin);
+
+    GstElement* tee = gst_bin_get_by_name(GST_BIN(pipeline), info.tee);
+    GstPad* teePad = tee ? request_tee_pad(tee) : nullptr;
+    GstPad* sinkPad = gst_element_get_static_pad(bin, "sink");
+    if (!teePad || !sinkPad || gst_pad_link(teePad, sinkPad) != GST_PAD_LINK_OK) {
+        logWithTime(LEVEL_ERROR, std::string("[GstManager] Failed to link branch ") + info.bin);
+        if (teePad) {
+            gst_element_release_request_pad(tee, teePad);
+            gst_object_unref(teePad);
+        }
+        gst_element_set_state(bin, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(pipeline), bin);
+    } else {
+        branch.bin = bin;
+        branch.teePad = teePad;
+        logWithTime(std::string("[GstManager] Branch added: ") + info.bin);
+    }
+    if (sinkPad) gst_object_unref(sinkPad);
+    if (tee) gst_object_unref(tee);
+}
+
+/**
+ * Unlinks on an IDLE probe so the tee is not in the middle of pushing into the
+ * branch, then shuts the bin down and gives the request pad back. The rest of
+ * the pipeline keeps running.
+ */
+void GstManager::removeBranch(BranchId id) {
+    const BranchInfo& info = kBranches[id];
+    Branch& branch = branches_[id];
+    GstElement* pipeline = info.video ? videoPipeline_ : audioPipeline_;
+    if (!pipeline || !branch.bin) return;
+
+    GstPad* peer = gst_pad_get_peer(branch.teePad);
+    if (peer) {
+        BranchUnlink* req = new BranchUnlink{peer, {}};
+        std::future<void> unlinked = req->done.get_future();
+        gulong probe = gst_pad_add_probe(branch.teePad, GST_PAD_PROBE_TYPE_IDLE, unlink_branch, req,
+                                         free_branch_unlink);
+        // A stalled upstream never goes idle; unlink directly rather than hang
+        if (unlinked.wait_for(std::chrono::seconds(1)) != std::future_status::ready) {
+            logWithTime(LEVEL_WARN, std::string("[GstManager] Branch ") + info.bin + " not idle, unlinking anyway");
+            if (probe) gst_pad_remove_probe(branch.teePad, probe);
+            gst_pad_unlink(branch.teePad, peer);
+        }
+        gst_object_unref(peer);
+    }
+
+    gst_element_set_state(branch.bin, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(pipeline), branch.bin);
+
+    GstElement* tee = gst_bin_get_by_name(GST_BIN(pipeline), info.tee);
+    if (tee) {
+        gst_element_release_request_pad(tee, branch.teePad);
+        gst_object_unref(tee);
+    }
+    gst_object_unref(branch.teePad);
+    branch = Branch();
+    logWithTime(std::string("[GstManager] Branch removed: ") + info.bin);
+}
+
+void GstManager::dropBranches(bool video) {
+    GstElement* pipeline = video ? videoPipeline_ : audioPipeline_;
+    for (int id = 0; id < BRANCH_COUNT; ++id) {
+        const BranchInfo& info = kBranches[id];
+        Branch& branch = branches_[id];
+        if (info.video != video || !branch.bin) continue;
 
+        GstElement* tee = gst_bin_get_by_name(GST_BIN(pipeline), info.tee);
+        if (tee) {
+            gst_element_release_request_pad(tee, branch.teePad);
+            gst_object_unref(tee);
+        }
+        gst_object_unref(branch.teePad);
+        branch = Branch();
+    }
+}
+
+// ---------------- Source ----------------
+bool GstManager::sharedDecoder() const {
+    return source_.kind == SourceKind::FILE || source_.kind == SourceKind::UDP;
+}
+
+bool GstManager::hasAudioInput() const {
+    return source_.kind != SourceKind::RTP || source_.audioPort > 0;
+}
+
+bool GstManager::encodedAudio() const {
+    return source_.kind == SourceKind::RTP && !source_.opus;
+}
+
+/**
+ * Packets are put back in order and timestamped from their RTP timestamps by
+ * the jitter buffer; late ones are dropped rather than holding the stream.
+ */
+std::string GstManager::rtpSourceDescription(const std::string& name, int port, const std::string& caps) const {
+    std::string desc = "udpsrc name=" + name + " port=" + std::to_string(port) + " buffer-size=2097152 caps=\"" +
+                       caps + "\"";
+    if (source_.jitterMs > 0) {
+        desc += " ! rtpjitterbuffer name=" + name + "_jitter latency=" + std::to_string(source_.jitterMs) +
+                " drop-on-latency=true";
+    }
+    return desc;
+}
+
+/**
+ * The access units go to the tee as the camera encoded them. The parser puts
+ * SPS/PPS in front of every IDR, so a sender that only has them out of band
+ * once still gives each GOP (and every RTMP join) its headers.
+ */
+std::string GstManager::rtpVideoTrunkDescription() const {
+    const bool hevc = videoCodec_ == VideoCodec::H265;
+    const std::string codec = hevc ? "h265" : "h264";
+    return rtpSourceDescription("vsrc", source_.port, std::string("application/x-rtp,media=video,clock-rate=90000,"
+                                "encoding-name=") + (hevc ? "H265" : "H264")) +
+           " ! rtp" + codec + "depay ! " + codec + "parse config-interval=-1 ! video/x-" + codec +
+           ",stream-format=byte-stream,alignment=au ! tee name=t_video allow-not-linked=true";
+}
+
+/** @brief AAC-LC AudioSpecificConfig as hex, the "config" of RFC 3640 caps */
+static std::string aac_config_hex(int rate, int channels) {
+    std::vector<uint8_t> asc;
+    if (!Aac::buildAsc(rate, channels, asc)) Aac::buildAsc(GstManager::kAudioSampleRate, channels, asc);
+    std::string hex;
+    char byte[3];
+    for (uint8_t b : asc) {
+        snprintf(byte, sizeof(byte), "%02x", b);
+        hex += byte;
+    }
+    return hex;
+}
+
+/**
+ * AAC stays encoded all the way to the appsink; its codec_data comes from the
+ * RTP caps. Opus is decoded into the same raw format as a capture trunk, and
+ * the AAC branch encodes it as usual.
+ */
+std::string GstManager::rtpAudioTrunkDescription() const {
+    const std::string tee = " ! tee name=t_audio allow-not-linked=true";
+    if (source_.opus) {
+        return rtpSourceDescription("asrc", source_.audioPort, "application/x-rtp,media=audio,clock-rate=48000,"
+                                    "encoding-name=OPUS") +
+               " ! rtpopusdepay ! opusdec ! audioconvert ! audioresample ! audio/x-raw,format=S16LE,rate=" +
+               std::to_string(kAudioSampleRate) + ",channels=" + std::to_string(kAudioChannels) + tee;
+    }
+    return rtpSourceDescription("asrc", source_.audioPort,
+                                "application/x-rtp,media=audio,clock-rate=" + std::to_string(source_.audioRate) +
+                                ",encoding-name=MPEG4-GENERIC,encoding-params=(string)" +
+                                std::to_string(source_.audioChannels) + ",mode=(string)AAC-hbr,config=(string)" +
+                                aac_config_hex(source_.audioRate, source_.audioChannels) +
+                                ",sizelength=(string)13,indexlength=(string)3,indexdeltalength=(string)3") +
+           " ! rtpmp4gdepay ! aacparse ! audio/mpeg,mpegversion=4,stream-format=raw" + tee;
+}
+
+/** @brief The demuxer/decoder both trunks of a FILE or UDP source start from ("dec.") */
+std::string GstManager::decoderDescription() const {
+    if (source_.kind == SourceKind::UDP) {
+        return "udpsrc name=vsrc port=" + std::to_string(source_.port) + " buffer-size=2097152 "
+               "caps=\"video/mpegts,systemstream=(boolean)true\" ! decodebin name=dec";
+    }
+    return "filesrc name=vsrc location=\"" + source_.location + "\" ! decodebin name=dec";
+}
+
+/** @brief Raw video caps at the configured size and rate */
+std::string GstManager::rawVideoCaps() const {
+#if PLATFORM_NUM == 0x610
+    return "video/x-raw,format=NV12,width=" + std::to_string(width_) +
+           ",height=" + std::to_string(height_) + ",framerate=" + std::to_string(fps_) + "/1";
+#else
+    return "video/x-raw,width=" + std::to_string(width_) +
+           ",height=" + std::to_string(height_) + ",framerate=" + std::to_string(fps_) + "/1";
+#endif
+}
+
+/**
+ * Raw video at the configured size and rate, ahead of vrate. Decoded inputs
+ * are converted and scaled to it; a file is not live, so identity sync=true
+ * releases its frames in real time (nothing downstream syncs on x86).
+ * The caps sit in a named capsfilter so setVideoFormat() can change them.
+ */
+std::string GstManager::videoSourceDescription() const {
+    const std::string caps = "capsfilter name=vcaps caps=\"" + rawVideoCaps() + "\"";
+    const std::string testSource = "videotestsrc name=vsrc is-live=true pattern=ball do-timestamp=true ! " + caps;
+    switch (source_.kind) {
+    case SourceKind::TEST:
+        return testSource;
+    case SourceKind::FILE:
+    case SourceKind::UDP:
+        return decoderDescription() + " dec. ! " + queueDescription("vdec_q", QueueKind::RAW_VIDEO) + " ! videoconvert ! videoscale ! videorate ! " + caps +
+               (source_.kind == SourceKind::FILE ? " ! identity name=vpace sync=true" : "");
+    default:
+#if PLATFORM_NUM == 0x610
+        return "qtiqmmfsrc name=vsrc ! " + caps;
+#else
+        return testSource;
+#endif
+    }
+}
+
+// ---------------- Video ----------------
+std::string GstManager::videoTrunkDescription() const {
+    if (source_.kind == SourceKind::RTP) return rtpVideoTrunkDescription();
+#if PLATFORM_NUM == 0x610
+    // QCS610 Hardware Encoding
+    const std::string source = videoSourceDescription() + " ! "
+        "videorate name=vrate drop-only=true max-rate=" + std::to_string(fps_) + " ! ";
+    if (videoCodec_ == VideoCodec::H265) {
+        return source +
+            "omxh265enc name=venc periodicity-idr=1 interval-intraframes=29 control-rate=2 target-bitrate=" + std::to_string(videoBitrate_) +
+            " ! video/x-h265 ! "
+            "h265parse name=vparse config-interval=1 ! "
+            "video/x-h265,stream-format=byte-stream,alignment=au ! tee name=t_video allow-not-linked=true";
+    }
+    return source +
+        "omxh264enc name=venc periodicity-idr=1 interval-intraframes=29 control-rate=2 target-bitrate=" + std::to_string(videoBitrate_) + 
+        " b-frames=0 entropy-mode=0 ! " 
+        "video/x-h264,profile=baseline ! "
+        "h264parse name=vparse config-interval=1 ! " 
+        "video/x-h264,stream-format=byte-stream,alignment=au ! tee name=t_video allow-not-linked=true";
+#else
+    // x86 Video - the burned-in clock (setTimeOverlay) costs two conversions and font rendering per frame
+    const std::string overlay = timeOverlay_ ?
+        "textoverlay name=time_overlay halignment=right valignment=bottom font-desc=\"Sans, 24\" ! videoconvert ! " : "";
+    const std::string source = videoSourceDescription() + " ! "
+        "videorate name=vrate drop-only=true max-rate=" + std::to_string(fps_) + " ! "
+        "videoconvert ! " + overlay + queueDescription("enc_q", QueueKind::RAW_VIDEO) + " ! video/x-raw,format=I420 ! ";
+    if (videoCodec_ == VideoCodec::H265) {
+        return source +
+            "x265enc name=venc tune=zerolatency key-int-max=30 speed-preset=ultrafast bitrate=" + std::to_string(videoBitrate_ / 1000) + " ! "
+            "h265parse name=vparse config-interval=1 ! video/x-h265,stream-format=byte-stream,alignment=au ! "
+            "tee name=t_video allow-not-linked=true";
+    }
+    return source +
+        "x264enc name=venc tune=zerolatency key-int-max=30 speed-preset=ultrafast bitrate=" + std::to_string(videoBitrate_ / 1000) + " ! "
+        "h264parse name=vparse config-interval=1 ! video/x-h264,stream-format=byte-stream,alignment=au ! "
+        "tee name=t_video allow-not-linked=true";
+#endif
+}
+
+/** @brief Trunk instrumentation and the subscribed branches, before PLAYING */
+void GstManager::setupVideo() {
     // Benchmark injection: Only effective on x86 platform
 #if PLATFORM_NUM != 0x610
     GstElement* overlay = gst_bin_get_by_name(GST_BIN(videoPipeline_), "time_overlay");
@@ -119,176 +710,468 @@ void GstManager::startVideo() {
     }
 #endif
 
-    setupSink(videoPipeline_, "rtpsink", G_CALLBACK(onVideoRTPSample));
-    setupSink(videoPipeline_, "h264sink", G_CALLBACK(onVideoAnnexBSample));
+    instrumentElement(videoPipeline_, "video", "vrate", Stage::DROPPER);
+    instrumentElement(videoPipeline_, "video", "enc_q", Stage::QUEUE);
+    instrumentElement(videoPipeline_, "video", "venc", Stage::PLAIN);
+    instrumentEncoder(videoPipeline_, "venc");
+    // A relayed stream has no capture time to tell; whatever SEI the sender put in goes through
+    if (captureTimeSei_ && source_.kind != SourceKind::RTP) {
+        addProbe(videoPipeline_, "vparse", "src", GST_PAD_PROBE_TYPE_BUFFER, insert_capture_time,
+                 new SeiInserter{videoCodec_ == VideoCodec::H265, {}}, free_sei_inserter);
+    }
+    if (budget_.enabled && budget_.shed == MemoryBudget::Shed::RAW) {
+        addProbe(videoPipeline_, "vrate", "src", GST_PAD_PROBE_TYPE_BUFFER, hold_raw,
+                 new RawValve{&holdRaw_, rawHeld_}, free_raw_valve);
+    }
+    if (onVideoAnnexBFrame_) addBranch(BRANCH_VIDEO_H264);
+    if (onVideoRTPFrame_) addBranch(BRANCH_VIDEO_RTP);
+}
+
+void GstManager::startVideo() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (combined_ || sharedDecoder()) {
+        startCombined();
+        return;
+    }
+    if (videoPipeline_) return;
+    if (!onVideoAnnexBFrame_ && !onVideoRTPFrame_) {
+        logWithTime("[GstManager] No video subscribers, video pipeline not started");
+        return;
+    }
 
+    std::string videoPipelineDesc = videoTrunkDescription();
+    GError* error = nullptr;
+    logWithTime("Video Pipeline = " + videoPipelineDesc);
+    videoPipeline_ = gst_parse_launch(videoPipelineDesc.c_str(), &error);
+    if (!videoPipeline_ || error) {
+        logWithTime(LEVEL_ERROR, std::string("[GstManager] Failed to create video pipeline: ") +
+                    (error ? error->message : "Unknown"));
+        if (error) g_error_free(error);
+        return;
+    }
+
+    useSharedClock(videoPipeline_);
+    watchBus(videoPipeline_);
+    setupVideo();
     gst_element_set_state(videoPipeline_, GST_STATE_PLAYING);
 }
 
+void GstManager::setVideoBitrate(int bitrate) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    videoBitrate_ = bitrate;
+    if (!videoPipeline_) return;
+
+    GstElement* enc = gst_bin_get_by_name(GST_BIN(videoPipeline_), "venc");
+    if (!enc) return;
+#if PLATFORM_NUM == 0x610
+    g_object_set(enc, "target-bitrate", (guint)bitrate, NULL);
+#else
+    g_object_set(enc, "bitrate", (guint)(bitrate / 1000), NULL);
+#endif
+    gst_object_unref(enc);
+}
+
+void GstManager::setVideoFramerate(int fps) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (fps <= 0) return;
+    fps_ = fps;
+    if (!videoPipeline_) return;
+
+    GstElement* rate = gst_bin_get_by_name(GST_BIN(videoPipeline_), "vrate");
+    if (!rate) return;
+    g_object_set(rate, "max-rate", (gint)fps, NULL);
+    gst_object_unref(rate);
+}
+
+/**
+ * Renegotiates the raw video caps while PLAYING. The test source (or
+ * videoscale/videorate behind a decoder) follows the new vcaps; the encoder
+ * reinitialises on the new format and restarts with an IDR and new SPS/PPS,
+ * which RTMPStreamer and SegmentRecorder pick up in-stream.
+ */
+bool GstManager::setVideoFormat(int width, int height, int fps) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (width <= 0 || height <= 0 || fps <= 0) return false;
+    // A relayed stream is encoded by the sender
+    if (source_.kind == SourceKind::RTP) return false;
+    if (videoPipeline_ && !formatChangeable()) {
+        logWithTime(LEVEL_WARN, "[GstManager] The camera cannot change format while PLAYING");
+        return false;
+    }
+    width_ = width;
+    height_ = height;
+    fps_ = fps;
+    if (!videoPipeline_) return true;
+
+    GstElement* filter = gst_bin_get_by_name(GST_BIN(videoPipeline_), "vcaps");
+    if (!filter) return false;
+    GstCaps* caps = gst_caps_from_string(rawVideoCaps().c_str());
+    g_object_set(filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_object_unref(filter);
+
+    GstElement* rate = gst_bin_get_by_name(GST_BIN(videoPipeline_), "vrate");
+    if (rate) {
+        g_object_set(rate, "max-rate", (gint)fps, NULL);
+        gst_object_unref(rate);
+    }
+    logWithTime("[GstManager] Video format changed to " + std::to_string(width) + "x" + std::to_string(height) +
+                " @ " + std::to_string(fps) + " fps");
+    return true;
+}
+
+bool GstManager::canChangeVideoFormat() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return source_.kind != SourceKind::RTP && formatChangeable();
+}
+
+/** @brief qtiqmmfsrc sets up its camera stream once, at preroll */
+bool GstManager::formatChangeable() const {
+#if PLATFORM_NUM == 0x610
+    return source_.kind != SourceKind::CAPTURE;
+#else
+    return true;
+#endif
+}
+
+/**
+ * Sends the upstream GstForceKeyUnit event that x264enc/x265enc and the OMX encoders handle
+ * through GstVideoEncoder. Built by hand, as
+ * gst_video_event_new_upstream_force_key_unit() does, to avoid linking
+ * gstreamer-video for one event.
+ */
+void GstManager::requestKeyframe() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!videoPipeline_) return;
+    int64_t now = Metrics::nowNs();
+    if (lastKeyframeRequestNs_ > 0 && now - lastKeyframeRequestNs_ < 500 * 1000000LL) return;
+    lastKeyframeRequestNs_ = now;
+
+    GstElement* enc = gst_bin_get_by_name(GST_BIN(videoPipeline_), "venc");
+    GstPad* pad = enc ? gst_element_get_static_pad(enc, "src") : nullptr;
+    if (enc) gst_object_unref(enc);
+    if (!pad) return;
+
+    GstStructure* s = gst_structure_new("GstForceKeyUnit",
+                                        "running-time", G_TYPE_UINT64, (guint64)GST_CLOCK_TIME_NONE,
+                                        "all-headers", G_TYPE_BOOLEAN, TRUE,
+                                        "count", G_TYPE_UINT, 0u, NULL);
+    if (gst_pad_send_event(pad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, s))) {
+        keyframeRequests_->add();
+        logWithTime(LEVEL_DEBUG, "[GstManager] Keyframe requested");
+    }
+    gst_object_unref(pad);
+}
+
+bool GstManager::addVideoProbe(const std::string& element, const std::string& pad, BufferProbe probe) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!videoPipeline_) return false;
+    return addProbe(videoPipeline_, element, pad, GST_PAD_PROBE_TYPE_BUFFER, onBufferProbe,
+                    new BufferProbe(std::move(probe)),
+                    [](gpointer data) { delete static_cast<BufferProbe*>(data); });
+}
+
+/**
+ * Live sources start their segment at 0, so PTS + base time is the clock time
+ * MediaFrame reports for the same buffer further downstream.
+ */
+GstPadProbeReturn GstManager::onBufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    int64_t pts = -1;
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) {
+        pts = GST_BUFFER_PTS(buffer) + gst_element_get_base_time(GST_ELEMENT(GST_PAD_PARENT(pad)));
+    }
+    (*static_cast<BufferProbe*>(user_data))(buffer, pts);
+    return GST_PAD_PROBE_OK;
+}
+
 void GstManager::stopVideo() {
     if (!videoPipeline_) return;
+    if (videoPipeline_ == audioPipeline_) {
+        stopCombined();
+        return;
+    }
     gst_element_set_state(videoPipeline_, GST_STATE_NULL);
+    dropBranches(true);
     gst_object_unref(videoPipeline_);
     videoPipeline_ = nullptr;
 }
 
 // ---------------- Audio ----------------
-void GstManager::startAudio() {
-    std::lock_guard<std::mutex> lk(mutex_);
-    if (audioPipeline_) return;
-
-    std::string audioPipelineDesc;
-
+/**
+ * The source is asked for the final format (pulsesrc converts inside the
+ * sound server if the device differs); both branches take S16LE at 48 kHz
+ * as is, so the capture trunk has no converter or resampler of its own.
+ * Only decoded inputs, whose format is whatever the file or feed carries,
+ * convert and resample.
+ */
+std::string GstManager::audioTrunkDescription(bool withDecoder) const {
+    const std::string caps = "audio/x-raw,format=S16LE,rate=" + std::to_string(kAudioSampleRate) +
+                             ",channels=" + std::to_string(kAudioChannels);
+    const std::string tee = " ! tee name=t_audio allow-not-linked=true";
+    switch (source_.kind) {
+    case SourceKind::TEST:
+        return "audiotestsrc name=asrc is-live=true wave=sine volume=0.1 ! " + caps + tee;
+    case SourceKind::FILE:
+    case SourceKind::UDP:
+        return (withDecoder ? decoderDescription() + " " : std::string()) +
+               "dec. ! " + queueDescription("adec_q", QueueKind::RAW_AUDIO) + " ! audioconvert ! audioresample ! " + caps +
+               (source_.kind == SourceKind::FILE ? " ! identity name=apace sync=true" : "") + tee;
+    case SourceKind::RTP:
+        return rtpAudioTrunkDescription();
+    default:
 #if PLATFORM_NUM == 0x610
-    // QCS610 Audio: Uses avenc_aac
-    audioPipelineDesc =
-        "pulsesrc provide-clock=false ! audio/x-raw,format=S16LE,rate=48000,channels=1 ! tee name=t_audio "
-        "t_audio. ! queue ! opusenc ! rtpopuspay pt=111 ssrc=" + std::to_string(audioSSRC_) + 
-        " ! appsink name=rtpsink emit-signals=true sync=false "
-        "t_audio. ! queue ! audioconvert ! audioresample ! audio/x-raw,format=F32LE,rate=44100,channels=1 ! avenc_aac ! aacparse ! appsink name=aacsink emit-signals=true sync=false";
+        return "pulsesrc name=asrc provide-clock=false ! " + caps + tee;
 #else
-    // x86 Audio: Optimized for voaacenc stability
-    audioPipelineDesc =
-        "pulsesrc ! queue ! audio/x-raw,format=S16LE,rate=48000,channels=1 ! "
-        "audioconvert ! audioresample ! tee name=t_audio "
-        "t_audio. ! queue ! opusenc ! rtpopuspay pt=111 ssrc=" + std::to_string(audioSSRC_) + 
-        " ! appsink name=rtpsink emit-signals=true sync=false "
-        "t_audio. ! queue ! audioconvert ! audioresample ! audio/x-raw,rate=44100,channels=1 ! "
-        "voaacenc ! aacparse ! appsink name=aacsink emit-signals=true sync=false";
+        return "pulsesrc name=asrc ! " + queueDescription("asrc_q", QueueKind::RAW_AUDIO) + " ! " + caps + tee;
 #endif
+    }
+}
+
+void GstManager::setupAudio() {
+    if (onAudioAACFrame_) addBranch(BRANCH_AUDIO_AAC);
+    if (onAudioRTPFrame_) addBranch(BRANCH_AUDIO_RTP);
+}
+
+void GstManager::startAudio() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (combined_ || sharedDecoder()) {
+        startCombined();
+        return;
+    }
+    if (audioPipeline_) return;
+    if (!onAudioAACFrame_ && !onAudioRTPFrame_) {
+        logWithTime("[GstManager] No audio subscribers, audio pipeline not started");
+        return;
+    }
+    if (!hasAudioInput()) {
+        logWithTime("[GstManager] RTP input without an audio port, audio pipeline not started");
+        return;
+    }
 
+    std::string audioPipelineDesc = audioTrunkDescription(true);
     GError* error = nullptr;
     audioPipeline_ = gst_parse_launch(audioPipelineDesc.c_str(), &error);
     logWithTime("Audio Pipeline = " + audioPipelineDesc);
     if (!audioPipeline_ || error) {
-        std::cerr << "[GstManager] Failed to create audio pipeline: " << (error ? error->message : "Unknown") << std::endl;
+        logWithTime(LEVEL_ERROR, std::string("[GstManager] Failed to create audio pipeline: ") +
+                    (error ? error->message : "Unknown"));
         if (error) g_error_free(error);
         return;
     }
 
-    setupSink(audioPipeline_, "rtpsink", G_CALLBACK(onAudioRTPSample));
-    setupSink(audioPipeline_, "aacsink", G_CALLBACK(onAudioAACSample));
-
+    useSharedClock(audioPipeline_);
+    watchBus(audioPipeline_);
+    setupAudio();
     gst_element_set_state(audioPipeline_, GST_STATE_PLAYING);
 }
 
 void GstManager::stopAudio() {
     if (!audioPipeline_) return;
+    if (audioPipeline_ == videoPipeline_) {
+        stopCombined();
+        return;
+    }
     gst_element_set_state(audioPipeline_, GST_STATE_NULL);
+    dropBranches(false);
     gst_object_unref(audioPipeline_);
     audioPipeline_ = nullptr;
 }
 
-void GstManager::startAudioPlayer() {
+// ---------------- Combined A/V ----------------
+void GstManager::setVideoCodec(VideoCodec codec) {
     std::lock_guard<std::mutex> lk(mutex_);
-    if (audioPlayerPipeline_) return;
+    videoCodec_ = codec;
+}
 
-    std::string audioPlayDesc =
-        "appsrc name=audio_src is-live=true do-timestamp=true format=time ! "
-        "application/x-rtp,media=audio,clock-rate=48000,encoding-name=OPUS,payload=111 ! "
-        "rtpjitterbuffer latency=200 ! rtpopusdepay ! opusdec ! audioconvert ! audioresample ! autoaudiosink";
+void GstManager::setCaptureTimeSei(bool enabled) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    captureTimeSei_ = enabled;
+}
 
-    audioPlayerPipeline_ = gst_parse_launch(audioPlayDesc.c_str(), nullptr);
-    audioAppSrc_ = gst_bin_get_by_name(GST_BIN(audioPlayerPipeline_), "audio_src");
-    
-    gst_element_set_state(audioPlayerPipeline_, GST_STATE_PLAYING);
+void GstManager::setTimeOverlay(bool enabled) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    timeOverlay_ = enabled;
+}
+
+void GstManager::setCombinedPipeline(bool combined) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    combined_ = combined;
+}
+
+/**
+ * Both trunks in one pipeline: one clock, one base time and one state change,
+ * so the sources start together and video and audio running times stay
+ * coherent for the whole session instead of relying on two base times
+ * sampled apart. videoPipeline_ and audioPipeline_ both hold a reference, and
+ * the branch code works on either unchanged. A medium without a subscriber at
+ * start is left out; its trunk cannot be added later without a restart.
+ */
+void GstManager::startCombined() {
+    if (videoPipeline_ || audioPipeline_) return;
+    bool video = onVideoAnnexBFrame_ || onVideoRTPFrame_;
+    bool audio = (onAudioAACFrame_ || onAudioRTPFrame_) && hasAudioInput();
+    if (!video && !audio) {
+        logWithTime("[GstManager] No subscribers, A/V pipeline not started");
+        return;
+    }
 
-    if (!mainLoop_) {
-        mainLoop_ = g_main_loop_new(nullptr, FALSE);
-        mainThread_ = std::thread([this]() { g_main_loop_run(mainLoop_); });
+    std::string desc;
+    if (video) desc = videoTrunkDescription();
+    if (audio) desc += (desc.empty() ? "" : " ") + audioTrunkDescription(!video);
+
+    GError* error = nullptr;
+    logWithTime("A/V Pipeline = " + desc);
+    GstElement* pipeline = gst_parse_launch(desc.c_str(), &error);
+    if (!pipeline || error) {
+        logWithTime(LEVEL_ERROR, std::string("[GstManager] Failed to create A/V pipeline: ") +
+                    (error ? error->message : "Unknown"));
+        if (error) g_error_free(error);
+        return;
+    }
+
+    useSharedClock(pipeline);
+    watchBus(pipeline);
+    if (video) {
+        videoPipeline_ = pipeline;
+        setupVideo();
+    }
+    if (audio) {
+        audioPipeline_ = video ? GST_ELEMENT(gst_object_ref(pipeline)) : pipeline;
+        setupAudio();
     }
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
 }
 
-void GstManager::stopAudioPlayer() {
+void GstManager::stopCombined() {
+    gst_element_set_state(videoPipeline_, GST_STATE_NULL);
+    dropBranches(true);
+    dropBranches(false);
+    gst_object_unref(videoPipeline_);
+    gst_object_unref(audioPipeline_);
+    videoPipeline_ = nullptr;
+    audioPipeline_ = nullptr;
+}
+
+// ---------------- Memory budget ----------------
+void GstManager::setMemoryBudget(const MemoryBudget& budget) {
     std::lock_guard<std::mutex> lk(mutex_);
-    if (!audioPlayerPipeline_) return;
-    
-    if (audioAppSrc_) {
-        gst_object_unref(audioAppSrc_);
-        audioAppSrc_ = nullptr;
+    budget_ = budget;
+    holdAboveBytes_ = budget.enabled && budget.shed == MemoryBudget::Shed::RAW ? budget.sendQueueBytes : 0;
+    holdRaw_ = false;
+}
+
+/**
+ * Raw video is held back while the queue has more than 3/4 of its budget and
+ * let through again below 1/4; the gap keeps the valve from flapping on
+ * every frame once the uplink is back.
+ */
+void GstManager::setSendBacklog(size_t bytes) {
+    const size_t limit = holdAboveBytes_.load(std::memory_order_relaxed);
+    if (limit == 0) return;
+    if (!holdRaw_ && bytes > limit - limit / 4) {
+        holdRaw_ = true;
+        logWithTime(LEVEL_WARN, "[GstManager] Send queue at " + std::to_string(bytes >> 10) +
+                    " KB, holding raw video back");
+    } else if (holdRaw_ && bytes < limit / 4) {
+        holdRaw_ = false;
+        logWithTime("[GstManager] Send queue at " + std::to_string(bytes >> 10) + " KB, encoding again");
     }
-    gst_element_set_state(audioPlayerPipeline_, GST_STATE_NULL);
-    gst_object_unref(audioPlayerPipeline_);
-    audioPlayerPipeline_ = nullptr;
 }
 
-void GstManager::pushAudioFrame(const uint8_t* data, size_t size) {
+std::string GstManager::queueDescription(const std::string& name, QueueKind kind) const {
+    std::string desc = "queue name=" + name;
+    if (!budget_.enabled) return desc;
+    const std::string time = std::to_string(static_cast<int64_t>(budget_.queueMs) * 1000000);
+    switch (kind) {
+    case QueueKind::RAW_VIDEO:
+        return desc + " leaky=downstream max-size-buffers=" + std::to_string(budget_.rawQueueBuffers) +
+               " max-size-bytes=0 max-size-time=0";
+    case QueueKind::RAW_AUDIO:
+        return desc + " leaky=downstream max-size-buffers=0 max-size-bytes=0 max-size-time=" + time;
+    default:
+        return desc + " max-size-buffers=0 max-size-bytes=0 max-size-time=" + time;
+    }
+}
+
+std::string GstManager::appsinkOptions() const {
+    if (!budget_.enabled) return "";
+    return " max-buffers=" + std::to_string(budget_.appsinkBuffers) + " drop=true";
+}
+
+/** Raw queues sit ahead of an encoder; the audio branches encode behind their queue unless AAC arrives encoded. */
+GstMemoryStats GstManager::getMemoryStats() {
     std::lock_guard<std::mutex> lk(mutex_);
-    if (!audioAppSrc_) return;
+    GstMemoryStats stats;
+    stats.rawQueueBytes = queue_bytes(videoPipeline_, "vdec_q") + queue_bytes(videoPipeline_, "enc_q") +
+                          queue_bytes(audioPipeline_, "adec_q") + queue_bytes(audioPipeline_, "asrc_q");
+    for (int id = 0; id < BRANCH_COUNT; ++id) {
+        const BranchInfo& info = kBranches[id];
+        size_t bytes = queue_bytes(branches_[id].bin, info.queue);
+        (info.video || encodedAudio() ? stats.encodedQueueBytes : stats.rawQueueBytes) += bytes;
+    }
+    stats.rawFramesHeld = rawHeld_->value();
+    stats.holdingRaw = holdRaw_;
+    return stats;
+}
 
-    GstBuffer* buffer = gst_buffer_new_allocate(nullptr, size, nullptr);
-    gst_buffer_fill(buffer, 0, data, size);
-    
-    // Debug print for PTS/DTS
-    GST_BUFFER_PTS(buffer) = gst_util_get_timestamp();
-    GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+void GstManager::setTalkbackConfig(const TalkbackPlayer::Config& config) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (talkback_->isRunning()) return;
+    talkbackConfig_ = config;
+    talkback_.reset(new TalkbackPlayer(talkbackConfig_, metricLabels({})));
+}
 
-    GstFlowReturn ret;
-    g_signal_emit_by_name(audioAppSrc_, "push-buffer", buffer, &ret);
-    gst_buffer_unref(buffer);
+bool GstManager::startAudioPlayer() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return talkback_->start();
+}
+
+void GstManager::stopAudioPlayer() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    talkback_->stop();
+}
+
+/** No lock: the player is only replaced while stopped, when nobody may push */
+void GstManager::pushAudioFrame(const uint8_t* data, size_t size) {
+    talkback_->push(data, size);
 }
 
 // ---------------- Callbacks ----------------
-GstFlowReturn GstManager::onVideoRTPSample(GstAppSink* appsink, gpointer user_data) {
-    GstManager* self = static_cast<GstManager*>(user_data);
+void GstManager::dispatchSample(GstAppSink* appsink, const FrameCallback& cb) {
     GstSample* sample = gst_app_sink_pull_sample(appsink);
-    if (sample && self->onVideoRTPFrame_) {
-        GstBuffer* buffer = gst_sample_get_buffer(sample);
-        GstMapInfo map;
-        if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
-            std::vector<uint8_t> rtp(map.data, map.data + map.size);
-            self->onVideoRTPFrame_(rtp);
-            gst_buffer_unmap(buffer, &map);
-        }
+    if (!sample) return;
+    if (!cb) {
+        gst_sample_unref(sample);
+        return;
     }
-    if (sample) gst_sample_unref(sample);
+    // MediaFrame owns the sample from here on and keeps it mapped for consumers.
+    // The appsink inherits the pipeline base time, giving clock-domain timestamps.
+    GstClockTime baseTime = gst_element_get_base_time(GST_ELEMENT(appsink));
+    MediaFrame::Ptr frame = MediaFrame::fromSample(sample, baseTime);
+    if (frame) cb(frame);
+}
+
+GstFlowReturn GstManager::onVideoRTPSample(GstAppSink* appsink, gpointer user_data) {
+    GstManager* self = static_cast<GstManager*>(user_data);
+    dispatchSample(appsink, self->onVideoRTPFrame_);
     return GST_FLOW_OK;
 }
 
 GstFlowReturn GstManager::onVideoAnnexBSample(GstAppSink* appsink, gpointer user_data) {
     GstManager* self = static_cast<GstManager*>(user_data);
-    GstSample* sample = gst_app_sink_pull_sample(appsink);
-    if (sample && self->onVideoAnnexBFrame_) {
-        GstBuffer* buffer = gst_sample_get_buffer(sample);
-        GstMapInfo map;
-        if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
-            std::vector<uint8_t> frame(map.data, map.data + map.size);
-            self->onVideoAnnexBFrame_(frame);
-            gst_buffer_unmap(buffer, &map);
-        }
-    }
-    if (sample) gst_sample_unref(sample);
+    dispatchSample(appsink, self->onVideoAnnexBFrame_);
     return GST_FLOW_OK;
 }
 
 GstFlowReturn GstManager::onAudioRTPSample(GstAppSink* appsink, gpointer user_data) {
     GstManager* self = static_cast<GstManager*>(user_data);
-    GstSample* sample = gst_app_sink_pull_sample(appsink);
-    if (sample && self->onAudioRTPFrame_) {
-        GstBuffer* buffer = gst_sample_get_buffer(sample);
-        GstMapInfo map;
-        if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
-            std::vector<uint8_t> rtp(map.data, map.data + map.size);
-            self->onAudioRTPFrame_(rtp);
-            gst_buffer_unmap(buffer, &map);
-        }
-    }
-    if (sample) gst_sample_unref(sample);
+    dispatchSample(appsink, self->onAudioRTPFrame_);
     return GST_FLOW_OK;
 }
 
 GstFlowReturn GstManager::onAudioAACSample(GstAppSink* appsink, gpointer user_data) {
     GstManager* self = static_cast<GstManager*>(user_data);
-    GstSample* sample = gst_app_sink_pull_sample(appsink);
-    if (sample && self->onAudioAACFrame_) {
-        GstBuffer* buffer = gst_sample_get_buffer(sample);
-        GstMapInfo map;
-        if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
-            std::vector<uint8_t> frame(map.data, map.data + map.size);
-            self->onAudioAACFrame_(frame);
-            gst_buffer_unmap(buffer, &map);
-        }
-    }
-    if (sample) gst_sample_unref(sample);
+    dispatchSample(appsink, self->onAudioAACFrame_);
     return GST_FLOW_OK;
-}
\ No newline at end of file
+}
@@ -0,0 +1,306 @@
+#include "H264Bitstream.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define H264_SCAN_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define H264_SCAN_NEON 1
+#endif
+
+namespace H264 {
+
+// ---------------- Start code scanners ----------------
+static const uint8_t* scan_scalar(const uint8_t* p, const uint8_t* end) {
+    while (end - p >= 3) {
+        // A byte > 1 at p[2] rules out a start code beginning at p, p+1 or p+2
+        if (p[2] > 1) { p += 3; continue; }
+        if (p[2] == 1 && p[1] == 0 && p[0] == 0) return p;
+        ++p;
+    }
+    return nullptr;
+}
+
+#if defined(H264_SCAN_X86)
+static const uint8_t* scan_sse2(const uint8_t* p, const uint8_t* end) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    // Three overlapping loads test "00 00 01" at 16 positions per iteration
+    while (end - p >= 18) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 1));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+                                  _mm_cmpeq_epi8(c, one));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) return p + __builtin_ctz(static_cast<unsigned>(mask));
+        p += 16;
+    }
+    return scan_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t* scan_avx2(const uint8_t* p, const uint8_t* end) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    while (end - p >= 34) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 1));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 2));
+        __m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)),
+                                     _mm256_cmpeq_epi8(c, one));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(m));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return scan_sse2(p, end);
+}
+#endif
+
+#if defined(H264_SCAN_NEON)
+static const uint8_t* scan_neon(const uint8_t* p, const uint8_t* end) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    while (end - p >= 18) {
+        uint8x16_t a = vld1q_u8(p);
+        uint8x16_t b = vld1q_u8(p + 1);
+        uint8x16_t c = vld1q_u8(p + 2);
+        uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(a, zero), vceqq_u8(b, zero)), vceqq_u8(c, one));
+        // Narrow to 4 bits per lane to get a movemask equivalent
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (bits) return p + (__builtin_ctzll(bits) >> 2);
+        p += 16;
+    }
+    return scan_scalar(p, end);
+}
+#endif
+
+using ScanFn = const uint8_t* (*)(const uint8_t*, const uint8_t*);
+
+struct Scanner {
+    ScanFn fn;
+    const char* name;
+};
+
+static Scanner select_scanner() {
+#if defined(H264_SCAN_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {scan_avx2, "avx2"};
+    return {scan_sse2, "sse2"};
+#elif defined(H264_SCAN_NEON)
+    return {scan_neon, "neon"};
+#else
+    return {scan_scalar, "scalar"};
+#endif
+}
+
+static const Scanner& scanner() {
+    static const Scanner s = select_scanner();
+    return s;
+}
+
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end) {
+    if (!p || end - p < 3) return nullptr;
+    return scanner().fn(p, end);
+}
+
+const char* scannerName() {
+    return scanner().name;
+}
+
+// ---------------- Access unit ----------------
+const uint8_t* findFirstSlice(const uint8_t* data, size_t size) {
+    const uint8_t* end = data + size;
+    for (const uint8_t* sc = findStartCode(data, end); sc; sc = findStartCode(sc + 3, end)) {
+        if (sc + 3 >= end) break;
+        uint8_t type = sc[3] & 0x1F;
+        if (type == NAL_SLICE || type == NAL_IDR) return sc + 3;
+    }
+    return nullptr;
+}
+
+bool parseAccessUnit(const uint8_t* data, size_t size, AccessUnit& au) {
+    au.count = 0;
+    au.vpsIndex = au.spsIndex = au.ppsIndex = -1;
+    au.idr = au.disposable = au.hevc = false;
+
+    const uint8_t* end = data + size;
+    const uint8_t* sc = findStartCode(data, end);
+    bool sawSlice = false;
+
+    while (sc) {
+        const uint8_t* nal = sc + 3;
+        const uint8_t* next = findStartCode(nal, end);
+        const uint8_t* nalEnd = next ? next : end;
+        // A NAL unit never ends in 0x00; those are trailing_zero_8bits or
+        // the leading zero of a 4-byte start code
+        while (nalEnd > nal && nalEnd[-1] == 0x00) --nalEnd;
+
+        if (nalEnd > nal) {
+            if (au.count == AccessUnit::kMaxNals) return false;
+            Nal& n = au.nals[au.count];
+            n.data = nal;
+            n.size = static_cast<size_t>(nalEnd - nal);
+            n.type = nal[0] & 0x1F;
+            n.refIdc = (nal[0] >> 5) & 0x03;
+
+            if (n.type == NAL_SPS && au.spsIndex < 0) au.spsIndex = static_cast<int>(au.count);
+            else if (n.type == NAL_PPS && au.ppsIndex < 0) au.ppsIndex = static_cast<int>(au.count);
+            else if (n.type == NAL_IDR) au.idr = true;
+
+            if (!sawSlice && (n.type == NAL_SLICE || n.type == NAL_IDR)) {
+                sawSlice = true;
+                au.disposable = n.refIdc == 0;
+            }
+            ++au.count;
+        }
+        sc = next;
+    }
+    return true;
+}
+
+size_t avccSize(const AccessUnit& au) {
+    size_t total = 0;
+    for (size_t i = 0; i < au.count; ++i) {
+        if (!au.isAud(au.nals[i])) total += 4 + au.nals[i].size;
+    }
+    return total;
+}
+
+size_t writeAvcc(const AccessUnit& au, uint8_t* out) {
+    uint8_t* p = out;
+    for (size_t i = 0; i < au.count; ++i) {
+        const Nal& n = au.nals[i];
+        if (au.isAud(n)) continue;
+        uint32_t len = static_cast<uint32_t>(n.size);
+        p[0] = static_cast<uint8_t>(len >> 24);
+        p[1] = static_cast<uint8_t>(len >> 16);
+        p[2] = static_cast<uint8_t>(len >> 8);
+        p[3] = static_cast<uint8_t>(len);
+        memcpy(p + 4, n.data, n.size);
+        p += 4 + n.size;
+    }
+    return static_cast<size_t>(p - out);
+}
+
+// ---------------- SPS / avcC ----------------
+static bool has_chroma_info(int profileIdc) {
+    switch (profileIdc) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83: case 86: case 118: case 128: case 138:
+    case 139: case 134: case 135:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void skip_scaling_list(RbspReader& r, int size) {
+    int last = 8, next = 8;
+    for (int j = 0; j < size; ++j) {
+        if (next != 0) next = (last + r.se() + 256) % 256;
+        last = (next == 0) ? last : next;
+    }
+}
+
+bool parseSps(const Nal& sps, SpsInfo& info) {
+    if (sps.size < 4 || (sps.data[0] & 0x1F) != NAL_SPS) return false;
+
+    RbspReader r(sps.data + 1, sps.size - 1);
+    info.profileIdc = static_cast<int>(r.bits(8));
+    info.constraintFlags = static_cast<int>(r.bits(8));
+    info.levelIdc = static_cast<int>(r.bits(8));
+    r.ue(); // seq_parameter_set_id
+
+    bool separateColourPlane = false;
+    info.chromaFormatIdc = 1;
+    info.bitDepthLuma = info.bitDepthChroma = 8;
+    if (has_chroma_info(info.profileIdc)) {
+        info.chromaFormatIdc = static_cast<int>(r.ue());
+        if (info.chromaFormatIdc == 3) separateColourPlane = r.bit();
+        info.bitDepthLuma = static_cast<int>(r.ue()) + 8;
+        info.bitDepthChroma = static_cast<int>(r.ue()) + 8;
+        r.bit(); // qpprime_y_zero_transform_bypass_flag
+        if (r.bit()) { // seq_scaling_matrix_present_flag
+            int lists = (info.chromaFormatIdc != 3) ? 8 : 12;
+            for (int i = 0; i < lists; ++i) {
+                if (r.bit()) skip_scaling_list(r, i < 6 ? 16 : 64);
+            }
+        }
+    }
+
+    r.ue(); // log2_max_frame_num_minus4
+    uint32_t pocType = r.ue();
+    if (pocType == 0) {
+        r.ue(); // log2_max_pic_order_cnt_lsb_minus4
+    } else if (pocType == 1) {
+        r.bit();
+        r.se();
+        r.se();
+        uint32_t n = r.ue();
+        for (uint32_t i = 0; i < n && r.ok(); ++i) r.se();
+    }
+    r.ue(); // max_num_ref_frames
+    r.bit(); // gaps_in_frame_num_value_allowed_flag
+
+    uint32_t widthMbs = r.ue() + 1;
+    uint32_t heightMapUnits = r.ue() + 1;
+    uint32_t frameMbsOnly = r.bit();
+    if (!frameMbsOnly) r.bit(); // mb_adaptive_frame_field_flag
+    r.bit(); // direct_8x8_inference_flag
+
+    int width = static_cast<int>(widthMbs * 16);
+    int height = static_cast<int>((2 - frameMbsOnly) * heightMapUnits * 16);
+
+    if (r.bit()) { // frame_cropping_flag
+        uint32_t left = r.ue(), right = r.ue(), top = r.ue(), bottom = r.ue();
+        int chromaArrayType = separateColourPlane ? 0 : info.chromaFormatIdc;
+        int cropX = 1, cropY = static_cast<int>(2 - frameMbsOnly);
+        if (chromaArrayType != 0) {
+            cropX = (chromaArrayType == 3) ? 1 : 2;
+            cropY *= (chromaArrayType == 1) ? 2 : 1;
+        }
+        width -= static_cast<int>(left + right) * cropX;
+        height -= static_cast<int>(top + bottom) * cropY;
+    }
+
+    info.width = width;
+    info.height = height;
+    return r.ok() && width > 0 && height > 0;
+}
+
+static void put_be16(std::vector<uint8_t>& out, size_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+bool buildAvcC(const Nal& sps, const Nal& pps, std::vector<uint8_t>& out) {
+    out.clear();
+    if (sps.size < 4 || pps.size < 1 || sps.size > 0xFFFF || pps.size > 0xFFFF) return false;
+
+    out.push_back(1);            // configurationVersion
+    out.push_back(sps.data[1]);  // AVCProfileIndication
+    out.push_back(sps.data[2]);  // profile_compatibility
+    out.push_back(sps.data[3]);  // AVCLevelIndication
+    out.push_back(0xFC | 3);     // lengthSizeMinusOne = 3
+    out.push_back(0xE0 | 1);     // numOfSequenceParameterSets
+    put_be16(out, sps.size);
+    out.insert(out.end(), sps.data, sps.data + sps.size);
+    out.push_back(1);            // numOfPictureParameterSets
+    put_be16(out, pps.size);
+    out.insert(out.end(), pps.data, pps.data + pps.size);
+
+    int profile = sps.data[1];
+    if (profile == 100 || profile == 110 || profile == 122 || profile == 144) {
+        SpsInfo info;
+        if (!parseSps(sps, info)) info = SpsInfo();
+        out.push_back(static_cast<uint8_t>(0xFC | (info.chromaFormatIdc & 0x03)));
+        out.push_back(static_cast<uint8_t>(0xF8 | ((info.bitDepthLuma - 8) & 0x07)));
+        out.push_back(static_cast<uint8_t>(0xF8 | ((info.bitDepthChroma - 8) & 0x07)));
+        out.push_back(0);        // numOfSequenceParameterSetExt
+    }
+    return true;
+}
+
+} // namespace H264
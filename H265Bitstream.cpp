@@ -0,0 +1,157 @@
+#include "H265Bitstream.h"
+
+namespace H265 {
+
+// ---------------- Access unit ----------------
+const uint8_t* findFirstSlice(const uint8_t* data, size_t size) {
+    const uint8_t* end = data + size;
+    for (const uint8_t* sc = H264::findStartCode(data, end); sc; sc = H264::findStartCode(sc + 3, end)) {
+        if (sc + 4 >= end) break;
+        if (isVcl(nalType(sc[3]))) return sc + 3;
+    }
+    return nullptr;
+}
+
+bool parseAccessUnit(const uint8_t* data, size_t size, H264::AccessUnit& au) {
+    au.count = 0;
+    au.vpsIndex = au.spsIndex = au.ppsIndex = -1;
+    au.idr = au.disposable = false;
+    au.hevc = true;
+
+    const uint8_t* end = data + size;
+    const uint8_t* sc = H264::findStartCode(data, end);
+    bool sawSlice = false;
+
+    while (sc) {
+        const uint8_t* nal = sc + 3;
+        const uint8_t* next = H264::findStartCode(nal, end);
+        const uint8_t* nalEnd = next ? next : end;
+        while (nalEnd > nal && nalEnd[-1] == 0x00) --nalEnd;
+
+        // Two header bytes; anything shorter is not a NAL unit
+        if (nalEnd - nal >= 2) {
+            if (au.count == H264::AccessUnit::kMaxNals) return false;
+            H264::Nal& n = au.nals[au.count];
+            n.data = nal;
+            n.size = static_cast<size_t>(nalEnd - nal);
+            n.type = nalType(nal[0]);
+            n.refIdc = 0;
+
+            if (n.type == NAL_VPS && au.vpsIndex < 0) au.vpsIndex = static_cast<int>(au.count);
+            else if (n.type == NAL_SPS && au.spsIndex < 0) au.spsIndex = static_cast<int>(au.count);
+            else if (n.type == NAL_PPS && au.ppsIndex < 0) au.ppsIndex = static_cast<int>(au.count);
+
+            if (!sawSlice && isVcl(n.type)) {
+                sawSlice = true;
+                au.idr = isIrap(n.type);
+                au.disposable = isSubLayerNonRef(n.type);
+            }
+            ++au.count;
+        }
+        sc = next;
+    }
+    return true;
+}
+
+// ---------------- SPS / hvcC ----------------
+/**
+ * profile_tier_level(1, maxSubLayersMinus1): the general part is kept, the
+ * sub-layer parts are skipped
+ */
+static void parse_profile_tier_level(H264::RbspReader& r, SpsInfo& info) {
+    info.profileSpace = static_cast<int>(r.bits(2));
+    info.tierFlag = static_cast<int>(r.bit());
+    info.profileIdc = static_cast<int>(r.bits(5));
+    info.compatibilityFlags = r.bits(32);
+    info.constraintFlags = (static_cast<uint64_t>(r.bits(16)) << 32) | r.bits(32);
+    info.levelIdc = static_cast<int>(r.bits(8));
+
+    const int subLayers = info.maxSubLayersMinus1;
+    bool profilePresent[8] = {};
+    bool levelPresent[8] = {};
+    for (int i = 0; i < subLayers; ++i) {
+        profilePresent[i] = r.bit();
+        levelPresent[i] = r.bit();
+    }
+    if (subLayers > 0) {
+        for (int i = subLayers; i < 8; ++i) r.bits(2); // reserved_zero_2bits
+    }
+    for (int i = 0; i < subLayers; ++i) {
+        if (profilePresent[i]) {
+            r.bits(32);
+            r.bits(32);
+            r.bits(24);
+        }
+        if (levelPresent[i]) r.bits(8);
+    }
+}
+
+bool parseSps(const H264::Nal& sps, SpsInfo& info) {
+    if (sps.size < 16 || nalType(sps.data[0]) != NAL_SPS) return false;
+
+    H264::RbspReader r(sps.data + 2, sps.size - 2);
+    r.bits(4); // sps_video_parameter_set_id
+    info.maxSubLayersMinus1 = static_cast<int>(r.bits(3));
+    info.temporalIdNesting = static_cast<int>(r.bit());
+    parse_profile_tier_level(r, info);
+    r.ue(); // sps_seq_parameter_set_id
+
+    bool separateColourPlane = false;
+    info.chromaFormatIdc = static_cast<int>(r.ue());
+    if (info.chromaFormatIdc == 3) separateColourPlane = r.bit();
+    int width = static_cast<int>(r.ue());
+    int height = static_cast<int>(r.ue());
+
+    if (r.bit()) { // conformance_window_flag
+        uint32_t left = r.ue(), right = r.ue(), top = r.ue(), bottom = r.ue();
+        int chromaArrayType = separateColourPlane ? 0 : info.chromaFormatIdc;
+        int subWidth = (chromaArrayType == 1 || chromaArrayType == 2) ? 2 : 1;
+        int subHeight = (chromaArrayType == 1) ? 2 : 1;
+        width -= static_cast<int>(left + right) * subWidth;
+        height -= static_cast<int>(top + bottom) * subHeight;
+    }
+    info.bitDepthLuma = static_cast<int>(r.ue()) + 8;
+    info.bitDepthChroma = static_cast<int>(r.ue()) + 8;
+
+    info.width = width;
+    info.height = height;
+    return r.ok() && width > 0 && height > 0 && info.maxSubLayersMinus1 < 7;
+}
+
+static void put_be(std::vector<uint8_t>& out, uint64_t v, int bytes) {
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+bool buildHvcC(const H264::Nal& vps, const H264::Nal& sps, const H264::Nal& pps, std::vector<uint8_t>& out) {
+    out.clear();
+    SpsInfo info;
+    if (!parseSps(sps, info)) return false;
+    if (vps.size > 0xFFFF || sps.size > 0xFFFF || pps.size > 0xFFFF || vps.size < 2 || pps.size < 2) return false;
+
+    out.push_back(1);   // configurationVersion
+    out.push_back(static_cast<uint8_t>((info.profileSpace << 6) | (info.tierFlag << 5) | info.profileIdc));
+    put_be(out, info.compatibilityFlags, 4);
+    put_be(out, info.constraintFlags, 6);
+    out.push_back(static_cast<uint8_t>(info.levelIdc));
+    put_be(out, 0xF000, 2);  // min_spatial_segmentation_idc = 0
+    out.push_back(0xFC);     // parallelismType = 0 (unknown)
+    out.push_back(static_cast<uint8_t>(0xFC | (info.chromaFormatIdc & 0x03)));
+    out.push_back(static_cast<uint8_t>(0xF8 | ((info.bitDepthLuma - 8) & 0x07)));
+    out.push_back(static_cast<uint8_t>(0xF8 | ((info.bitDepthChroma - 8) & 0x07)));
+    put_be(out, 0, 2);       // avgFrameRate unspecified
+    // constantFrameRate = 0, numTemporalLayers, temporalIdNested, lengthSizeMinusOne = 3
+    out.push_back(static_cast<uint8_t>(((info.maxSubLayersMinus1 + 1) << 3) | (info.temporalIdNesting << 2) | 3));
+
+    // Parameter sets are repeated in-band (config-interval=1): array_completeness = 0
+    const H264::Nal* arrays[] = {&vps, &sps, &pps};
+    out.push_back(3);        // numOfArrays
+    for (const H264::Nal* nal : arrays) {
+        out.push_back(nalType(nal->data[0]));
+        put_be(out, 1, 2);   // numNalus
+        put_be(out, nal->size, 2);
+        out.insert(out.end(), nal->data, nal->data + nal->size);
+    }
+    return true;
+}
+
+} // namespace H265
@@ -0,0 +1,65 @@
+#include "Interleaver.h"
+#include <algorithm>
+
+void Interleaver::push(SendPacket&& pkt) {
+    if (pkt.isVideo) {
+        lastVideoDts_ = std::max(lastVideoDts_, pkt.dts);
+        video_.push_back(std::move(pkt));
+    } else {
+        lastAudioDts_ = std::max(lastAudioDts_, pkt.dts);
+        audio_.push_back(std::move(pkt));
+    }
+}
+
+bool Interleaver::ready(const std::deque<SendPacket>& q, int64_t otherLastDts) const {
+    if (q.empty()) return false;
+    const int64_t head = q.front().dts;
+    // Nothing earlier can still arrive from the other stream
+    if (otherLastDts >= head) return true;
+    // The other stream is idle; don't hold this one back indefinitely
+    return q.back().dts - head >= maxDelayMs_;
+}
+
+void Interleaver::take(std::deque<SendPacket>& q, SendPacket& out) {
+    out = std::move(q.front());
+    q.pop_front();
+
+    // Late arrivals are pulled forward rather than emitted out of order
+    if (out.dts < lastOutDts_) out.dts = lastOutDts_;
+    if (out.pts < out.dts) out.pts = out.dts;
+    lastOutDts_ = out.dts;
+}
+
+bool Interleaver::pop(SendPacket& out) {
+    if (!video_.empty() && !audio_.empty()) {
+        take(video_.front().dts <= audio_.front().dts ? video_ : audio_, out);
+        return true;
+    }
+    if (ready(video_, lastAudioDts_)) {
+        take(video_, out);
+        return true;
+    }
+    if (ready(audio_, lastVideoDts_)) {
+        take(audio_, out);
+        return true;
+    }
+    return false;
+}
+
+bool Interleaver::flush(SendPacket& out) {
+    if (video_.empty() && audio_.empty()) return false;
+    if (audio_.empty() || (!video_.empty() && video_.front().dts <= audio_.front().dts)) {
+        take(video_, out);
+    } else {
+        take(audio_, out);
+    }
+    return true;
+}
+
+void Interleaver::reset() {
+    video_.clear();
+    audio_.clear();
+    lastVideoDts_ = INT64_MIN;
+    lastAudioDts_ = INT64_MIN;
+    lastOutDts_ = INT64_MIN;
+}
@@ -1,26 +1,174 @@
 #include "Logger.h"
-#include <iostream>
-#include <iomanip>
-#include <sstream>
 #include <chrono>
 #include <ctime>
+#include <cstring>
+#include <pthread.h>
+#include "ThreadPolicy.h"
 
 using namespace std;
 
-void logWithTime(const string &msg)
+static int64_t now_us()
 {
     using namespace chrono;
-    auto now = system_clock::now();
-    auto itt = system_clock::to_time_t(now);
-    auto ms = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+Logger& Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
 
-    tm tm{};
-    localtime_r(&itt, &tm);
+Logger::Logger() : ring_(4096), level_(LEVEL_DEBUG), isRunning_(true)
+{
+    prefix_[0] = '\0';
+    thread_ = thread(&Logger::drainLoop, this);
+}
+
+Logger::~Logger()
+{
+    isRunning_ = false;
+    if (thread_.joinable()) thread_.join();
+    FILE* f = file_.exchange(nullptr);
+    if (f) fclose(f);
+}
+
+void Logger::log(LogLevel level, string msg)
+{
+    if (level < level_.load(memory_order_relaxed)) return;
 
-    ostringstream oss;
-    oss << "[" << put_time(&tm, "%H:%M:%S")
-        << "." << setw(3) << setfill('0') << ms.count()
-        << "] " << msg;
+    Record rec;
+    rec.timeUs = now_us();
+    rec.level = level;
+    rec.msg = move(msg);
+    if (!ring_.tryPush(move(rec))) {
+        dropped_.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    pushed_.fetch_add(1, memory_order_release);
+}
+
+void Logger::flush()
+{
+    uint64_t target = pushed_.load(memory_order_acquire);
+    while (isRunning_ && written_.load(memory_order_acquire) < target) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+bool Logger::enableFileSink(const string& dir, const string& name, size_t maxBytes, int maxFiles)
+{
+    string path = dir;
+    if (!path.empty() && path.back() != '/') path += '/';
+    path += name;
+
+    FILE* f = fopen(path.c_str(), "a");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    fileBytes_ = static_cast<size_t>(ftell(f));
+    filePath_ = path;
+    maxFileBytes_ = maxBytes;
+    maxFiles_ = maxFiles;
+    // Published last; the drain thread only touches the file once it sees it
+    FILE* old = file_.exchange(f);
+    if (old) fclose(old);
+    return true;
+}
+
+void Logger::drainLoop()
+{
+    // Never leave(): this thread outlives ThreadPolicy at process exit
+    ThreadPolicy::instance().enter("logger");
 
-    cout << oss.str() << endl;
+    Record rec;
+    for (;;) {
+        size_t n = 0;
+        while (ring_.tryPop(rec)) {
+            write(rec);
+            written_.fetch_add(1, memory_order_release);
+            ++n;
+        }
+
+        uint64_t drops = dropped_.load(memory_order_relaxed);
+        if (drops != reportedDrops_) {
+            Record note;
+            note.timeUs = now_us();
+            note.level = LEVEL_WARN;
+            note.msg = "[LOG] " + to_string(drops - reportedDrops_) + " messages dropped (ring full)";
+            write(note);
+            reportedDrops_ = drops;
+            ++n;
+        }
+
+        if (n > 0) {
+            fflush(stdout);
+            FILE* f = file_.load(memory_order_acquire);
+            if (f) fflush(f);
+            continue;
+        }
+        if (!isRunning_) break;
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+}
+
+/**
+ * Formats "[HH:MM:SS.mmm] msg"; localtime_r only runs once per second.
+ */
+void Logger::write(const Record& rec)
+{
+    int64_t sec = rec.timeUs / 1000000;
+    if (sec != prefixSec_) {
+        time_t t = static_cast<time_t>(sec);
+        tm tm{};
+        localtime_r(&t, &tm);
+        strftime(prefix_, sizeof(prefix_), "%H:%M:%S", &tm);
+        prefixSec_ = sec;
+    }
+
+    static const char* const tags[] = {"[DEBUG] ", "", "[WARN] ", "[ERROR] "};
+    char ms[8];
+    snprintf(ms, sizeof(ms), ".%03d] ", static_cast<int>((rec.timeUs / 1000) % 1000));
+
+    line_.assign("[");
+    line_.append(prefix_);
+    line_.append(ms);
+    line_.append(tags[rec.level]);
+    line_.append(rec.msg);
+    line_.push_back('\n');
+
+    fwrite(line_.data(), 1, line_.size(), rec.level >= LEVEL_ERROR ? stderr : stdout);
+
+    FILE* f = file_.load(memory_order_acquire);
+    if (!f) return;
+    fwrite(line_.data(), 1, line_.size(), f);
+    fileBytes_ += line_.size();
+    if (fileBytes_ >= maxFileBytes_) rotate();
+}
+
+void Logger::rotate()
+{
+    FILE* f = file_.exchange(nullptr);
+    if (f) fclose(f);
+
+    for (int i = maxFiles_ - 1; i >= 1; --i) {
+        rename((filePath_ + "." + to_string(i)).c_str(), (filePath_ + "." + to_string(i + 1)).c_str());
+    }
+    if (maxFiles_ > 0) {
+        rename(filePath_.c_str(), (filePath_ + ".1").c_str());
+    } else {
+        remove(filePath_.c_str());
+    }
+
+    fileBytes_ = 0;
+    file_.store(fopen(filePath_.c_str(), "w"), memory_order_release);
+}
+
+void logWithTime(string msg)
+{
+    Logger::instance().log(LEVEL_INFO, move(msg));
+}
+
+void logWithTime(LogLevel level, string msg)
+{
+    Logger::instance().log(level, move(msg));
 }
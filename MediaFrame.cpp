@@ -0,0 +1,64 @@
+#include "MediaFrame.h"
+
+static int64_t toSignedTime(GstClockTime t) {
+    return GST_CLOCK_TIME_IS_VALID(t) ? static_cast<int64_t>(t) : -1;
+}
+
+/**
+ * Buffer time -> running time (via the sample segment) -> clock time
+ */
+static int64_t toClockTime(const GstSegment* segment, GstClockTime baseTime, GstClockTime t) {
+    if (!GST_CLOCK_TIME_IS_VALID(t) || !GST_CLOCK_TIME_IS_VALID(baseTime)) return toSignedTime(t);
+    if (segment && segment->format == GST_FORMAT_TIME) {
+        t = gst_segment_to_running_time(segment, GST_FORMAT_TIME, t);
+        if (!GST_CLOCK_TIME_IS_VALID(t)) return -1;
+    }
+    return static_cast<int64_t>(t + baseTime);
+}
+
+MediaFrame::Ptr MediaFrame::fromSample(GstSample* sample, GstClockTime baseTime) {
+    if (!sample) return nullptr;
+
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    if (!buffer) {
+        gst_sample_unref(sample);
+        return nullptr;
+    }
+
+    MediaFrame* frame = new MediaFrame(sample, buffer, baseTime);
+    if (!gst_buffer_map(buffer, &frame->map_, GST_MAP_READ)) {
+        frame->buffer_ = nullptr;
+        delete frame;
+        return nullptr;
+    }
+    return Ptr(frame);
+}
+
+MediaFrame::MediaFrame(GstSample* sample, GstBuffer* buffer, GstClockTime baseTime)
+    : sample_(sample), buffer_(buffer), map_(),
+      pts_(toClockTime(gst_sample_get_segment(sample), baseTime, GST_BUFFER_PTS(buffer))),
+      dts_(toClockTime(gst_sample_get_segment(sample), baseTime, GST_BUFFER_DTS(buffer))),
+      duration_(toSignedTime(GST_BUFFER_DURATION(buffer))),
+      keyframe_(!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)),
+      discont_(GST_BUFFER_IS_DISCONT(buffer)) {
+}
+
+bool MediaFrame::codecData(std::vector<uint8_t>& out) const {
+    GstCaps* caps = sample_ ? gst_sample_get_caps(sample_) : nullptr;
+    if (!caps || gst_caps_get_size(caps) == 0) return false;
+    const GValue* value = gst_structure_get_value(gst_caps_get_structure(caps, 0), "codec_data");
+    if (!value || !GST_VALUE_HOLDS_BUFFER(value)) return false;
+
+    GstBuffer* buffer = gst_value_get_buffer(value);
+    GstMapInfo map;
+    if (!buffer || !gst_buffer_map(buffer, &map, GST_MAP_READ)) return false;
+    out.assign(map.data, map.data + map.size);
+    gst_buffer_unmap(buffer, &map);
+    return true;
+}
+
+MediaFrame::~MediaFrame() {
+    // The buffer is owned by the sample; unmap before dropping the last ref.
+    if (buffer_) gst_buffer_unmap(buffer_, &map_);
+    if (sample_) gst_sample_unref(sample_);
+}
@@ -0,0 +1,31 @@
+#include "MemoryBudget.h"
+#include <cstdio>
+#include <cstring>
+
+bool MemoryBudget::parseShed(const std::string& text, Shed& shed) {
+    if (text == "raw") {
+        shed = Shed::RAW;
+    } else if (text == "encoded") {
+        shed = Shed::ENCODED;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ProcessMemory ProcessMemory::read() {
+    ProcessMemory m;
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return m;
+    char line[256];
+    unsigned long kb = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "VmRSS: %lu kB", &kb) == 1) {
+            m.rssBytes = kb << 10;
+        } else if (sscanf(line, "VmHWM: %lu kB", &kb) == 1) {
+            m.peakRssBytes = kb << 10;
+        }
+    }
+    fclose(f);
+    return m;
+}
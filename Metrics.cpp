@@ -0,0 +1,232 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <set>
+#include <sstream>
+#include "Logger.h"
+
+namespace Metrics {
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const std::vector<double>& latencyBucketsMs() {
+    static const std::vector<double> buckets = {1, 2, 5, 10, 20, 33, 50, 100, 200, 500, 1000};
+    return buckets;
+}
+
+// ---------------- Histogram ----------------
+Histogram::Histogram(const std::vector<double>& bounds)
+    : bounds_(bounds), buckets_(new std::atomic<uint64_t>[bounds.size() + 1]) {
+    std::sort(bounds_.begin(), bounds_.end());
+    for (size_t i = 0; i <= bounds_.size(); ++i) buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+void Histogram::observe(double v) {
+    size_t i = 0;
+    while (i < bounds_.size() && v > bounds_[i]) ++i;
+    buckets_[i].fetch_add(1, std::memory_order_relaxed);
+    sumMilli_.fetch_add(static_cast<int64_t>(v * 1000.0), std::memory_order_relaxed);
+}
+
+// ---------------- StageTimer ----------------
+void StageTimer::begin(int64_t key) {
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[head % kWindow];
+    slot.ns.store(nowNs(), std::memory_order_relaxed);
+    slot.key.store(key, std::memory_order_relaxed);
+    head_.store(head + 1, std::memory_order_release);
+}
+
+void StageTimer::end(int64_t key) {
+    uint32_t head = head_.load(std::memory_order_acquire);
+    if (head - tail_ > kWindow) tail_ = head - kWindow;
+
+    // In-order stage: the match is normally the oldest unmatched input
+    for (uint32_t i = tail_; i != head; ++i) {
+        Slot& slot = slots_[i % kWindow];
+        if (slot.key.load(std::memory_order_relaxed) != key) continue;
+        hist_.observe((nowNs() - slot.ns.load(std::memory_order_relaxed)) / 1e6);
+        tail_ = i + 1;
+        return;
+    }
+}
+
+// ---------------- Registry ----------------
+Registry& Registry::instance() {
+    static Registry registry;
+    return registry;
+}
+
+Registry::Entry* Registry::find(const std::string& name, const Labels& labels) {
+    for (auto& e : entries_) {
+        if (e->name == name && e->labels == labels) return e.get();
+    }
+    return nullptr;
+}
+
+Registry::Entry& Registry::add(const std::string& name, const std::string& help, Type type,
+                               const Labels& labels, const void* owner) {
+    entries_.emplace_back(new Entry());
+    Entry& e = *entries_.back();
+    e.name = name;
+    e.help = help;
+    e.type = type;
+    e.labels = labels;
+    e.owners.push_back(owner);
+    return e;
+}
+
+void Registry::share(Entry& e, const void* owner) {
+    if (std::find(e.owners.begin(), e.owners.end(), owner) == e.owners.end()) e.owners.push_back(owner);
+}
+
+Counter& Registry::counter(const std::string& name, const std::string& help, const Labels& labels,
+                           const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* e = find(name, labels);
+    if (e && e->counter) {
+        share(*e, owner);
+        return *e->counter;
+    }
+    Entry& added = add(name, help, Type::COUNTER, labels, owner);
+    added.counter.reset(new Counter());
+    return *added.counter;
+}
+
+Gauge& Registry::gauge(const std::string& name, const std::string& help, const Labels& labels,
+                       const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* e = find(name, labels);
+    if (e && e->gauge) {
+        share(*e, owner);
+        return *e->gauge;
+    }
+    Entry& added = add(name, help, Type::GAUGE, labels, owner);
+    added.gauge.reset(new Gauge());
+    return *added.gauge;
+}
+
+Histogram& Registry::histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+                               const Labels& labels, const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* e = find(name, labels);
+    if (e && e->histogram) {
+        share(*e, owner);
+        return *e->histogram;
+    }
+    Entry& added = add(name, help, Type::HISTOGRAM, labels, owner);
+    added.histogram.reset(new Histogram(bounds));
+    return *added.histogram;
+}
+
+void Registry::callback(const std::string& name, const std::string& help, Type type, ValueFn fn,
+                        const Labels& labels, const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* e = find(name, labels);
+    if (e && e->owners != std::vector<const void*>{owner}) {
+        logWithTime(LEVEL_ERROR, "[METRICS] " + name + " is already registered with the same labels; "
+                    "the second series is not exported");
+        return;
+    }
+    if (!e) e = &add(name, help, type, labels, owner);
+    e->fn = std::move(fn);
+}
+
+void Registry::remove(const void* owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& e : entries_) {
+        e->owners.erase(std::remove(e->owners.begin(), e->owners.end(), owner), e->owners.end());
+    }
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+                                  [](const std::unique_ptr<Entry>& e) { return e->owners.empty(); }),
+                   entries_.end());
+}
+
+static void write_labels(std::ostringstream& out, const Labels& labels, const std::string& le = "") {
+    if (labels.empty() && le.empty()) return;
+    out << '{';
+    bool first = true;
+    for (const auto& l : labels) {
+        if (!first) out << ',';
+        first = false;
+        out << l.first << "=\"";
+        for (char c : l.second) {
+            if (c == '\n') {
+                out << "\\n";
+                continue;
+            }
+            if (c == '\\' || c == '"') out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+    if (!le.empty()) out << (first ? "" : ",") << "le=\"" << le << '"';
+    out << '}';
+}
+
+static void write_value(std::ostringstream& out, double v) {
+    // Byte counters exceed the default 6 significant digits quickly
+    if (std::fabs(v) < 9e15 && v == static_cast<double>(static_cast<int64_t>(v))) {
+        out << static_cast<int64_t>(v);
+    } else {
+        out << v;
+    }
+}
+
+std::string Registry::render() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    std::set<std::string> done;
+
+    for (const auto& head : entries_) {
+        if (!done.insert(head->name).second) continue;
+        static const char* const typeNames[] = {"counter", "gauge", "histogram"};
+        out << "# HELP " << head->name << ' ' << head->help << '\n';
+        out << "# TYPE " << head->name << ' ' << typeNames[static_cast<int>(head->type)] << '\n';
+
+        // Samples of one metric family must be contiguous
+        for (const auto& e : entries_) {
+            if (e->name != head->name) continue;
+            if (e->histogram) {
+                const Histogram& h = *e->histogram;
+                uint64_t cumulative = 0;
+                for (size_t i = 0; i <= h.bounds().size(); ++i) {
+                    cumulative += h.bucket(i);
+                    std::ostringstream le;
+                    if (i < h.bounds().size()) le << h.bounds()[i]; else le << "+Inf";
+                    out << e->name << "_bucket";
+                    write_labels(out, e->labels, le.str());
+                    out << ' ' << cumulative << '\n';
+                }
+                out << e->name << "_sum";
+                write_labels(out, e->labels);
+                out << ' ';
+                write_value(out, h.sum());
+                out << '\n';
+                out << e->name << "_count";
+                write_labels(out, e->labels);
+                out << ' ' << cumulative << '\n';
+                continue;
+            }
+
+            out << e->name;
+            write_labels(out, e->labels);
+            if (e->counter) {
+                out << ' ' << e->counter->value() << '\n';
+            } else if (e->gauge) {
+                out << ' ' << e->gauge->value() << '\n';
+            } else {
+                out << ' ';
+                write_value(out, e->fn ? e->fn() : 0.0);
+                out << '\n';
+            }
+        }
+    }
+    return out.str();
+}
+
+} // namespace Metrics
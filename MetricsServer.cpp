@@ -0,0 +1,134 @@
+#include "MetricsServer.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Logger.h"
+#include "ThreadPolicy.h"
+
+MetricsServer::MetricsServer(Metrics::Registry& registry)
+    : registry_(registry), wakeFds_{-1, -1}, isRunning_(false) {}
+
+MetricsServer::~MetricsServer() {
+    stop();
+    for (int fd : listenFds_) close(fd);
+    if (!unixPath_.empty()) unlink(unixPath_.c_str());
+}
+
+bool MetricsServer::listenUnix(const std::string& path) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        logWithTime(LEVEL_ERROR, "[METRICS] Cannot listen on " + path + ": " + strerror(errno));
+        close(fd);
+        return false;
+    }
+    listenFds_.push_back(fd);
+    unixPath_ = path;
+    logWithTime("[METRICS] Serving on unix:" + path);
+    return true;
+}
+
+bool MetricsServer::listenTcp(int port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        logWithTime(LEVEL_ERROR, "[METRICS] Cannot listen on 127.0.0.1:" + std::to_string(port) + ": " + strerror(errno));
+        close(fd);
+        return false;
+    }
+    listenFds_.push_back(fd);
+    logWithTime("[METRICS] Serving on http://127.0.0.1:" + std::to_string(port) + "/metrics");
+    return true;
+}
+
+bool MetricsServer::start() {
+    if (isRunning_ || listenFds_.empty()) return false;
+    if (pipe2(wakeFds_, O_CLOEXEC) < 0) return false;
+    isRunning_ = true;
+    thread_ = std::thread(&MetricsServer::serveLoop, this);
+    return true;
+}
+
+void MetricsServer::stop() {
+    if (!isRunning_) return;
+    isRunning_ = false;
+    char c = 0;
+    if (write(wakeFds_[1], &c, 1) < 0) { /* the poll timeout still ends the loop */ }
+    if (thread_.joinable()) thread_.join();
+    close(wakeFds_[0]);
+    close(wakeFds_[1]);
+    wakeFds_[0] = wakeFds_[1] = -1;
+}
+
+void MetricsServer::serveLoop() {
+    ThreadPolicy::instance().enter("metrics");
+
+    std::vector<pollfd> fds;
+    for (int fd : listenFds_) fds.push_back({fd, POLLIN, 0});
+    fds.push_back({wakeFds_[0], POLLIN, 0});
+
+    while (isRunning_) {
+        if (poll(fds.data(), fds.size(), 1000) <= 0) continue;
+        for (size_t i = 0; i + 1 < fds.size(); ++i) {
+            if (!(fds[i].revents & POLLIN)) continue;
+            int client = accept4(fds[i].fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) continue;
+            handle(client);
+            close(client);
+        }
+    }
+    ThreadPolicy::instance().leave();
+}
+
+/**
+ * Any request gets the full exposition; the request itself is only drained
+ * so the client sees an orderly close.
+ */
+void MetricsServer::handle(int fd) {
+    timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[2048];
+    ssize_t got = recv(fd, request, sizeof(request), 0);
+    if (got <= 0) return;
+
+    std::string body = registry_.render();
+    std::string response =
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+
+    const char* p = response.data();
+    size_t left = response.size();
+    while (left > 0) {
+        ssize_t n = send(fd, p, left, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+}
@@ -0,0 +1,167 @@
+#include "PacketQueue.h"
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <ctime>
+
+// sem_clockwait (glibc 2.30+) lets the writer wait on CLOCK_MONOTONIC so an
+// NTP or RTC step on the device cannot stretch or cut short its timeout.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+#define PACKET_QUEUE_CLOCKWAIT 1
+static const clockid_t kWaitClock = CLOCK_MONOTONIC;
+#else
+static const clockid_t kWaitClock = CLOCK_REALTIME;
+#endif
+
+PacketQueue::PacketQueue(const Config& config)
+    : config_(config), queue_(config.capacity) {
+    if (config_.audioReserve >= queue_.capacity()) {
+        config_.audioReserve = queue_.capacity() / 4;
+    }
+    sem_init(&available_, 0, 0);
+}
+
+PacketQueue::~PacketQueue() {
+    sem_destroy(&available_);
+}
+
+int64_t PacketQueue::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PacketQueue::noteDrop(std::atomic<uint64_t>& counter) {
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool PacketQueue::push(SendPacket&& pkt) {
+    const size_t capacity = queue_.capacity();
+    const size_t depth = queue_.size();
+    const bool isVideo = pkt.isVideo;
+    const size_t size = packetBytes(pkt);
+    const size_t bytes = bytes_.load(std::memory_order_relaxed);
+    const size_t budget = config_.maxBytes;
+    // An empty queue always takes the packet, however large the keyframe
+    const bool overBytes = budget > 0 && bytes > 0 && bytes + size > (isVideo ? budget - budget / 8 : budget);
+
+    if (isVideo) {
+        if (producerSkip_.load(std::memory_order_relaxed) && !pkt.keyframe) {
+            noteDrop(droppedVideo_);
+            return false;
+        }
+        if (pkt.disposable && (depth >= capacity / 2 || (budget > 0 && bytes >= budget / 2))) {
+            noteDrop(droppedDisposable_);
+            return false;
+        }
+        if (depth + config_.audioReserve >= capacity || overBytes) {
+            // The rest of this GOP references what we just dropped
+            producerSkip_.store(true, std::memory_order_relaxed);
+            noteDrop(droppedVideo_);
+            return false;
+        }
+        if (pkt.keyframe) producerSkip_.store(false, std::memory_order_relaxed);
+    } else if (overBytes) {
+        noteDrop(droppedAudio_);
+        return false;
+    }
+
+    pkt.enqueueNs = nowNs();
+    // Counted before the push so the consumer never subtracts first
+    const size_t newBytes = bytes_.fetch_add(size, std::memory_order_relaxed) + size;
+    if (!queue_.tryPush(std::move(pkt))) {
+        bytes_.fetch_sub(size, std::memory_order_relaxed);
+        if (isVideo) {
+            producerSkip_.store(true, std::memory_order_relaxed);
+            noteDrop(droppedVideo_);
+        } else {
+            noteDrop(droppedAudio_);
+        }
+        return false;
+    }
+
+    size_t newDepth = queue_.size();
+    size_t prevMax = maxDepth_.load(std::memory_order_relaxed);
+    while (newDepth > prevMax &&
+           !maxDepth_.compare_exchange_weak(prevMax, newDepth, std::memory_order_relaxed)) {
+    }
+    size_t prevPeak = peakBytes_.load(std::memory_order_relaxed);
+    while (newBytes > prevPeak &&
+           !peakBytes_.compare_exchange_weak(prevPeak, newBytes, std::memory_order_relaxed)) {
+    }
+    enqueued_.fetch_add(1, std::memory_order_relaxed);
+    sem_post(&available_);
+    return true;
+}
+
+bool PacketQueue::pop(SendPacket& out, int timeoutMs) {
+    timespec deadline;
+    clock_gettime(kWaitClock, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += static_cast<long>(timeoutMs % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (;;) {
+#ifdef PACKET_QUEUE_CLOCKWAIT
+        int ret = sem_clockwait(&available_, kWaitClock, &deadline);
+#else
+        int ret = sem_timedwait(&available_, &deadline);
+#endif
+        if (ret != 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (!queue_.tryPop(out)) {
+            if (woken_.exchange(false)) return false;
+            // A producer claimed an earlier slot but has not published it yet
+            sem_post(&available_);
+            std::this_thread::yield();
+            continue;
+        }
+        // A wakeup() that raced with this item left a surplus token; take it
+        // back so the next pop does not return early on an empty queue.
+        if (woken_.exchange(false)) sem_trywait(&available_);
+        bytes_.fetch_sub(packetBytes(out), std::memory_order_relaxed);
+
+        if (out.isVideo) {
+            int64_t ageMs = (nowNs() - out.enqueueNs) / 1000000;
+            if (!out.keyframe && (consumerSkip_ || ageMs > config_.latencyBudgetMs)) {
+                // producerSkip_ stays with push(): the producer may already
+                // have queued the next IDR, and re-arming it would shed that GOP
+                consumerSkip_ = true;
+                noteDrop(droppedLate_);
+                out = SendPacket();
+                continue;
+            }
+            if (out.keyframe) consumerSkip_ = false;
+        }
+
+        dequeued_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+}
+
+void PacketQueue::wakeup() {
+    // Post before flagging so a set woken_ always has a token behind it
+    sem_post(&available_);
+    woken_.store(true);
+}
+
+PacketQueueStats PacketQueue::stats() const {
+    PacketQueueStats s;
+    s.depth = queue_.size();
+    s.maxDepth = maxDepth_.load(std::memory_order_relaxed);
+    s.capacity = queue_.capacity();
+    s.enqueued = enqueued_.load(std::memory_order_relaxed);
+    s.dequeued = dequeued_.load(std::memory_order_relaxed);
+    s.droppedDisposable = droppedDisposable_.load(std::memory_order_relaxed);
+    s.droppedVideo = droppedVideo_.load(std::memory_order_relaxed);
+    s.droppedLate = droppedLate_.load(std::memory_order_relaxed);
+    s.droppedAudio = droppedAudio_.load(std::memory_order_relaxed);
+    s.bytes = bytes_.load(std::memory_order_relaxed);
+    s.peakBytes = peakBytes_.load(std::memory_order_relaxed);
+    s.byteBudget = config_.maxBytes;
+    return s;
+}
@@ -0,0 +1,261 @@
+#include "PublisherSession.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include "AacConfig.h"
+#include "Logger.h"
+
+// ---------------- Configuration ----------------
+/** @brief rtp:VPORT[,APORT[,opus|aac[/RATE[/CHANNELS]]]] */
+static bool parse_rtp_source(const std::string& text, MediaSource& source) {
+    source.kind = SourceKind::RTP;
+    char codec[16] = "aac";
+    int fields = sscanf(text.c_str(), "%d,%d,%15[a-z]/%d/%d", &source.port, &source.audioPort, codec,
+                        &source.audioRate, &source.audioChannels);
+    if (fields < 1 || source.port <= 0 || source.port > 65535) return false;
+    if (fields >= 2 && (source.audioPort <= 0 || source.audioPort > 65535)) return false;
+    source.opus = !strcmp(codec, "opus");
+    std::vector<uint8_t> asc;
+    return source.opus || (!strcmp(codec, "aac") && source.audioChannels > 0 &&
+                           Aac::buildAsc(source.audioRate, source.audioChannels, asc));
+}
+
+bool PublisherSession::parseSource(const std::string& text, MediaSource& source) {
+    if (text == "capture") {
+        source.kind = SourceKind::CAPTURE;
+    } else if (text == "test") {
+        source.kind = SourceKind::TEST;
+    } else if (text.compare(0, 5, "file:") == 0 && text.size() > 5) {
+        source.kind = SourceKind::FILE;
+        source.location = text.substr(5);
+    } else if (text.compare(0, 4, "udp:") == 0) {
+        source.kind = SourceKind::UDP;
+        source.port = atoi(text.c_str() + 4);
+        if (source.port <= 0 || source.port > 65535) return false;
+    } else if (text.compare(0, 4, "rtp:") == 0) {
+        return parse_rtp_source(text.substr(4), source);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool PublisherSession::parseLine(const std::string& line, Config& config, std::string& error) {
+    std::istringstream in(line);
+    std::string source;
+    if (!(in >> config.name >> source)) {
+        error = "expected: name source [options] url...";
+        return false;
+    }
+    if (!parseSource(source, config.source)) {
+        error = "unknown source '" + source + "' (capture, test, file:PATH, udp:PORT, rtp:VPORT[,APORT[,opus]])";
+        return false;
+    }
+    // A video-only RTP input has nothing for the interleaver to wait for
+    if (config.source.kind == SourceKind::RTP && config.source.audioPort == 0) config.audio = false;
+
+    std::string token;
+    while (in >> token) {
+        size_t eq = token.find('=');
+        std::string key = token.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : token.substr(eq + 1);
+        bool ok = true;
+        if (token.find("://") != std::string::npos) {
+            config.urls.push_back(token);
+        } else if (key == "size") {
+            ok = sscanf(value.c_str(), "%dx%d", &config.width, &config.height) == 2 &&
+                 config.width > 0 && config.height > 0;
+        } else if (key == "fps") {
+            config.fps = atoi(value.c_str());
+            ok = config.fps > 0;
+        } else if (key == "kbps") {
+            config.bitrateBps = atoi(value.c_str()) * 1000;
+            ok = config.bitrateBps > 0;
+        } else if (token == "noaudio") {
+            config.audio = false;
+        } else if (token == "noabr") {
+            config.abr = false;
+        } else if (token == "hevc") {
+            config.codec = VideoCodec::H265;
+        } else if (token == "native") {
+            config.backend = RTMPBackend::NATIVE;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            error = "bad option '" + token + "'";
+            return false;
+        }
+    }
+    if (config.urls.empty()) {
+        error = "no destination URL";
+        return false;
+    }
+    return true;
+}
+
+BitrateController::Sample PublisherSession::abrSample(const RTMPStreamer& rtmp) {
+    PacketQueueStats q = rtmp.getQueueStats();
+    RTMPWriterStats w = rtmp.getWriterStats();
+    BitrateController::Sample s;
+    s.queueDepth = q.depth;
+    s.drops = q.droppedDisposable + q.droppedVideo + q.droppedLate + q.droppedAudio;
+    s.bytesSent = w.bytesSent;
+    s.packetsSent = w.videoPackets + w.audioPackets;
+    s.writeUsTotal = w.totalWriteUs;
+    s.tcpValid = w.tcpValid;
+    s.tcpRttUs = w.tcpRttUs;
+    s.tcpUnsentBytes = w.tcpUnsentBytes;
+    return s;
+}
+
+const char* PublisherSession::stateName(State state) {
+    switch (state) {
+    case State::RUNNING: return "running";
+    case State::ENDED: return "ended";
+    case State::FAILED: return "failed";
+    default: return "idle";
+    }
+}
+
+void PublisherSession::audioFormat(const MediaSource& source, int& sampleRate, int& channels) {
+    if (source.kind != SourceKind::RTP || source.opus || sampleRate == 0) return;
+    sampleRate = source.audioRate;
+    channels = source.audioChannels;
+}
+
+PacketQueue::Config PublisherSession::queueConfig(const MemoryBudget& budget) {
+    PacketQueue::Config config;
+    if (budget.enabled) config.maxBytes = budget.sendQueueBytes;
+    return config;
+}
+
+// ---------------- Lifecycle ----------------
+PublisherSession::PublisherSession(const Config& config, WriterPool* pool)
+    : config_(config), gst_(config.width, config.height, config.fps, config.bitrateBps),
+      rtmp_(config.urls, queueConfig(config.memory)) {
+    gst_.setSessionName(config_.name);
+    gst_.setSource(config_.source);
+    gst_.setVideoCodec(config_.codec);
+    gst_.setMemoryBudget(config_.memory);
+
+    rtmp_.setSessionName(config_.name);
+    rtmp_.setWriterPool(pool);
+    rtmp_.setBackend(config_.backend);
+    rtmp_.setTcpOptions(config_.tcp);
+    rtmp_.setVideoCodec(config_.codec);
+    rtmp_.setOnKeyframeNeeded([this]() { gst_.requestKeyframe(); });
+
+    // An RTP input is relayed as encoded; there is no encoder to steer
+    if (config_.abr && config_.source.kind != SourceKind::RTP) {
+        // Same shape as the single-stream defaults, around this session's bitrate and frame rate
+        BitrateController::Config abrConfig;
+        abrConfig.startBps = config_.bitrateBps;
+        abrConfig.floorBps = config_.bitrateBps / 3;
+        abrConfig.ceilingBps = config_.bitrateBps * 2;
+        abrConfig.allowFpsStepDown = true;
+        abrConfig.fpsSteps = fpsSteps(config_.fps);
+        abrConfig.allowScaleStepDown = gst_.canChangeVideoFormat();
+        abr_.reset(new BitrateController(abrConfig));
+        const std::string tag = "[ABR] " + config_.name + " ";
+        abr_->setOnDecision([this, tag](const BitrateController::Decision& d) {
+            logWithTime(tag + d.reason + ": " + std::to_string(d.prevBitrateBps / 1000) + " -> " +
+                        std::to_string(d.bitrateBps / 1000) + " kbps, " + std::to_string(d.prevFps) + " -> " +
+                        std::to_string(d.fps) + " fps, " + std::to_string(d.prevScale) + " -> " +
+                        std::to_string(d.scale) + " %");
+            applyAbrDecision(gst_, d, config_.width, config_.height, config_.fps);
+        });
+    }
+}
+
+std::vector<int> PublisherSession::fpsSteps(int fps) {
+    return {fps, std::max(1, fps * 2 / 3), std::max(1, fps / 2)};
+}
+
+void PublisherSession::applyAbrDecision(GstManager& gst, const BitrateController::Decision& d,
+                                        int width, int height, int fps) {
+    if (d.bitrateBps != d.prevBitrateBps) gst.setVideoBitrate(d.bitrateBps);
+    if (d.scale != d.prevScale) {
+        // Even sizes for 4:2:0 chroma
+        gst.setVideoFormat((width * d.scale / 100) & ~1, (height * d.scale / 100) & ~1, fps);
+    }
+    // setVideoFormat restores the format's rate; the current step goes back on top
+    if (d.fps != d.prevFps || (d.scale != d.prevScale && d.fps != fps)) gst.setVideoFramerate(d.fps);
+}
+
+PublisherSession::~PublisherSession() {
+    // The appsink callbacks refer to rtmp_; the pipelines go first
+    stop();
+}
+
+bool PublisherSession::start() {
+    if (state_ == State::RUNNING) return true;
+    int sampleRate = config_.audio ? GstManager::kAudioSampleRate : 0;
+    int channels = config_.audio ? GstManager::kAudioChannels : 0;
+    audioFormat(config_.source, sampleRate, channels);
+    if (!rtmp_.start(config_.width, config_.height, sampleRate, channels)) {
+        state_ = State::FAILED;
+        return false;
+    }
+
+    gst_.setOnVideoAnnexBFrame([this](const MediaFrame::Ptr& frame) { rtmp_.pushVideoFrame(frame); });
+    if (config_.audio) {
+        gst_.setOnAudioAACFrame([this](const MediaFrame::Ptr& frame) { rtmp_.pushAudioFrame(frame, 1024); });
+    }
+    gst_.startVideo();
+    gst_.startAudio();
+    state_ = State::RUNNING;
+    logWithTime("[SESSION] " + config_.name + " started (" + std::to_string(config_.width) + "x" +
+                std::to_string(config_.height) + "@" + std::to_string(config_.fps) + ", " +
+                std::to_string(config_.urls.size()) + " destination(s))");
+    return true;
+}
+
+void PublisherSession::stop() {
+    gst_.stopVideo();
+    gst_.stopAudio();
+    rtmp_.stop();
+    if (state_ == State::RUNNING) state_ = State::IDLE;
+}
+
+/**
+ * Runs on the host's event loop thread, never on a streaming or writer thread,
+ * so stopping a session from here cannot deadlock on its own pipeline.
+ */
+void PublisherSession::tick(int64_t nowMs) {
+    if (state_ != State::RUNNING) return;
+    if (gst_.hasFailed() || rtmp_.allFailed()) {
+        logWithTime(LEVEL_ERROR, "[SESSION] " + config_.name + (gst_.hasFailed() ? ": pipeline error" :
+                    ": all destinations gave up reconnecting") + ", stopping session");
+        stop();
+        state_ = State::FAILED;
+        return;
+    }
+    if (gst_.hasEnded()) {
+        logWithTime("[SESSION] " + config_.name + ": end of input, stopping session");
+        stop();
+        state_ = State::ENDED;
+        return;
+    }
+    // Bitrate follows the primary (first) destination; an outage says nothing about the link rate
+    if (abr_ && rtmp_.destination(0).isConnected()) abr_->update(abrSample(rtmp_.destination(0)), nowMs);
+    gst_.setSendBacklog(rtmp_.destination(0).getQueueStats().bytes);
+}
+
+PublisherSession::Stats PublisherSession::stats() {
+    Stats s;
+    s.name = config_.name;
+    s.state = state_;
+    s.bitrateBps = abr_ ? abr_->bitrate() : config_.bitrateBps;
+    for (const auto& d : rtmp_.getStats()) {
+        if (s.destinations++ == 0) s.videoPackets = d.writer.videoPackets;
+        if (d.writer.connected) ++s.connected;
+        s.throughputBps += d.throughputBps;
+        s.queueDepth = std::max(s.queueDepth, d.queue.depth);
+        s.drops += d.queue.droppedDisposable + d.queue.droppedVideo + d.queue.droppedLate + d.queue.droppedAudio;
+        s.reconnects += d.writer.reconnects;
+    }
+    return s;
+}
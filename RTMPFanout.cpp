@@ -0,0 +1,94 @@
+#include "RTMPFanout.h"
+#include "Logger.h"
+
+RTMPFanout::RTMPFanout(const std::vector<std::string>& urls, const PacketQueue::Config& queueConfig,
+                       const RTMPReconnectPolicy& reconnectPolicy) {
+    for (const auto& url : urls) {
+        destinations_.emplace_back(new RTMPStreamer(url, queueConfig, reconnectPolicy));
+    }
+    prevBytes_.assign(destinations_.size(), 0);
+}
+
+bool RTMPFanout::start(int width, int height, int sampleRate, int channels) {
+    size_t started = 0;
+    for (auto& dest : destinations_) {
+        if (dest->start(width, height, sampleRate, channels)) {
+            ++started;
+        } else {
+            logWithTime(LEVEL_ERROR, "[FANOUT] Failed to start " + dest->url());
+        }
+    }
+    prevStatsNs_ = PacketQueue::nowNs();
+    return started > 0;
+}
+
+void RTMPFanout::stop() {
+    for (auto& dest : destinations_) dest->stop();
+}
+
+void RTMPFanout::setOnKeyframeNeeded(const RTMPStreamer::KeyframeRequest& cb) {
+    for (auto& dest : destinations_) dest->setOnKeyframeNeeded(cb);
+}
+
+void RTMPFanout::setBackend(RTMPBackend backend) {
+    for (auto& dest : destinations_) dest->setBackend(backend);
+}
+
+void RTMPFanout::setTcpOptions(const TcpOptions& options) {
+    for (auto& dest : destinations_) dest->setTcpOptions(options);
+}
+
+void RTMPFanout::setVideoCodec(VideoCodec codec) {
+    videoCodec_ = codec;
+    for (auto& dest : destinations_) dest->setVideoCodec(codec);
+}
+
+void RTMPFanout::setWriterPool(WriterPool* pool) {
+    for (auto& dest : destinations_) dest->setWriterPool(pool);
+}
+
+void RTMPFanout::setSessionName(const std::string& name) {
+    for (auto& dest : destinations_) dest->setSessionName(name);
+}
+
+void RTMPFanout::pushVideoFrame(const MediaFrame::Ptr& frame) {
+    SendPacket pkt;
+    if (!RTMPStreamer::classifyVideo(frame, videoCodec_, pkt)) return;
+    for (auto& dest : destinations_) dest->pushPacket(pkt);
+}
+
+void RTMPFanout::pushAudioFrame(const MediaFrame::Ptr& frame, int nb_samples) {
+    SendPacket pkt;
+    pkt.frame = frame;
+    pkt.nbSamples = nb_samples;
+    for (auto& dest : destinations_) dest->pushPacket(pkt);
+}
+
+bool RTMPFanout::allFailed() const {
+    for (const auto& dest : destinations_) {
+        if (!dest->hasFailed()) return false;
+    }
+    return true;
+}
+
+std::vector<RTMPFanout::DestinationStats> RTMPFanout::getStats() {
+    std::lock_guard<std::mutex> lock(statsMutex_);
+    int64_t now = PacketQueue::nowNs();
+    double elapsedSec = (now - prevStatsNs_) / 1e9;
+    prevStatsNs_ = now;
+
+    std::vector<DestinationStats> out;
+    for (size_t i = 0; i < destinations_.size(); ++i) {
+        DestinationStats s;
+        s.url = destinations_[i]->url();
+        s.queue = destinations_[i]->getQueueStats();
+        s.writer = destinations_[i]->getWriterStats();
+        s.failed = destinations_[i]->hasFailed();
+        if (elapsedSec > 0) {
+            s.throughputBps = (s.writer.bytesSent - prevBytes_[i]) * 8.0 / elapsedSec;
+        }
+        prevBytes_[i] = s.writer.bytesSent;
+        out.push_back(s);
+    }
+    return out;
+}
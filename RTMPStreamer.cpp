@@ -0,0 +1,856 @@
+#include "RTMPStreamer.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <pthread.h>
+#include "Logger.h"
+#include "ThreadPolicy.h"
+#include "H264Bitstream.h"
+#include "H265Bitstream.h"
+#include "AacConfig.h"
+#include "RtmpClient.h"
+#include "FlvTagWriter.h"
+#include "WriterPool.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+#include <libavutil/dict.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/mathematics.h>
+}
+
+// Owned by the application; toggled from the CLI
+extern std::atomic<bool> g_enable_trace;
+
+/**
+ * AVBuffer free hook: drops the packet's reference to the appsink frame
+ */
+static void release_frame(void* opaque, uint8_t* /*data*/) {
+    delete static_cast<MediaFrame::Ptr*>(opaque);
+}
+
+/**
+ * Builds a packet that references the frame memory instead of copying it.
+ * The frame stays mapped until libavformat releases the packet buffer.
+ */
+static AVPacket* wrap_frame(const MediaFrame::Ptr& frame) {
+    AVPacket* pkt = av_packet_alloc();
+    if (!pkt) return nullptr;
+
+    MediaFrame::Ptr* ref = new MediaFrame::Ptr(frame);
+    pkt->buf = av_buffer_create(const_cast<uint8_t*>(frame->data()), frame->size(),
+                                release_frame, ref, AV_BUFFER_FLAG_READONLY);
+    if (!pkt->buf) {
+        delete ref;
+        av_packet_free(&pkt);
+        return nullptr;
+    }
+    pkt->data = pkt->buf->data;
+    pkt->size = static_cast<int>(frame->size());
+    return pkt;
+}
+
+RTMPStreamer::RTMPStreamer(const std::string& rtmpUrl, const PacketQueue::Config& queueConfig,
+                           const RTMPReconnectPolicy& reconnectPolicy)
+    : rtmpUrl_(rtmpUrl), policy_(reconnectPolicy), outContext_(nullptr), transport_(nullptr),
+      backend_(RTMPBackend::FFMPEG), sessionOpen_(false), videoStream_(nullptr),
+      audioStream_(nullptr), width_(0), height_(0), sampleRate_(44100), channels_(1), hasAudio_(true),
+      videoCodec_(VideoCodec::H264),
+      hasTimeline_(false), baseNs_(0), audioAnchorNs_(-1), audioSamples_(0), tsOffsetMs_(0),
+      awaitKeyframe_(true), gopCacheBytes_(0), gopCacheValid_(false),
+      backoffMs_(reconnectPolicy.initialBackoffMs), failedAttempts_(0), nextAttemptNs_(0),
+      startNs_(0), lastKeyframeRequestNs_(0),
+      videoFrameCnt_(0), audioFrameCnt_(0),
+      queue_(queueConfig), isRunning_(false), abort_(false), connected_(false), failed_(false) {
+    avformat_network_init();
+    registerMetrics();
+}
+
+RTMPStreamer::~RTMPStreamer() {
+    // The writer observes writeMs_ and packetAgeMs_ until stop() has joined it
+    stop();
+    Metrics::Registry::instance().remove(this);
+}
+
+/**
+ * The stream key is masked in the label; the last characters still tell
+ * destinations on the same ingest apart.
+ */
+static std::string metrics_label(const std::string& url) {
+    size_t slash = url.rfind('/');
+    if (slash == std::string::npos || slash == 0 || slash + 1 >= url.size() || url[slash - 1] == '/') return url;
+    std::string key = url.substr(slash + 1);
+    return url.substr(0, slash + 1) + "***" + (key.size() > 8 ? key.substr(key.size() - 4) : "");
+}
+
+/**
+ * Everything already counted for the stats line is exported through scrape-time
+ * callbacks; only the two histograms add work on the writer thread.
+ */
+void RTMPStreamer::registerMetrics() {
+    Metrics::Registry& reg = Metrics::Registry::instance();
+    const std::string dest = metrics_label(rtmpUrl_);
+    // Two sessions may publish to the same ingest; the session label keeps their series apart
+    auto withSession = [this](Metrics::Labels labels) {
+        if (!sessionName_.empty()) labels.insert(labels.begin(), {"session", sessionName_});
+        return labels;
+    };
+    const Metrics::Labels labels = withSession({{"dest", dest}});
+    const Metrics::Type COUNTER = Metrics::Type::COUNTER;
+    const Metrics::Type GAUGE = Metrics::Type::GAUGE;
+
+    reg.callback("rtmp_packets_sent_total", "Packets written to the muxer", COUNTER,
+                 [this]() { return (double)videoPackets_.load(std::memory_order_relaxed); },
+                 withSession({{"dest", dest}, {"type", "video"}}), this);
+    reg.callback("rtmp_packets_sent_total", "Packets written to the muxer", COUNTER,
+                 [this]() { return (double)audioPackets_.load(std::memory_order_relaxed); },
+                 withSession({{"dest", dest}, {"type", "audio"}}), this);
+    reg.callback("rtmp_bytes_sent_total", "Payload bytes written to the muxer", COUNTER,
+                 [this]() { return (double)bytesSent_.load(std::memory_order_relaxed); }, labels, this);
+
+    reg.callback("rtmp_queue_depth", "Packets waiting for the writer thread", GAUGE,
+                 [this]() { return (double)queue_.stats().depth; }, labels, this);
+    reg.callback("rtmp_queue_bytes", "Frame payload waiting for the writer thread", GAUGE,
+                 [this]() { return (double)queue_.stats().bytes; }, labels, this);
+    reg.callback("rtmp_gop_cache_bytes", "Frame payload held in the GOP cache", GAUGE,
+                 [this]() { return (double)gopCacheBytes_.load(std::memory_order_relaxed); }, labels, this);
+    reg.callback("rtmp_queue_dropped_total", "Packets dropped by the send queue", COUNTER,
+                 [this]() { return (double)queue_.stats().droppedDisposable; },
+                 withSession({{"dest", dest}, {"reason", "nonref"}}), this);
+    reg.callback("rtmp_queue_dropped_total", "Packets dropped by the send queue", COUNTER,
+                 [this]() { return (double)queue_.stats().droppedVideo; },
+                 withSession({{"dest", dest}, {"reason", "video"}}), this);
+    reg.callback("rtmp_queue_dropped_total", "Packets dropped by the send queue", COUNTER,
+                 [this]() { return (double)queue_.stats().droppedLate; },
+                 withSession({{"dest", dest}, {"reason", "late"}}), this);
+    reg.callback("rtmp_queue_dropped_total", "Packets dropped by the send queue", COUNTER,
+                 [this]() { return (double)queue_.stats().droppedAudio; },
+                 withSession({{"dest", dest}, {"reason", "audio"}}), this);
+
+    reg.callback("rtmp_connected", "1 while the RTMP connection is up", GAUGE,
+                 [this]() { return connected_ ? 1.0 : 0.0; }, labels, this);
+    reg.callback("rtmp_reconnects_total", "Successful reconnects after a dropped connection", COUNTER,
+                 [this]() { return (double)reconnects_.load(std::memory_order_relaxed); }, labels, this);
+    reg.callback("rtmp_sequence_header_changes_total", "Video sequence headers replaced mid-stream (new SPS/PPS)",
+                 COUNTER, [this]() { return (double)videoConfigChanges_.load(std::memory_order_relaxed); },
+                 labels, this);
+    reg.callback("rtmp_outage_seconds_total", "Time spent disconnected (completed outages)", COUNTER,
+                 [this]() { return totalOutageMs_.load(std::memory_order_relaxed) / 1000.0; }, labels, this);
+
+    reg.callback("rtmp_tcp_rtt_ms", "Smoothed TCP round-trip time (native backend)", GAUGE,
+                 [this]() { return tcpRttUs_.load(std::memory_order_relaxed) / 1000.0; }, labels, this);
+    reg.callback("rtmp_tcp_unsent_bytes", "Bytes in the kernel send queue not yet sent (native backend)", GAUGE,
+                 [this]() { return (double)tcpUnsentBytes_.load(std::memory_order_relaxed); }, labels, this);
+    reg.callback("rtmp_tcp_unacked_bytes", "Bytes sent but not yet acknowledged (native backend)", GAUGE,
+                 [this]() { return (double)tcpUnackedBytes_.load(std::memory_order_relaxed); }, labels, this);
+    reg.callback("rtmp_tcp_cwnd_segments", "TCP congestion window (native backend)", GAUGE,
+                 [this]() { return (double)tcpCwnd_.load(std::memory_order_relaxed); }, labels, this);
+    reg.callback("rtmp_tcp_retransmits_total", "TCP retransmissions on the current connection (native backend)",
+                 COUNTER, [this]() { return (double)tcpRetransmits_.load(std::memory_order_relaxed); }, labels, this);
+
+    writeMs_ = &reg.histogram("rtmp_write_duration_ms", "Time spent writing one packet to the muxer",
+                              {0.1, 0.5, 1, 2, 5, 10, 20, 50, 100, 500}, labels, this);
+    packetAgeMs_ = &reg.histogram("rtmp_packet_age_ms", "Time from appsink enqueue to written",
+                                  Metrics::latencyBucketsMs(), labels, this);
+}
+
+void RTMPStreamer::setSessionName(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (isRunning_ || name == sessionName_) return;
+    Metrics::Registry::instance().remove(this);
+    sessionName_ = name;
+    registerMetrics();
+}
+
+bool RTMPStreamer::start(int width, int height, int sampleRate, int channels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (isRunning_) return true;
+
+    // The writer thread connects right away; the header follows the first keyframe
+    width_ = width;
+    height_ = height;
+    sampleRate_ = sampleRate;
+    channels_ = channels;
+    hasAudio_ = sampleRate > 0 && channels > 0;
+    backoffMs_ = policy_.initialBackoffMs;
+    failedAttempts_ = 0;
+    nextAttemptNs_ = 0;
+    startNs_ = PacketQueue::nowNs();
+    lastKeyframeRequestNs_ = 0;
+    firstVideoNs_ = 0;
+
+    failed_ = false;
+    isRunning_ = true;
+    if (pool_) {
+        poolTask_ = pool_->add([this]() { return writerTurn(); });
+        pool_->wake(poolTask_);
+    } else {
+        writerThread_ = std::thread(&RTMPStreamer::writerLoop, this);
+    }
+    return true;
+}
+
+void RTMPStreamer::stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    isRunning_ = false;
+    abort_ = true;
+    queue_.wakeup();
+    if (writerThread_.joinable()) writerThread_.join();
+    // An appsink thread may still be in pushPacket(); it sees 0 from here on
+    int task = poolTask_.exchange(0);
+    if (pool_ && task) pool_->remove(task);
+    abort_ = false;
+
+    SendPacket pkt;
+    while (connected_ && interleaver_.flush(pkt)) send(pkt);
+    closeOutput(true);
+    connected_ = false;
+
+    hasTimeline_ = false;
+    videoConfig_.clear();
+    audioConfig_.clear();
+    gopCache_.clear();
+    gopCacheBytes_ = 0;
+    gopCacheValid_ = false;
+    outageStartNs_ = 0;
+    interleaver_.reset();
+    audioAnchorNs_ = -1;
+    audioSamples_ = 0;
+}
+
+bool RTMPStreamer::classifyVideo(const MediaFrame::Ptr& frame, VideoCodec codec, SendPacket& pkt) {
+    // Only the NALs up to the first slice are touched on the streaming thread
+    if (codec == VideoCodec::H265) {
+        const uint8_t* slice = H265::findFirstSlice(frame->data(), frame->size());
+        if (!slice) return false;
+        uint8_t type = H265::nalType(slice[0]);
+        pkt.keyframe = H265::isIrap(type);
+        pkt.disposable = H265::isSubLayerNonRef(type);
+    } else {
+        const uint8_t* slice = H264::findFirstSlice(frame->data(), frame->size());
+        if (!slice) return false;
+        pkt.keyframe = (slice[0] & 0x1F) == H264::NAL_IDR;
+        pkt.disposable = (slice[0] & 0x60) == 0;
+    }
+    pkt.frame = frame;
+    pkt.isVideo = true;
+    return true;
+}
+
+void RTMPStreamer::pushVideoFrame(const MediaFrame::Ptr& frame) {
+    SendPacket pkt;
+    if (classifyVideo(frame, videoCodec_, pkt)) pushPacket(std::move(pkt));
+}
+
+void RTMPStreamer::pushAudioFrame(const MediaFrame::Ptr& frame, int nb_samples) {
+    SendPacket pkt;
+    pkt.frame = frame;
+    pkt.nbSamples = nb_samples;
+    pushPacket(std::move(pkt));
+}
+
+void RTMPStreamer::pushPacket(SendPacket pkt) {
+    if (!isRunning_ || failed_ || (!pkt.isVideo && !hasAudio_)) return;
+    if (queue_.push(std::move(pkt)) && pool_) {
+        int task = poolTask_.load();
+        if (task) pool_->wake(task);
+    }
+}
+
+RTMPWriterStats RTMPStreamer::getWriterStats() const {
+    RTMPWriterStats s;
+    s.videoPackets = videoPackets_.load(std::memory_order_relaxed);
+    s.audioPackets = audioPackets_.load(std::memory_order_relaxed);
+    s.bytesSent = bytesSent_.load(std::memory_order_relaxed);
+    s.lastWriteUs = lastWriteUs_.load(std::memory_order_relaxed);
+    s.maxWriteUs = maxWriteUs_.load(std::memory_order_relaxed);
+    s.totalWriteUs = totalWriteUs_.load(std::memory_order_relaxed);
+    int64_t lastNs = lastWrittenEnqueueNs_.load(std::memory_order_relaxed);
+    if (lastNs > 0 && queue_.stats().depth > 0) {
+        s.lagMs = (PacketQueue::nowNs() - lastNs) / 1000000;
+    }
+    s.connected = connected_;
+    s.reconnects = reconnects_.load(std::memory_order_relaxed);
+    s.resumedPackets = resumedPackets_.load(std::memory_order_relaxed);
+    int64_t outageNs = outageStartNs_.load(std::memory_order_relaxed);
+    if (outageNs > 0) s.outageMs = (PacketQueue::nowNs() - outageNs) / 1000000;
+    s.lastOutageMs = lastOutageMs_.load(std::memory_order_relaxed);
+    s.totalOutageMs = totalOutageMs_.load(std::memory_order_relaxed);
+    s.handshakeMs = handshakeMs_.load(std::memory_order_relaxed);
+    s.firstVideoNs = firstVideoNs_.load(std::memory_order_relaxed);
+    s.gopCacheBytes = gopCacheBytes_.load(std::memory_order_relaxed);
+    s.videoConfigChanges = videoConfigChanges_.load(std::memory_order_relaxed);
+    s.tcpValid = tcpValid_;
+    s.tcpRttUs = tcpRttUs_.load(std::memory_order_relaxed);
+    s.tcpRttVarUs = tcpRttVarUs_.load(std::memory_order_relaxed);
+    s.tcpCwnd = tcpCwnd_.load(std::memory_order_relaxed);
+    s.tcpUnsentBytes = tcpUnsentBytes_.load(std::memory_order_relaxed);
+    s.tcpUnackedBytes = tcpUnackedBytes_.load(std::memory_order_relaxed);
+    s.tcpRetransmits = tcpRetransmits_.load(std::memory_order_relaxed);
+    return s;
+}
+
+/**
+ * Pipeline clock time of a packet; falls back to the enqueue time, which is
+ * on the same CLOCK_MONOTONIC timeline as the GStreamer system clock.
+ */
+static int64_t clockPts(const SendPacket& pkt) {
+    if (pkt.frame->pts() >= 0) return pkt.frame->pts();
+    if (pkt.frame->dts() >= 0) return pkt.frame->dts();
+    return pkt.enqueueNs;
+}
+
+static int64_t clockDts(const SendPacket& pkt) {
+    if (pkt.frame->dts() >= 0) return pkt.frame->dts();
+    return clockPts(pkt);
+}
+
+// ---------------- Writer thread ----------------
+void RTMPStreamer::writerLoop() {
+    ThreadPolicy::instance().enter("rtmp-writer");
+
+    SendPacket pkt;
+    while (isRunning_) {
+        if (!connected_ && !failed_ && PacketQueue::nowNs() >= nextAttemptNs_) connect();
+
+        if (!queue_.pop(pkt, 100)) continue;
+        process(pkt);
+        pkt = SendPacket();
+    }
+    ThreadPolicy::instance().leave();
+}
+
+/**
+ * The pool counterpart of one writerLoop() pass: never waits for packets, and
+ * returns after a bounded batch so other streams on the pool get their turn.
+ */
+bool RTMPStreamer::writerTurn() {
+    static const int kTurnPackets = 16;
+    if (!isRunning_) return false;
+    if (!connected_ && !failed_ && PacketQueue::nowNs() >= nextAttemptNs_) connect();
+
+    SendPacket pkt;
+    for (int n = 0; n < kTurnPackets && isRunning_ && queue_.pop(pkt, 0); ++n) {
+        process(pkt);
+        pkt = SendPacket();
+    }
+    return isRunning_ && queue_.stats().depth > 0;
+}
+
+void RTMPStreamer::process(SendPacket& pkt) {
+    if (!pkt.isVideo && hasAudio_ && audioConfig_.empty()) parseAudio(pkt);
+
+    // While disconnected or after giving up keep draining, so the appsink
+    // frames are released promptly and the GOP cache stays current
+    if (!hasTimeline_ && pkt.isVideo && !failed_ && !startTimeline(pkt)) requestKeyframe();
+    if (!failed_ && hasTimeline_ && assignTimestamps(pkt)) {
+        if (hasAudio_) {
+            interleaver_.push(std::move(pkt));
+            SendPacket ready;
+            while (interleaver_.pop(ready)) deliver(ready);
+        } else {
+            deliver(pkt);
+        }
+    }
+}
+
+/**
+ * Fixes the timeline origin and the sequence header on the first keyframe
+ * carrying SPS/PPS (and VPS for H.265). Both outlive individual connections.
+ */
+bool RTMPStreamer::startTimeline(const SendPacket& pkt) {
+    if (!pkt.isVideo || !pkt.keyframe) return false;
+
+    if (!parseVideo(pkt)) return false;
+
+    // avcC/hvcC extradata tells the FLV muxer the packets are already length-prefixed
+    if (!FlvTagWriter::buildVideoConfig(videoCodec_, au_, videoConfig_, width_, height_)) return false;
+
+    baseNs_ = clockDts(pkt);
+    hasTimeline_ = true;
+    // A session opened during preroll writes its header right away
+    if (sessionOpen_) nextAttemptNs_ = 0;
+    return true;
+}
+
+/**
+ * Maps a packet onto the FLV timeline (ms since the first keyframe).
+ * Video uses the buffer DTS/PTS on the shared pipeline clock. Audio is
+ * counted in samples from an anchor so AAC frames are exactly spaced; the
+ * anchor is reset on discontinuities or when the count drifts from the clock.
+ */
+bool RTMPStreamer::assignTimestamps(SendPacket& pkt) {
+    int64_t dtsNs = clockDts(pkt);
+    int64_t ptsNs = clockPts(pkt);
+
+    if (!pkt.isVideo) {
+        const int64_t driftLimitNs = 100 * 1000000LL;
+        int64_t countedNs = audioAnchorNs_ +
+            av_rescale(audioSamples_, 1000000000LL, sampleRate_);
+        if (audioAnchorNs_ < 0 || pkt.frame->isDiscont() ||
+            std::llabs(countedNs - ptsNs) > driftLimitNs) {
+            audioAnchorNs_ = ptsNs;
+            audioSamples_ = 0;
+            countedNs = ptsNs;
+        }
+        audioSamples_ += pkt.nbSamples;
+        ptsNs = dtsNs = countedNs;
+    }
+
+    // Audio captured before the first keyframe has no place on the timeline
+    if (dtsNs < baseNs_) return false;
+
+    pkt.dts = (dtsNs - baseNs_) / 1000000;
+    pkt.pts = (std::max(ptsNs, dtsNs) - baseNs_) / 1000000;
+    return true;
+}
+
+void RTMPStreamer::deliver(const SendPacket& sp) {
+    if (sp.isVideo && sp.keyframe) updateVideoConfig(sp);
+    cachePacket(sp);
+    if (connected_) send(sp);
+}
+
+/**
+ * An encoder restart or a resolution / frame rate change shows up as new
+ * parameter sets on the next keyframe. The stored sequence header follows
+ * them, so a reconnect starts with the right one; the current connection
+ * gets it in-stream ahead of that keyframe (writeFlvTag / writeAVPacket).
+ * The keyframe also starts a fresh GOP cache, so nothing cached predates it.
+ */
+void RTMPStreamer::updateVideoConfig(const SendPacket& sp) {
+    int width = width_, height = height_;
+    if (!parseVideo(sp) || !FlvTagWriter::buildVideoConfig(videoCodec_, au_, configScratch_, width, height)) return;
+    if (configScratch_ == videoConfig_) return;
+
+    logWithTime("[RTMP] Parameter sets changed, " + std::to_string(width_) + "x" + std::to_string(height_) +
+                " -> " + std::to_string(width) + "x" + std::to_string(height) + ", new sequence header: " + rtmpUrl_);
+    videoConfig_.swap(configScratch_);
+    width_ = width;
+    height_ = height;
+    videoConfigChanges_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Keeps every packet since the last IDR. A GOP that outgrows the byte budget
+ * is dropped whole; the next IDR starts a fresh one.
+ */
+void RTMPStreamer::cachePacket(const SendPacket& sp) {
+    if (sp.isVideo && sp.keyframe) {
+        gopCache_.clear();
+        gopCacheBytes_ = 0;
+        gopCacheValid_ = true;
+    }
+    if (!gopCacheValid_) return;
+
+    if (gopCacheBytes_ + sp.frame->size() > policy_.gopCacheMaxBytes) {
+        gopCache_.clear();
+        gopCacheBytes_ = 0;
+        gopCacheValid_ = false;
+        return;
+    }
+    gopCache_.push_back(sp);
+    gopCacheBytes_ += sp.frame->size();
+}
+
+// ---------------- Connection ----------------
+/**
+ * Called by libavformat while blocked in connect/write; lets stop() abort a
+ * dead socket instead of waiting for the TCP timeout.
+ */
+int RTMPStreamer::interruptCallback(void* opaque) {
+    return static_cast<RTMPStreamer*>(opaque)->abort_ ? 1 : 0;
+}
+
+/**
+ * RTMP connect and publish; needs nothing but the URL, so it can run before
+ * the first frame exists.
+ */
+int RTMPStreamer::openTransport() {
+    int64_t begin = PacketQueue::nowNs();
+    if (backend_ == RTMPBackend::NATIVE) {
+        rtmpClient_.reset(new RtmpClient(abort_));
+        rtmpClient_->setTcpOptions(tcpOptions_);
+        if (videoCodec_ == VideoCodec::H265) rtmpClient_->setFourCcList({"hvc1"});
+        int ret = rtmpClient_->connect(rtmpUrl_, policy_.ioTimeoutMs);
+        if (ret >= 0) handshakeMs_.store((PacketQueue::nowNs() - begin) / 1000000, std::memory_order_relaxed);
+        return ret;
+    }
+
+    AVIOInterruptCB interrupt = {&RTMPStreamer::interruptCallback, this};
+    AVDictionary* opts = nullptr;
+    av_dict_set(&opts, "rtmp_live", "live", 0);
+    av_dict_set_int(&opts, "rw_timeout", (int64_t)policy_.ioTimeoutMs * 1000, 0);
+    // Passed down to tcp://; the socket itself stays inside libavformat
+    if (tcpOptions_.noDelay) av_dict_set(&opts, "tcp_nodelay", "1", 0);
+    if (tcpOptions_.sendBufferBytes > 0) av_dict_set_int(&opts, "send_buffer_size", tcpOptions_.sendBufferBytes, 0);
+
+    int ret = avio_open2(&transport_, rtmpUrl_.c_str(), AVIO_FLAG_WRITE, &interrupt, &opts);
+    av_dict_free(&opts);
+    if (ret >= 0) handshakeMs_.store((PacketQueue::nowNs() - begin) / 1000000, std::memory_order_relaxed);
+    return ret;
+}
+
+/**
+ * FLV header on the open session; takes ownership of transport_.
+ * The native backend sends onMetaData and the sequence headers itself.
+ */
+int RTMPStreamer::openOutput() {
+    if (backend_ == RTMPBackend::NATIVE) {
+        flvWriter_.reset(new FlvTagWriter(*rtmpClient_, videoCodec_));
+        wireConfig_ = videoConfig_;
+        bool ok = flvWriter_->writeMetadata(width_, height_, hasAudio_, sampleRate_, channels_) &&
+                  flvWriter_->writeVideoHeader(videoConfig_) &&
+                  (!hasAudio_ || flvWriter_->writeAudioHeader(audioHeader()));
+        return ok ? 0 : AVERROR(EIO);
+    }
+
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(60, 16, 100)
+    // Enhanced RTMP (hvc1 tags) arrived in the FLV muxer with FFmpeg 6.1
+    if (videoCodec_ == VideoCodec::H265) {
+        logWithTime(LEVEL_ERROR, "[RTMP] This libavformat cannot mux HEVC into FLV; use the native backend");
+        return AVERROR(ENOSYS);
+    }
+#endif
+    int ret = avformat_alloc_output_context2(&outContext_, nullptr, "flv", rtmpUrl_.c_str());
+    if (ret < 0) return ret;
+    outContext_->interrupt_callback.callback = &RTMPStreamer::interruptCallback;
+    outContext_->interrupt_callback.opaque = this;
+
+    videoStream_ = avformat_new_stream(outContext_, nullptr);
+    videoStream_->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+    videoStream_->codecpar->codec_id = videoCodec_ == VideoCodec::H265 ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264;
+    videoStream_->codecpar->width = width_;
+    videoStream_->codecpar->height = height_;
+    videoStream_->codecpar->extradata_size = static_cast<int>(videoConfig_.size());
+    videoStream_->codecpar->extradata = (uint8_t*)av_mallocz(videoConfig_.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+    memcpy(videoStream_->codecpar->extradata, videoConfig_.data(), videoConfig_.size());
+    videoStream_->time_base = {1, 1000};
+    wireConfig_ = videoConfig_;
+
+    if (hasAudio_) {
+        audioStream_ = avformat_new_stream(outContext_, nullptr);
+        audioStream_->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
+        audioStream_->codecpar->codec_id = AV_CODEC_ID_AAC;
+        audioStream_->codecpar->sample_rate = sampleRate_;
+        av_channel_layout_default(&audioStream_->codecpar->ch_layout, channels_);
+        std::vector<uint8_t> asc = audioHeader();
+        audioStream_->codecpar->extradata_size = static_cast<int>(asc.size());
+        audioStream_->codecpar->extradata = (uint8_t*)av_mallocz(asc.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        memcpy(audioStream_->codecpar->extradata, asc.data(), asc.size());
+        audioStream_->time_base = {1, 1000};
+    }
+
+    outContext_->pb = transport_;
+    transport_ = nullptr;
+    return avformat_write_header(outContext_, nullptr);
+}
+
+void RTMPStreamer::closeOutput(bool writeTrailer) {
+    sessionOpen_ = false;
+    if (rtmpClient_) {
+        if (writeTrailer && connected_) rtmpClient_->unpublish();
+        flvWriter_.reset();
+        rtmpClient_.reset();
+    }
+    if (transport_) avio_closep(&transport_);
+    if (!outContext_) return;
+    if (writeTrailer && connected_) av_write_trailer(outContext_);
+    if (outContext_->pb) avio_closep(&outContext_->pb);
+    avformat_free_context(outContext_);
+    outContext_ = nullptr;
+    videoStream_ = audioStream_ = nullptr;
+}
+
+/**
+ * One connection attempt. The handshake runs as soon as the writer starts;
+ * the header needs the sequence header, so before the first keyframe the
+ * session is left open and the attempt resumes from startTimeline(). On
+ * success the cached GOP is replayed at once so the new publish session
+ * starts on an IDR; on failure the next attempt is scheduled with
+ * exponential backoff.
+ */
+void RTMPStreamer::connect() {
+    if (sessionOpen_ && !hasTimeline_) return;
+
+    int ret = 0;
+    if (!sessionOpen_) {
+        ret = openTransport();
+        sessionOpen_ = ret >= 0;
+        if (ret >= 0 && !hasTimeline_) {
+            logWithTime("[RTMP] Connected in " + std::to_string(handshakeMs_.load()) +
+                        " ms, waiting for the first keyframe: " + rtmpUrl_);
+            return;
+        }
+    }
+    if (ret >= 0) ret = openOutput();
+    sessionOpen_ = false;
+    if (ret < 0) {
+        closeOutput(false);
+        if (policy_.maxAttempts > 0 && ++failedAttempts_ >= policy_.maxAttempts) {
+            logWithTime(LEVEL_ERROR, "[RTMP] Giving up on " + rtmpUrl_ + " after " + std::to_string(failedAttempts_) +
+                        " attempts (" + std::to_string(ret) + ")");
+            failed_ = true;
+            return;
+        }
+        logWithTime(LEVEL_WARN, "[RTMP] Connect failed (" + std::to_string(ret) + "), retrying in " +
+                    std::to_string(backoffMs_) + " ms: " + rtmpUrl_);
+        nextAttemptNs_ = PacketQueue::nowNs() + (int64_t)backoffMs_ * 1000000;
+        backoffMs_ = std::min(backoffMs_ * 2, policy_.maxBackoffMs);
+        return;
+    }
+
+    connected_ = true;
+    backoffMs_ = policy_.initialBackoffMs;
+    failedAttempts_ = 0;
+    awaitKeyframe_ = true;
+
+    int64_t outageNs = outageStartNs_.exchange(0);
+    if (outageNs > 0) {
+        int64_t outageMs = (PacketQueue::nowNs() - outageNs) / 1000000;
+        lastOutageMs_.store(outageMs, std::memory_order_relaxed);
+        totalOutageMs_.fetch_add(outageMs, std::memory_order_relaxed);
+        reconnects_.fetch_add(1, std::memory_order_relaxed);
+        logWithTime("[RTMP] Reconnected after " + std::to_string(outageMs) + " ms, resuming with " +
+                    std::to_string(gopCache_.size()) + " cached packets: " + rtmpUrl_);
+    } else {
+        logWithTime("[RTMP] Header written: " + rtmpUrl_);
+    }
+
+    size_t replayed = 0;
+    for (size_t i = 0; connected_ && i < gopCache_.size(); ++i, ++replayed) send(gopCache_[i]);
+    if (outageNs > 0) resumedPackets_.fetch_add(replayed, std::memory_order_relaxed);
+}
+
+/**
+ * Tears down only the muxer and socket; the pipelines, the queue and the
+ * timeline are untouched. The first retry waits one initial backoff period.
+ */
+void RTMPStreamer::disconnect() {
+    logWithTime(LEVEL_WARN, "[RTMP] Connection lost: " + rtmpUrl_);
+    closeOutput(false);
+    connected_ = false;
+    tcpValid_ = false;
+    outageStartNs_ = PacketQueue::nowNs();
+    backoffMs_ = policy_.initialBackoffMs;
+    nextAttemptNs_ = PacketQueue::nowNs() + (int64_t)backoffMs_ * 1000000;
+    backoffMs_ = std::min(backoffMs_ * 2, policy_.maxBackoffMs);
+}
+
+/**
+ * Writes one packet on the current connection. Each connection starts on an
+ * IDR at FLV timestamp 0, so the replayed GOP and everything after it are
+ * shifted by the DTS of that IDR.
+ */
+void RTMPStreamer::send(const SendPacket& sp) {
+    if (awaitKeyframe_) {
+        if (!sp.isVideo || !sp.keyframe) {
+            requestKeyframe();
+            return;
+        }
+        awaitKeyframe_ = false;
+        tsOffsetMs_ = sp.dts;
+    }
+    if (!writePacket(sp)) disconnect();
+}
+
+/**
+ * The encoder needs a frame or two to answer, and every packet dropped in the
+ * meantime would ask again; one request per second is plenty.
+ */
+void RTMPStreamer::requestKeyframe() {
+    if (!onKeyframeNeeded_) return;
+    int64_t now = PacketQueue::nowNs();
+    if (lastKeyframeRequestNs_ > 0 && now - lastKeyframeRequestNs_ < 1000000000LL) return;
+    lastKeyframeRequestNs_ = now;
+    onKeyframeNeeded_();
+}
+
+/** @brief Splits the frame into au_ with the parser of the configured codec */
+bool RTMPStreamer::parseVideo(const SendPacket& sp) {
+    if (videoCodec_ == VideoCodec::H265) return H265::parseAccessUnit(sp.frame->data(), sp.frame->size(), au_);
+    return H264::parseAccessUnit(sp.frame->data(), sp.frame->size(), au_);
+}
+
+/**
+ * Takes the AudioSpecificConfig from the encoder caps of the first AAC frame.
+ * Its rate and channel count replace the start() parameters: audio
+ * timestamps are counted in the encoder's samples.
+ */
+void RTMPStreamer::parseAudio(const SendPacket& sp) {
+    std::vector<uint8_t> asc;
+    Aac::AscInfo info;
+    if (!sp.frame->codecData(asc) || !Aac::parseAsc(asc.data(), asc.size(), info)) return;
+    if (info.sampleRate != sampleRate_ || (info.channels > 0 && info.channels != channels_)) {
+        logWithTime(LEVEL_WARN, "[RTMP] Encoder produces " + std::to_string(info.sampleRate) + " Hz, " +
+                    std::to_string(info.channels) + " ch; start() said " + std::to_string(sampleRate_) + " Hz, " +
+                    std::to_string(channels_) + " ch");
+        sampleRate_ = info.sampleRate;
+        if (info.channels > 0) channels_ = info.channels;
+        audioAnchorNs_ = -1;
+    }
+    audioConfig_ = asc;
+}
+
+/** @brief The encoder's ASC, or one built from the start() parameters if no audio arrived yet */
+std::vector<uint8_t> RTMPStreamer::audioHeader() const {
+    if (!audioConfig_.empty()) return audioConfig_;
+    std::vector<uint8_t> asc;
+    Aac::buildAsc(sampleRate_, channels_, asc);
+    return asc;
+}
+
+/**
+ * Converts an Annex B access unit to AVCC in the reusable scratch buffer.
+ * This is the one copy FLV requires; libavformat no longer rewrites it.
+ */
+AVPacket* RTMPStreamer::convertVideo(const SendPacket& sp) {
+    if (!parseVideo(sp)) {
+        logWithTime(LEVEL_WARN, "[RTMP] Access unit has too many NAL units, dropped");
+        return nullptr;
+    }
+    size_t size = H264::avccSize(au_);
+    if (avccScratch_.size() < size + AV_INPUT_BUFFER_PADDING_SIZE) {
+        avccScratch_.resize(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    }
+    H264::writeAvcc(au_, avccScratch_.data());
+
+    AVPacket* pkt = av_packet_alloc();
+    if (!pkt) return nullptr;
+    pkt->data = avccScratch_.data();
+    pkt->size = static_cast<int>(size);
+    return pkt;
+}
+
+/**
+ * libavformat path: one AVPacket per frame, video converted to AVCC first.
+ * 1 = nothing written (packet skipped), otherwise the av_write_frame result.
+ */
+int RTMPStreamer::writeAVPacket(const SendPacket& sp, int64_t pts, int64_t dts, size_t& size) {
+    AVPacket *pkt = sp.isVideo ? convertVideo(sp) : wrap_frame(sp.frame);
+    if (!pkt) return 1;
+
+    if (sp.isVideo) {
+        pkt->stream_index = videoStream_->index;
+        if (sp.keyframe) pkt->flags |= AV_PKT_FLAG_KEY;
+        // The FLV muxer writes a new sequence header when the extradata in the side data differs
+        if (sp.keyframe && wireConfig_ != videoConfig_) {
+            uint8_t* side = av_packet_new_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, videoConfig_.size());
+            if (!side) {
+                av_packet_free(&pkt);
+                return AVERROR(ENOMEM);
+            }
+            memcpy(side, videoConfig_.data(), videoConfig_.size());
+            wireConfig_ = videoConfig_;
+        }
+    } else {
+        pkt->stream_index = audioStream_->index;
+    }
+    pkt->pts = pts;
+    pkt->dts = dts;
+
+    size = pkt->size;
+    int ret = av_write_frame(outContext_, pkt);
+    av_packet_free(&pkt);
+    return ret;
+}
+
+/**
+ * Native path: the tag is gathered straight from the appsink buffer, so
+ * there is no AVCC copy and no AVPacket; same return convention.
+ */
+int RTMPStreamer::writeFlvTag(const SendPacket& sp, int64_t pts, int64_t dts, size_t& size) {
+    bool ok;
+    if (sp.isVideo) {
+        if (!parseVideo(sp)) {
+            logWithTime(LEVEL_WARN, "[RTMP] Access unit has too many NAL units, dropped");
+            return 1;
+        }
+        size = H264::avccSize(au_);
+        // New parameter sets: metadata and sequence header at the keyframe's timestamp, then the keyframe
+        if (sp.keyframe && wireConfig_ != videoConfig_) {
+            if (!flvWriter_->writeMetadata(width_, height_, hasAudio_, sampleRate_, channels_, dts) ||
+                !flvWriter_->writeVideoHeader(videoConfig_, dts)) {
+                return AVERROR(EIO);
+            }
+            wireConfig_ = videoConfig_;
+        }
+        ok = flvWriter_->writeVideo(au_, sp.keyframe, dts, static_cast<int32_t>(pts - dts));
+    } else {
+        size = sp.frame->size();
+        ok = flvWriter_->writeAudio(sp.frame->data(), sp.frame->size(), dts);
+    }
+    return ok ? 0 : AVERROR(EIO);
+}
+
+bool RTMPStreamer::writePacket(const SendPacket& sp) {
+    const int64_t pts = sp.pts - tsOffsetMs_;
+    const int64_t dts = sp.dts - tsOffsetMs_;
+
+    // Conditional Trace Log
+    if (g_enable_trace) {
+        if (sp.isVideo) {
+            logWithTime(LEVEL_DEBUG, "[V TRACE] Frm: " + std::to_string(videoFrameCnt_++) +
+                        " | PTS: " + std::to_string(pts) + " | DTS: " + std::to_string(dts));
+        } else {
+            logWithTime(LEVEL_DEBUG, "[A TRACE] Pkt: " + std::to_string(audioFrameCnt_++) +
+                        " | PTS: " + std::to_string(pts) + " | DTS: " + std::to_string(dts));
+        }
+    }
+
+    size_t size = 0;
+    int64_t begin = av_gettime_relative();
+    int ret = backend_ == RTMPBackend::NATIVE ? writeFlvTag(sp, pts, dts, size)
+                                             : writeAVPacket(sp, pts, dts, size);
+    int64_t elapsed = av_gettime_relative() - begin;
+    if (ret == 1) return true;
+
+    if (ret < 0) {
+        logWithTime(LEVEL_WARN, std::string("[RTMP] ") +
+                    (backend_ == RTMPBackend::NATIVE ? "Native write" : "av_write_frame") +
+                    " failed: " + std::to_string(ret));
+        return false;
+    }
+
+    (sp.isVideo ? videoPackets_ : audioPackets_).fetch_add(1, std::memory_order_relaxed);
+    bytesSent_.fetch_add(size, std::memory_order_relaxed);
+    lastWriteUs_.store(elapsed, std::memory_order_relaxed);
+    totalWriteUs_.fetch_add(elapsed, std::memory_order_relaxed);
+    lastWrittenEnqueueNs_.store(sp.enqueueNs, std::memory_order_relaxed);
+    if (elapsed > maxWriteUs_.load(std::memory_order_relaxed)) {
+        maxWriteUs_.store(elapsed, std::memory_order_relaxed);
+    }
+    if (rtmpClient_) sampleTcpInfo();
+    writeMs_->observe(elapsed / 1000.0);
+    packetAgeMs_->observe((PacketQueue::nowNs() - sp.enqueueNs) / 1e6);
+    if (sp.isVideo && firstVideoNs_.load(std::memory_order_relaxed) == 0) {
+        int64_t now = PacketQueue::nowNs();
+        firstVideoNs_.store(now, std::memory_order_relaxed);
+        logWithTime("[RTMP] First video packet written " + std::to_string((now - startNs_) / 1000000) +
+                    " ms after start(): " + rtmpUrl_);
+    }
+    if (onPacketWritten_) onPacketWritten_(sp, sp.dts - tsOffsetMs_);
+    return true;
+}
+
+/**
+ * One getsockopt and two ioctls; read after every write so the unsent
+ * figure reflects the frame that was just handed to the kernel.
+ */
+void RTMPStreamer::sampleTcpInfo() {
+    TcpInfo info;
+    if (!rtmpClient_->readTcpInfo(info)) {
+        tcpValid_ = false;
+        return;
+    }
+    tcpRttUs_.store(info.rttUs, std::memory_order_relaxed);
+    tcpRttVarUs_.store(info.rttVarUs, std::memory_order_relaxed);
+    tcpCwnd_.store(info.cwndSegments, std::memory_order_relaxed);
+    tcpUnsentBytes_.store(info.unsentBytes, std::memory_order_relaxed);
+    tcpUnackedBytes_.store(info.unackedBytes, std::memory_order_relaxed);
+    tcpRetransmits_.store(info.retransmits, std::memory_order_relaxed);
+    tcpValid_ = true;
+}
@@ -1,193 +1,167 @@
 #include <iostream>
-#include <vector>
 #include <string>
-#include <mutex>
+#include <vector>
 #include <thread>
-#include <cstring>
 #include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #include "GstManager.h"
+#include "RTMPFanout.h"
+#include "BitrateController.h"
+#include "MetricsServer.h"
+#include "SegmentRecorder.h"
+#include "SessionHost.h"
+#include "ThreadPolicy.h"
 #include "Logger.h"
 
-extern "C" {
-#include <libavformat/avformat.h>
-#include <libavutil/time.h>
-#include <libavutil/dict.h>
-#include <libavcodec/avcodec.h>
-#include <libavutil/channel_layout.h>
-#include <libavutil/mathematics.h>
-}
-
 #define APP_VERSION "v1.0.0"
 #define RTMP_URL "rtmp://rtmpurl"
+#ifndef METRICS_SOCKET_PATH
+#define METRICS_SOCKET_PATH "/tmp/rtmp-publisher-metrics.sock"
+#endif
+#ifndef RECORD_STORAGE_LOCATION
+#define RECORD_STORAGE_LOCATION "/tmp/recordings"
+#endif
 
 std::atomic<bool> g_should_exit(false);
 // Global flag to control trace logs via stdin, default to false
 std::atomic<bool> g_enable_trace(false);
 
 /**
- * Helper to find NALU start codes in the byte stream
+ * Prints per-destination queue and writer counters so congestion is visible
  */
-static const uint8_t* find_nalu(const uint8_t* start, const uint8_t* end) {
-    for (const uint8_t* p = start; p < end - 4; ++p) {
-        if (p[0] == 0x00 && p[1] == 0x00 && (p[2] == 0x01 || (p[2] == 0x00 && p[3] == 0x01))) return p;
+static void print_stats(RTMPFanout& rtmp) {
+    for (const auto& d : rtmp.getStats()) {
+        const PacketQueueStats& q = d.queue;
+        const RTMPWriterStats& w = d.writer;
+        std::string state = d.failed ? " (FAILED)" :
+                            (w.connected ? "" : " (RECONNECTING " + std::to_string(w.outageMs) + " ms)");
+        logWithTime("[STATS] " + d.url + state +
+                    " | Queue: " + std::to_string(q.depth) + "/" + std::to_string(q.capacity) +
+                    " (max " + std::to_string(q.maxDepth) + ")" +
+                    " | Drops nonref/video/late/audio: " + std::to_string(q.droppedDisposable) + "/" +
+                    std::to_string(q.droppedVideo) + "/" + std::to_string(q.droppedLate) + "/" +
+                    std::to_string(q.droppedAudio) +
+                    " | Sent V/A: " + std::to_string(w.videoPackets) + "/" + std::to_string(w.audioPackets) +
+                    " | Bytes: " + std::to_string(w.bytesSent) +
+                    " | kbps: " + std::to_string((int)(d.throughputBps / 1000)) +
+                    " | Lag ms: " + std::to_string(w.lagMs) +
+                    " | Write us last/max: " + std::to_string(w.lastWriteUs) + "/" + std::to_string(w.maxWriteUs) +
+                    (w.tcpValid ? " | TCP rtt ms " + std::to_string(w.tcpRttUs / 1000) + " unsent " +
+                                  std::to_string(w.tcpUnsentBytes) + " cwnd " + std::to_string(w.tcpCwnd) +
+                                  " retrans " + std::to_string(w.tcpRetransmits) : std::string()) +
+                    " | Reconnects: " + std::to_string(w.reconnects) +
+                    " (outage last/total ms " + std::to_string(w.lastOutageMs) + "/" +
+                    std::to_string(w.totalOutageMs) + ")" +
+                    (w.videoConfigChanges > 0 ? " | Format changes: " + std::to_string(w.videoConfigChanges)
+                                              : std::string()));
     }
-    return nullptr;
 }
 
-class RTMPStreamer {
-public:
-    RTMPStreamer(const std::string& rtmpUrl)
-        : rtmpUrl_(rtmpUrl), outContext_(nullptr), videoStream_(nullptr), audioStream_(nullptr),
-          _previousVideoPts(-1), isRunning_(false), isHeaderWritten_(false),
-          videoFrameCnt_(0), audioFrameCnt_(0) {
-        avformat_network_init();
-    }
-
-    ~RTMPStreamer() { stop(); }
-
-    bool start(int width, int height, int sampleRate = 44100, int channels = 1) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (avformat_alloc_output_context2(&outContext_, nullptr, "flv", rtmpUrl_.c_str()) < 0) return false;
-
-        videoStream_ = avformat_new_stream(outContext_, nullptr);
-        videoStream_->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-        videoStream_->codecpar->codec_id = AV_CODEC_ID_H264;
-        videoStream_->codecpar->width = width;
-        videoStream_->codecpar->height = height;
-        videoStream_->time_base = {1, 1000};
-
-        audioStream_ = avformat_new_stream(outContext_, nullptr);
-        audioStream_->codecpar->codec_type = AVMEDIA_TYPE_AUDIO;
-        audioStream_->codecpar->codec_id = AV_CODEC_ID_AAC;
-        audioStream_->codecpar->sample_rate = sampleRate;
-        av_channel_layout_default(&audioStream_->codecpar->ch_layout, channels);
-        audioStream_->time_base = {1, 1000};
-
-        isRunning_ = true;
-        return true;
-    }
+static void print_talkback(const TalkbackStats& t) {
+    logWithTime("[TALKBACK] Received: " + std::to_string(t.received) + " | Played: " + std::to_string(t.played) +
+                " | Late/lost/dup/dropped: " + std::to_string(t.late) + "/" + std::to_string(t.lost) + "/" +
+                std::to_string(t.duplicates) + "/" + std::to_string(t.dropped) +
+                " | Jitter ms: " + std::to_string((int)t.jitterMs) +
+                " | Delay ms target/buffer/output: " + std::to_string(t.targetDelayMs) + "/" +
+                std::to_string((int)t.bufferMs) + "/" + std::to_string((int)t.outputMs) +
+                (t.mouthToEarMs >= 0 ? " | Mouth-to-ear ms: " + std::to_string((int)t.mouthToEarMs) : std::string()));
+}
 
-    void stop() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (outContext_) {
-            if (isHeaderWritten_) av_write_trailer(outContext_);
-            if (outContext_->pb) avio_closep(&outContext_->pb);
-            avformat_free_context(outContext_);
-            outContext_ = nullptr;
-        }
-        isRunning_ = false;
-        isHeaderWritten_ = false;
+/** @brief Bytes held at each stage between capture and socket, and the process RSS */
+static void print_memory(GstManager& gst, RTMPFanout& rtmp) {
+    GstMemoryStats g = gst.getMemoryStats();
+    size_t queueBytes = 0;
+    size_t gopCacheBytes = 0;
+    for (size_t i = 0; i < rtmp.size(); ++i) {
+        queueBytes += rtmp.destination(i).getQueueStats().bytes;
+        gopCacheBytes += rtmp.destination(i).getWriterStats().gopCacheBytes;
     }
+    ProcessMemory m = ProcessMemory::read();
+    logWithTime("[MEMORY] Raw queues KB: " + std::to_string(g.rawQueueBytes >> 10) +
+                " | Encoded queues KB: " + std::to_string(g.encodedQueueBytes >> 10) +
+                " | Send queues KB: " + std::to_string(queueBytes >> 10) +
+                " | GOP cache KB: " + std::to_string(gopCacheBytes >> 10) +
+                " | Raw frames held: " + std::to_string(g.rawFramesHeld) + (g.holdingRaw ? " (holding)" : "") +
+                " | RSS MB now/peak: " + std::to_string(m.rssBytes >> 20) + "/" + std::to_string(m.peakRssBytes >> 20));
+}
 
-    int64_t getRelativeMs() {
-        auto now = std::chrono::steady_clock::now();
-        return std::chrono::duration_cast<std::chrono::milliseconds>(now - _baseTimePoint).count();
+/**
+ * Receives the far end's RTP/Opus talkback on a UDP port and hands every
+ * datagram to the player; the receive buffer is reused, the player copies.
+ */
+static void talkback_receiver(int port, GstManager& gst) {
+    ThreadPolicy::instance().enter("talkback-rx");
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    timeval timeout = {0, 100000};
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        logWithTime(LEVEL_ERROR, "[TALKBACK] Cannot listen on UDP port " + std::to_string(port));
+        if (fd >= 0) close(fd);
+        ThreadPolicy::instance().leave();
+        return;
     }
-
-    void pushVideoFrame(const std::vector<uint8_t>& data) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!isRunning_ || g_should_exit) return;
-
-        const uint8_t* p = data.data();
-        const uint8_t* end = p + data.size();
-        const uint8_t* sps = nullptr; size_t sps_len = 0;
-        const uint8_t* pps = nullptr; size_t pps_len = 0;
-        const uint8_t* idr = nullptr;
-        const uint8_t* curr = find_nalu(p, end);
-
-        while (curr) {
-            int offset = (curr[2] == 0x01) ? 3 : 4;
-            int type = curr[offset] & 0x1F;
-            const uint8_t* next = find_nalu(curr + offset, end);
-            size_t len = (next ? next : end) - curr;
-            if (type == 7) { sps = curr; sps_len = len; }
-            else if (type == 8) { pps = curr; pps_len = len; }
-            else if (type == 5) { idr = curr; }
-            curr = next;
-        }
-
-        if (!isHeaderWritten_) {
-            if (sps && pps) {
-                videoStream_->codecpar->extradata_size = sps_len + pps_len;
-                videoStream_->codecpar->extradata = (uint8_t*)av_mallocz(videoStream_->codecpar->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
-                memcpy(videoStream_->codecpar->extradata, sps, sps_len);
-                memcpy(videoStream_->codecpar->extradata + sps_len, pps, pps_len);
-
-                AVDictionary* opts = nullptr;
-                av_dict_set(&opts, "rtmp_live", "live", 0);
-                if (avio_open2(&outContext_->pb, rtmpUrl_.c_str(), AVIO_FLAG_WRITE, nullptr, &opts) >= 0) {
-                    if (avformat_write_header(outContext_, &opts) >= 0) {
-                        isHeaderWritten_ = true;
-                        _baseTimePoint = std::chrono::steady_clock::now();
-                        logWithTime("[RTMP] Header written. Version: " + std::string(APP_VERSION));
-                        std::cout << "\n>>> PRESS 't' TO TOGGLE TRACE LOGS, 'q' TO EXIT <<<\n" << std::endl;
-                    }
-                }
-                av_dict_free(&opts);
-            }
-            if (!isHeaderWritten_) return;
-        }
-
-        AVPacket *pkt = av_packet_alloc();
-        pkt->data = const_cast<uint8_t*>(data.data());
-        pkt->size = data.size();
-        pkt->stream_index = videoStream_->index;
-
-        int64_t pts = getRelativeMs();
-        if (_previousVideoPts != -1 && pts <= _previousVideoPts) pts = _previousVideoPts + 1;
-
-        pkt->pts = pkt->dts = pts;
-        if (idr) pkt->flags |= AV_PKT_FLAG_KEY;
-
-        // Conditional Trace Log
-        if (g_enable_trace) {
-            logWithTime("[V TRACE] Frm: " + std::to_string(videoFrameCnt_++) +
-                        " | PTS: " + std::to_string(pkt->pts) + " | DTS: " + std::to_string(pkt->dts));
-        }
-
-        if (av_write_frame(outContext_, pkt) < 0) g_should_exit = true;
-
-        _previousVideoPts = pts;
-        av_packet_free(&pkt);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint8_t packet[1500];
+    while (!g_should_exit) {
+        ssize_t n = recv(fd, packet, sizeof(packet), 0);
+        if (n > 0) gst.pushAudioFrame(packet, static_cast<size_t>(n));
     }
+    close(fd);
+    ThreadPolicy::instance().leave();
+}
 
-    void pushAudioFrame(const std::vector<uint8_t>& data, int nb_samples) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (!isHeaderWritten_ || g_should_exit) return;
-
-        AVPacket *pkt = av_packet_alloc();
-        pkt->data = const_cast<uint8_t*>(data.data());
-        pkt->size = data.size();
-        pkt->stream_index = audioStream_->index;
-        pkt->pts = pkt->dts = getRelativeMs();
-
-        // Conditional Trace Log
-        if (g_enable_trace) {
-            logWithTime("[A TRACE] Pkt: " + std::to_string(audioFrameCnt_++) +
-                        " | PTS: " + std::to_string(pkt->pts) + " | DTS: " + std::to_string(pkt->dts));
-        }
-
-        if (av_write_frame(outContext_, pkt) < 0) g_should_exit = true;
+/**
+ * Time since the kernel started this process (/proc/self/stat starttime), so
+ * startup figures include exec, dynamic linking and gst_init.
+ */
+static int64_t process_age_ms() {
+    char buf[1024];
+    FILE* f = fopen("/proc/self/stat", "r");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // Fields after the parenthesised command name start at field 3; starttime is field 22
+    const char* p = strrchr(buf, ')');
+    unsigned long long startTicks = 0;
+    for (int field = 2; p && field < 22; ++field) p = strchr(p + 1, ' ');
+    if (!p || sscanf(p + 1, "%llu", &startTicks) != 1) return -1;
+
+    timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000 - (int64_t)(startTicks * 1000 / sysconf(_SC_CLK_TCK));
+}
 
-        av_packet_free(&pkt);
-    }
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-private:
-    std::string rtmpUrl_;
-    AVFormatContext* outContext_;
-    AVStream *videoStream_, *audioStream_;
-    std::chrono::steady_clock::time_point _baseTimePoint;
-    int64_t _previousVideoPts;
-    bool isRunning_, isHeaderWritten_;
-    uint64_t videoFrameCnt_, audioFrameCnt_;
-    std::mutex mutex_;
-};
+/** @brief "WxH" or "WxH@FPS"; fps is left alone without the suffix */
+static bool parse_format(const std::string& text, int& width, int& height, int& fps) {
+    int n = sscanf(text.c_str(), "%dx%d@%d", &width, &height, &fps);
+    return n >= 2 && width > 0 && height > 0 && fps > 0;
+}
 
 /**
  * Thread function to handle CLI commands
  */
-void command_listener() {
+void command_listener(std::function<void()> printStats, std::function<void(const std::string&)> changeFormat) {
+    ThreadPolicy::instance().enter("cli");
     std::string cmd;
     while (!g_should_exit) {
         if (std::cin >> cmd) {
@@ -198,41 +172,297 @@ void command_listener() {
                 logWithTime("[CLI] Exit command received.");
                 g_should_exit = true;
                 break;
+            } else if (cmd == "s" || cmd == "S") {
+                printStats();
+                ThreadPolicy::instance().logReport();
+            } else if ((cmd == "f" || cmd == "F") && std::cin >> cmd) {
+                if (changeFormat) changeFormat(cmd);
+                else logWithTime(LEVEL_WARN, "[CLI] Format changes are not available in multi-session mode");
             }
         }
     }
+    ThreadPolicy::instance().leave();
+}
+
+static void print_usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [options] [rtmp://... | rtmps://...]...\n"
+                 "  --source SPEC             capture, test, file:PATH, udp:PORT, rtp:VPORT[,APORT[,opus|aac[/RATE[/CH]]]]\n"
+                 "  --size WxH[@FPS]          encoded size and rate (720x480@30)\n"
+                 "  --hevc                    H.265 (Enhanced RTMP)\n"
+                 "  --native-rtmp             built-in FLV/RTMP muxer instead of libavformat\n"
+                 "  --av-pipeline             one pipeline for audio and video\n"
+                 "  --tcp-sndbuf BYTES        --tcp-notsent-lowat BYTES\n"
+                 "  --memory-budget KB        --shed raw|encoded\n"
+                 "  --no-sei                  --time-overlay\n"
+                 "  --record                  --record-dir DIR  --record-segment-sec N  --record-max-mb N\n"
+                 "  --talkback PORT           --sched RULES\n"
+                 "  --sessions FILE           --writer-threads N\n"
+                 "  --metrics-port PORT       --log-file\n";
 }
 
 int main(int argc, char* argv[]) {
     logWithTime("RtmpPublisher Starting... Version: " + std::string(APP_VERSION));
-    RTMPStreamer rtmp(RTMP_URL);
+    // Every other argument is an RTMP destination fed from the same encode
+    std::vector<std::string> urls;
+    int metricsPort = 0;
+    bool combinedPipeline = false;
+    bool nativeRtmp = false;
+    // Keeps the kernel backlog to a fraction of a second so the queue, not the socket, holds stale frames
+    TcpOptions tcpOptions;
+    tcpOptions.notSentLowatBytes = 64 << 10;
+    VideoCodec videoCodec = VideoCodec::H264;
+    bool record = false;
+    std::string sessionsFile;
+    int writerThreads = 0;
+    int talkbackPort = 0;
+    MemoryBudget memoryBudget;
+    MediaSource source;
+    bool captureTimeSei = true;
+    bool timeOverlay = false;
+    int width = 720, height = 480, fps = 30;
+    SegmentRecorder::Config recordConfig;
+    recordConfig.dir = RECORD_STORAGE_LOCATION;
+#if PLATFORM_NUM == 0x610
+    bool logToFile = true;
+#else
+    bool logToFile = false;
+#endif
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--metrics-port" && i + 1 < argc) {
+            metricsPort = std::atoi(argv[++i]);
+        } else if (arg == "--log-file") {
+            logToFile = true;
+        } else if (arg == "--av-pipeline") {
+            combinedPipeline = true;
+        } else if (arg == "--native-rtmp") {
+            nativeRtmp = true;
+        } else if (arg == "--tcp-sndbuf" && i + 1 < argc) {
+            tcpOptions.sendBufferBytes = std::atoi(argv[++i]);
+        } else if (arg == "--tcp-notsent-lowat" && i + 1 < argc) {
+            tcpOptions.notSentLowatBytes = std::atoi(argv[++i]);
+        } else if (arg == "--sessions" && i + 1 < argc) {
+            sessionsFile = argv[++i];
+        } else if (arg == "--writer-threads" && i + 1 < argc) {
+            writerThreads = std::atoi(argv[++i]);
+        } else if (arg == "--sched" && i + 1 < argc) {
+            if (!ThreadPolicy::instance().setRules(argv[++i])) return -1;
+        } else if (arg == "--talkback" && i + 1 < argc) {
+            talkbackPort = std::atoi(argv[++i]);
+        } else if (arg == "--source" && i + 1 < argc) {
+            if (!PublisherSession::parseSource(argv[++i], source)) {
+                logWithTime(LEVEL_ERROR, std::string("Unknown source ") + argv[i]);
+                return -1;
+            }
+        } else if (arg == "--size" && i + 1 < argc) {
+            if (!parse_format(argv[++i], width, height, fps)) {
+                logWithTime(LEVEL_ERROR, std::string("--size takes WxH or WxH@FPS, not ") + argv[i]);
+                return -1;
+            }
+        } else if (arg == "--no-sei") {
+            captureTimeSei = false;
+        } else if (arg == "--time-overlay") {
+            timeOverlay = true;
+        } else if (arg == "--memory-budget" && i + 1 < argc) {
+            memoryBudget.enabled = true;
+            memoryBudget.sendQueueBytes = static_cast<size_t>(std::atoll(argv[++i])) << 10;
+        } else if (arg == "--shed" && i + 1 < argc) {
+            if (!MemoryBudget::parseShed(argv[++i], memoryBudget.shed)) {
+                logWithTime(LEVEL_ERROR, std::string("--shed takes raw or encoded, not ") + argv[i]);
+                return -1;
+            }
+        } else if (arg == "--hevc") {
+            videoCodec = VideoCodec::H265;
+        } else if (arg == "--record") {
+            record = true;
+        } else if (arg == "--record-dir" && i + 1 < argc) {
+            record = true;
+            recordConfig.dir = argv[++i];
+        } else if (arg == "--record-segment-sec" && i + 1 < argc) {
+            recordConfig.segmentSeconds = std::atoi(argv[++i]);
+        } else if (arg == "--record-max-mb" && i + 1 < argc) {
+            recordConfig.maxBytes = static_cast<uint64_t>(std::atoll(argv[++i])) << 20;
+        } else if (arg.compare(0, 7, "rtmp://") == 0 || arg.compare(0, 8, "rtmps://") == 0) {
+            urls.push_back(arg);
+        } else {
+            // A typo or a flag without its value must not become a destination that reconnects forever
+            std::cerr << "Unknown or incomplete argument: " << arg << "\n";
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (urls.empty()) urls.push_back(RTMP_URL);
+    ThreadPolicy::instance().enter("main");
 
-    if (!rtmp.start(720, 480, 44100, 1)) return -1;
+    if (logToFile && !Logger::instance().enableFileSink(LOG_STORAGE_LOCATION, "RtmpPublisher.log")) {
+        logWithTime(LEVEL_WARN, std::string("Cannot open log file in ") + LOG_STORAGE_LOCATION);
+    }
 
-    // Start CLI listener thread
-    std::thread cliThread(command_listener);
+    // Prometheus text on a local socket; scraping never touches the media threads
+    MetricsServer metrics;
+    metrics.listenUnix(METRICS_SOCKET_PATH);
+    if (metricsPort > 0) metrics.listenTcp(metricsPort);
+    metrics.start();
+    Metrics::Registry::instance().callback(
+        "log_messages_dropped_total", "Log messages dropped because the log ring was full", Metrics::Type::COUNTER,
+        []() { return (double)Logger::instance().dropped(); }, {}, &Logger::instance());
+    Metrics::Registry::instance().callback(
+        "process_resident_memory_bytes", "Resident set size of the process", Metrics::Type::GAUGE,
+        []() { return (double)ProcessMemory::read().rssBytes; }, {}, &metrics);
+    Metrics::Registry::instance().callback(
+        "process_resident_memory_peak_bytes", "Peak resident set size of the process", Metrics::Type::GAUGE,
+        []() { return (double)ProcessMemory::read().peakRssBytes; }, {}, &metrics);
+
+    if (!sessionsFile.empty()) {
+        // Multi-session mode: the sessions file replaces the URL arguments
+        PublisherSession::Config defaults;
+        defaults.backend = nativeRtmp ? RTMPBackend::NATIVE : RTMPBackend::FFMPEG;
+        defaults.codec = videoCodec;
+        defaults.tcp = tcpOptions;
+        defaults.memory = memoryBudget;
+        SessionHost host(writerThreads);
+        if (!host.load(sessionsFile, defaults) || !host.start()) return -1;
+        std::thread cliThread(command_listener, [&host]() { host.requestStats(); }, nullptr);
+        std::cout << "\n>>> PRESS 't' TO TOGGLE TRACE LOGS, 's' FOR STATS, 'q' TO EXIT <<<\n" << std::endl;
+        host.run(g_should_exit);
+        g_should_exit = true;
+        host.stop();
+        if (cliThread.joinable()) cliThread.join();
+        return 0;
+    }
 
-    GstManager gst(720, 480, 30, 800000);
+    GstManager gst(width, height, fps, 800000);
+    gst.setCombinedPipeline(combinedPipeline);
+    gst.setVideoCodec(videoCodec);
+    gst.setMemoryBudget(memoryBudget);
+    gst.setSource(source);
+    gst.setCaptureTimeSei(captureTimeSei);
+    gst.setTimeOverlay(timeOverlay);
+    // A video-only RTP input has no audio track for the interleaver to wait for
+    const bool audio = source.kind != SourceKind::RTP || source.audioPort > 0;
+    const bool relay = source.kind == SourceKind::RTP;
+    int sampleRate = audio ? GstManager::kAudioSampleRate : 0;
+    int channels = audio ? GstManager::kAudioChannels : 0;
+    PublisherSession::audioFormat(source, sampleRate, channels);
+
+    // Connections are opened now and handshake while the pipelines preroll;
+    // a destination waiting for an IDR gets one forced instead of waiting a GOP
+    RTMPFanout rtmp(urls, PublisherSession::queueConfig(memoryBudget));
+    rtmp.setOnKeyframeNeeded([&gst]() { gst.requestKeyframe(); });
+    if (nativeRtmp) rtmp.setBackend(RTMPBackend::NATIVE);
+    rtmp.setTcpOptions(tcpOptions);
+    rtmp.setVideoCodec(videoCodec);
+
+    if (!rtmp.start(width, height, sampleRate, channels)) return -1;
+
+    // Local recording taps the same encoded frames; no second encode
+    std::unique_ptr<SegmentRecorder> recorder;
+    if (record) {
+        recorder.reset(new SegmentRecorder(recordConfig));
+        recorder->setVideoCodec(videoCodec);
+        if (!recorder->start(sampleRate, channels)) recorder.reset();
+    }
 
-    gst.setOnVideoAnnexBFrame([&rtmp](const std::vector<uint8_t>& data) {
-        rtmp.pushVideoFrame(data);
+    // Start CLI listener thread
+    std::mutex formatMutex;
+    std::string pendingFormat;
+    std::thread cliThread(command_listener, [&rtmp, &gst, talkbackPort]() {
+        print_stats(rtmp);
+        print_memory(gst, rtmp);
+        if (talkbackPort > 0) print_talkback(gst.getTalkbackStats());
+    }, [&formatMutex, &pendingFormat](const std::string& format) {
+        // Applied by the main loop, which also owns the ABR ladders
+        std::lock_guard<std::mutex> lock(formatMutex);
+        pendingFormat = format;
     });
 
-    gst.setOnAudioAACFrame([&rtmp](const std::vector<uint8_t>& data) {
-        rtmp.pushAudioFrame(data, 1024);
+    BitrateController::Config abrConfig;
+    abrConfig.startBps = 800000;
+    abrConfig.floorBps = 250000;
+    abrConfig.ceilingBps = 1500000;
+    abrConfig.allowFpsStepDown = true;
+    abrConfig.fpsSteps = PublisherSession::fpsSteps(fps);
+    abrConfig.allowScaleStepDown = gst.canChangeVideoFormat();
+    BitrateController abr(abrConfig);
+    abr.setOnDecision([&gst, &width, &height, &fps](const BitrateController::Decision& d) {
+        logWithTime("[ABR] " + d.reason + ": " + std::to_string(d.prevBitrateBps / 1000) + " -> " +
+                    std::to_string(d.bitrateBps / 1000) + " kbps, " + std::to_string(d.prevFps) + " -> " +
+                    std::to_string(d.fps) + " fps, " + std::to_string(d.prevScale) + " -> " +
+                    std::to_string(d.scale) + " % (sent " + std::to_string((int)(d.throughputBps / 1000)) +
+                    " kbps, queue " + std::to_string(d.queueDepth) + ")");
+        PublisherSession::applyAbrDecision(gst, d, width, height, fps);
     });
 
+    SegmentRecorder* rec = recorder.get();
+    gst.setOnVideoAnnexBFrame([&rtmp, rec](const MediaFrame::Ptr& frame) {
+        rtmp.pushVideoFrame(frame);
+        if (rec) rec->pushVideoFrame(frame);
+    });
+
+    if (audio) {
+        gst.setOnAudioAACFrame([&rtmp, rec](const MediaFrame::Ptr& frame) {
+            rtmp.pushAudioFrame(frame, 1024);
+            if (rec) rec->pushAudioFrame(frame);
+        });
+    }
+
     gst.startVideo();
     gst.startAudio();
 
+    // Far-end audio back to the device's speaker
+    std::thread talkbackThread;
+    if (talkbackPort > 0 && gst.startAudioPlayer()) {
+        talkbackThread = std::thread(talkback_receiver, talkbackPort, std::ref(gst));
+    }
+
+    std::cout << "\n>>> PRESS 't' TO TOGGLE TRACE LOGS, 's' FOR STATS, 'f WxH[@FPS]' TO CHANGE FORMAT, "
+                 "'q' TO EXIT <<<\n" << std::endl;
+
     // Main loop remains simple; logic is handled by atomic flags
+    bool startupReported = false;
     while (!g_should_exit) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        RTMPWriterStats primary = rtmp.destination(0).getWriterStats();
+        if (!startupReported && primary.firstVideoNs > 0) {
+            int64_t sinceFirstMs = (PacketQueue::nowNs() - primary.firstVideoNs) / 1000000;
+            logWithTime("[STARTUP] First video on the wire " + std::to_string(process_age_ms() - sinceFirstMs) +
+                        " ms after process start (RTMP handshake " + std::to_string(primary.handshakeMs) + " ms)");
+            startupReported = true;
+        }
+        std::string format;
+        {
+            std::lock_guard<std::mutex> lock(formatMutex);
+            format.swap(pendingFormat);
+        }
+        if (!format.empty()) {
+            // The encoder restarts on the new caps; the destinations stay connected
+            int w = 0, h = 0, f = fps;
+            if (parse_format(format, w, h, f) && gst.setVideoFormat(w, h, f)) {
+                width = w;
+                height = h;
+                fps = f;
+                abr.setFpsSteps(PublisherSession::fpsSteps(fps));
+            } else {
+                logWithTime(LEVEL_WARN, "[CLI] Cannot change the video format to " + format);
+            }
+        }
+        // Bitrate follows the primary (first) destination; an outage says nothing about the link rate
+        // A relayed stream has no encoder to steer
+        if (!relay && rtmp.destination(0).isConnected()) abr.update(PublisherSession::abrSample(rtmp.destination(0)), steady_ms());
+        gst.setSendBacklog(rtmp.destination(0).getQueueStats().bytes);
+        if (rtmp.allFailed()) {
+            logWithTime(LEVEL_ERROR, "[RTMP] All destinations gave up reconnecting, exiting.");
+            print_stats(rtmp);
+            g_should_exit = true;
+        }
     }
 
+    if (talkbackThread.joinable()) talkbackThread.join();
+    gst.stopAudioPlayer();
     gst.stopVideo();
     gst.stopAudio();
     rtmp.stop();
+    if (recorder) recorder->stop();
 
     if (cliThread.joinable()) cliThread.join();
 
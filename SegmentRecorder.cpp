@@ -0,0 +1,307 @@
+#include "SegmentRecorder.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "H265Bitstream.h"
+#include "AacConfig.h"
+#include "Logger.h"
+#include "Metrics.h"
+
+static const int64_t kNsPerMs = 1000000;
+
+SegmentRecorder::SegmentRecorder(const Config& config)
+    : config_(config), videoCodec_(VideoCodec::H264), sampleRate_(0), channels_(0), hasAudio_(false),
+      isRunning_(false), writer_(config.io), width_(0), height_(0),
+      segmentOpen_(false), cut_(false), segmentBaseNs_(0), segmentBytes_(0),
+      segmentFrames_(0), diskBytes_(0),
+      segmentsStarted_(0), truncated_(0), droppedFrames_(0) {
+    if (config_.segmentSeconds <= 0) config_.segmentSeconds = 60;
+    registerMetrics();
+}
+
+SegmentRecorder::~SegmentRecorder() {
+    stop();
+    Metrics::Registry::instance().remove(this);
+}
+
+void SegmentRecorder::registerMetrics() {
+    Metrics::Registry& reg = Metrics::Registry::instance();
+    const Metrics::Type COUNTER = Metrics::Type::COUNTER;
+    const Metrics::Type GAUGE = Metrics::Type::GAUGE;
+
+    reg.callback("recorder_segments_total", "Recording segments started", COUNTER,
+                 [this]() { return (double)getStats().segments; }, {}, this);
+    reg.callback("recorder_truncated_segments_total", "Segments cut short because the disk fell behind", COUNTER,
+                 [this]() { return (double)getStats().truncatedSegments; }, {}, this);
+    reg.callback("recorder_dropped_frames_total", "Frames not recorded after a cut, until the next keyframe", COUNTER,
+                 [this]() { return (double)getStats().droppedFrames; }, {}, this);
+    reg.callback("recorder_disk_bytes", "Bytes of recordings kept in the directory", GAUGE,
+                 [this]() { return (double)getStats().diskBytes; }, {}, this);
+    reg.callback("recorder_bytes_written_total", "Bytes written to disk by the file writer", COUNTER,
+                 [this]() { return (double)writer_.stats().bytesWritten; }, {}, this);
+    reg.callback("recorder_buffers_queued", "File writer buffers waiting for the disk", GAUGE,
+                 [this]() { return (double)writer_.stats().buffersQueued; }, {}, this);
+}
+
+/** @brief mkdir -p */
+static bool make_dirs(const std::string& dir) {
+    for (size_t pos = 1; pos <= dir.size(); ++pos) {
+        if (pos != dir.size() && dir[pos] != '/') continue;
+        std::string part = dir.substr(0, pos);
+        if (mkdir(part.c_str(), 0755) < 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+bool SegmentRecorder::start(int sampleRate, int channels) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (isRunning_) return true;
+    if (config_.dir.empty() || !make_dirs(config_.dir)) {
+        logWithTime(LEVEL_ERROR, "[REC] Cannot create recording directory " + config_.dir + ": " + strerror(errno));
+        return false;
+    }
+
+    sampleRate_ = sampleRate;
+    channels_ = channels;
+    hasAudio_ = sampleRate > 0 && channels > 0;
+    flv_.reset(new FlvTagWriter(*this, videoCodec_));
+    scanExisting();
+    writer_.start();
+    enforceRetention();
+    isRunning_ = true;
+    logWithTime("[REC] Recording " + std::to_string(config_.segmentSeconds) + " s segments to " + config_.dir +
+                " (cap " + std::to_string(config_.maxBytes >> 20) + " MiB, " +
+                std::to_string(diskBytes_ >> 20) + " MiB already there)");
+    return true;
+}
+
+void SegmentRecorder::stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isRunning_) return;
+    isRunning_ = false;
+    closeSegment(false);
+    writer_.stop();
+}
+
+/**
+ * Segments left by earlier runs count against the cap; names sort by time.
+ */
+void SegmentRecorder::scanExisting() {
+    segments_.clear();
+    diskBytes_ = 0;
+    DIR* d = opendir(config_.dir.c_str());
+    if (!d) return;
+
+    std::vector<std::string> names;
+    const std::string head = config_.prefix + "_";
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() > head.size() + 4 && name.compare(0, head.size(), head) == 0 &&
+            name.compare(name.size() - 4, 4, ".flv") == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+
+    std::sort(names.begin(), names.end());
+    for (const std::string& name : names) {
+        std::string path = config_.dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0) continue;
+        segments_.emplace_back(path, (uint64_t)st.st_size);
+        diskBytes_ += st.st_size;
+    }
+}
+
+/** @brief <dir>/<prefix>_YYYYmmdd_HHMMSS_mmm.flv in local time, suffixed if already taken */
+std::string SegmentRecorder::segmentPath() const {
+    auto now = std::chrono::system_clock::now();
+    time_t t = std::chrono::system_clock::to_time_t(now);
+    int ms = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char stamp[32];
+    snprintf(stamp, sizeof(stamp), "%04d%02d%02d_%02d%02d%02d_%03d", tm.tm_year + 1900, tm.tm_mon + 1,
+             tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, ms);
+    std::string base = config_.dir + "/" + config_.prefix + "_" + stamp;
+    std::string path = base + ".flv";
+    for (int n = 1; path == segmentPath_; ++n) path = base + "_" + std::to_string(n) + ".flv";
+    return path;
+}
+
+/**
+ * Deletes whole segments, oldest first. The open segment counts but is
+ * never deleted, so the cap can be exceeded by at most one segment.
+ */
+void SegmentRecorder::enforceRetention() {
+    while (!segments_.empty() && diskBytes_ + segmentBytes_ > config_.maxBytes) {
+        writer_.remove(segments_.front().first);
+        diskBytes_ -= segments_.front().second;
+        segments_.pop_front();
+    }
+}
+
+// ---------------- Segments ----------------
+/**
+ * FLV header, onMetaData and the sequence headers from the keyframe in au_.
+ */
+bool SegmentRecorder::openSegment(int64_t baseNs) {
+    if (!FlvTagWriter::buildVideoConfig(videoCodec_, au_, videoConfig_, width_, height_)) return false;
+
+    segmentPath_ = segmentPath();
+    segmentBaseNs_ = baseNs;
+    segmentBytes_ = 0;
+    segmentFrames_ = 0;
+    segmentOpen_ = true;
+    ++segmentsStarted_;
+    writer_.open(segmentPath_);
+
+    // Signature, version 1, audio/video flags, header size; then PreviousTagSize0
+    uint8_t header[13] = {'F', 'L', 'V', 1, static_cast<uint8_t>(hasAudio_ ? 0x05 : 0x01), 0, 0, 0, 9, 0, 0, 0, 0};
+    iovec iov = {header, sizeof(header)};
+    std::vector<uint8_t> asc = audioConfig_;
+    if (hasAudio_ && asc.empty()) Aac::buildAsc(sampleRate_, channels_, asc);
+    bool ok = writeFile(&iov, 1) && flv_->writeMetadata(width_, height_, hasAudio_, sampleRate_, channels_) &&
+              flv_->writeVideoHeader(videoConfig_) && (!hasAudio_ || flv_->writeAudioHeader(asc));
+    if (!ok) closeSegment(true);
+    else cut_ = false;
+    enforceRetention();
+    return ok;
+}
+
+void SegmentRecorder::closeSegment(bool truncated) {
+    if (!segmentOpen_) return;
+    segmentOpen_ = false;
+    writer_.close();
+    if (segmentFrames_ == 0) {
+        // Headers only: nothing worth keeping
+        writer_.remove(segmentPath_);
+    } else {
+        segments_.emplace_back(segmentPath_, segmentBytes_);
+        diskBytes_ += segmentBytes_;
+        if (!truncated) {
+            logWithTime(LEVEL_DEBUG, "[REC] Segment closed: " + segmentPath_ + " (" +
+                        std::to_string(segmentBytes_) + " bytes)");
+        }
+    }
+    segmentBytes_ = 0;
+    if (truncated) {
+        ++truncated_;
+        cut_ = true;
+        logWithTime(LEVEL_WARN, "[REC] Disk is behind, segment cut short after " + std::to_string(segmentFrames_) +
+                    " frames: " + segmentPath_);
+    }
+    enforceRetention();
+}
+
+/**
+ * FLV file tag: 11-byte header (type, size, timestamp with its extension
+ * byte, stream id 0), the body, then PreviousTagSize.
+ */
+bool SegmentRecorder::writeTag(uint8_t type, uint32_t timestampMs, const iovec* parts, size_t count) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; ++i) size += parts[i].iov_len;
+
+    uint8_t header[11] = {type,
+                          static_cast<uint8_t>(size >> 16), static_cast<uint8_t>(size >> 8),
+                          static_cast<uint8_t>(size),
+                          static_cast<uint8_t>(timestampMs >> 16), static_cast<uint8_t>(timestampMs >> 8),
+                          static_cast<uint8_t>(timestampMs), static_cast<uint8_t>(timestampMs >> 24),
+                          0, 0, 0};
+    const uint32_t tagSize = static_cast<uint32_t>(sizeof(header) + size);
+    uint8_t trailer[4] = {static_cast<uint8_t>(tagSize >> 24), static_cast<uint8_t>(tagSize >> 16),
+                          static_cast<uint8_t>(tagSize >> 8), static_cast<uint8_t>(tagSize)};
+
+    iov_.clear();
+    iov_.push_back({header, sizeof(header)});
+    iov_.insert(iov_.end(), parts, parts + count);
+    iov_.push_back({trailer, sizeof(trailer)});
+    return writeFile(iov_.data(), iov_.size());
+}
+
+bool SegmentRecorder::writeFile(const iovec* parts, size_t count) {
+    if (!writer_.write(parts, count)) return false;
+    for (size_t i = 0; i < count; ++i) segmentBytes_ += parts[i].iov_len;
+    return true;
+}
+
+// ---------------- Frames ----------------
+bool SegmentRecorder::parseVideo(const MediaFrame::Ptr& frame) {
+    if (videoCodec_ == VideoCodec::H265) return H265::parseAccessUnit(frame->data(), frame->size(), au_);
+    return H264::parseAccessUnit(frame->data(), frame->size(), au_);
+}
+
+/** @brief The keyframe in au_ carries parameter sets that differ from the open segment's */
+bool SegmentRecorder::configChanged() {
+    int width = width_, height = height_;
+    return segmentOpen_ && FlvTagWriter::buildVideoConfig(videoCodec_, au_, configScratch_, width, height) &&
+           configScratch_ != videoConfig_;
+}
+
+/**
+ * A keyframe past the segment duration starts the next segment, so segment
+ * length is rounded up to the GOP. So does a keyframe with new parameter
+ * sets: every file keeps the single sequence header it starts with.
+ */
+void SegmentRecorder::pushVideoFrame(const MediaFrame::Ptr& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isRunning_ || !parseVideo(frame)) return;
+
+    int64_t ptsNs = frame->pts() >= 0 ? frame->pts() : frame->dts();
+    int64_t dtsNs = frame->dts() >= 0 ? frame->dts() : ptsNs;
+    if (dtsNs < 0) return;
+
+    if (au_.idr && (!segmentOpen_ || dtsNs - segmentBaseNs_ >= (int64_t)config_.segmentSeconds * 1000 * kNsPerMs ||
+                    configChanged())) {
+        closeSegment(false);
+        openSegment(dtsNs);
+    }
+    if (!segmentOpen_) {
+        if (cut_) ++droppedFrames_;
+        return;
+    }
+
+    int64_t dtsMs = (dtsNs - segmentBaseNs_) / kNsPerMs;
+    int32_t ctsMs = static_cast<int32_t>((std::max(ptsNs, dtsNs) - dtsNs) / kNsPerMs);
+    if (flv_->writeVideo(au_, au_.idr, dtsMs, ctsMs)) ++segmentFrames_;
+    else closeSegment(true);
+}
+
+void SegmentRecorder::pushAudioFrame(const MediaFrame::Ptr& frame) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!isRunning_ || !hasAudio_) return;
+
+    // The encoder's ASC goes into every later segment header
+    Aac::AscInfo info;
+    if (audioConfig_.empty() && frame->codecData(audioConfig_)) {
+        if (Aac::parseAsc(audioConfig_.data(), audioConfig_.size(), info)) {
+            sampleRate_ = info.sampleRate;
+            if (info.channels > 0) channels_ = info.channels;
+        } else {
+            audioConfig_.clear();
+        }
+    }
+    if (!segmentOpen_) return;
+
+    // Audio captured before the segment's keyframe belongs to the previous one
+    int64_t ptsNs = frame->pts() >= 0 ? frame->pts() : frame->dts();
+    if (ptsNs < segmentBaseNs_) return;
+    if (!flv_->writeAudio(frame->data(), frame->size(), (ptsNs - segmentBaseNs_) / kNsPerMs)) closeSegment(true);
+}
+
+SegmentRecorderStats SegmentRecorder::getStats() const {
+    SegmentRecorderStats s;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        s.segments = segmentsStarted_;
+        s.truncatedSegments = truncated_;
+        s.droppedFrames = droppedFrames_;
+        s.diskBytes = diskBytes_ + segmentBytes_;
+    }
+    s.writer = writer_.stats();
+    return s;
+}
@@ -0,0 +1,110 @@
+#include "SessionHost.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+#include "Logger.h"
+
+static int default_workers() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return static_cast<int>(std::max(2L, cpus));
+}
+
+static int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SessionHost::SessionHost(int workers) : pool_(workers > 0 ? workers : default_workers()) {}
+
+SessionHost::~SessionHost() {
+    // Sessions unregister their writers from pool_, which outlives them
+    stop();
+    sessions_.clear();
+}
+
+bool SessionHost::load(const std::string& path, const PublisherSession::Config& defaults) {
+    std::ifstream in(path);
+    if (!in) {
+        logWithTime(LEVEL_ERROR, "[HOST] Cannot open sessions file " + path);
+        return false;
+    }
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') continue;
+
+        PublisherSession::Config config = defaults;
+        std::string error;
+        if (!PublisherSession::parseLine(line, config, error)) {
+            logWithTime(LEVEL_ERROR, "[HOST] " + path + ":" + std::to_string(lineNo) + ": " + error);
+            return false;
+        }
+        for (const auto& s : sessions_) {
+            if (s->name() == config.name) {
+                logWithTime(LEVEL_ERROR, "[HOST] " + path + ":" + std::to_string(lineNo) + ": duplicate session " +
+                            config.name);
+                return false;
+            }
+        }
+        add(config);
+    }
+    return !sessions_.empty();
+}
+
+void SessionHost::add(const PublisherSession::Config& config) {
+    sessions_.emplace_back(new PublisherSession(config, &pool_));
+}
+
+bool SessionHost::start() {
+    size_t started = 0;
+    for (auto& s : sessions_) {
+        if (s->start()) {
+            ++started;
+        } else {
+            logWithTime(LEVEL_ERROR, "[HOST] Session " + s->name() + " failed to start");
+        }
+    }
+    logWithTime("[HOST] " + std::to_string(started) + "/" + std::to_string(sessions_.size()) +
+                " sessions started, " + std::to_string(pool_.threads()) + " writer threads");
+    return started > 0;
+}
+
+void SessionHost::run(const std::atomic<bool>& exit) {
+    while (!exit) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        int64_t now = steady_ms();
+        size_t running = 0;
+        for (auto& s : sessions_) {
+            s->tick(now);
+            if (s->state() == PublisherSession::State::RUNNING) ++running;
+        }
+        if (statsRequested_.exchange(false)) logStats();
+        if (running == 0) {
+            logWithTime(LEVEL_WARN, "[HOST] No session left running");
+            logStats();
+            return;
+        }
+    }
+}
+
+void SessionHost::stop() {
+    for (auto& s : sessions_) s->stop();
+}
+
+void SessionHost::logStats() {
+    for (auto& s : sessions_) {
+        PublisherSession::Stats st = s->stats();
+        logWithTime("[SESSION] " + st.name + " " + PublisherSession::stateName(st.state) +
+                    " | Dest up: " + std::to_string(st.connected) + "/" + std::to_string(st.destinations) +
+                    " | kbps out: " + std::to_string((int)(st.throughputBps / 1000)) +
+                    " | Target kbps: " + std::to_string(st.bitrateBps / 1000) +
+                    " | Video sent: " + std::to_string(st.videoPackets) +
+                    " | Queue: " + std::to_string(st.queueDepth) +
+                    " | Drops: " + std::to_string(st.drops) +
+                    " | Reconnects: " + std::to_string(st.reconnects));
+    }
+}
@@ -0,0 +1,482 @@
+#include "TalkbackPlayer.h"
+#include <gst/app/gstappsrc.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include "Logger.h"
+#include "ThreadPolicy.h"
+
+// Opus over RTP always uses a 48 kHz timestamp clock; talkback senders use 20 ms frames
+static constexpr int64_t kRtpUnitsPerMs = 48;
+static constexpr int64_t kFrameNs = 20 * 1000000LL;
+// A missing packet is given up this long before the next one that did arrive is due
+static constexpr int64_t kLeadNs = 5 * 1000000LL;
+// Longest sleep of the playout thread while it waits for packets
+static constexpr int64_t kIdleWaitNs = 20 * 1000000LL;
+static constexpr int64_t kShrinkPeriodNs = 1000000000LL;
+
+// Same as PacketQueue: sleep on CLOCK_MONOTONIC where sem_clockwait exists
+// (glibc 2.30+), so a clock step cannot stretch the playout wait.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+#define TALKBACK_CLOCKWAIT 1
+static const clockid_t kWaitClock = CLOCK_MONOTONIC;
+#else
+static const clockid_t kWaitClock = CLOCK_REALTIME;
+#endif
+
+static int64_t wall_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** @brief NTP UQ32.32 (seconds since 1900) to Unix nanoseconds; 0 if out of range */
+static int64_t ntp_to_unix_ns(uint64_t ntp) {
+    const uint64_t kNtpUnixOffset = 2208988800ULL;
+    uint64_t seconds = ntp >> 32;
+    if (seconds < kNtpUnixOffset) return 0;
+    uint64_t frac = ((ntp & 0xffffffffULL) * 1000000000ULL) >> 32;
+    return static_cast<int64_t>((seconds - kNtpUnixOffset) * 1000000000ULL + frac);
+}
+
+/**
+ * Capture time from the abs-capture-time header extension (one-byte or
+ * two-byte form, RFC 8285): the first 8 bytes are the sender's NTP time of
+ * capture. 0 if the packet does not carry it.
+ */
+static int64_t abs_capture_wall_ns(const uint8_t* p, size_t size, int extId) {
+    if (extId <= 0 || !(p[0] & 0x10)) return 0;
+    size_t pos = 12 + 4 * (p[0] & 0x0f);
+    if (pos + 4 > size) return 0;
+    const uint16_t profile = static_cast<uint16_t>(p[pos] << 8 | p[pos + 1]);
+    const size_t end = pos + 4 + 4 * static_cast<size_t>(p[pos + 2] << 8 | p[pos + 3]);
+    if (end > size) return 0;
+    const bool oneByte = profile == 0xBEDE;
+    if (!oneByte && (profile & 0xfff0) != 0x1000) return 0;
+
+    for (pos += 4; pos < end;) {
+        if (p[pos] == 0) {      // padding
+            ++pos;
+            continue;
+        }
+        int id;
+        size_t len;
+        if (oneByte) {
+            id = p[pos] >> 4;
+            len = (p[pos] & 0x0f) + 1;
+            if (id == 15) break;
+            pos += 1;
+        } else {
+            if (pos + 2 > end) break;
+            id = p[pos];
+            len = p[pos + 1];
+            pos += 2;
+        }
+        if (pos + len > end) break;
+        if (id == extId && len >= 8) {
+            uint64_t ntp = 0;
+            for (int i = 0; i < 8; ++i) ntp = ntp << 8 | p[pos + i];
+            return ntp_to_unix_ns(ntp);
+        }
+        pos += len;
+    }
+    return 0;
+}
+
+// ---------------- Lifecycle ----------------
+TalkbackPlayer::TalkbackPlayer(const Config& config, const Metrics::Labels& labels)
+    : config_(config), free_(config.poolPackets), ready_(config.poolPackets) {
+    slots_.resize(config_.poolPackets);
+    for (size_t i = 0; i < slots_.size(); ++i) slots_[i] = Slot{this, static_cast<uint32_t>(i), 0, 0};
+    sem_init(&wake_, 0, 0);
+    registerMetrics(labels);
+}
+
+TalkbackPlayer::~TalkbackPlayer() {
+    stop();
+    Metrics::Registry::instance().remove(this);
+    sem_destroy(&wake_);
+}
+
+void TalkbackPlayer::registerMetrics(const Metrics::Labels& labels) {
+    Metrics::Registry& reg = Metrics::Registry::instance();
+    auto packets = [&](const char* result, const std::atomic<uint64_t>& value) {
+        Metrics::Labels l = labels;
+        l.push_back({"result", result});
+        reg.callback("talkback_packets_total", "Talkback RTP packets by outcome", Metrics::Type::COUNTER,
+                     [&value]() { return static_cast<double>(value.load(std::memory_order_relaxed)); }, l, this);
+    };
+    packets("played", played_);
+    packets("late", late_);
+    packets("lost", lost_);
+    packets("duplicate", duplicates_);
+    packets("dropped", dropped_);
+    reg.callback("talkback_jitter_ms", "Interarrival jitter of the talkback stream (RFC 3550)", Metrics::Type::GAUGE,
+                 [this]() { return jitterUs_.load(std::memory_order_relaxed) / 1000.0; }, labels, this);
+    reg.callback("talkback_target_delay_ms", "Current jitter buffer delay", Metrics::Type::GAUGE,
+                 [this]() { return delayUs_.load(std::memory_order_relaxed) / 1000.0; }, labels, this);
+    bufferHist_ = &reg.histogram("talkback_buffer_ms", "Time from packet arrival to its playout time",
+                                 Metrics::latencyBucketsMs(), labels, this);
+    mouthToEarHist_ = &reg.histogram("talkback_mouth_to_ear_ms",
+                                     "Sender capture to local playout (needs abs-capture-time)",
+                                     Metrics::latencyBucketsMs(), labels, this);
+}
+
+bool TalkbackPlayer::start() {
+    if (running_) return true;
+
+    // The previous pipeline is gone, so every slot is back in our hands
+    if (!storage_) storage_.reset(new uint8_t[config_.poolPackets * config_.packetBytes]);
+    uint32_t index;
+    while (ready_.tryPop(index)) {}
+    while (free_.tryPop(index)) {}
+    for (uint32_t i = 0; i < slots_.size(); ++i) free_.tryPush(uint32_t(i));
+    for (Pending& p : window_) p = Pending();
+    buffered_ = 0;
+    synced_ = false;
+    haveTransit_ = false;
+    jitter_ = 0;
+    lastPlayoutEndNs_ = 0;
+    minWaitNs_ = INT64_MAX;
+    maxWaitNs_ = 0;
+    shrinkCheckNs_ = 0;
+    nextLatencyQueryNs_ = 0;
+    while (sem_trywait(&wake_) == 0) {}
+
+    // No rtpjitterbuffer: the PTS set by the playout thread already carries the delay
+    const std::string desc =
+        "appsrc name=talkback_src is-live=true format=time do-timestamp=false min-latency=0 ! "
+        "application/x-rtp,media=audio,clock-rate=48000,encoding-name=OPUS,payload=111 ! "
+        "rtpopusdepay ! opusdec plc=true ! audioconvert ! audioresample ! " + config_.sink;
+    GError* error = nullptr;
+    pipeline_ = gst_parse_launch(desc.c_str(), &error);
+    if (error) {
+        logWithTime(LEVEL_ERROR, std::string("[TALKBACK] Cannot build player: ") + error->message);
+        g_error_free(error);
+        if (pipeline_) gst_object_unref(pipeline_);
+        pipeline_ = nullptr;
+        return false;
+    }
+    appsrc_ = gst_bin_get_by_name(GST_BIN(pipeline_), "talkback_src");
+
+    // Playout times are taken on the monotonic clock, which is the system clock's
+    GstClock* clock = gst_system_clock_obtain();
+    gst_pipeline_use_clock(GST_PIPELINE(pipeline_), clock);
+    gst_object_unref(clock);
+    if (gst_element_set_state(pipeline_, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        logWithTime(LEVEL_ERROR, "[TALKBACK] Player pipeline failed to start");
+        gst_element_set_state(pipeline_, GST_STATE_NULL);
+        gst_object_unref(appsrc_);
+        gst_object_unref(pipeline_);
+        appsrc_ = nullptr;
+        pipeline_ = nullptr;
+        return false;
+    }
+    gst_element_get_state(pipeline_, nullptr, nullptr, GST_SECOND);
+    baseTime_ = gst_element_get_base_time(pipeline_);
+
+    running_.store(true, std::memory_order_release);
+    thread_ = std::thread(&TalkbackPlayer::playoutLoop, this);
+    logWithTime("[TALKBACK] Player started, delay " + std::to_string(config_.minDelayMs) + "-" +
+                std::to_string(config_.maxDelayMs) + " ms");
+    return true;
+}
+
+void TalkbackPlayer::stop() {
+    if (!running_.exchange(false)) return;
+    // A push() that saw running_ set finishes before the pool may be reset
+    while (pushing_.load() > 0) std::this_thread::yield();
+    sem_post(&wake_);
+    if (thread_.joinable()) thread_.join();
+
+    // Buffers still in the pipeline return their slots while it shuts down
+    gst_element_set_state(pipeline_, GST_STATE_NULL);
+    gst_object_unref(appsrc_);
+    gst_object_unref(pipeline_);
+    appsrc_ = nullptr;
+    pipeline_ = nullptr;
+}
+
+// ---------------- Producer ----------------
+void TalkbackPlayer::push(const uint8_t* data, size_t size) {
+    pushing_.fetch_add(1);
+    if (!running_.load()) {
+        pushing_.fetch_sub(1);
+        return;
+    }
+    received_.fetch_add(1, std::memory_order_relaxed);
+    uint32_t index;
+    if (size < 12 || size > config_.packetBytes || !free_.tryPop(index)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        pushing_.fetch_sub(1);
+        return;
+    }
+    Slot& slot = slots_[index];
+    memcpy(storage_.get() + index * config_.packetBytes, data, size);
+    slot.size = static_cast<uint32_t>(size);
+    slot.arrivalNs = Metrics::nowNs();
+    // Never full: it has room for every slot
+    ready_.tryPush(uint32_t(index));
+    sem_post(&wake_);
+    pushing_.fetch_sub(1);
+}
+
+void TalkbackPlayer::onSlotReleased(gpointer data) {
+    Slot* slot = static_cast<Slot*>(data);
+    slot->owner->free_.tryPush(uint32_t(slot->index));
+}
+
+void TalkbackPlayer::freeSlot(int32_t index) {
+    free_.tryPush(static_cast<uint32_t>(index));
+}
+
+// ---------------- Playout thread ----------------
+void TalkbackPlayer::playoutLoop() {
+    ThreadPolicy::instance().enter("talkback");
+    while (running_.load(std::memory_order_acquire)) {
+        int64_t now = Metrics::nowNs();
+        int64_t wakeNs = nextWakeNs();
+        int64_t waitNs = wakeNs > 0 ? std::min(wakeNs - now, kIdleWaitNs) : kIdleWaitNs;
+        if (waitNs > 0) {
+            timespec deadline;
+            clock_gettime(kWaitClock, &deadline);
+            deadline.tv_nsec += static_cast<long>(waitNs);
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+#ifdef TALKBACK_CLOCKWAIT
+            while (sem_clockwait(&wake_, kWaitClock, &deadline) != 0 && errno == EINTR) {}
+#else
+            while (sem_timedwait(&wake_, &deadline) != 0 && errno == EINTR) {}
+#endif
+        }
+
+        uint32_t index;
+        while (ready_.tryPop(index)) receive(index);
+        now = Metrics::nowNs();
+        release(now);
+        if (now >= nextLatencyQueryNs_) {
+            queryOutputLatency();
+            nextLatencyQueryNs_ = now + 1000000000LL;
+        }
+    }
+    for (Pending& p : window_) {
+        if (p.slot >= 0) freeSlot(p.slot);
+        p = Pending();
+    }
+    buffered_ = 0;
+    ThreadPolicy::instance().leave();
+}
+
+int TalkbackPlayer::targetDelayMs() const {
+    double jitterMs = jitter_ / kRtpUnitsPerMs;
+    int target = static_cast<int>(std::ceil(config_.jitterFactor * jitterMs));
+    return std::max(config_.minDelayMs, std::min(config_.maxDelayMs, target));
+}
+
+int64_t TalkbackPlayer::playoutNs(uint32_t timestamp) const {
+    int64_t units = static_cast<int32_t>(timestamp - baseTimestamp_);
+    return baseNs_ + units * 1000000 / kRtpUnitsPerMs + delayNs_;
+}
+
+/**
+ * Anchors the timeline to this packet: it plays delay after its arrival, or
+ * right after the audio already scheduled, whichever is later.
+ */
+void TalkbackPlayer::resync(uint16_t seq, uint32_t timestamp, int64_t arrivalNs) {
+    for (Pending& p : window_) {
+        if (p.slot >= 0) freeSlot(p.slot);
+        p = Pending();
+    }
+    buffered_ = 0;
+    nextSeq_ = seq;
+    baseTimestamp_ = timestamp;
+    delayNs_ = targetDelayMs() * 1000000LL;
+    baseNs_ = std::max(arrivalNs, lastPlayoutEndNs_ - delayNs_);
+    synced_ = true;
+    discont_ = true;
+    delayUs_.store(delayNs_ / 1000, std::memory_order_relaxed);
+}
+
+void TalkbackPlayer::receive(uint32_t index) {
+    const Slot& slot = slots_[index];
+    const uint8_t* p = storage_.get() + index * config_.packetBytes;
+    if ((p[0] >> 6) != 2) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        freeSlot(index);
+        return;
+    }
+    const bool marker = p[1] & 0x80;
+    const uint16_t seq = static_cast<uint16_t>(p[2] << 8 | p[3]);
+    const uint32_t timestamp = static_cast<uint32_t>(p[4]) << 24 | p[5] << 16 | p[6] << 8 | p[7];
+    const uint32_t ssrc = static_cast<uint32_t>(p[8]) << 24 | p[9] << 16 | p[10] << 8 | p[11];
+
+    // RFC 3550 A.8: J += (|D| - J) / 16, with D the change in transit time
+    const uint32_t transit = static_cast<uint32_t>(slot.arrivalNs * kRtpUnitsPerMs / 1000000) - timestamp;
+    if (haveTransit_ && ssrc == ssrc_) {
+        int32_t d = static_cast<int32_t>(transit - lastTransit_);
+        jitter_ += (std::abs(static_cast<double>(d)) - jitter_) / 16.0;
+        jitterUs_.store(static_cast<int64_t>(jitter_ * 1000 / kRtpUnitsPerMs), std::memory_order_relaxed);
+    }
+    lastTransit_ = transit;
+    haveTransit_ = true;
+
+    // New stream, a jump past the window, or a point where moving the playout
+    // time is inaudible: the talkspurt start, or the last audio has played out
+    const int16_t ahead = static_cast<int16_t>(seq - nextSeq_);
+    const bool idle = buffered_ == 0 && slot.arrivalNs >= lastPlayoutEndNs_;
+    if (!synced_ || ssrc != ssrc_ || ahead >= kWindow || (buffered_ == 0 && marker) || (idle && ahead >= 0)) {
+        if (synced_ && ssrc == ssrc_ && ahead > 0 && ahead < kWindow) {
+            lost_.fetch_add(ahead, std::memory_order_relaxed);
+        }
+        ssrc_ = ssrc;
+        resync(seq, timestamp, slot.arrivalNs);
+    } else if (ahead < 0) {
+        late_.fetch_add(1, std::memory_order_relaxed);
+        freeSlot(index);
+        return;
+    }
+
+    Pending& w = window_[seq % kWindow];
+    if (w.slot >= 0) {
+        duplicates_.fetch_add(1, std::memory_order_relaxed);
+        freeSlot(index);
+        return;
+    }
+    w.slot = static_cast<int32_t>(index);
+    w.timestamp = timestamp;
+    w.captureWallNs = abs_capture_wall_ns(p, slot.size, config_.absCaptureTimeExtId);
+    ++buffered_;
+}
+
+int64_t TalkbackPlayer::nextWakeNs() const {
+    if (buffered_ == 0) return 0;
+    if (window_[nextSeq_ % kWindow].slot >= 0) return 1;     // due now
+    // The head is missing: wait until the first packet behind it is nearly due
+    for (uint16_t i = 1; i < kWindow; ++i) {
+        const Pending& p = window_[static_cast<uint16_t>(nextSeq_ + i) % kWindow];
+        if (p.slot >= 0) return playoutNs(p.timestamp) - kLeadNs;
+    }
+    return 0;
+}
+
+void TalkbackPlayer::release(int64_t nowNs) {
+    while (buffered_ > 0) {
+        Pending& head = window_[nextSeq_ % kWindow];
+        if (head.slot < 0) {
+            if (nextWakeNs() > nowNs) break;
+            lost_.fetch_add(1, std::memory_order_relaxed);
+            discont_ = true;
+            ++nextSeq_;
+            continue;
+        }
+        Pending p = head;
+        head = Pending();
+        --buffered_;
+        ++nextSeq_;
+
+        int64_t at = playoutNs(p.timestamp);
+        if (at < nowNs) {
+            // Too late to play: move the playout point back by as much, right away
+            late_.fetch_add(1, std::memory_order_relaxed);
+            freeSlot(p.slot);
+            discont_ = true;
+            delayNs_ = std::min<int64_t>(config_.maxDelayMs * 1000000LL,
+                                         std::max<int64_t>(delayNs_ + (nowNs - at), targetDelayMs() * 1000000LL));
+            delayUs_.store(delayNs_ / 1000, std::memory_order_relaxed);
+            continue;
+        }
+        play(p, at, nowNs);
+    }
+
+    // Continuous speech never resyncs. Once a period, take up to a frame off
+    // the delay if it grew past the target, or off the anchor if even the
+    // fastest packet waited longer than the delay (the anchor packet itself
+    // was held up); never so much that the slowest packet would be late
+    if (shrinkCheckNs_ == 0) shrinkCheckNs_ = nowNs + kShrinkPeriodNs;
+    if (nowNs >= shrinkCheckNs_) {
+        if (minWaitNs_ != INT64_MAX) {
+            const int64_t overTarget = std::max<int64_t>(0, delayNs_ - targetDelayMs() * 1000000LL);
+            const int64_t overAnchor = std::max<int64_t>(0, maxWaitNs_ - delayNs_);
+            const int64_t cut = std::min({kFrameNs, minWaitNs_ - kFrameNs - kLeadNs,
+                                          std::max(overTarget, overAnchor)});
+            if (cut >= kLeadNs) {
+                const int64_t fromDelay = std::min(cut, overTarget);
+                delayNs_ -= fromDelay;
+                baseNs_ -= cut - fromDelay;
+                discont_ = true;
+                delayUs_.store(delayNs_ / 1000, std::memory_order_relaxed);
+            }
+        }
+        minWaitNs_ = INT64_MAX;
+        maxWaitNs_ = 0;
+        shrinkCheckNs_ = nowNs + kShrinkPeriodNs;
+    }
+}
+
+/** @brief The slot memory becomes the buffer; it returns to the pool when GStreamer frees it */
+void TalkbackPlayer::play(const Pending& p, int64_t playoutNs, int64_t nowNs) {
+    Slot& slot = slots_[p.slot];
+    // The slot may be reused as soon as the buffer is pushed
+    const int64_t waitNs = playoutNs - slot.arrivalNs;
+
+    GstBuffer* buffer = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY,
+                                                    storage_.get() + slot.index * config_.packetBytes,
+                                                    config_.packetBytes, 0, slot.size, &slot, onSlotReleased);
+    GST_BUFFER_PTS(buffer) = static_cast<GstClockTime>(playoutNs) - baseTime_;
+    if (discont_) {
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+        discont_ = false;
+    }
+    gst_app_src_push_buffer(GST_APP_SRC(appsrc_), buffer);
+    played_.fetch_add(1, std::memory_order_relaxed);
+    lastPlayoutEndNs_ = playoutNs + kFrameNs;
+    // Same mapping, anchored here, so the 32-bit timestamp difference never wraps
+    baseNs_ += static_cast<int64_t>(static_cast<int32_t>(p.timestamp - baseTimestamp_)) * 1000000 / kRtpUnitsPerMs;
+    baseTimestamp_ = p.timestamp;
+
+    minWaitNs_ = std::min(minWaitNs_, waitNs);
+    maxWaitNs_ = std::max(maxWaitNs_, waitNs);
+    int64_t bufferUs = bufferUs_.load(std::memory_order_relaxed);
+    bufferUs_.store(bufferUs == 0 ? waitNs / 1000 : bufferUs + (waitNs / 1000 - bufferUs) / 16,
+                    std::memory_order_relaxed);
+    bufferHist_->observe(waitNs / 1e6);
+
+    if (p.captureWallNs > 0) {
+        // The sink renders at PTS plus the pipeline latency
+        int64_t earWallNs = wall_ns() + (playoutNs - nowNs) + outputUs_.load(std::memory_order_relaxed) * 1000;
+        int64_t mouthToEarNs = earWallNs - p.captureWallNs;
+        mouthToEarUs_.store(mouthToEarNs / 1000, std::memory_order_relaxed);
+        mouthToEarHist_->observe(mouthToEarNs / 1e6);
+    }
+}
+
+void TalkbackPlayer::queryOutputLatency() {
+    GstQuery* query = gst_query_new_latency();
+    if (gst_element_query(pipeline_, query)) {
+        gboolean live = FALSE;
+        GstClockTime minLatency = 0, maxLatency = 0;
+        gst_query_parse_latency(query, &live, &minLatency, &maxLatency);
+        outputUs_.store(static_cast<int64_t>(minLatency / 1000), std::memory_order_relaxed);
+    }
+    gst_query_unref(query);
+}
+
+TalkbackStats TalkbackPlayer::stats() const {
+    TalkbackStats s;
+    s.received = received_.load(std::memory_order_relaxed);
+    s.played = played_.load(std::memory_order_relaxed);
+    s.late = late_.load(std::memory_order_relaxed);
+    s.lost = lost_.load(std::memory_order_relaxed);
+    s.duplicates = duplicates_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    s.jitterMs = jitterUs_.load(std::memory_order_relaxed) / 1000.0;
+    s.targetDelayMs = static_cast<int>(delayUs_.load(std::memory_order_relaxed) / 1000);
+    s.bufferMs = bufferUs_.load(std::memory_order_relaxed) / 1000.0;
+    s.outputMs = outputUs_.load(std::memory_order_relaxed) / 1000.0;
+    int64_t m2e = mouthToEarUs_.load(std::memory_order_relaxed);
+    s.mouthToEarMs = m2e < 0 ? -1 : m2e / 1000.0;
+    return s;
+}
@@ -0,0 +1,279 @@
+#include "ThreadPolicy.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Logger.h"
+#include "Metrics.h"
+
+static pid_t current_tid() {
+    return static_cast<pid_t>(syscall(SYS_gettid));
+}
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** run ns, run-queue wait ns, periods; false if the kernel has no schedstats */
+static bool read_schedstat(pid_t tid, uint64_t& runNs, uint64_t& waitNs, uint64_t& periods) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", static_cast<int>(tid));
+    FILE* f = fopen(path, "r");
+    if (!f) return false;
+    unsigned long long run = 0, wait = 0, slices = 0;
+    int n = fscanf(f, "%llu %llu %llu", &run, &wait, &slices);
+    fclose(f);
+    if (n != 3) return false;
+    runNs = run;
+    waitNs = wait;
+    periods = slices;
+    return true;
+}
+
+static const char* policy_name(int policy) {
+    switch (policy) {
+    case SCHED_FIFO: return "fifo";
+    case SCHED_RR: return "rr";
+    default: return "other";
+    }
+}
+
+ThreadPolicy& ThreadPolicy::instance() {
+    static ThreadPolicy policy;
+    return policy;
+}
+
+// ---------------- Rules ----------------
+bool ThreadPolicy::parseRule(const std::string& text, std::string& name, Rule& rule) {
+    size_t eq = text.find('=');
+    if (eq == std::string::npos || eq == 0) return false;
+    name = text.substr(0, eq);
+    std::string value = text.substr(eq + 1);
+
+    std::string cpus;
+    size_t at = value.find('@');
+    if (at != std::string::npos) {
+        cpus = value.substr(at + 1);
+        value.resize(at);
+    }
+    std::string policy = value;
+    size_t colon = value.find(':');
+    if (colon != std::string::npos) {
+        policy = value.substr(0, colon);
+        rule.priority = atoi(value.c_str() + colon + 1);
+    }
+    if (policy == "fifo") rule.policy = SCHED_FIFO;
+    else if (policy == "rr") rule.policy = SCHED_RR;
+    else if (policy == "other" || policy.empty()) rule.policy = SCHED_OTHER;
+    else return false;
+
+    // "2,3" or "4-7" or a mix
+    size_t pos = 0;
+    while (pos < cpus.size()) {
+        size_t end = cpus.find(',', pos);
+        if (end == std::string::npos) end = cpus.size();
+        std::string item = cpus.substr(pos, end - pos);
+        size_t dash = item.find('-');
+        char* tail = nullptr;
+        int first = static_cast<int>(strtol(item.c_str(), &tail, 10));
+        int last = dash == std::string::npos ? first : atoi(item.c_str() + dash + 1);
+        if (item.empty() || tail == item.c_str() || first < 0 || last < first || last >= CPU_SETSIZE) return false;
+        for (int cpu = first; cpu <= last; ++cpu) rule.cpus.push_back(cpu);
+        pos = end + 1;
+    }
+    return true;
+}
+
+bool ThreadPolicy::setRules(const std::string& spec) {
+    std::map<std::string, Rule> rules;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(';', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty()) continue;
+        std::string name;
+        Rule rule;
+        if (!parseRule(item, name, rule)) {
+            logWithTime(LEVEL_ERROR, "[SCHED] Bad rule '" + item + "' (expected name=other|fifo|rr[:prio][@cpus])");
+            return false;
+        }
+        rules[name] = rule;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    rules_ = rules;
+    for (auto& it : threads_) it.second.placement = apply(it.first, it.second.name);
+    return true;
+}
+
+/**
+ * sched_setaffinity / sched_setscheduler / setpriority all take a thread id
+ * on Linux, so rules reach threads registered before they were set.
+ */
+std::string ThreadPolicy::apply(pid_t tid, const std::string& name) {
+    auto it = rules_.find(name);
+    if (it == rules_.end()) return "";
+    const Rule& rule = it->second;
+    std::string placement;
+
+    if (!rule.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        std::string list;
+        for (int cpu : rule.cpus) {
+            CPU_SET(cpu, &set);
+            list += (list.empty() ? "" : ",") + std::to_string(cpu);
+        }
+        if (sched_setaffinity(tid, sizeof(set), &set) == 0) {
+            placement = "@" + list;
+        } else {
+            logWithTime(LEVEL_WARN, "[SCHED] " + name + ": cannot pin to CPU " + list + ": " + strerror(errno));
+        }
+    }
+
+    std::string sched = "other";
+#ifdef _POSIX_PRIORITY_SCHEDULING
+    if (rule.policy != SCHED_OTHER) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rule.priority;
+        if (sched_setscheduler(tid, rule.policy, &param) == 0) {
+            sched = std::string(policy_name(rule.policy)) + ":" + std::to_string(rule.priority);
+        } else {
+            logWithTime(LEVEL_WARN, "[SCHED] " + name + ": " + policy_name(rule.policy) + " " +
+                        std::to_string(rule.priority) + " refused (" + strerror(errno) +
+                        "; needs CAP_SYS_NICE or RLIMIT_RTPRIO), staying SCHED_OTHER");
+        }
+    }
+#else
+    if (rule.policy != SCHED_OTHER) {
+        logWithTime(LEVEL_WARN, "[SCHED] " + name + ": built without _POSIX_PRIORITY_SCHEDULING, staying SCHED_OTHER");
+    }
+#endif
+    if (rule.policy == SCHED_OTHER && rule.priority != 0) {
+        if (setpriority(PRIO_PROCESS, static_cast<id_t>(tid), rule.priority) == 0) {
+            sched += ":" + std::to_string(rule.priority);
+        } else {
+            logWithTime(LEVEL_WARN, "[SCHED] " + name + ": nice " + std::to_string(rule.priority) + " refused: " +
+                        strerror(errno));
+        }
+    }
+    return placement.empty() ? sched : sched + " " + placement;
+}
+
+// ---------------- Threads ----------------
+void ThreadPolicy::enter(const std::string& name) {
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    const pid_t tid = current_tid();
+
+    const Thread* owner = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = threads_.find(tid);
+        // A pooled GStreamer thread may start another task without a LEAVE in between
+        if (it != threads_.end()) owner = &it->second;
+    }
+    if (owner) Metrics::Registry::instance().remove(owner);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Thread& t = threads_[tid];
+        t = Thread();
+        t.name = name;
+        t.placement = apply(tid, name);
+        t.lastReportNs = now_ns();
+        read_schedstat(tid, t.lastRunNs, t.lastWaitNs, t.lastPeriods);
+        owner = &t;
+    }
+    // Outside mutex_: a scrape holds the registry lock while it runs callbacks
+    registerMetrics(owner, name, tid);
+}
+
+void ThreadPolicy::leave() {
+    const pid_t tid = current_tid();
+    const Thread* owner = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = threads_.find(tid);
+        if (it == threads_.end()) return;
+        owner = &it->second;
+    }
+    // Metrics first: the node address is their owner key until it is erased
+    Metrics::Registry::instance().remove(owner);
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.erase(tid);
+}
+
+/**
+ * The callbacks read schedstat by tid and touch nothing in ThreadPolicy.
+ */
+void ThreadPolicy::registerMetrics(const Thread* owner, const std::string& name, pid_t tid) {
+    Metrics::Registry& reg = Metrics::Registry::instance();
+    const Metrics::Labels labels = {{"thread", name}, {"tid", std::to_string(tid)}};
+    reg.callback("thread_runqueue_wait_seconds_total", "Time runnable but waiting for a CPU", Metrics::Type::COUNTER,
+                 [tid]() {
+                     uint64_t run = 0, wait = 0, periods = 0;
+                     read_schedstat(tid, run, wait, periods);
+                     return wait / 1e9;
+                 }, labels, owner);
+    reg.callback("thread_run_periods_total", "Times the thread was scheduled in", Metrics::Type::COUNTER,
+                 [tid]() {
+                     uint64_t run = 0, wait = 0, periods = 0;
+                     read_schedstat(tid, run, wait, periods);
+                     return (double)periods;
+                 }, labels, owner);
+    reg.callback("thread_cpu_seconds_total", "Time spent running", Metrics::Type::COUNTER,
+                 [tid]() {
+                     uint64_t run = 0, wait = 0, periods = 0;
+                     read_schedstat(tid, run, wait, periods);
+                     return run / 1e9;
+                 }, labels, owner);
+}
+
+// ---------------- Reporting ----------------
+std::vector<ThreadSchedStats> ThreadPolicy::report() {
+    std::vector<ThreadSchedStats> out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    const int64_t now = now_ns();
+    for (auto& it : threads_) {
+        Thread& t = it.second;
+        uint64_t run = 0, wait = 0, periods = 0;
+        if (!read_schedstat(it.first, run, wait, periods)) continue;
+
+        ThreadSchedStats s;
+        s.name = t.name;
+        s.tid = it.first;
+        s.placement = t.placement.empty() ? "default" : t.placement;
+        s.periods = periods - t.lastPeriods;
+        if (s.periods > 0) s.avgWaitUs = (wait - t.lastWaitNs) / 1000.0 / s.periods;
+        if (now > t.lastReportNs) s.cpuPercent = 100.0 * (run - t.lastRunNs) / (now - t.lastReportNs);
+        if (s.avgWaitUs > t.maxAvgWaitUs) t.maxAvgWaitUs = s.avgWaitUs;
+        s.maxAvgWaitUs = t.maxAvgWaitUs;
+
+        t.lastRunNs = run;
+        t.lastWaitNs = wait;
+        t.lastPeriods = periods;
+        t.lastReportNs = now;
+        out.push_back(s);
+    }
+    return out;
+}
+
+void ThreadPolicy::logReport() {
+    for (const ThreadSchedStats& s : report()) {
+        char line[256];
+        snprintf(line, sizeof(line), "[SCHED] %-15s tid %-6d %-16s wake-up wait avg %7.1f us (worst %7.1f) | %6llu periods | cpu %5.1f%%",
+                 s.name.c_str(), static_cast<int>(s.tid), s.placement.c_str(), s.avgWaitUs, s.maxAvgWaitUs,
+                 static_cast<unsigned long long>(s.periods), s.cpuPercent);
+        logWithTime(line);
+    }
+}
@@ -0,0 +1,110 @@
+#include "WriterPool.h"
+#include <chrono>
+#include "Logger.h"
+#include "Metrics.h"
+#include "ThreadPolicy.h"
+
+static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+WriterPool::WriterPool(int threads, const std::string& name) : name_(name) {
+    if (threads < 1) threads = 1;
+    for (int i = 0; i < threads; ++i) workers_.emplace_back(&WriterPool::workerLoop, this, i);
+
+    Metrics::Registry& reg = Metrics::Registry::instance();
+    reg.callback("writer_pool_threads", "Threads in the shared RTMP writer pool", Metrics::Type::GAUGE,
+                 [threads]() { return (double)threads; }, {{"pool", name_}}, this);
+    reg.callback("writer_pool_ready_tasks", "Writers waiting for a pool thread", Metrics::Type::GAUGE,
+                 [this]() {
+                     std::lock_guard<std::mutex> lock(mutex_);
+                     return (double)ready_.size();
+                 }, {{"pool", name_}}, this);
+}
+
+WriterPool::~WriterPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    readyCv_.notify_all();
+    for (auto& t : workers_) t.join();
+    Metrics::Registry::instance().remove(this);
+}
+
+int WriterPool::add(Task task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int id = nextId_++;
+    slots_[id].task = std::make_shared<Task>(std::move(task));
+    return id;
+}
+
+void WriterPool::remove(int id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = slots_.find(id);
+    if (it == slots_.end()) return;
+    idleCv_.wait(lock, [&it]() { return !it->second.running; });
+    // A stale id left in ready_ is skipped by the workers
+    slots_.erase(it);
+}
+
+void WriterPool::wake(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = slots_.find(id);
+    if (it == slots_.end()) return;
+    if (it->second.running) {
+        it->second.rerun = true;
+    } else {
+        enqueue(id, it->second);
+    }
+}
+
+void WriterPool::enqueue(int id, Slot& slot) {
+    if (slot.queued) return;
+    slot.queued = true;
+    ready_.push_back(id);
+    readyCv_.notify_one();
+}
+
+// ---------------- Workers ----------------
+void WriterPool::workerLoop(int index) {
+    ThreadPolicy::instance().enter(name_.substr(0, 12) + "-" + std::to_string(index));
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        int64_t now = now_ns();
+        if (now >= nextSweepNs_) {
+            // Timers (reconnect backoff) have no wake(); every idle task gets a turn
+            for (auto& it : slots_) {
+                if (!it.second.running) enqueue(it.first, it.second);
+            }
+            nextSweepNs_ = now + kSweepMs * 1000000LL;
+        }
+        if (ready_.empty()) {
+            readyCv_.wait_for(lock, std::chrono::nanoseconds(nextSweepNs_ - now));
+            continue;
+        }
+
+        int id = ready_.front();
+        ready_.pop_front();
+        auto it = slots_.find(id);
+        if (it == slots_.end()) continue;
+        Slot& slot = it->second;
+        slot.queued = false;
+        slot.running = true;
+        slot.rerun = false;
+        std::shared_ptr<Task> task = slot.task;
+
+        lock.unlock();
+        bool more = (*task)();
+        lock.lock();
+
+        // remove() waits for running to clear, so the slot is still there
+        slot.running = false;
+        if (more || slot.rerun) enqueue(id, slot);
+        idleCv_.notify_all();
+    }
+    lock.unlock();
+    ThreadPolicy::instance().leave();
+}
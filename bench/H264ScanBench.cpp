@@ -0,0 +1,182 @@
+/**
+ * H264ScanBench: Compares the legacy byte-by-byte find_nalu loop from
+ * RtmpPublisher.cpp with H264::parseAccessUnit (+ AVCC conversion) on a
+ * captured Annex B stream.
+ *
+ * Capture a stream with e.g.
+ *   gst-launch-1.0 videotestsrc num-buffers=900 ! video/x-raw,width=1920,height=1080 ! \
+ *       x264enc tune=zerolatency ! h264parse ! video/x-h264,stream-format=byte-stream ! \
+ *       filesink location=capture.h264
+ * and run ./bench_h264_x86 capture.h264 [iterations]
+ * Without a file, --synthetic generates an emulation-safe random stream.
+ */
+#include "H264Bitstream.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// Verbatim copy of the original scanner for comparison
+static const uint8_t* find_nalu(const uint8_t* start, const uint8_t* end) {
+    for (const uint8_t* p = start; p < end - 4; ++p) {
+        if (p[0] == 0x00 && p[1] == 0x00 && (p[2] == 0x01 || (p[2] == 0x00 && p[3] == 0x01))) return p;
+    }
+    return nullptr;
+}
+
+static size_t legacy_scan(const uint8_t* p, size_t size, size_t& idrCount) {
+    const uint8_t* end = p + size;
+    const uint8_t* curr = find_nalu(p, end);
+    size_t nals = 0;
+    while (curr) {
+        int offset = (curr[2] == 0x01) ? 3 : 4;
+        int type = curr[offset] & 0x1F;
+        if (type == 5) ++idrCount;
+        ++nals;
+        curr = find_nalu(curr + offset, end);
+    }
+    return nals;
+}
+
+/**
+ * Splits a stream into access units at AUD / SPS / first-slice boundaries, the
+ * way alignment=au buffers arrive from h264parse.
+ */
+static std::vector<std::pair<size_t, size_t>> split_access_units(const std::vector<uint8_t>& s) {
+    std::vector<std::pair<size_t, size_t>> aus;
+    const uint8_t* base = s.data();
+    const uint8_t* end = base + s.size();
+    size_t auStart = 0;
+    bool sawSlice = false;
+    for (const uint8_t* sc = H264::findStartCode(base, end); sc && sc + 3 < end;
+         sc = H264::findStartCode(sc + 3, end)) {
+        uint8_t type = sc[3] & 0x1F;
+        size_t pos = static_cast<size_t>(sc - base);
+        if (pos > 0 && base[pos - 1] == 0) --pos;
+        bool isSlice = (type == H264::NAL_SLICE || type == H264::NAL_IDR);
+        bool startsAu = type == H264::NAL_AUD || type == H264::NAL_SPS || type == H264::NAL_SEI ||
+                        (isSlice && (sc[4] & 0x80)); // first_mb_in_slice == 0
+        if (sawSlice && startsAu) {
+            aus.emplace_back(auStart, pos - auStart);
+            auStart = pos;
+            sawSlice = false;
+        }
+        if (isSlice) sawSlice = true;
+    }
+    if (auStart < s.size()) aus.emplace_back(auStart, s.size() - auStart);
+    return aus;
+}
+
+static void append_nal(std::vector<uint8_t>& s, uint8_t header, size_t size, std::mt19937& rng) {
+    static const uint8_t sc[] = {0, 0, 0, 1};
+    s.insert(s.end(), sc, sc + 4);
+    s.push_back(header);
+    int zeros = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t b = static_cast<uint8_t>(rng() & 0xFF);
+        // Entropy-coded data is mostly dense with occasional zero runs
+        if ((rng() & 0x3F) == 0) b = 0;
+        if (zeros >= 2 && b <= 3) {
+            s.push_back(3);
+            zeros = 0;
+        }
+        s.push_back(b);
+        zeros = (b == 0) ? zeros + 1 : 0;
+    }
+    if (s.back() == 0) s.push_back(0x80);
+}
+
+static std::vector<uint8_t> synthetic_stream(int frames) {
+    std::mt19937 rng(1234);
+    std::vector<uint8_t> s;
+    for (int i = 0; i < frames; ++i) {
+        append_nal(s, 0x09, 1, rng);
+        if (i % 30 == 0) {
+            append_nal(s, 0x67, 12, rng);
+            append_nal(s, 0x68, 4, rng);
+            append_nal(s, 0x65, 150000, rng);
+        } else {
+            append_nal(s, 0x41, 15000, rng);
+        }
+    }
+    return s;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <capture.h264|--synthetic> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> stream;
+    if (strcmp(argv[1], "--synthetic") == 0) {
+        stream = synthetic_stream(300);
+    } else {
+        std::ifstream in(argv[1], std::ios::binary);
+        if (!in) {
+            fprintf(stderr, "cannot open %s\n", argv[1]);
+            return 1;
+        }
+        stream.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    if (iterations < 1) iterations = 1;
+
+    auto aus = split_access_units(stream);
+    printf("Stream: %zu bytes, %zu access units, scanner=%s\n", stream.size(), aus.size(), H264::scannerName());
+
+    size_t legacyNals = 0, legacyIdr = 0;
+    auto t0 = Clock::now();
+    for (int it = 0; it < iterations; ++it) {
+        legacyNals = legacyIdr = 0;
+        for (auto& au : aus) legacyNals += legacy_scan(stream.data() + au.first, au.second, legacyIdr);
+    }
+    auto t1 = Clock::now();
+
+    size_t newNals = 0, newIdr = 0;
+    H264::AccessUnit* parsed = new H264::AccessUnit();
+    for (int it = 0; it < iterations; ++it) {
+        newNals = newIdr = 0;
+        for (auto& au : aus) {
+            H264::parseAccessUnit(stream.data() + au.first, au.second, *parsed);
+            newNals += parsed->count;
+            newIdr += parsed->idr ? 1 : 0;
+        }
+    }
+    auto t2 = Clock::now();
+
+    std::vector<uint8_t> avcc(stream.size() + 4 * aus.size() * 8);
+    size_t avccBytes = 0;
+    for (int it = 0; it < iterations; ++it) {
+        avccBytes = 0;
+        for (auto& au : aus) {
+            H264::parseAccessUnit(stream.data() + au.first, au.second, *parsed);
+            avccBytes += H264::writeAvcc(*parsed, avcc.data());
+        }
+    }
+    auto t3 = Clock::now();
+    delete parsed;
+
+    auto report = [&](const char* name, Clock::duration d, size_t nals) {
+        double sec = std::chrono::duration<double>(d).count();
+        double mb = static_cast<double>(stream.size()) * iterations / (1024.0 * 1024.0);
+        double perAu = sec * 1e9 / (static_cast<double>(aus.size()) * iterations);
+        printf("%-22s %9.1f MB/s  %9.0f ns/AU  nals=%zu\n", name, mb / sec, perAu, nals);
+    };
+    report("legacy find_nalu", t1 - t0, legacyNals);
+    report("H264::parseAccessUnit", t2 - t1, newNals);
+    report("parse + writeAvcc", t3 - t2, newNals);
+    printf("IDR legacy=%zu new=%zu, AVCC bytes/iteration=%zu\n", legacyIdr, newIdr, avccBytes);
+
+    double speedup = std::chrono::duration<double>(t1 - t0).count() /
+                     std::chrono::duration<double>(t2 - t1).count();
+    printf("Speedup: %.2fx\n", speedup);
+    return (legacyIdr == newIdr) ? 0 : 2;
+}
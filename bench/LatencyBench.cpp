@@ -0,0 +1,494 @@
+/**
+ * LatencyBench: Per-frame latency of the publish path against a local RTMP
+ * receiver, so every change gets a reproducible number without a network or CDN.
+ *
+ * The receiver stand-in is libavformat's RTMP server mode (listen=1) on
+ * 127.0.0.1, running in a thread of this process, so all timestamps share one
+ * CLOCK_MONOTONIC timeline. For every video frame the harness records
+ *   capture   buffer PTS at the source (vsrc, pipeline clock)
+ *   encoded   buffer leaving the encoder (venc src pad probe)
+ *   appsink   h264sink callback entered
+ *   written   packet write returned on the RTMP writer thread
+ *   received  av_read_frame returned on the receiver thread
+ * and reports p50/p99/max per stage, receive throughput and CPU time per
+ * thread. Capture is the buffer timestamp: sensor exposure and display
+ * latency are outside the measurement. The receiver also reads the capture
+ * wallclock SEI (CaptureTimeSei) of every frame, the figure any remote
+ * receiver with a synchronised clock gets without this harness.
+ *
+ *   make bench_latency
+ *   ./bench_latency_x86 [seconds] [--no-audio] [--with-rtp] [--av-pipeline] [--native] [--hevc] [--port N]
+ *                       [--sched SPEC] [--stall SEC] [--memory-budget KB] [--shed raw|encoded]
+ *                       [--time-overlay]
+ *
+ * Audio uses the regular pulsesrc pipeline; without a sound server pass
+ * --no-audio, otherwise the interleaver holds video waiting for audio.
+ * --with-rtp also subscribes (and discards) the WebRTC RTP outputs, so the
+ * CPU table of two runs shows what the unused branches cost. --av-pipeline
+ * runs video and audio in one pipeline (GstManager::setCombinedPipeline).
+ * --native publishes with the built-in FLV/RTMP muxer (RTMPBackend::NATIVE)
+ * instead of libavformat; compare the written stage and rtmp-writer CPU.
+ * --hevc encodes H.265 and publishes Enhanced RTMP (the receiver needs an
+ * FFmpeg with Enhanced FLV demuxing, 6.1 or later).
+ * --sched applies a ThreadPolicy rule spec (same syntax as RtmpPublisher)
+ * and adds the run-queue wait of every named thread to the report, so a
+ * placement can be compared against the default scheduler.
+ * --stall stops the receiver reading for SEC seconds in the middle of the
+ * measured window, as a stalled uplink would: the TCP buffers fill and the
+ * backlog stays in the process. The report then has the peak bytes per
+ * stage and the peak RSS, with or without --memory-budget (MemoryBudget;
+ * the send queue budget in KB) and with either --shed policy.
+ * --time-overlay adds the burned-in clock (x86), to see what it costs.
+ */
+#include "CaptureTimeSei.h"
+#include "GstManager.h"
+#include "RTMPStreamer.h"
+#include "PacketQueue.h"
+#include "ThreadPolicy.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// RTMPStreamer traces through this flag; normally owned by RtmpPublisher.cpp
+std::atomic<bool> g_enable_trace(false);
+
+static std::atomic<bool> g_stop_receiver(false);
+static std::atomic<int64_t> g_stall_from_ns(0);
+static std::atomic<int64_t> g_stall_to_ns(0);
+
+struct FrameStamps {
+    int64_t capture = -1;
+    int64_t encoded = -1;
+    int64_t appsink = -1;
+    int64_t written = -1;
+    int64_t received = -1;
+};
+
+/**
+ * Stamps keyed by the capture clock time (the PTS every stage reports for the
+ * same frame). The FLV DTS seen by the receiver is mapped back on write.
+ */
+class StampTable {
+public:
+    void set(int64_t key, int64_t FrameStamps::*field, int64_t ns) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FrameStamps& f = frames_[key];
+        if (f.*field < 0) f.*field = ns;
+    }
+
+    void written(int64_t key, int64_t flvDtsMs, int64_t ns) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        FrameStamps& f = frames_[key];
+        if (f.written < 0) f.written = ns;
+        flvToKey_[flvDtsMs] = key;
+    }
+
+    void received(int64_t flvDtsMs, int64_t ns) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = flvToKey_.find(flvDtsMs);
+        if (it == flvToKey_.end()) return;
+        FrameStamps& f = frames_[it->second];
+        if (f.received < 0) f.received = ns;
+    }
+
+    std::vector<FrameStamps> captured(int64_t fromNs, int64_t toNs) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<FrameStamps> out;
+        for (const auto& kv : frames_) {
+            if (kv.first >= fromNs && kv.first < toNs) {
+                out.push_back(kv.second);
+                out.back().capture = kv.first;
+            }
+        }
+        return out;
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<int64_t, FrameStamps> frames_;
+    std::unordered_map<int64_t, int64_t> flvToKey_;
+};
+
+struct Receipt {
+    int64_t ns;
+    int size;
+    int64_t seiLatencyUs;   // receipt wallclock - capture wallclock from the SEI, -1 without
+};
+
+static int receiver_interrupt(void* /*opaque*/) {
+    return g_stop_receiver ? 1 : 0;
+}
+
+// ---------------- Receiver stand-in ----------------
+static void receiver_loop(std::string url, bool hevc, StampTable& table, std::vector<Receipt>& receipts,
+                          std::atomic<bool>& listening) {
+    pthread_setname_np(pthread_self(), "bench-recv");
+
+    AVFormatContext* in = avformat_alloc_context();
+    in->interrupt_callback.callback = receiver_interrupt;
+
+    // Return packets as soon as they are demuxed; nothing to probe in FLV
+    AVDictionary* opts = nullptr;
+    av_dict_set(&opts, "listen", "1", 0);
+    av_dict_set(&opts, "fflags", "nobuffer", 0);
+    av_dict_set(&opts, "probesize", "32", 0);
+    av_dict_set(&opts, "analyzeduration", "0", 0);
+    listening = true;
+    int ret = avformat_open_input(&in, url.c_str(), nullptr, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        if (!g_stop_receiver) fprintf(stderr, "receiver: cannot listen on %s (%d)\n", url.c_str(), ret);
+        return;
+    }
+
+    AVPacket* pkt = av_packet_alloc();
+    while (!g_stop_receiver && av_read_frame(in, pkt) >= 0) {
+        int64_t now = PacketQueue::nowNs();
+        // FLV streams use a 1 ms time base, the same units the writer reports
+        int64_t seiLatencyUs = -1;
+        if (in->streams[pkt->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+            table.received(pkt->dts, now);
+            // FLV carries the NAL units with 4-byte length prefixes
+            int64_t captureUs = 0;
+            if (CaptureTimeSei::extract(hevc, pkt->data, pkt->size, 4, captureUs)) {
+                seiLatencyUs = CaptureTimeSei::wallclockUs() - captureUs;
+            }
+        }
+        receipts.push_back({now, pkt->size, seiLatencyUs});
+        av_packet_unref(pkt);
+        while (!g_stop_receiver && now >= g_stall_from_ns && PacketQueue::nowNs() < g_stall_to_ns) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&in);
+}
+
+// ---------------- CPU accounting ----------------
+struct ThreadCpu {
+    std::string name;
+    int64_t ticks = 0;
+};
+
+/** @brief utime + stime of every thread of this process, by tid */
+static std::map<int, ThreadCpu> sample_threads() {
+    std::map<int, ThreadCpu> out;
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) return out;
+    while (dirent* e = readdir(dir)) {
+        int tid = atoi(e->d_name);
+        if (tid <= 0) continue;
+        std::ifstream f(std::string("/proc/self/task/") + e->d_name + "/stat");
+        std::string line;
+        if (!std::getline(f, line)) continue;
+
+        // comm may contain spaces; the fields after it are fixed
+        size_t open = line.find('('), close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos) continue;
+        std::istringstream rest(line.substr(close + 2));
+        std::string skip;
+        for (int i = 3; i <= 13; ++i) rest >> skip;
+        int64_t utime = 0, stime = 0;
+        rest >> utime >> stime;
+        out[tid] = {line.substr(open + 1, close - open - 1), utime + stime};
+    }
+    closedir(dir);
+    return out;
+}
+
+static void print_cpu(const std::map<int, ThreadCpu>& before, const std::map<int, ThreadCpu>& after,
+                      double seconds) {
+    const double msPerTick = 1000.0 / sysconf(_SC_CLK_TCK);
+    std::map<std::string, int64_t> byName;
+    int64_t total = 0;
+    for (const auto& kv : after) {
+        auto it = before.find(kv.first);
+        int64_t ticks = kv.second.ticks - (it != before.end() ? it->second.ticks : 0);
+        byName[kv.second.name] += ticks;
+        total += ticks;
+    }
+
+    std::vector<std::pair<std::string, int64_t>> sorted(byName.begin(), byName.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<std::string, int64_t>& a, const std::pair<std::string, int64_t>& b) {
+                  return a.second > b.second;
+              });
+
+    printf("\nCPU per thread (%% of one core)\n");
+    for (const auto& t : sorted) {
+        if (t.second == 0) continue;
+        printf("  %-20s %8.0f ms %6.1f%%\n", t.first.c_str(), t.second * msPerTick,
+               t.second * msPerTick / (seconds * 10.0));
+    }
+    printf("  %-20s %8.0f ms %6.1f%%\n", "total", total * msPerTick, total * msPerTick / (seconds * 10.0));
+}
+
+static void print_sched(const std::vector<ThreadSchedStats>& threads) {
+    if (threads.empty()) return;
+    printf("\nScheduling (run-queue wait per wake-up)\n");
+    for (const ThreadSchedStats& t : threads) {
+        printf("  %-15s %-16s %8.1f us %8llu periods %6.1f%%\n", t.name.c_str(), t.placement.c_str(), t.avgWaitUs,
+               (unsigned long long)t.periods, t.cpuPercent);
+    }
+}
+
+// ---------------- Report ----------------
+static void print_stage(const char* name, std::vector<int64_t> ns) {
+    if (ns.empty()) {
+        printf("  %-24s %8s %8s %8s %6s\n", name, "-", "-", "-", "0");
+        return;
+    }
+    std::sort(ns.begin(), ns.end());
+    auto pct = [&ns](double p) {
+        size_t i = std::min(ns.size() - 1, static_cast<size_t>(p * ns.size()));
+        return ns[i] / 1e6;
+    };
+    printf("  %-24s %8.2f %8.2f %8.2f %6zu\n", name, pct(0.50), pct(0.99), ns.back() / 1e6, ns.size());
+}
+
+static void print_latency(const std::vector<FrameStamps>& frames, const std::vector<Receipt>& receipts,
+                          int64_t fromNs, int64_t toNs) {
+    std::vector<int64_t> encode, handoff, send, network, total;
+    size_t complete = 0;
+    for (const auto& f : frames) {
+        if (f.encoded >= 0) encode.push_back(f.encoded - f.capture);
+        if (f.encoded >= 0 && f.appsink >= 0) handoff.push_back(f.appsink - f.encoded);
+        if (f.appsink >= 0 && f.written >= 0) send.push_back(f.written - f.appsink);
+        if (f.written >= 0 && f.received >= 0) network.push_back(f.received - f.written);
+        if (f.received >= 0) {
+            total.push_back(f.received - f.capture);
+            ++complete;
+        }
+    }
+
+    printf("\nLatency per stage (ms)\n");
+    printf("  %-24s %8s %8s %8s %6s\n", "stage", "p50", "p99", "max", "n");
+    print_stage("capture -> encoder out", encode);
+    print_stage("encoder out -> appsink", handoff);
+    print_stage("appsink -> mux write", send);
+    print_stage("mux write -> receipt", network);
+    print_stage("capture -> receipt", total);
+    std::vector<int64_t> sei;
+    for (const auto& r : receipts) {
+        if (r.ns >= fromNs && r.ns < toNs && r.seiLatencyUs >= 0) sei.push_back(r.seiLatencyUs * 1000);
+    }
+    print_stage("capture -> receipt (SEI)", sei);
+    printf("  frames captured %zu, received %zu\n", frames.size(), complete);
+}
+
+static void print_throughput(const std::vector<Receipt>& receipts, int64_t fromNs, int64_t toNs) {
+    uint64_t bytes = 0, packets = 0;
+    for (const auto& r : receipts) {
+        if (r.ns < fromNs || r.ns >= toNs) continue;
+        bytes += r.size;
+        ++packets;
+    }
+    double seconds = (toNs - fromNs) / 1e9;
+    printf("\nThroughput at receiver: %.1f packets/s, %.0f kbps\n", packets / seconds, bytes * 8 / seconds / 1000);
+}
+
+// ---------------- Memory ----------------
+struct MemoryPeaks {
+    size_t rssStartBytes = 0;
+    size_t rawQueueBytes = 0;
+    size_t encodedQueueBytes = 0;
+    size_t gopCacheBytes = 0;
+};
+
+static void sample_memory(GstManager& gst, const RTMPStreamer& rtmp, MemoryPeaks& peaks) {
+    GstMemoryStats g = gst.getMemoryStats();
+    peaks.rawQueueBytes = std::max(peaks.rawQueueBytes, g.rawQueueBytes);
+    peaks.encodedQueueBytes = std::max(peaks.encodedQueueBytes, g.encodedQueueBytes);
+    peaks.gopCacheBytes = std::max(peaks.gopCacheBytes, rtmp.getWriterStats().gopCacheBytes);
+}
+
+static void print_memory(const MemoryPeaks& peaks, const PacketQueueStats& q, const GstMemoryStats& g,
+                         const MemoryBudget& budget) {
+    ProcessMemory m = ProcessMemory::read();
+    printf("\nMemory (%s%s)\n", budget.enabled ? "budget, shed " : "unbounded",
+           budget.enabled ? MemoryBudget::shedName(budget.shed) : "");
+    printf("  %-24s %10.1f KB\n", "raw queues peak", peaks.rawQueueBytes / 1024.0);
+    printf("  %-24s %10.1f KB\n", "encoded queues peak", peaks.encodedQueueBytes / 1024.0);
+    printf("  %-24s %10.1f KB", "send queue peak", q.peakBytes / 1024.0);
+    if (q.byteBudget > 0) printf(" (budget %zu KB)", q.byteBudget >> 10);
+    printf("\n  %-24s %10.1f KB\n", "GOP cache peak", peaks.gopCacheBytes / 1024.0);
+    printf("  %-24s %10.1f MB at start, %.1f MB peak\n", "RSS", peaks.rssStartBytes / 1048576.0,
+           m.peakRssBytes / 1048576.0);
+    printf("  raw frames held %llu, send queue drops nonref/video/audio %llu/%llu/%llu\n",
+           (unsigned long long)g.rawFramesHeld, (unsigned long long)q.droppedDisposable,
+           (unsigned long long)q.droppedVideo, (unsigned long long)q.droppedAudio);
+}
+
+int main(int argc, char* argv[]) {
+    int seconds = 20;
+    int port = 19350;
+    bool audio = true;
+    bool withRtp = false;
+    bool combined = false;
+    bool native = false;
+    VideoCodec codec = VideoCodec::H264;
+    int stallSeconds = 0;
+    bool timeOverlay = false;
+    MemoryBudget budget;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--no-audio")) {
+            audio = false;
+        } else if (!strcmp(argv[i], "--with-rtp")) {
+            withRtp = true;
+        } else if (!strcmp(argv[i], "--av-pipeline")) {
+            combined = true;
+        } else if (!strcmp(argv[i], "--native")) {
+            native = true;
+        } else if (!strcmp(argv[i], "--hevc")) {
+            codec = VideoCodec::H265;
+        } else if (!strcmp(argv[i], "--sched") && i + 1 < argc) {
+            if (!ThreadPolicy::instance().setRules(argv[++i])) return -1;
+        } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--time-overlay")) {
+            timeOverlay = true;
+        } else if (!strcmp(argv[i], "--stall") && i + 1 < argc) {
+            stallSeconds = std::max(0, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--memory-budget") && i + 1 < argc) {
+            budget.enabled = true;
+            budget.sendQueueBytes = static_cast<size_t>(atoll(argv[++i])) << 10;
+        } else if (!strcmp(argv[i], "--shed") && i + 1 < argc) {
+            if (!MemoryBudget::parseShed(argv[++i], budget.shed)) {
+                fprintf(stderr, "--shed takes raw or encoded\n");
+                return 1;
+            }
+        } else {
+            seconds = std::max(1, atoi(argv[i]));
+        }
+    }
+    const int warmupSeconds = 3;
+    const std::string url = "rtmp://127.0.0.1:" + std::to_string(port) + "/live/bench";
+
+    avformat_network_init();
+
+    StampTable table;
+    std::vector<Receipt> receipts;
+    std::atomic<bool> listening(false);
+    std::thread receiver(receiver_loop, url, codec == VideoCodec::H265, std::ref(table), std::ref(receipts), std::ref(listening));
+    while (!listening) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    GstManager gst(720, 480, 30, 800000);
+    gst.setCombinedPipeline(combined);
+    gst.setVideoCodec(codec);
+    gst.setMemoryBudget(budget);
+    gst.setTimeOverlay(timeOverlay);
+
+    // Same settings as RtmpPublisher, one destination
+    PacketQueue::Config queueConfig;
+    if (budget.enabled) queueConfig.maxBytes = budget.sendQueueBytes;
+    RTMPStreamer rtmp(url, queueConfig);
+    rtmp.setOnPacketWritten([&table](const SendPacket& pkt, int64_t flvDtsMs) {
+        if (pkt.isVideo) table.written(pkt.frame->pts(), flvDtsMs, PacketQueue::nowNs());
+    });
+    rtmp.setOnKeyframeNeeded([&gst]() { gst.requestKeyframe(); });
+    if (native) rtmp.setBackend(RTMPBackend::NATIVE);
+    rtmp.setVideoCodec(codec);
+    int64_t startNs = PacketQueue::nowNs();
+    if (!rtmp.start(720, 480, audio ? GstManager::kAudioSampleRate : 0, audio ? GstManager::kAudioChannels : 0)) {
+        // The receiver is still waiting in accept; its interrupt callback ends that
+        g_stop_receiver = true;
+        receiver.join();
+        return -1;
+    }
+    gst.setOnVideoAnnexBFrame([&table, &rtmp](const MediaFrame::Ptr& frame) {
+        table.set(frame->pts(), &FrameStamps::appsink, PacketQueue::nowNs());
+        rtmp.pushVideoFrame(frame);
+    });
+    gst.setOnAudioAACFrame([&rtmp](const MediaFrame::Ptr& frame) {
+        rtmp.pushAudioFrame(frame, 1024);
+    });
+    if (withRtp) {
+        gst.setOnVideoRTPFrame([](const MediaFrame::Ptr&) {});
+        gst.setOnAudioRTPFrame([](const MediaFrame::Ptr&) {});
+    }
+
+    gst.startVideo();
+    if (audio) gst.startAudio();
+
+    bool probed = gst.addVideoProbe("vsrc", "src", [&table](GstBuffer*, int64_t pts) {
+        if (pts >= 0) table.set(pts, &FrameStamps::capture, pts);
+    });
+    probed = gst.addVideoProbe("venc", "src", [&table](GstBuffer*, int64_t pts) {
+        if (pts >= 0) table.set(pts, &FrameStamps::encoded, PacketQueue::nowNs());
+    }) && probed;
+    if (!probed) fprintf(stderr, "warning: pipeline probes not installed, encoder stages missing\n");
+
+    printf("Publishing to %s for %d s (+%d s warm-up)%s\n", url.c_str(), seconds, warmupSeconds,
+           audio ? "" : ", video only");
+    std::this_thread::sleep_for(std::chrono::seconds(warmupSeconds));
+    auto cpuBefore = sample_threads();
+    ThreadPolicy::instance().report();
+    MemoryPeaks peaks;
+    peaks.rssStartBytes = ProcessMemory::read().rssBytes;
+    int64_t fromNs = PacketQueue::nowNs();
+    if (stallSeconds > 0) {
+        g_stall_from_ns = fromNs + (seconds - stallSeconds) * 500000000LL;
+        g_stall_to_ns = g_stall_from_ns + stallSeconds * 1000000000LL;
+        printf("Receiver stalls for %d s, %.1f s into the measurement\n", stallSeconds,
+               (g_stall_from_ns - fromNs) / 1e9);
+    }
+    // What the publisher's main loop does, plus the memory samples
+    const int64_t endNs = fromNs + seconds * 1000000000LL;
+    while (PacketQueue::nowNs() < endNs) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        gst.setSendBacklog(rtmp.getQueueStats().bytes);
+        sample_memory(gst, rtmp, peaks);
+    }
+    int64_t toNs = PacketQueue::nowNs();
+    auto cpuAfter = sample_threads();
+    auto sched = ThreadPolicy::instance().report();
+
+    // Frames still in flight at the end are given a moment to arrive
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    GstMemoryStats gstMemory = gst.getMemoryStats();
+    gst.stopVideo();
+    gst.stopAudio();
+    rtmp.stop();
+    g_stop_receiver = true;
+    receiver.join();
+
+    print_latency(table.captured(fromNs, toNs), receipts, fromNs, toNs);
+    print_throughput(receipts, fromNs, toNs);
+    print_cpu(cpuBefore, cpuAfter, (toNs - fromNs) / 1e9);
+    print_sched(sched);
+
+    RTMPWriterStats w = rtmp.getWriterStats();
+    PacketQueueStats q = rtmp.getQueueStats();
+    if (w.firstVideoNs > 0) {
+        printf("\nStartup: RTMP handshake %lld ms, first video written %lld ms after start\n",
+               (long long)w.handshakeMs, (long long)((w.firstVideoNs - startNs) / 1000000));
+    }
+    printf("\nSender: %llu video / %llu audio packets, queue max %zu, drops %llu, reconnects %llu\n",
+           (unsigned long long)w.videoPackets, (unsigned long long)w.audioPackets, q.maxDepth,
+           (unsigned long long)(q.droppedDisposable + q.droppedVideo + q.droppedLate + q.droppedAudio),
+           (unsigned long long)w.reconnects);
+    print_memory(peaks, q, gstMemory, budget);
+    if (audio && w.audioPackets == 0) {
+        printf("warning: no audio reached the muxer; video waited in the interleaver. Rerun with --no-audio\n");
+    }
+    return 0;
+}
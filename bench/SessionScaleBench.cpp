@@ -0,0 +1,319 @@
+/**
+ * SessionScaleBench: Streams per core of the multi-session mode (SessionHost:
+ * one process, shared writer pool and event loop) against the baseline of one
+ * publisher process per stream.
+ *
+ *   make bench_sessions
+ *   ./bench_sessions_x86 [--streams 1,2,4,8] [--seconds 20] [--size 640x360] [--fps 30] [--kbps 800]
+ *                        [--writer-threads N] [--native] [--no-audio] [--port N] [--relay]
+ *
+ * Every stream encodes its own test source (videotestsrc + audiotestsrc, so
+ * no camera or sound server is needed) and publishes to a local libavformat
+ * RTMP receiver. The receivers run in a process of their own, so only the
+ * publishers are measured: CPU time (user + sys) and peak RSS come from
+ * wait4() on the publisher process(es), the delivered frame rate from the
+ * receiver. Streams per core is one core divided by the CPU per stream; it
+ * only means something while every stream is still delivered at the target
+ * rate (the "min fps" column).
+ *
+ * --relay feeds every session H.264 + AAC over RTP on loopback instead
+ * (MediaSource RTP: depayload and parse, no encoder). The test sources are
+ * encoded by a sender process of their own, which is not measured, so two
+ * runs with and without --relay compare relaying against encoding.
+ */
+#include "PublisherSession.h"
+#include "SessionHost.h"
+#include "PacketQueue.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <signal.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// RTMPStreamer traces through this flag; normally owned by RtmpPublisher.cpp
+std::atomic<bool> g_enable_trace(false);
+
+struct BenchConfig {
+    std::vector<int> streams = {1, 2, 4, 8};
+    int seconds = 20;
+    int warmupSeconds = 3;
+    int port = 19400;
+    int writerThreads = 0;
+    bool relay = false;
+    int rtpPort = 20000;        // stream i: video rtpPort + 2i, audio rtpPort + 2i + 1
+    PublisherSession::Config session;
+};
+
+static std::string stream_url(const BenchConfig& bench, int i) {
+    return "rtmp://127.0.0.1:" + std::to_string(bench.port + i) + "/live/s" + std::to_string(i);
+}
+
+static PublisherSession::Config session_config(const BenchConfig& bench, int i) {
+    PublisherSession::Config config = bench.session;
+    config.name = "s" + std::to_string(i);
+    config.urls = {stream_url(bench, i)};
+    if (bench.relay) {
+        config.source.kind = SourceKind::RTP;
+        config.source.port = bench.rtpPort + 2 * i;
+        config.source.audioPort = config.audio ? bench.rtpPort + 2 * i + 1 : 0;
+    }
+    return config;
+}
+
+// ---------------- Receiver process ----------------
+static int64_t g_receiver_deadline_ns = 0;
+
+static int receiver_interrupt(void* /*opaque*/) {
+    return PacketQueue::nowNs() > g_receiver_deadline_ns ? 1 : 0;
+}
+
+/** @brief Video packets whose FLV DTS falls in the measured window */
+static void receive_stream(const std::string& url, int64_t fromMs, int64_t toMs, int& frames) {
+    AVFormatContext* in = avformat_alloc_context();
+    in->interrupt_callback.callback = receiver_interrupt;
+    AVDictionary* opts = nullptr;
+    av_dict_set(&opts, "listen", "1", 0);
+    av_dict_set(&opts, "fflags", "nobuffer", 0);
+    av_dict_set(&opts, "probesize", "32", 0);
+    av_dict_set(&opts, "analyzeduration", "0", 0);
+    int ret = avformat_open_input(&in, url.c_str(), nullptr, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) return;
+
+    AVPacket* pkt = av_packet_alloc();
+    while (av_read_frame(in, pkt) >= 0) {
+        if (in->streams[pkt->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+            pkt->dts >= fromMs && pkt->dts < toMs) {
+            ++frames;
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    avformat_close_input(&in);
+}
+
+/** @brief Forks the receivers; the frame counts arrive on the returned pipe when they are done */
+static pid_t fork_receiver(const BenchConfig& bench, int streams, int& readFd) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    pid_t pid = fork();
+    if (pid != 0) {
+        close(fds[1]);
+        readFd = fds[0];
+        return pid;
+    }
+
+    close(fds[0]);
+    avformat_network_init();
+    g_receiver_deadline_ns = PacketQueue::nowNs() + (bench.warmupSeconds + bench.seconds + 15) * 1000000000LL;
+    std::vector<int> frames(streams, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < streams; ++i) {
+        threads.emplace_back(receive_stream, stream_url(bench, i), bench.warmupSeconds * 1000LL,
+                             (bench.warmupSeconds + bench.seconds) * 1000LL, std::ref(frames[i]));
+    }
+    for (auto& t : threads) t.join();
+    std::string out;
+    for (int n : frames) out += std::to_string(n) + " ";
+    if (write(fds[1], out.data(), out.size()) < 0) _exit(1);
+    _exit(0);
+}
+
+// ---------------- RTP sender process ----------------
+/** @brief What a camera would send: every stream's test source encoded once, as RTP to the relay ports */
+static pid_t fork_sender(const BenchConfig& bench, int streams) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    gst_init(nullptr, nullptr);
+    const PublisherSession::Config& c = bench.session;
+    const bool hevc = c.codec == VideoCodec::H265;
+    std::string desc;
+    for (int i = 0; i < streams; ++i) {
+        const std::string port = std::to_string(bench.rtpPort + 2 * i);
+        desc += "videotestsrc is-live=true pattern=ball ! video/x-raw,width=" + std::to_string(c.width) +
+                ",height=" + std::to_string(c.height) + ",framerate=" + std::to_string(c.fps) + "/1 ! " +
+                (hevc ? "x265enc" : "x264enc") + " tune=zerolatency speed-preset=ultrafast key-int-max=" +
+                std::to_string(c.fps) + " bitrate=" + std::to_string(c.bitrateBps / 1000) + " ! " +
+                (hevc ? "rtph265pay" : "rtph264pay") + " config-interval=1 pt=96 ! "
+                "udpsink host=127.0.0.1 port=" + port + " sync=false async=false ";
+        if (c.audio) {
+            desc += "audiotestsrc is-live=true wave=sine volume=0.1 ! audio/x-raw,rate=" +
+                    std::to_string(c.source.audioRate) + ",channels=" + std::to_string(c.source.audioChannels) +
+                    " ! audioconvert ! avenc_aac ! rtpmp4gpay pt=97 ! udpsink host=127.0.0.1 port=" +
+                    std::to_string(bench.rtpPort + 2 * i + 1) + " sync=false async=false ";
+        }
+    }
+    GError* error = nullptr;
+    GstElement* pipeline = gst_parse_launch(desc.c_str(), &error);
+    if (!pipeline || error) {
+        fprintf(stderr, "sender: %s\n", error ? error->message : "cannot build pipeline");
+        _exit(1);
+    }
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    for (;;) pause();       // until the bench kills it
+}
+
+// ---------------- Publisher processes ----------------
+/** @brief Runs the sessions for warm-up + measured time in a child process */
+static pid_t fork_publisher(const BenchConfig& bench, int first, int count, bool shared) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    std::atomic<bool> exit(false);
+    std::thread timer([&bench, &exit]() {
+        std::this_thread::sleep_for(std::chrono::seconds(bench.warmupSeconds + bench.seconds + 1));
+        exit = true;
+    });
+    if (shared) {
+        SessionHost host(bench.writerThreads);
+        for (int i = first; i < first + count; ++i) host.add(session_config(bench, i));
+        if (host.start()) host.run(exit);
+        host.stop();
+    } else {
+        // What RtmpPublisher does for one stream: own writer thread, own process
+        PublisherSession session(session_config(bench, first));
+        if (session.start()) {
+            while (!exit) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        session.stop();
+    }
+    timer.join();
+    _exit(0);
+}
+
+struct RunResult {
+    double cpuSeconds = 0;
+    double wallSeconds = 0;
+    long maxRssKb = 0;          // summed over the publisher processes
+    std::vector<int> frames;
+};
+
+static RunResult run(const BenchConfig& bench, int streams, bool shared) {
+    RunResult r;
+    int countsFd = -1;
+    pid_t receiver = fork_receiver(bench, streams, countsFd);
+    if (receiver < 0) return r;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    pid_t sender = bench.relay ? fork_sender(bench, streams) : -1;
+
+    int64_t begin = PacketQueue::nowNs();
+    std::vector<pid_t> publishers;
+    if (shared) {
+        publishers.push_back(fork_publisher(bench, 0, streams, true));
+    } else {
+        for (int i = 0; i < streams; ++i) publishers.push_back(fork_publisher(bench, i, 1, false));
+    }
+    for (pid_t pid : publishers) {
+        int status = 0;
+        rusage usage;
+        if (wait4(pid, &status, 0, &usage) != pid) continue;
+        r.cpuSeconds += usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                        usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+        r.maxRssKb += usage.ru_maxrss;
+    }
+    r.wallSeconds = (PacketQueue::nowNs() - begin) / 1e9;
+    if (sender > 0) {
+        kill(sender, SIGTERM);
+        waitpid(sender, nullptr, 0);
+    }
+
+    std::string counts;
+    char buf[256];
+    ssize_t n;
+    while ((n = read(countsFd, buf, sizeof(buf))) > 0) counts.append(buf, n);
+    close(countsFd);
+    waitpid(receiver, nullptr, 0);
+    for (const char* p = counts.c_str(); *p;) {
+        char* end = nullptr;
+        long v = strtol(p, &end, 10);
+        if (end == p) break;
+        r.frames.push_back(static_cast<int>(v));
+        p = end;
+    }
+    return r;
+}
+
+static void print_row(const BenchConfig& bench, int streams, const char* mode, const RunResult& r) {
+    double cpuPercent = r.wallSeconds > 0 ? 100.0 * r.cpuSeconds / r.wallSeconds : 0;
+    double perStream = cpuPercent / streams;
+    int minFrames = r.frames.empty() ? 0 : *std::min_element(r.frames.begin(), r.frames.end());
+    double minFps = minFrames / static_cast<double>(bench.seconds);
+    printf("  %7d  %-12s %8.1f %10.1f %10.2f %9.1f %9.1f%s\n", streams, mode, cpuPercent, perStream,
+           perStream > 0 ? 100.0 / perStream : 0.0, r.maxRssKb / 1024.0, minFps,
+           (int)r.frames.size() < streams || minFps < 0.95 * bench.session.fps ? "  (below target)" : "");
+}
+
+static std::vector<int> parse_list(const char* text) {
+    std::vector<int> out;
+    for (const char* p = text; *p;) {
+        int v = atoi(p);
+        if (v > 0) out.push_back(v);
+        const char* comma = strchr(p, ',');
+        if (!comma) break;
+        p = comma + 1;
+    }
+    return out;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig bench;
+    bench.session.source.kind = SourceKind::TEST;
+    bench.session.width = 640;
+    bench.session.height = 360;
+    bench.session.bitrateBps = 800000;
+    bench.session.abr = false;      // a fixed bitrate keeps the runs comparable
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--streams") && i + 1 < argc) {
+            bench.streams = parse_list(argv[++i]);
+        } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+            bench.seconds = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            sscanf(argv[++i], "%dx%d", &bench.session.width, &bench.session.height);
+        } else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            bench.session.fps = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--kbps") && i + 1 < argc) {
+            bench.session.bitrateBps = std::max(1, atoi(argv[++i])) * 1000;
+        } else if (!strcmp(argv[i], "--writer-threads") && i + 1 < argc) {
+            bench.writerThreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--native")) {
+            bench.session.backend = RTMPBackend::NATIVE;
+        } else if (!strcmp(argv[i], "--no-audio")) {
+            bench.session.audio = false;
+        } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+            bench.port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--relay")) {
+            bench.relay = true;
+        } else {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    // Nothing in this process may start threads before the forks
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%s %dx%d@%d, %d kbps%s, %d s measured (+%d s warm-up), %ld CPUs\n",
+           bench.relay ? "RTP relay of a test source" : "Test source", bench.session.width, bench.session.height, bench.session.fps, bench.session.bitrateBps / 1000,
+           bench.session.audio ? " + AAC" : "", bench.seconds, bench.warmupSeconds, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("\n  %7s  %-12s %8s %10s %10s %9s %9s\n", "streams", "mode", "CPU %", "per stream", "per core",
+           "RSS MB", "min fps");
+    for (int streams : bench.streams) {
+        print_row(bench, streams, "per-process", run(bench, streams, false));
+        print_row(bench, streams, "shared", run(bench, streams, true));
+    }
+    return 0;
+}
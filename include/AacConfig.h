@@ -0,0 +1,25 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Aac: AudioSpecificConfig (ISO 14496-3 1.6.2.1) helpers. The encoder's
+ * caps carry the real ASC as codec_data; buildAsc is only the fallback when
+ * a header has to go out before the first audio buffer.
+ */
+namespace Aac {
+
+struct AscInfo {
+    int objectType = 0;   // 2 = AAC-LC
+    int sampleRate = 0;
+    int channels = 0;
+};
+
+/** @brief Reads object type, sampling frequency (index or explicit) and channel configuration */
+bool parseAsc(const uint8_t* data, size_t size, AscInfo& info);
+
+/** @brief Two-byte AAC-LC ASC; false for a rate without a frequency index */
+bool buildAsc(int sampleRate, int channels, std::vector<uint8_t>& out);
+
+} // namespace Aac
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Amf0: The subset of AMF0 that an RTMP publisher needs: encoding command
+ * arguments and onMetaData, and walking the server's replies.
+ */
+namespace Amf0 {
+
+enum Marker : uint8_t {
+    NUMBER = 0x00,
+    BOOLEAN = 0x01,
+    STRING = 0x02,
+    OBJECT = 0x03,
+    NULL_VALUE = 0x05,
+    UNDEFINED = 0x06,
+    ECMA_ARRAY = 0x08,
+    OBJECT_END = 0x09,
+    STRICT_ARRAY = 0x0A,
+    DATE = 0x0B,
+    LONG_STRING = 0x0C,
+};
+
+void writeNumber(std::vector<uint8_t>& out, double v);
+void writeBool(std::vector<uint8_t>& out, bool v);
+void writeString(std::vector<uint8_t>& out, const std::string& v);
+void writeNull(std::vector<uint8_t>& out);
+
+/** @brief Objects and ECMA arrays: start, then properties, then writeObjectEnd */
+void writeObjectStart(std::vector<uint8_t>& out);
+void writeEcmaArrayStart(std::vector<uint8_t>& out, uint32_t count);
+void writeObjectEnd(std::vector<uint8_t>& out);
+
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, double v);
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, bool v);
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, const std::string& v);
+inline void writeProperty(std::vector<uint8_t>& out, const std::string& key, const char* v) {
+    writeProperty(out, key, std::string(v));
+}
+/** @brief Strict array of strings, e.g. the Enhanced RTMP fourCcList */
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, const std::vector<std::string>& v);
+
+/**
+ * Sequential reader over one message body. Every read fails (returns false)
+ * on a type mismatch or a truncated value instead of running past the end.
+ */
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size) : p_(data), end_(data + size) {}
+
+    bool atEnd() const { return p_ >= end_; }
+    bool readNumber(double& v);
+    bool readString(std::string& v);
+
+    /** @brief Skips one value of any supported type */
+    bool skip();
+
+    /**
+     * @brief Reads an object (or ECMA array) and returns the string property
+     * named key; other properties are skipped. A null counts as not found.
+     */
+    bool findString(const std::string& key, std::string& value);
+
+private:
+    bool readKey(std::string& key);
+    bool skipProperties();
+
+    const uint8_t* p_;
+    const uint8_t* end_;
+};
+
+} // namespace Amf0
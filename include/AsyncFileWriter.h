@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+
+struct AsyncFileWriterStats {
+    uint64_t bytesWritten = 0;
+    uint64_t droppedWrites = 0;    // write() calls refused because every buffer was queued
+    uint64_t errors = 0;           // failed open/write; the rest of that file is discarded
+    int64_t maxWriteUs = 0;        // slowest single buffer write
+    size_t buffersQueued = 0;
+    size_t bufferCount = 0;
+};
+
+/**
+ * AsyncFileWriter: Sequential file output on a dedicated I/O thread.
+ * The producer copies into a fixed pool of page-aligned buffers and hands
+ * full ones over; the I/O thread writes them with O_DIRECT where the
+ * filesystem allows it, so recordings do not evict the page cache. When
+ * every buffer is still queued behind a slow disk, write() fails at once
+ * instead of blocking, and the caller decides what to give up.
+ *
+ * open/write/close/remove are executed in call order. They must come from
+ * one producer at a time; only the copy and a short lock happen there.
+ */
+class AsyncFileWriter {
+public:
+    struct Config {
+        size_t bufferBytes = 1 << 20;   // rounded up to kAlign
+        size_t bufferCount = 8;
+    };
+
+    static constexpr size_t kAlign = 4096;
+
+    explicit AsyncFileWriter(const Config& config);
+    ~AsyncFileWriter();
+
+    void start();
+    /** @brief Completes every queued operation, then joins the I/O thread */
+    void stop();
+
+    /** @brief Starts a new file (truncated); closes the previous one first */
+    void open(const std::string& path);
+
+    /** @brief All or nothing: false, with nothing written, when the buffers are full */
+    bool write(const iovec* parts, size_t count);
+
+    /** @brief Flushes the partial buffer and closes the file */
+    void close();
+
+    /** @brief unlink() on the I/O thread, after everything queued before it */
+    void remove(const std::string& path);
+
+    AsyncFileWriterStats stats() const;
+
+private:
+    enum class OpType { OPEN, DATA, CLOSE, REMOVE };
+
+    struct Op {
+        OpType type;
+        std::string path;
+        int buffer = -1;
+        size_t size = 0;
+    };
+
+    void submit(Op op);
+    void ioLoop();
+    void openFile(const std::string& path);
+    void writeBuffer(int buffer, size_t size);
+    void closeFile();
+
+    const size_t bufferBytes_;
+    std::vector<uint8_t*> buffers_;
+
+    // Producer side
+    int current_;
+    size_t fill_;
+    bool fileOpen_;
+
+    // Shared, under mutex_
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Op> ops_;
+    std::vector<int> free_;
+    size_t queued_;             // DATA ops not yet written
+    bool isRunning_;
+    std::thread ioThread_;
+
+    // I/O thread
+    int fd_;
+    bool direct_;
+    bool fileFailed_;
+    uint64_t fileSize_;
+    std::string path_;
+
+    std::atomic<uint64_t> bytesWritten_{0};
+    std::atomic<uint64_t> droppedWrites_{0};
+    std::atomic<uint64_t> errors_{0};
+    std::atomic<int64_t> maxWriteUs_{0};
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * BitrateController: Closed-loop ABR driven by RTMP send backpressure.
+ * Fed periodically with sender samples (queue depth, drops, bytes and time
+ * spent in av_write_frame, plus TCP RTT and unsent bytes when the sender
+ * owns its socket). The socket figures react before the queue does: the
+ * kernel backlog grows and RTT inflates as soon as the uplink is saturated.
+ * Backs off multiplicatively when the uplink falls behind and probes upwards
+ * slowly once it has been clean for a while, within [floorBps, ceilingBps].
+ * Optionally steps the frame rate down once the bitrate is pinned at the
+ * floor, and then the picture size (percent of the configured size; the
+ * encoder restarts with new parameter sets, sent in-stream). Recovery undoes
+ * the size first, then the frame rate. Every change is reported as a Decision.
+ */
+class BitrateController {
+public:
+    struct Config {
+        int startBps = 800000;
+        int floorBps = 200000;
+        int ceilingBps = 2000000;
+        int intervalMs = 500;             // evaluation period
+        double decreaseFactor = 0.7;
+        double increaseFactor = 1.08;
+        int increaseHoldMs = 5000;        // clean time required before probing up
+        size_t highQueueDepth = 30;       // ~1 s of video at 30 fps
+        size_t lowQueueDepth = 5;
+        int64_t highWriteUs = 40000;      // average av_write_frame time per packet
+        int highUnsentMs = 300;           // kernel backlog, as play time at the current bitrate
+        int highRttRiseMs = 200;          // smoothed RTT above the lowest seen on this connection
+        bool allowFpsStepDown = false;
+        std::vector<int> fpsSteps = {30, 20, 15};
+        int fpsStepDownAfterMs = 3000;    // congested at the floor this long
+        bool allowScaleStepDown = false;  // after the last frame rate step
+        std::vector<int> scaleSteps = {100, 75, 50};   // percent of the configured width and height
+    };
+
+    struct Sample {
+        size_t queueDepth = 0;
+        uint64_t drops = 0;         // cumulative
+        uint64_t bytesSent = 0;     // cumulative
+        uint64_t packetsSent = 0;   // cumulative
+        int64_t writeUsTotal = 0;   // cumulative time inside av_write_frame
+        bool tcpValid = false;      // the fields below are filled in
+        int64_t tcpRttUs = 0;
+        uint64_t tcpUnsentBytes = 0;
+    };
+
+    struct Decision {
+        int64_t timeMs = 0;
+        int prevBitrateBps = 0;
+        int bitrateBps = 0;
+        int prevFps = 0;
+        int fps = 0;
+        int prevScale = 0;          // percent; 0 without scaleSteps
+        int scale = 0;
+        double throughputBps = 0;
+        size_t queueDepth = 0;
+        std::string reason;
+    };
+
+    using DecisionCallback = std::function<void(const Decision&)>;
+
+    explicit BitrateController(const Config& config);
+
+    void setOnDecision(DecisionCallback cb) { onDecision_ = cb; }
+
+    /** @brief Call regularly (e.g. from the main loop); evaluates once per interval */
+    void update(const Sample& sample, int64_t nowMs);
+
+    int bitrate() const { return bitrateBps_; }
+    int fps() const { return config_.fpsSteps.empty() ? 0 : config_.fpsSteps[fpsStep_]; }
+    int scale() const { return config_.scaleSteps.empty() ? 0 : config_.scaleSteps[scaleStep_]; }
+
+    /**
+     * @brief New frame rate steps after the video format was changed from
+     * outside; both ladders start over at their first step, no Decision.
+     */
+    void setFpsSteps(const std::vector<int>& fpsSteps);
+
+private:
+    void apply(int64_t nowMs, int bitrateBps, size_t fpsStep, size_t scaleStep, double throughputBps,
+               size_t queueDepth, const std::string& reason);
+
+    Config config_;
+    DecisionCallback onDecision_;
+
+    int bitrateBps_;
+    size_t fpsStep_ = 0;
+    size_t scaleStep_ = 0;
+    bool havePrev_ = false;
+    Sample prev_;
+    int64_t prevMs_ = 0;
+    int64_t lastChangeMs_ = 0;
+    int64_t cleanSinceMs_ = -1;
+    int64_t floorCongestedSinceMs_ = -1;
+    int64_t minRttUs_ = 0;
+};
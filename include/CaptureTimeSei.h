@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * CaptureTimeSei: The capture wallclock of a frame as an H.264/H.265
+ * user_data_unregistered SEI message (payload type 5): a fixed UUID and the
+ * capture time in microseconds since the Unix epoch (CLOCK_REALTIME), big
+ * endian. Decoders skip SEI they do not know, so the stream stays playable
+ * everywhere; any receiver with a synchronised clock can read per-frame
+ * latency out of it.
+ * - insert: Annex B access unit with the SEI NAL ahead of its first slice
+ * - insertOffset / appendNal: the same without copying the access unit, for
+ *   callers that can splice the NAL in (a GstBuffer of several memories)
+ * - extract: finds it again in Annex B or length-prefixed (FLV/MP4) payloads
+ */
+namespace CaptureTimeSei {
+
+/** @brief Offset of the start code of the first slice, where the SEI goes; false if there is no slice */
+bool insertOffset(bool hevc, const uint8_t* au, size_t size, size_t& offset);
+
+/** @brief Appends the SEI NAL unit, with a 4-byte start code, to out */
+void appendNal(bool hevc, int64_t captureUs, std::vector<uint8_t>& out);
+
+/**
+ * @brief Copies the access unit into out with the SEI in front of the first
+ * slice (after AUD and parameter sets). False, and out untouched, if the
+ * access unit has no slice.
+ */
+bool insert(bool hevc, const uint8_t* au, size_t size, int64_t captureUs, std::vector<uint8_t>& out);
+
+/**
+ * @brief Capture time of the access unit, if it carries the SEI.
+ * lengthSize 0: Annex B; otherwise the size of the NAL length prefix (1, 2 or 4).
+ */
+bool extract(bool hevc, const uint8_t* data, size_t size, int lengthSize, int64_t& captureUs);
+
+/** @brief CLOCK_REALTIME in microseconds, the timeline of the SEI */
+int64_t wallclockUs();
+
+} // namespace CaptureTimeSei
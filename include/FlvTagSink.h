@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <sys/uio.h>
+
+/**
+ * FlvTagSink: Destination of the tag bodies produced by FlvTagWriter: an RTMP
+ * session (one message per tag) or an FLV file (tag header + body + size).
+ * The body is given as an iovec list so sinks can gather it without a copy.
+ */
+class FlvTagSink {
+public:
+    /** @brief FLV tag types; identical to the RTMP message types */
+    enum TagType : uint8_t {
+        TAG_AUDIO = 8,
+        TAG_VIDEO = 9,
+        TAG_SCRIPT = 18,
+    };
+
+    virtual ~FlvTagSink() = default;
+
+    /** @brief false once the sink is unusable */
+    virtual bool writeTag(uint8_t type, uint32_t timestampMs, const iovec* parts, size_t count) = 0;
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include "H264Bitstream.h"
+#include "MediaFrame.h"
+#include "FlvTagSink.h"
+
+/**
+ * FlvTagWriter: FLV tag bodies (onMetaData, AVC and AAC sequence headers,
+ * NALU and raw AAC packets) handed to an FlvTagSink: RtmpClient or a file.
+ * A video message is the 5-byte VIDEODATA header followed by 4-byte length
+ * prefixes and NAL units taken straight from the access unit, all in one
+ * gathered write; the Annex B frame is never converted into a new buffer.
+ * H.265 uses the Enhanced RTMP ExVideoTagHeader (FourCC hvc1) with the same
+ * length-prefixed payload; frames without a composition offset are sent as
+ * CodedFramesX, which drops the 3-byte offset.
+ * Metadata and sequence headers may be repeated mid-stream at the timestamp
+ * of the keyframe they apply to, after a parameter-set change.
+ */
+class FlvTagWriter {
+public:
+    explicit FlvTagWriter(FlvTagSink& sink, VideoCodec codec = VideoCodec::H264)
+        : sink_(sink), codec_(codec) {}
+
+    /**
+     * @brief avcC (or hvcC for H.265) and picture size from the SPS/PPS (and
+     * VPS) of a keyframe; false if the access unit does not carry them.
+     * width and height keep their values if the SPS cannot be parsed.
+     */
+    static bool buildVideoConfig(VideoCodec codec, const H264::AccessUnit& au, std::vector<uint8_t>& config,
+                                 int& width, int& height);
+
+    bool writeMetadata(int width, int height, bool hasAudio, int sampleRate, int channels, int64_t dtsMs = 0);
+    /** @brief avcC, or hvcC for H.265 */
+    bool writeVideoHeader(const std::vector<uint8_t>& config, int64_t dtsMs = 0);
+
+    /** @brief AAC sequence header carrying the encoder's AudioSpecificConfig */
+    bool writeAudioHeader(const std::vector<uint8_t>& asc);
+
+    /** @brief ctsMs = PTS - DTS; AUD NAL units are dropped like H264::writeAvcc; au may be H.265 */
+    bool writeVideo(const H264::AccessUnit& au, bool keyframe, int64_t dtsMs, int32_t ctsMs);
+
+    /** @brief Raw AAC or ADTS; an ADTS header is skipped, not copied */
+    bool writeAudio(const uint8_t* data, size_t size, int64_t dtsMs);
+
+private:
+    /** @brief VIDEODATA header (legacy AVC or ExVideoTagHeader); returns its length */
+    size_t videoHeader(uint8_t* out, int frameType, int packetType, int32_t ctsMs) const;
+
+    FlvTagSink& sink_;
+    VideoCodec codec_;
+    std::vector<uint8_t> lengths_;   // NAL length prefixes of the current frame
+    std::vector<iovec> iov_;
+};
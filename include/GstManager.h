@@ -1,77 +1,313 @@
 #pragma once
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
+#include <atomic>
 #include <vector>
 #include <functional>
 #include <thread>
 #include <mutex>
 #include <cstdint>
 #include <string>
+#include <memory>
+#include "MediaFrame.h"
+#include "MemoryBudget.h"
+#include "Metrics.h"
+#include "TalkbackPlayer.h"
+
+/** @brief Where the trunks get raw video and audio */
+enum class SourceKind {
+    CAPTURE,    // the platform camera and microphone (videotestsrc and pulsesrc on x86)
+    TEST,       // videotestsrc and audiotestsrc; live, needs no device or sound server
+    FILE,       // anything decodebin plays, paced to the clock; the pipeline ends at EOS
+    UDP,        // MPEG-TS over UDP, e.g. from a hardware encoder or ffmpeg -f mpegts
+    RTP,        // H.264/H.265 and AAC or Opus over RTP/UDP, relayed without re-encoding
+};
+
+struct MediaSource {
+    SourceKind kind = SourceKind::CAPTURE;
+    std::string location;   // FILE: path
+    int port = 0;           // UDP: listen port; RTP: video RTP port
+    // RTP only
+    int audioPort = 0;      // audio RTP port, 0 for video only
+    bool opus = false;      // Opus, decoded and encoded to AAC; otherwise AAC as RFC 3640 AAC-hbr
+    int audioRate = 48000;  // AAC input; describes the stream, nothing is resampled
+    int audioChannels = 1;
+    int jitterMs = 50;      // rtpjitterbuffer latency, 0 for none (in-order local senders)
+};
+
+/** @brief Bytes held inside the pipelines (see GstManager::getMemoryStats) */
+struct GstMemoryStats {
+    size_t rawQueueBytes = 0;       // raw frames and samples waiting for an encoder
+    size_t encodedQueueBytes = 0;   // encoded frames waiting for their appsink
+    uint64_t rawFramesHeld = 0;     // raw video frames dropped to protect the send queue
+    bool holdingRaw = false;
+};
 
 /**
  * GstManager: Manages GStreamer pipelines for video/audio capture and playback.
  * Supports dual-stream output:
  * - WebRTC Path: Video (RTP/H.264), Audio (RTP/Opus)
- * - RTMP Path: Video (Annex B/H.264), Audio (Raw AAC ADTS)
+ * - RTMP Path: Video (Annex B H.264 or H.265), Audio (Raw AAC ADTS)
+ * Each output is a tee branch that only exists while its callback is set;
+ * setting or clearing a callback adds or removes the branch, also while PLAYING.
+ * Frame timestamps are absolute system-clock times shared by both pipelines;
+ * optionally both run in one pipeline with a single base time.
+ * Encoder, rate and queue elements are instrumented with pad probes that only
+ * bump Metrics counters (buffers, bytes, encoder latency).
+ * The raw input is the platform capture by default; a test pattern, a file or
+ * an MPEG-TS/UDP feed can be decoded instead (MediaSource), so one process can
+ * host several independent instances (see PublisherSession). An RTP input is
+ * already encoded: it is depayloaded and parsed straight into the video tee
+ * (and, for AAC, the audio tee), so there is no encoder, rate control or
+ * keyframe request on that path.
  */
 class GstManager {
 public:
-    using FrameCallback = std::function<void(const std::vector<uint8_t>&)>;
+    /** @brief Frames are handed over by reference; no copy is made on the streaming thread */
+    using FrameCallback = std::function<void(const MediaFrame::Ptr&)>;
+
+    /** @brief Buffer observer; ptsClockNs is on the same timeline as MediaFrame::pts() (-1 if unset) */
+    using BufferProbe = std::function<void(GstBuffer* buffer, int64_t ptsClockNs)>;
 
     GstManager(int width, int height, int fps, int videoBitrate,
                uint32_t videoSSRC = 42, uint32_t audioSSRC = 43);
 
     ~GstManager();
 
+    // ---------------- Source ----------------
+    /**
+     * @brief Takes effect on the next start. FILE and UDP are demuxed and decoded
+     * once for both trunks, so they always run as a combined pipeline.
+     */
+    void setSource(const MediaSource& source);
+
+    /**
+     * @brief Adds session=name to every metric of this instance, so several
+     * GstManagers can share the registry. Call before the first start.
+     */
+    void setSessionName(const std::string& name);
+
+    /** @brief Set from the streaming thread when a pipeline posts EOS / an error; cleared on start */
+    bool hasEnded() const { return ended_; }
+    bool hasFailed() const { return failed_; }
+
     // ---------------- Video ----------------
     void startVideo();
     void stopVideo();
+
+    /**
+     * @brief H.264 (default) or H.265: omxh265enc on QCS610, x265enc on x86.
+     * Takes effect on the next startVideo(); the RTP branch follows with rtph265pay.
+     */
+    void setVideoCodec(VideoCodec codec);
+    VideoCodec videoCodec() const { return videoCodec_; }
+
+    /**
+     * @brief Puts the capture wallclock of every access unit into the stream
+     * as an SEI message (CaptureTimeSei), on both platforms; on by default.
+     * Not for RTP inputs, which have no capture time. Takes effect on the next startVideo().
+     */
+    void setCaptureTimeSei(bool enabled);
+
+    /** @brief Burns the wallclock into the picture (x86 only, off by default); next startVideo() */
+    void setTimeOverlay(bool enabled);
     
-    /** @brief For WebRTC: H.264 RTP Packets */
-    void setOnVideoRTPFrame(FrameCallback cb) { onVideoRTPFrame_ = cb; }
+    /** @brief Runtime encoder bitrate change (bits per second); safe while PLAYING */
+    void setVideoBitrate(int bitrate);
+
+    /** @brief Caps the output frame rate by dropping frames ahead of the encoder */
+    void setVideoFramerate(int fps);
+
+    /**
+     * @brief Changes the encoded resolution and frame rate, while PLAYING too.
+     * The encoder restarts on the new caps with an IDR and new parameter sets;
+     * the RTMP connections stay up. False for RTP inputs and, on QCS610, for
+     * the camera once it is running.
+     */
+    bool setVideoFormat(int width, int height, int fps);
+
+    /** @brief Whether setVideoFormat() works while PLAYING with the configured source */
+    bool canChangeVideoFormat();
+
+    /**
+     * @brief Asks the encoder for an IDR with SPS/PPS as soon as possible.
+     * Thread-safe; requests within 500 ms of the previous one are coalesced.
+     */
+    void requestKeyframe();
+
+    /**
+     * @brief Observes buffers leaving/entering a pad of a named video element
+     * (e.g. "vsrc"/"src", "venc"/"src"). Call after startVideo(); runs on the
+     * streaming thread, so the probe must be cheap.
+     */
+    bool addVideoProbe(const std::string& element, const std::string& pad, BufferProbe probe);
 
-    /** @brief For RTMP: Raw H.264 Annex B frames */
-    void setOnVideoAnnexBFrame(FrameCallback cb) { onVideoAnnexBFrame_ = cb; }
+    /** @brief For WebRTC: H.264/H.265 RTP Packets (an empty callback removes the branch) */
+    void setOnVideoRTPFrame(FrameCallback cb) { setCallback(BRANCH_VIDEO_RTP, std::move(cb)); }
+
+    /** @brief For RTMP: Annex B access units in the selected codec */
+    void setOnVideoAnnexBFrame(FrameCallback cb) { setCallback(BRANCH_VIDEO_H264, std::move(cb)); }
 
     // ---------------- Audio ----------------
+    /** @brief Capture format of the audio trunk; AAC is encoded at this rate, nothing resamples */
+    static constexpr int kAudioSampleRate = 48000;
+    static constexpr int kAudioChannels = 1;
+
     void startAudio();
     void stopAudio();
     
     /** @brief For WebRTC: Opus RTP Packets */
-    void setOnAudioRTPFrame(FrameCallback cb) { onAudioRTPFrame_ = cb; }
+    void setOnAudioRTPFrame(FrameCallback cb) { setCallback(BRANCH_AUDIO_RTP, std::move(cb)); }
+
+    /** @brief For RTMP: Raw AAC frames; the AudioSpecificConfig is in the caps (MediaFrame::codecData) */
+    void setOnAudioAACFrame(FrameCallback cb) { setCallback(BRANCH_AUDIO_AAC, std::move(cb)); }
 
-    /** @brief For RTMP: Raw AAC frames (ADTS) */
-    void setOnAudioAACFrame(FrameCallback cb) { onAudioAACFrame_ = cb; }
+    // ---------------- Combined A/V ----------------
+    /**
+     * @brief Builds video and audio as one pipeline on a single clock and base
+     * time instead of two. Takes effect on the next start; startVideo() or
+     * startAudio() then starts both, and stopping either stops both.
+     */
+    void setCombinedPipeline(bool combined);
+
+    // ---------------- Memory budget ----------------
+    /** @brief Queue and appsink limits (MemoryBudget); takes effect on the next start */
+    void setMemoryBudget(const MemoryBudget& budget);
+
+    /**
+     * @brief Bytes waiting in the primary send queue. With Shed::RAW, raw video
+     * is dropped ahead of the encoder while this is high. Lock-free; call it
+     * periodically from one thread.
+     */
+    void setSendBacklog(size_t bytes);
+
+    GstMemoryStats getMemoryStats();
 
     // ---------------- Audio Playback ----------------
-    void startAudioPlayer();
+    /** @brief Talkback jitter buffer and sink settings; only while the player is stopped */
+    void setTalkbackConfig(const TalkbackPlayer::Config& config);
+    bool startAudioPlayer();
     void stopAudioPlayer();
+    /**
+     * @brief One received RTP/Opus packet for the talkback player. Lock-free;
+     * call from one thread at a time, and not concurrently with
+     * setTalkbackConfig() or setSessionName().
+     */
     void pushAudioFrame(const uint8_t* data, size_t size);
+    TalkbackStats getTalkbackStats() const { return talkback_->stats(); }
 
 private:
+    enum BranchId {
+        BRANCH_VIDEO_H264,
+        BRANCH_VIDEO_RTP,
+        BRANCH_AUDIO_AAC,
+        BRANCH_AUDIO_RTP,
+        BRANCH_COUNT,
+    };
+
+    struct BranchInfo {
+        const char* bin;        // bin name inside the pipeline
+        const char* tee;
+        const char* sink;       // appsink inside the bin
+        const char* queue;      // branch queue, instrumented
+        const char* encoder;    // instrumented when set
+        bool video;
+        FrameCallback GstManager::*callback;
+        GstFlowReturn (*onSample)(GstAppSink*, gpointer);
+    };
+
+    struct Branch {
+        GstElement* bin = nullptr;
+        GstPad* teePad = nullptr;
+    };
+
+    static const BranchInfo kBranches[BRANCH_COUNT];
+
+    void setCallback(BranchId id, FrameCallback cb);
+    std::string branchDescription(BranchId id) const;
+    void addBranch(BranchId id);
+    void removeBranch(BranchId id);
+    /** @brief After the pipeline went to NULL: releases the tee pads it still holds */
+    void dropBranches(bool video);
+
+    bool sharedDecoder() const;
+    /** @brief False for an RTP input without an audio port */
+    bool hasAudioInput() const;
+    /** @brief AAC arrives encoded (RTP AAC input): the AAC branch only queues, the Opus branch decodes */
+    bool encodedAudio() const;
+    /** @brief udpsrc with RTP caps, then the jitter buffer */
+    std::string rtpSourceDescription(const std::string& name, int port, const std::string& caps) const;
+    std::string rtpVideoTrunkDescription() const;
+    std::string rtpAudioTrunkDescription() const;
+    std::string decoderDescription() const;
+    std::string rawVideoCaps() const;
+    bool formatChangeable() const;
+    std::string videoSourceDescription() const;
+    std::string videoTrunkDescription() const;
+    /** @brief withDecoder: a FILE/UDP trunk that is not preceded by the video trunk declares the decodebin */
+    std::string audioTrunkDescription(bool withDecoder) const;
+    enum class QueueKind { RAW_VIDEO, RAW_AUDIO, ENCODED };
+    /** @brief "queue name=..." plus the MemoryBudget limits for its kind */
+    std::string queueDescription(const std::string& name, QueueKind kind) const;
+    /** @brief Appended to the audio appsinks; encoded video is only shed by PacketQueue, GOP-aware */
+    std::string appsinkOptions() const;
+
+    void setupVideo();
+    void setupAudio();
+    void startCombined();
+    void stopCombined();
+
     /** * @brief Helper to connect appsink signals and reduce boilerplate 
      * Added to fix the 'no declaration matches' compilation error.
      */
     void setupSink(GstElement* pipeline, const std::string& name, GCallback callback);
+    void useSharedClock(GstElement* pipeline);
+    /**
+     * @brief Streaming threads register with ThreadPolicy under their task
+     * owner's name; EOS and errors set ended_ / failed_
+     */
+    void watchBus(GstElement* pipeline);
+
+    void registerMetrics();
+    /** @brief labels with session=sessionName_ in front, if set */
+    Metrics::Labels metricLabels(const Metrics::Labels& labels) const;
+
+    enum class Stage { PLAIN, QUEUE, DROPPER };
+    /** @brief Buffer/byte counters on a named element's pads, plus queue level or drops */
+    void instrumentElement(GstElement* pipeline, const std::string& pipelineName, const std::string& element,
+                           Stage stage);
+    void instrumentEncoder(GstElement* pipeline, const std::string& element);
+    bool addProbe(GstElement* pipeline, const std::string& element, const std::string& pad,
+                  GstPadProbeType type, GstPadProbeCallback cb, gpointer data, GDestroyNotify notify);
 
     // Callbacks for GStreamer appsinks
     static GstFlowReturn onVideoRTPSample(GstAppSink* appsink, gpointer user_data);
     static GstFlowReturn onVideoAnnexBSample(GstAppSink* appsink, gpointer user_data);
     static GstFlowReturn onAudioRTPSample(GstAppSink* appsink, gpointer user_data);
     static GstFlowReturn onAudioAACSample(GstAppSink* appsink, gpointer user_data);
+    static void dispatchSample(GstAppSink* appsink, const FrameCallback& cb);
+    static GstPadProbeReturn onBufferProbe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data);
+    static GstBusSyncReply onBusMessage(GstBus* bus, GstMessage* msg, gpointer user_data);
 
 private:
     // Pipeline elements
     GstElement* videoPipeline_ = nullptr;
     GstElement* audioPipeline_ = nullptr;
-    GstElement* audioPlayerPipeline_ = nullptr;
-    GstElement* audioAppSrc_ = nullptr;
+    bool combined_ = false;     // video and audio share one pipeline
+    VideoCodec videoCodec_ = VideoCodec::H264;
+    bool captureTimeSei_ = true;
+    bool timeOverlay_ = false;
+    MediaSource source_;
+    std::string sessionName_;
+    std::atomic<bool> ended_{false};
+    std::atomic<bool> failed_{false};
 
     // Callbacks
     FrameCallback onVideoRTPFrame_;
     FrameCallback onVideoAnnexBFrame_;
     FrameCallback onAudioRTPFrame_;
     FrameCallback onAudioAACFrame_;
+    Branch branches_[BRANCH_COUNT];
 
     // Video / audio params
     int width_;
@@ -81,8 +317,21 @@ private:
     uint32_t videoSSRC_;
     uint32_t audioSSRC_;
 
-    // Threads & loop
-    GMainLoop* mainLoop_ = nullptr;
-    std::thread mainThread_;
+    // Encoder latency, matched by PTS between the encoder's sink and src pads
+    std::unique_ptr<Metrics::StageTimer> encTimer_;
+    Metrics::Counter* encKeyframes_ = nullptr;
+    Metrics::Counter* keyframeRequests_ = nullptr;
+    int64_t lastKeyframeRequestNs_ = 0;
+
+    // Memory budget
+    MemoryBudget budget_;
+    std::atomic<size_t> holdAboveBytes_{0};     // 0: raw video is never held
+    std::atomic<bool> holdRaw_{false};
+    Metrics::Counter* rawHeld_ = nullptr;
+
+    // Talkback playback
+    TalkbackPlayer::Config talkbackConfig_;
+    std::unique_ptr<TalkbackPlayer> talkback_;
+
     std::mutex mutex_;
-};
\ No newline at end of file
+};
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/**
+ * H264: Annex B bitstream helpers shared by the RTMP path and the tools.
+ * - findStartCode: start-code scanner (SSE2/AVX2 on x86, NEON on ARM, scalar fallback)
+ * - parseAccessUnit: single pass yielding NAL types and offsets
+ * - writeAvcc / buildAvcC: length-prefixed (AVCC) payload and avcC extradata for FLV/MP4
+ */
+namespace H264 {
+
+enum NalType : uint8_t {
+    NAL_SLICE = 1,
+    NAL_IDR = 5,
+    NAL_SEI = 6,
+    NAL_SPS = 7,
+    NAL_PPS = 8,
+    NAL_AUD = 9,
+};
+
+struct Nal {
+    const uint8_t* data = nullptr;  // NAL header byte, start code excluded
+    size_t size = 0;
+    uint8_t type = 0;               // nal_unit_type of the codec the unit was parsed as
+    uint8_t refIdc = 0;
+};
+
+struct AccessUnit {
+    static constexpr size_t kMaxNals = 128;
+
+    Nal nals[kMaxNals];
+    size_t count = 0;
+    int vpsIndex = -1;        // H.265 only
+    int spsIndex = -1;
+    int ppsIndex = -1;
+    bool idr = false;         // H.265: any IRAP picture
+    bool disposable = false;  // first slice has nal_ref_idc == 0 (H.265: sub-layer non-reference)
+    bool hevc = false;        // filled by H265::parseAccessUnit
+
+    const Nal* vps() const { return vpsIndex >= 0 ? &nals[vpsIndex] : nullptr; }
+    const Nal* sps() const { return spsIndex >= 0 ? &nals[spsIndex] : nullptr; }
+    const Nal* pps() const { return ppsIndex >= 0 ? &nals[ppsIndex] : nullptr; }
+
+    /** @brief Access unit delimiters carry nothing once NALs are length-prefixed */
+    bool isAud(const Nal& n) const { return n.type == (hevc ? 35 : NAL_AUD); }
+};
+
+struct SpsInfo {
+    int profileIdc = 0;
+    int constraintFlags = 0;
+    int levelIdc = 0;
+    int chromaFormatIdc = 1;
+    int bitDepthLuma = 8;
+    int bitDepthChroma = 8;
+    int width = 0;
+    int height = 0;
+};
+
+/**
+ * Exp-Golomb reader over RBSP; strips emulation prevention bytes on the fly.
+ * Shared with the H.265 parameter set parsers.
+ */
+class RbspReader {
+public:
+    RbspReader(const uint8_t* p, size_t n) : p_(p), end_(p + n) {}
+
+    uint32_t bit() {
+        if (left_ == 0 && !load()) return 0;
+        --left_;
+        return (cur_ >> left_) & 1;
+    }
+
+    uint32_t bits(int n) {
+        uint32_t v = 0;
+        while (n-- > 0) v = (v << 1) | bit();
+        return v;
+    }
+
+    uint32_t ue() {
+        int zeros = 0;
+        while (!bit()) {
+            if (++zeros > 31 || overrun_) {
+                overrun_ = true;
+                return 0;
+            }
+        }
+        return ((1u << zeros) - 1) + bits(zeros);
+    }
+
+    int32_t se() {
+        uint32_t v = ue();
+        return (v & 1) ? static_cast<int32_t>((v + 1) / 2) : -static_cast<int32_t>(v / 2);
+    }
+
+    bool ok() const { return !overrun_; }
+
+private:
+    bool load() {
+        if (p_ >= end_) { overrun_ = true; return false; }
+        uint8_t b = *p_++;
+        if (zeros_ >= 2 && b == 0x03) {
+            zeros_ = 0;
+            if (p_ >= end_) { overrun_ = true; return false; }
+            b = *p_++;
+        }
+        zeros_ = (b == 0) ? zeros_ + 1 : 0;
+        cur_ = b;
+        left_ = 8;
+        return true;
+    }
+
+    const uint8_t* p_;
+    const uint8_t* end_;
+    uint8_t cur_ = 0;
+    int left_ = 0;
+    int zeros_ = 0;
+    bool overrun_ = false;
+};
+
+/** @brief Returns the first "00 00 01" at or after p, or nullptr */
+const uint8_t* findStartCode(const uint8_t* p, const uint8_t* end);
+
+/** @brief Name of the scanner selected for this CPU ("avx2", "sse2", "neon", "scalar") */
+const char* scannerName();
+
+/**
+ * @brief Header byte of the first slice NAL (type 1 or 5), or nullptr.
+ * Stops scanning there, so classifying a frame only touches the prefix NALs.
+ */
+const uint8_t* findFirstSlice(const uint8_t* data, size_t size);
+
+/** @brief Splits an Annex B access unit. Returns false if it holds more than kMaxNals. */
+bool parseAccessUnit(const uint8_t* data, size_t size, AccessUnit& au);
+
+/** @brief Size of the AVCC payload written by writeAvcc (AUDs are dropped) */
+size_t avccSize(const AccessUnit& au);
+
+/** @brief Writes 4-byte big-endian length prefixed NAL units; returns bytes written */
+size_t writeAvcc(const AccessUnit& au, uint8_t* out);
+
+/** @brief Parses the fields of a sequence parameter set needed for avcC and stream setup */
+bool parseSps(const Nal& sps, SpsInfo& info);
+
+/** @brief Builds an AVCDecoderConfigurationRecord (ISO/IEC 14496-15) with 4-byte lengths */
+bool buildAvcC(const Nal& sps, const Nal& pps, std::vector<uint8_t>& out);
+
+} // namespace H264
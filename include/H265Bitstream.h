@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "H264Bitstream.h"
+
+/**
+ * H265: HEVC counterparts of the H264 helpers. Start codes are the same, so
+ * H264::findStartCode does the scanning and the access unit is split into
+ * the same H264::AccessUnit (with hevc set); H264::writeAvcc then produces
+ * the length-prefixed payload for either codec.
+ * - parseAccessUnit: NAL types, VPS/SPS/PPS, IRAP and sub-layer reference flags
+ * - parseSps / buildHvcC: stream size and the hvcC extradata for FLV/MP4
+ */
+namespace H265 {
+
+enum NalType : uint8_t {
+    NAL_TRAIL_N = 0,
+    NAL_BLA_W_LP = 16,
+    NAL_IDR_W_RADL = 19,
+    NAL_IDR_N_LP = 20,
+    NAL_CRA = 21,
+    NAL_RSV_IRAP_23 = 23,
+    NAL_VPS = 32,
+    NAL_SPS = 33,
+    NAL_PPS = 34,
+    NAL_AUD = 35,
+    NAL_PREFIX_SEI = 39,
+};
+
+/** @brief nal_unit_type from the first header byte */
+inline uint8_t nalType(uint8_t header) { return (header >> 1) & 0x3F; }
+
+/** @brief Slice segments are the VCL types 0..31 */
+inline bool isVcl(uint8_t type) { return type < NAL_VPS; }
+
+/** @brief BLA, IDR and CRA: decoding can start here */
+inline bool isIrap(uint8_t type) { return type >= NAL_BLA_W_LP && type <= NAL_RSV_IRAP_23; }
+
+/** @brief TRAIL_N, TSA_N, ... RSV_VCL_N14: nothing references the picture */
+inline bool isSubLayerNonRef(uint8_t type) { return type <= 14 && (type & 1) == 0; }
+
+struct SpsInfo {
+    int profileSpace = 0;
+    int tierFlag = 0;
+    int profileIdc = 0;
+    uint32_t compatibilityFlags = 0;
+    uint64_t constraintFlags = 0;    // 48 bits
+    int levelIdc = 0;
+    int maxSubLayersMinus1 = 0;
+    int temporalIdNesting = 0;
+    int chromaFormatIdc = 1;
+    int bitDepthLuma = 8;
+    int bitDepthChroma = 8;
+    int width = 0;
+    int height = 0;
+};
+
+/** @brief Header byte of the first slice segment NAL, or nullptr (see H264::findFirstSlice) */
+const uint8_t* findFirstSlice(const uint8_t* data, size_t size);
+
+/** @brief Splits an Annex B access unit. Returns false if it holds more than kMaxNals. */
+bool parseAccessUnit(const uint8_t* data, size_t size, H264::AccessUnit& au);
+
+/** @brief Profile/tier/level, chroma format, bit depths and the cropped picture size */
+bool parseSps(const H264::Nal& sps, SpsInfo& info);
+
+/** @brief Builds an HEVCDecoderConfigurationRecord (ISO/IEC 14496-15) with 4-byte lengths */
+bool buildHvcC(const H264::Nal& vps, const H264::Nal& sps, const H264::Nal& pps, std::vector<uint8_t>& out);
+
+} // namespace H265
@@ -0,0 +1,38 @@
+#pragma once
+#include <deque>
+#include <cstdint>
+#include <cstddef>
+#include "PacketQueue.h"
+
+/**
+ * Interleaver: Orders timestamped audio and video packets by DTS before the muxer.
+ * A packet is released once the other stream has reached its DTS (each stream
+ * is monotonic on its own), or once it has waited maxDelayMs of stream time
+ * because the other stream went quiet. Output DTS never decreases across streams.
+ */
+class Interleaver {
+public:
+    explicit Interleaver(int64_t maxDelayMs = 500) : maxDelayMs_(maxDelayMs) {}
+
+    void push(SendPacket&& pkt);
+
+    /** @brief Next packet that can be written without breaking DTS order */
+    bool pop(SendPacket& out);
+
+    /** @brief Releases queued packets regardless of the other stream (shutdown) */
+    bool flush(SendPacket& out);
+
+    void reset();
+    size_t size() const { return video_.size() + audio_.size(); }
+
+private:
+    bool ready(const std::deque<SendPacket>& q, int64_t otherLastDts) const;
+    void take(std::deque<SendPacket>& q, SendPacket& out);
+
+    std::deque<SendPacket> video_;
+    std::deque<SendPacket> audio_;
+    int64_t maxDelayMs_;
+    int64_t lastVideoDts_ = INT64_MIN;
+    int64_t lastAudioDts_ = INT64_MIN;
+    int64_t lastOutDts_ = INT64_MIN;
+};
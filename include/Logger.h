@@ -1,4 +1,77 @@
 #pragma once
 #include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include "BoundedQueue.h"
 
-void logWithTime(const std::string& msg);
+enum LogLevel {
+    LEVEL_DEBUG,
+    LEVEL_INFO,
+    LEVEL_WARN,
+    LEVEL_ERROR,
+};
+
+/**
+ * Logger: Asynchronous logger. Callers only take a timestamp and move the
+ * message into a lock-free MPSC ring; a background thread formats the time
+ * and writes to the console and an optional rotating file. When the ring is
+ * full the message is dropped and counted, so logging never blocks or adds
+ * I/O latency to the streaming and writer threads.
+ */
+class Logger {
+public:
+    static Logger& instance();
+
+    void log(LogLevel level, std::string msg);
+    void setLevel(LogLevel level) { level_ = level; }
+
+    /** @brief Also writes to dir/name, rotating to name.1 .. name.maxFiles at maxBytes */
+    bool enableFileSink(const std::string& dir, const std::string& name,
+                        size_t maxBytes = 4 << 20, int maxFiles = 3);
+
+    /** @brief Waits until everything logged so far has been written */
+    void flush();
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    ~Logger();
+
+private:
+    struct Record {
+        int64_t timeUs = 0;   // system clock
+        LogLevel level = LEVEL_INFO;
+        std::string msg;
+    };
+
+    Logger();
+    void drainLoop();
+    void write(const Record& rec);
+    void rotate();
+
+    BoundedQueue<Record> ring_;
+    std::atomic<int> level_;
+    std::atomic<bool> isRunning_;
+    std::atomic<uint64_t> pushed_{0};
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t reportedDrops_ = 0;
+
+    // Drain thread only
+    int64_t prefixSec_ = -1;
+    char prefix_[16];
+    std::string line_;
+
+    std::atomic<FILE*> file_{nullptr};
+    std::string filePath_;
+    size_t fileBytes_ = 0;
+    size_t maxFileBytes_ = 0;
+    int maxFiles_ = 0;
+
+    std::thread thread_;
+};
+
+void logWithTime(std::string msg);
+void logWithTime(LogLevel level, std::string msg);
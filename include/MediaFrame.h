@@ -0,0 +1,64 @@
+#pragma once
+#include <gst/gst.h>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/** @brief Encoded video format carried by MediaFrames and published over RTMP */
+enum class VideoCodec { H264, H265 };
+
+/**
+ * MediaFrame: Ref-counted, read-only view of an encoded GstSample.
+ * The underlying GstBuffer stays mapped until the last reference is dropped,
+ * so consumers (RTMP muxer, recorders, ...) can reference the appsink memory
+ * directly instead of copying it into a std::vector.
+ */
+class MediaFrame {
+public:
+    using Ptr = std::shared_ptr<const MediaFrame>;
+
+    /**
+     * @brief Takes ownership of the sample. Returns nullptr if it cannot be mapped.
+     * When baseTime is valid, timestamps are converted from buffer time to
+     * absolute pipeline clock time (running time + base time), which makes
+     * frames from separate pipelines sharing one clock directly comparable.
+     */
+    static Ptr fromSample(GstSample* sample, GstClockTime baseTime = GST_CLOCK_TIME_NONE);
+
+    ~MediaFrame();
+
+    MediaFrame(const MediaFrame&) = delete;
+    MediaFrame& operator=(const MediaFrame&) = delete;
+
+    const uint8_t* data() const { return map_.data; }
+    size_t size() const { return map_.size; }
+
+    /** @brief Timestamps in nanoseconds (clock time, see fromSample), -1 when unset */
+    int64_t pts() const { return pts_; }
+    int64_t dts() const { return dts_; }
+    int64_t duration() const { return duration_; }
+
+    /** @brief True unless GStreamer flagged the buffer as a delta unit */
+    bool isKeyframe() const { return keyframe_; }
+
+    /** @brief Set after a gap in the stream (dropped buffers, device restart) */
+    bool isDiscont() const { return discont_; }
+
+    GstSample* sample() const { return sample_; }
+
+    /** @brief codec_data of the sample caps (e.g. the AAC AudioSpecificConfig); false if there is none */
+    bool codecData(std::vector<uint8_t>& out) const;
+
+private:
+    MediaFrame(GstSample* sample, GstBuffer* buffer, GstClockTime baseTime);
+
+    GstSample* sample_;
+    GstBuffer* buffer_;
+    GstMapInfo map_;
+    int64_t pts_;
+    int64_t dts_;
+    int64_t duration_;
+    bool keyframe_;
+    bool discont_;
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+ * MemoryBudget: Bounded-memory mode. By default every GStreamer queue may hold
+ * 200 buffers / 10 MB / 1 s and the appsinks are unbounded, so a slow encoder
+ * or a stalled uplink turns into memory growth and seconds of latency. With a
+ * budget every stage between capture and socket has a hard limit:
+ *
+ *   raw video queues (vdec_q, enc_q) rawQueueBuffers frames, leaky: the
+ *                    oldest frame goes when the encoder falls behind
+ *   raw audio queues (adec_q, asrc_q and the aac_q / rtp_q ahead of the audio
+ *                    encoders) queueMs, leaky
+ *   encoded queues   (h264_q, rtp_q of the video branches) queueMs, not
+ *                    leaky, so they never cut into a GOP
+ *   audio appsinks   appsinkBuffers, oldest dropped (a safety net; the
+ *                    callbacks never block). The video appsinks never drop:
+ *                    losing a frame inside a GOP breaks decoding until the
+ *                    next IDR, so encoded video is only shed by the send queue
+ *   RTMP send queue  sendQueueBytes per destination (PacketQueue::Config::maxBytes)
+ *
+ * shed chooses what gives when the uplink stalls. RAW holds raw video back at
+ * the encoder input while the primary destination's send queue is above 3/4
+ * of its budget (until it drains below 1/4): no encode work and no broken
+ * GOP, just a gap in capture. ENCODED keeps encoding and lets the send queue
+ * shed encoded frames, GOP-aware; other destinations keep getting everything
+ * their own queues can hold.
+ */
+struct MemoryBudget {
+    enum class Shed { RAW, ENCODED };
+
+    bool enabled = false;
+    Shed shed = Shed::RAW;
+    int rawQueueBuffers = 3;
+    int queueMs = 300;
+    int appsinkBuffers = 8;
+    size_t sendQueueBytes = 2 << 20;
+
+    static const char* shedName(Shed shed) { return shed == Shed::RAW ? "raw" : "encoded"; }
+    /** @brief "raw" or "encoded" */
+    static bool parseShed(const std::string& text, Shed& shed);
+};
+
+/** @brief Resident set of this process from /proc/self/status (VmRSS, VmHWM) */
+struct ProcessMemory {
+    size_t rssBytes = 0;
+    size_t peakRssBytes = 0;
+
+    static ProcessMemory read();
+};
@@ -0,0 +1,148 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Metrics: Always-on instrumentation rendered in the Prometheus text format.
+ * Counters, gauges and fixed-bucket histograms are plain relaxed atomics, so
+ * updating one from a streaming thread costs one or two fetch_adds.
+ * Registration and rendering take the registry mutex and only happen at setup
+ * and scrape time. Values that already exist elsewhere (queue stats, writer
+ * stats) are registered as callbacks and read only when scraped.
+ */
+namespace Metrics {
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+enum class Type { COUNTER, GAUGE, HISTOGRAM };
+
+int64_t nowNs();
+
+class Counter {
+public:
+    void add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+public:
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+/**
+ * Bucket bounds are fixed at registration. observe() is a short linear scan
+ * plus two fetch_adds; the sum is kept in thousandths of the unit.
+ */
+class Histogram {
+public:
+    explicit Histogram(const std::vector<double>& bounds);
+
+    void observe(double v);
+
+    const std::vector<double>& bounds() const { return bounds_; }
+    /** @brief Non-cumulative count of bucket i; i == bounds().size() is +Inf */
+    uint64_t bucket(size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+    double sum() const { return sumMilli_.load(std::memory_order_relaxed) / 1000.0; }
+
+private:
+    std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+    std::atomic<int64_t> sumMilli_{0};
+};
+
+/**
+ * StageTimer: Time spent inside an in-order stage (e.g. an encoder), matched by
+ * key (PTS) between begin() on the input and end() on the output. One thread
+ * calls begin() and one calls end(); keys that fall out of the window are not timed.
+ */
+class StageTimer {
+public:
+    explicit StageTimer(Histogram& hist) : hist_(hist) {}
+
+    void begin(int64_t key);
+    void end(int64_t key);
+
+private:
+    static constexpr uint32_t kWindow = 64;
+    struct Slot {
+        std::atomic<int64_t> key{INT64_MIN};
+        std::atomic<int64_t> ns{0};
+    };
+
+    Histogram& hist_;
+    Slot slots_[kWindow];
+    std::atomic<uint32_t> head_{0};   // written by begin()
+    uint32_t tail_ = 0;               // oldest unmatched input, end() only
+};
+
+/**
+ * Registry: Process-wide set of metrics. Registering the same name and labels
+ * twice returns the existing metric, so pipelines can be restarted freely.
+ * A counter, gauge or histogram registered by several owners is shared and
+ * counted: remove(owner) drops the owner's references and an entry goes with
+ * its last one. A callback refers to its owner, so it cannot be shared; a
+ * second owner registering the same series is refused with an error (the
+ * same owner replaces its function). Call remove(owner) once nothing can
+ * update the owner's metrics any more, before the owner is destroyed.
+ */
+class Registry {
+public:
+    using ValueFn = std::function<double()>;
+
+    static Registry& instance();
+
+    Counter& counter(const std::string& name, const std::string& help, const Labels& labels, const void* owner);
+    Gauge& gauge(const std::string& name, const std::string& help, const Labels& labels, const void* owner);
+    Histogram& histogram(const std::string& name, const std::string& help, const std::vector<double>& bounds,
+                         const Labels& labels, const void* owner);
+
+    /** @brief Value read at scrape time; type is COUNTER or GAUGE */
+    void callback(const std::string& name, const std::string& help, Type type, ValueFn fn,
+                  const Labels& labels, const void* owner);
+
+    void remove(const void* owner);
+
+    /** @brief Prometheus text exposition format, version 0.0.4 */
+    std::string render() const;
+
+private:
+    struct Entry {
+        std::string name;
+        std::string help;
+        Type type;
+        Labels labels;
+        std::vector<const void*> owners;   // one for callbacks; every sharer otherwise
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Histogram> histogram;
+        ValueFn fn;
+    };
+
+    Entry* find(const std::string& name, const Labels& labels);
+    static void share(Entry& e, const void* owner);
+    Entry& add(const std::string& name, const std::string& help, Type type, const Labels& labels,
+               const void* owner);
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Entry>> entries_;
+};
+
+/** @brief Default bucket bounds in milliseconds for latencies */
+const std::vector<double>& latencyBucketsMs();
+
+} // namespace Metrics
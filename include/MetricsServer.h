@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "Metrics.h"
+
+/**
+ * MetricsServer: Serves Metrics::Registry::render() as a minimal HTTP/1.0
+ * response on a local UNIX socket and/or a TCP port bound to 127.0.0.1, so
+ * Prometheus (or curl --unix-socket) can scrape it. One short-lived
+ * connection at a time on its own thread; nothing on the media path.
+ */
+class MetricsServer {
+public:
+    explicit MetricsServer(Metrics::Registry& registry = Metrics::Registry::instance());
+    ~MetricsServer();
+
+    /** @brief Call before start(); a stale socket file at path is replaced */
+    bool listenUnix(const std::string& path);
+    bool listenTcp(int port);
+
+    bool start();
+    void stop();
+
+private:
+    void serveLoop();
+    void handle(int fd);
+
+    Metrics::Registry& registry_;
+    std::vector<int> listenFds_;
+    std::string unixPath_;
+    int wakeFds_[2];
+    std::thread thread_;
+    std::atomic<bool> isRunning_;
+};
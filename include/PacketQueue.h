@@ -0,0 +1,99 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <semaphore.h>
+#include "BoundedQueue.h"
+#include "MediaFrame.h"
+
+/**
+ * SendPacket: One encoded frame waiting for the RTMP writer thread.
+ */
+struct SendPacket {
+    MediaFrame::Ptr frame;
+    bool isVideo = false;
+    bool keyframe = false;    // IDR access unit
+    bool disposable = false;  // nal_ref_idc == 0, nothing references it
+    int nbSamples = 0;        // audio only
+    int64_t enqueueNs = 0;    // steady clock at enqueue
+    int64_t pts = -1;         // FLV timeline (ms), assigned by the writer
+    int64_t dts = -1;
+};
+
+struct PacketQueueStats {
+    size_t depth = 0;
+    size_t maxDepth = 0;
+    size_t capacity = 0;
+    uint64_t enqueued = 0;
+    uint64_t dequeued = 0;
+    uint64_t droppedDisposable = 0;  // non-reference frames shed at the high watermark
+    uint64_t droppedVideo = 0;       // reference frames shed while skipping to the next IDR
+    uint64_t droppedLate = 0;        // video older than the latency budget at dequeue
+    uint64_t droppedAudio = 0;       // audio shed only when the queue (or its byte budget) is full
+    size_t bytes = 0;                // frame payload currently queued
+    size_t peakBytes = 0;
+    size_t byteBudget = 0;           // 0: bounded by capacity only
+};
+
+/**
+ * PacketQueue: Bounded GOP-aware queue between the appsink callbacks and the RTMP writer.
+ * Producers never block. Under congestion frames are shed in this order:
+ *  1. non-reference video frames once the queue is half full
+ *  2. reference video frames once the video share is exhausted, then
+ *     everything up to the next IDR (the GOP is undecodable anyway)
+ *  3. audio, only when no slot is left at all
+ * The consumer additionally skips to the next IDR when queued video is older
+ * than the latency budget.
+ * With a byte budget (maxBytes) the same order applies to queued bytes as
+ * well as slots: non-reference frames go at half the budget, reference video
+ * at 7/8 (the rest is kept for audio), audio only at the budget itself.
+ */
+class PacketQueue {
+public:
+    struct Config {
+        size_t capacity = 256;
+        size_t audioReserve = 64;        // slots only audio may use
+        int64_t latencyBudgetMs = 1000;
+        size_t maxBytes = 0;             // 0: no byte budget
+    };
+
+    explicit PacketQueue(const Config& config);
+    ~PacketQueue();
+
+    /** @brief Producer side. Returns false if the packet was dropped by the policy. */
+    bool push(SendPacket&& pkt);
+
+    /** @brief Consumer side. Waits up to timeoutMs; returns false on timeout or wakeup(). */
+    bool pop(SendPacket& out, int timeoutMs);
+
+    /** @brief Unblocks a waiting consumer (used on shutdown) */
+    void wakeup();
+
+    PacketQueueStats stats() const;
+
+    static int64_t nowNs();
+
+private:
+    void noteDrop(std::atomic<uint64_t>& counter);
+    static size_t packetBytes(const SendPacket& pkt) { return pkt.frame ? pkt.frame->size() : 0; }
+
+    Config config_;
+    BoundedQueue<SendPacket> queue_;
+    sem_t available_;
+
+    // Producer-side: set after shedding a reference frame, cleared by the next IDR
+    std::atomic<bool> producerSkip_{false};
+    // Consumer-side: set when queued video exceeded the latency budget
+    bool consumerSkip_ = false;
+    std::atomic<bool> woken_{false};
+
+    std::atomic<size_t> maxDepth_{0};
+    std::atomic<size_t> bytes_{0};
+    std::atomic<size_t> peakBytes_{0};
+    std::atomic<uint64_t> enqueued_{0};
+    std::atomic<uint64_t> dequeued_{0};
+    std::atomic<uint64_t> droppedDisposable_{0};
+    std::atomic<uint64_t> droppedVideo_{0};
+    std::atomic<uint64_t> droppedLate_{0};
+    std::atomic<uint64_t> droppedAudio_{0};
+};
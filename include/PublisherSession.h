@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BitrateController.h"
+#include "GstManager.h"
+#include "RTMPFanout.h"
+
+class WriterPool;
+
+/**
+ * PublisherSession: One independent stream inside a multi-session process:
+ * its own source and GstManager pipelines, its own RTMPFanout (queues,
+ * connections, GOP cache) and its own BitrateController. Nothing is shared
+ * with other sessions except the WriterPool that drives the RTMP writers and
+ * the host's event loop, which calls tick(). Metrics carry session=name.
+ *
+ * A session that fails (pipeline error, every destination gave up) or ends
+ * (a file reached EOS) stops itself on the next tick(); the others carry on.
+ */
+class PublisherSession {
+public:
+    struct Config {
+        std::string name;
+        MediaSource source;
+        std::vector<std::string> urls;
+        int width = 720;
+        int height = 480;
+        int fps = 30;
+        int bitrateBps = 800000;
+        bool audio = true;          // FILE/UDP inputs without an audio track need audio=false
+        bool abr = true;
+        VideoCodec codec = VideoCodec::H264;
+        RTMPBackend backend = RTMPBackend::FFMPEG;
+        TcpOptions tcp;
+        MemoryBudget memory;
+    };
+
+    enum class State { IDLE, RUNNING, ENDED, FAILED };
+
+    struct Stats {
+        std::string name;
+        State state = State::IDLE;
+        size_t destinations = 0;
+        size_t connected = 0;
+        double throughputBps = 0;   // all destinations, since the previous stats() call
+        int bitrateBps = 0;         // current encoder target
+        uint64_t videoPackets = 0;  // written, primary destination
+        size_t queueDepth = 0;      // deepest destination queue
+        uint64_t drops = 0;         // all destinations
+        uint64_t reconnects = 0;
+    };
+
+    /**
+     * @brief capture, test, file:PATH, udp:PORT (MPEG-TS) or
+     * rtp:VPORT[,APORT[,opus|aac[/RATE[/CHANNELS]]]] (RTP relay; AAC 48000/1 by default)
+     */
+    static bool parseSource(const std::string& text, MediaSource& source);
+
+    /**
+     * @brief Parses one session line: name source [key=value | flag | url]...
+     * source is as in parseSource(); keys are size=WxH, fps,
+     * kbps; flags are noaudio, noabr, hevc, native. Tokens with "://" are URLs.
+     * @return false with error set if the line is malformed
+     */
+    static bool parseLine(const std::string& line, Config& config, std::string& error);
+
+    /** @brief AAC relayed from RTP keeps the sender's rate and channels; leaves a disabled (0) rate alone */
+    static void audioFormat(const MediaSource& source, int& sampleRate, int& channels);
+
+    /** @brief Send queue settings for a memory budget (sendQueueBytes per destination) */
+    static PacketQueue::Config queueConfig(const MemoryBudget& budget);
+
+    /** @brief Sender counters the bitrate controller works from */
+    static BitrateController::Sample abrSample(const RTMPStreamer& rtmp);
+
+    /** @brief The ABR frame rate ladder for a format: full, 2/3 and 1/2 rate */
+    static std::vector<int> fpsSteps(int fps);
+
+    /**
+     * @brief Applies an ABR decision to the encoder. A scale step changes the
+     * encoded size through GstManager::setVideoFormat (the destinations get
+     * the new sequence header in-stream); the frame rate step is applied on
+     * top of the format's rate.
+     */
+    static void applyAbrDecision(GstManager& gst, const BitrateController::Decision& d,
+                                 int width, int height, int fps);
+
+    explicit PublisherSession(const Config& config, WriterPool* pool = nullptr);
+    ~PublisherSession();
+    PublisherSession(const PublisherSession&) = delete;
+    PublisherSession& operator=(const PublisherSession&) = delete;
+
+    bool start();
+    void stop();
+
+    /** @brief Host event loop, every ~100 ms: ABR, memory budget, end and failure detection */
+    void tick(int64_t nowMs);
+
+    const std::string& name() const { return config_.name; }
+    State state() const { return state_; }
+    Stats stats();
+
+    static const char* stateName(State state);
+
+private:
+    Config config_;
+    State state_ = State::IDLE;
+    GstManager gst_;
+    RTMPFanout rtmp_;
+    std::unique_ptr<BitrateController> abr_;
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "RTMPStreamer.h"
+
+/**
+ * RTMPFanout: Publishes one encoded stream to several RTMP endpoints.
+ * Each destination is an independent RTMPStreamer with its own connection,
+ * header state, queue and writer thread, so a slow or dead ingest never
+ * delays the others. Frames are classified once and the same MediaFrame
+ * memory is shared by every destination.
+ */
+class RTMPFanout {
+public:
+    struct DestinationStats {
+        std::string url;
+        PacketQueueStats queue;
+        RTMPWriterStats writer;
+        double throughputBps = 0;  // since the previous getStats() call
+        bool failed = false;
+    };
+
+    explicit RTMPFanout(const std::vector<std::string>& urls,
+                        const PacketQueue::Config& queueConfig = PacketQueue::Config(),
+                        const RTMPReconnectPolicy& reconnectPolicy = RTMPReconnectPolicy());
+
+    /** @brief Starts every destination; false only if none could be started */
+    bool start(int width, int height, int sampleRate = 48000, int channels = 1);
+    void stop();
+
+    /** @brief Set before start(); shared by every destination (see RTMPStreamer::setOnKeyframeNeeded) */
+    void setOnKeyframeNeeded(const RTMPStreamer::KeyframeRequest& cb);
+
+    /** @brief Set before start(); applies to every destination */
+    void setBackend(RTMPBackend backend);
+    void setTcpOptions(const TcpOptions& options);
+    void setVideoCodec(VideoCodec codec);
+    void setWriterPool(WriterPool* pool);
+    void setSessionName(const std::string& name);
+
+    void pushVideoFrame(const MediaFrame::Ptr& frame);
+    void pushAudioFrame(const MediaFrame::Ptr& frame, int nb_samples);
+
+    size_t size() const { return destinations_.size(); }
+    const RTMPStreamer& destination(size_t i) const { return *destinations_[i]; }
+
+    /** @brief True when every destination has given up reconnecting */
+    bool allFailed() const;
+
+    std::vector<DestinationStats> getStats();
+
+private:
+    std::vector<std::unique_ptr<RTMPStreamer>> destinations_;
+    VideoCodec videoCodec_ = VideoCodec::H264;
+
+    std::mutex statsMutex_;
+    std::vector<uint64_t> prevBytes_;
+    int64_t prevStatsNs_ = 0;
+};
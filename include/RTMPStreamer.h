@@ -0,0 +1,268 @@
+#pragma once
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <memory>
+#include "MediaFrame.h"
+#include "H264Bitstream.h"
+#include "PacketQueue.h"
+#include "Interleaver.h"
+#include "Metrics.h"
+#include "TcpSocket.h"
+
+struct AVFormatContext;
+struct AVIOContext;
+struct AVStream;
+struct AVPacket;
+class RtmpClient;
+class FlvTagWriter;
+class WriterPool;
+
+struct RTMPWriterStats {
+    uint64_t videoPackets = 0;
+    uint64_t audioPackets = 0;
+    uint64_t bytesSent = 0;
+    int64_t lastWriteUs = 0;   // duration of the most recent av_write_frame
+    int64_t maxWriteUs = 0;
+    int64_t totalWriteUs = 0;
+    int64_t lagMs = 0;         // age of the last written packet while more are queued
+    bool connected = false;
+    uint64_t reconnects = 0;   // successful reconnects after a dropped connection
+    uint64_t resumedPackets = 0;  // packets replayed from the GOP cache on reconnect
+    int64_t outageMs = 0;      // duration of the ongoing outage, 0 while connected
+    int64_t lastOutageMs = 0;
+    int64_t totalOutageMs = 0;
+    int64_t handshakeMs = 0;   // RTMP connect + publish of the latest connection
+    int64_t firstVideoNs = 0;  // monotonic time the first video packet was written, 0 before
+    size_t gopCacheBytes = 0;  // frame payload held for replay after a reconnect
+    uint64_t videoConfigChanges = 0;  // sequence headers replaced mid-stream (new SPS/PPS)
+    // Socket telemetry after the latest write (native backend only; tcpValid false otherwise)
+    bool tcpValid = false;
+    int64_t tcpRttUs = 0;
+    int64_t tcpRttVarUs = 0;
+    uint32_t tcpCwnd = 0;         // segments
+    uint32_t tcpUnsentBytes = 0;  // in the kernel send queue, not yet on the wire
+    uint32_t tcpUnackedBytes = 0;
+    uint32_t tcpRetransmits = 0;
+};
+
+struct RTMPReconnectPolicy {
+    int initialBackoffMs = 500;
+    int maxBackoffMs = 16000;
+    int maxAttempts = 0;                 // consecutive failed attempts before giving up; 0 = never
+    int ioTimeoutMs = 5000;              // a write stalled this long counts as a dropped connection
+    size_t gopCacheMaxBytes = 8 << 20;   // GOPs larger than this are not cached
+};
+
+/** @brief FFMPEG: libavformat FLV muxer + AVIO. NATIVE: RtmpClient + FlvTagWriter (muxer/) */
+enum class RTMPBackend { FFMPEG, NATIVE };
+
+/**
+ * RTMPStreamer: Publishes Annex B H.264 and AAC frames as FLV over RTMP (libavformat).
+ * Video is converted to AVCC with avcC extradata here, not inside libavformat.
+ * H.265 is published as Enhanced RTMP (FourCC hvc1 video tags, hvcC sequence
+ * header); IRAP pictures (IDR, CRA, BLA) count as keyframes.
+ * The appsink callbacks only classify frames and enqueue them into a bounded
+ * PacketQueue; a dedicated writer thread owns the connection and calls
+ * av_write_frame, so a stalled socket never blocks the GStreamer streaming threads.
+ * Timestamps come from the pipeline clock (video) and accumulated sample counts
+ * (audio), relative to the first keyframe, and pass an Interleaver before muxing.
+ *
+ * A dropped connection is not terminal: only the FLV muxer and RTMP socket are
+ * torn down and reopened with exponential backoff while the pipelines keep
+ * running. The packets since the last IDR are kept in a rolling GOP cache and
+ * replayed right after the new header, so viewers get a decodable picture
+ * immediately instead of waiting for the next keyframe.
+ *
+ * With RTMPBackend::NATIVE the same writer thread drives the built-in FLV tag
+ * writer and RTMP chunk client instead of libavformat: no AVPacket per frame,
+ * no AVCC copy, one gathered socket write per frame. That backend also owns
+ * the TCP socket: TcpOptions (e.g. TCP_NOTSENT_LOWAT, which keeps the backlog
+ * in the PacketQueue where stale frames can still be dropped) are applied to
+ * every connection and RTT / unsent bytes are sampled after each write.
+ *
+ * With a WriterPool the writer is not a thread of its own but a task the
+ * pool's threads take turns on (see WriterPool), for processes that host
+ * many streams.
+ *
+ * Parameter sets are checked on every keyframe: new SPS/PPS (a resolution
+ * change, an encoder restart) become a new sequence header, sent in-stream
+ * right before that keyframe on the same connection, so players switch
+ * over without a reconnect.
+ *
+ * The RTMP handshake starts with start(), in parallel with pipeline preroll;
+ * only the FLV header waits for the first keyframe. Whenever a connection is
+ * waiting for an IDR the KeyframeRequest hook asks the encoder for one.
+ */
+class RTMPStreamer {
+public:
+    explicit RTMPStreamer(const std::string& rtmpUrl,
+                          const PacketQueue::Config& queueConfig = PacketQueue::Config(),
+                          const RTMPReconnectPolicy& reconnectPolicy = RTMPReconnectPolicy());
+    ~RTMPStreamer();
+
+    /** @brief Writer-thread hook after each successful av_write_frame, with the FLV DTS on the wire */
+    using WriteObserver = std::function<void(const SendPacket& pkt, int64_t flvDtsMs)>;
+
+    /** @brief Writer-thread hook when output is blocked until the next IDR; at most once per second */
+    using KeyframeRequest = std::function<void()>;
+
+    /**
+     * @brief sampleRate or channels of 0 publishes video only (no audio track, no interleaving).
+     * The AAC caps (codec_data) of the first audio frame override both; they are
+     * only used for a header that has to go out before any audio arrived.
+     */
+    bool start(int width, int height, int sampleRate = 48000, int channels = 1);
+    void stop();
+
+    /** @brief Called from the appsink thread; never blocks on the network */
+    void pushVideoFrame(const MediaFrame::Ptr& frame);
+    void pushAudioFrame(const MediaFrame::Ptr& frame, int nb_samples);
+
+    /** @brief Enqueues an already classified packet (shared between destinations) */
+    void pushPacket(SendPacket pkt);
+
+    /** @brief Classifies an Annex B frame (IDR or IRAP / non-reference); false if it has no slice */
+    static bool classifyVideo(const MediaFrame::Ptr& frame, VideoCodec codec, SendPacket& pkt);
+
+    const std::string& url() const { return rtmpUrl_; }
+
+    /** @brief Set before start(); used by the latency benchmark */
+    void setOnPacketWritten(WriteObserver cb) { onPacketWritten_ = cb; }
+
+    /** @brief Set before start(); typically GstManager::requestKeyframe */
+    void setOnKeyframeNeeded(KeyframeRequest cb) { onKeyframeNeeded_ = cb; }
+
+    /** @brief Set before start(); must match GstManager::setVideoCodec */
+    void setVideoCodec(VideoCodec codec) { videoCodec_ = codec; }
+    VideoCodec videoCodec() const { return videoCodec_; }
+
+    /** @brief Set before start(); FFMPEG by default */
+    void setBackend(RTMPBackend backend) { backend_ = backend; }
+    RTMPBackend backend() const { return backend_; }
+
+    /** @brief Set before start(); libavformat's tcp:// only takes noDelay and sendBufferBytes */
+    void setTcpOptions(const TcpOptions& options) { tcpOptions_ = options; }
+
+    /** @brief Set before start(); the writer then runs as turns on the shared pool instead of its own thread */
+    void setWriterPool(WriterPool* pool) { pool_ = pool; }
+
+    /** @brief Set before start(); adds session=name to this destination's metrics */
+    void setSessionName(const std::string& name);
+
+    /** @brief True once reconnecting was given up (RTMPReconnectPolicy::maxAttempts) */
+    bool hasFailed() const { return failed_; }
+    bool isConnected() const { return connected_; }
+
+    PacketQueueStats getQueueStats() const { return queue_.stats(); }
+    RTMPWriterStats getWriterStats() const;
+
+private:
+    static int interruptCallback(void* opaque);
+    void registerMetrics();
+
+    void writerLoop();
+    bool writerTurn();
+    void process(SendPacket& pkt);
+    bool startTimeline(const SendPacket& pkt);
+    bool assignTimestamps(SendPacket& pkt);
+    void deliver(const SendPacket& pkt);
+    void updateVideoConfig(const SendPacket& pkt);
+    void cachePacket(const SendPacket& pkt);
+    void connect();
+    int openTransport();
+    int openOutput();
+    void closeOutput(bool writeTrailer);
+    void disconnect();
+    void send(const SendPacket& pkt);
+    void requestKeyframe();
+    AVPacket* convertVideo(const SendPacket& pkt);
+    bool writePacket(const SendPacket& pkt);
+    int writeAVPacket(const SendPacket& pkt, int64_t pts, int64_t dts, size_t& size);
+    int writeFlvTag(const SendPacket& pkt, int64_t pts, int64_t dts, size_t& size);
+    bool parseVideo(const SendPacket& pkt);
+    void parseAudio(const SendPacket& pkt);
+    std::vector<uint8_t> audioHeader() const;
+    void sampleTcpInfo();
+
+    std::string rtmpUrl_;
+    RTMPReconnectPolicy policy_;
+    AVFormatContext* outContext_;
+    AVIOContext* transport_;              // connected RTMP session before the header is written
+    RTMPBackend backend_;
+    TcpOptions tcpOptions_;
+    std::unique_ptr<RtmpClient> rtmpClient_;
+    std::unique_ptr<FlvTagWriter> flvWriter_;   // set once the native header is out
+    bool sessionOpen_;                    // handshake done, header not yet written (either backend)
+    AVStream *videoStream_, *audioStream_;
+    int width_, height_, sampleRate_, channels_;
+    bool hasAudio_;
+    VideoCodec videoCodec_;
+    std::vector<uint8_t> videoConfig_;    // avcC or hvcC sequence header, kept for every reconnect
+    std::vector<uint8_t> wireConfig_;     // the one the current connection has; differs after a change
+    std::vector<uint8_t> configScratch_;  // rebuilt from each keyframe to compare
+    std::vector<uint8_t> audioConfig_;    // AudioSpecificConfig from the encoder caps
+    bool hasTimeline_;                    // first keyframe seen, baseNs_ fixed
+    int64_t baseNs_;            // clock time mapped to FLV timestamp 0
+    int64_t audioAnchorNs_;     // clock time of the first sample counted below
+    int64_t audioSamples_;
+    int64_t tsOffsetMs_;        // subtracted on write so every connection starts at 0
+    bool awaitKeyframe_;        // nothing is written on a new connection before an IDR
+    Interleaver interleaver_;
+
+    // Rolling cache of the packets since the last IDR, in write order
+    std::vector<SendPacket> gopCache_;
+    std::atomic<size_t> gopCacheBytes_;   // written by the writer, read by getWriterStats()
+    bool gopCacheValid_;
+
+    int backoffMs_;
+    int failedAttempts_;
+    int64_t nextAttemptNs_;
+    int64_t startNs_;
+    int64_t lastKeyframeRequestNs_;
+    H264::AccessUnit au_;                 // writer-thread parse state
+    std::vector<uint8_t> avccScratch_;    // reused AVCC output buffer
+    uint64_t videoFrameCnt_, audioFrameCnt_;
+    WriteObserver onPacketWritten_;
+    KeyframeRequest onKeyframeNeeded_;
+
+    PacketQueue queue_;
+    std::thread writerThread_;
+    WriterPool* pool_ = nullptr;
+    std::atomic<int> poolTask_{0};          // read by pushPacket() on the appsink threads
+    std::string sessionName_;
+    std::atomic<bool> isRunning_;
+    std::atomic<bool> abort_;             // interrupts blocking socket I/O on stop()
+    std::atomic<bool> connected_;
+    std::atomic<bool> failed_;
+
+    std::atomic<uint64_t> videoPackets_{0};
+    std::atomic<uint64_t> audioPackets_{0};
+    std::atomic<uint64_t> bytesSent_{0};
+    std::atomic<int64_t> lastWriteUs_{0};
+    std::atomic<int64_t> maxWriteUs_{0};
+    std::atomic<int64_t> totalWriteUs_{0};
+    std::atomic<int64_t> lastWrittenEnqueueNs_{0};
+    std::atomic<uint64_t> reconnects_{0};
+    std::atomic<uint64_t> resumedPackets_{0};
+    std::atomic<int64_t> outageStartNs_{0};
+    std::atomic<int64_t> lastOutageMs_{0};
+    std::atomic<int64_t> totalOutageMs_{0};
+    std::atomic<int64_t> handshakeMs_{0};
+    std::atomic<int64_t> firstVideoNs_{0};
+    std::atomic<uint64_t> videoConfigChanges_{0};
+    std::atomic<bool> tcpValid_{false};
+    std::atomic<int64_t> tcpRttUs_{0};
+    std::atomic<int64_t> tcpRttVarUs_{0};
+    std::atomic<uint32_t> tcpCwnd_{0};
+    std::atomic<uint32_t> tcpUnsentBytes_{0};
+    std::atomic<uint32_t> tcpUnackedBytes_{0};
+    std::atomic<uint32_t> tcpRetransmits_{0};
+    Metrics::Histogram* writeMs_ = nullptr;     // av_write_frame duration
+    Metrics::Histogram* packetAgeMs_ = nullptr; // appsink enqueue to written
+    std::mutex mutex_;
+};
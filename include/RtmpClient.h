@@ -0,0 +1,135 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include "FlvTagSink.h"
+#include "TcpSocket.h"
+
+/**
+ * RtmpClient: Minimal RTMP publisher (plain rtmp://, AMF0 commands).
+ * connect() does the simple handshake, connect / createStream / publish, and
+ * sendMessage() chunks a message whose payload is given as an iovec list:
+ * chunk headers are interleaved with slices of the caller's buffers and the
+ * whole message goes out in one writev, so payload bytes are never copied.
+ *
+ * The socket (TcpSocket) is non-blocking; every wait is sliced into 100 ms polls that
+ * check the abort flag, and a write stalled for ioTimeoutMs fails like
+ * libavformat's rw_timeout. Only the thread that owns the client may use it.
+ */
+class RtmpClient : public FlvTagSink {
+public:
+    enum MessageType : uint8_t {
+        SET_CHUNK_SIZE = 1,
+        ACKNOWLEDGEMENT = 3,
+        USER_CONTROL = 4,
+        WINDOW_ACK_SIZE = 5,
+        SET_PEER_BANDWIDTH = 6,
+        AUDIO = 8,
+        VIDEO = 9,
+        DATA_AMF0 = 18,
+        COMMAND_AMF3 = 17,
+        COMMAND_AMF0 = 20,
+    };
+
+    enum ChunkStream : uint32_t {
+        CS_CONTROL = 2,
+        CS_COMMAND = 3,
+        CS_AUDIO = 4,
+        CS_DATA = 5,
+        CS_VIDEO = 6,
+    };
+
+    explicit RtmpClient(const std::atomic<bool>& abort);
+    ~RtmpClient();
+
+    /** @brief Enhanced RTMP: FourCCs advertised in connect (e.g. "hvc1"); empty for legacy FLV codecs */
+    void setFourCcList(const std::vector<std::string>& list) { fourCcList_ = list; }
+
+    /** @brief Socket options of the next connect() */
+    void setTcpOptions(const TcpOptions& options) { tcpOptions_ = options; }
+
+    /** @brief Connects and starts publishing; 0 or a negative errno */
+    int connect(const std::string& url, int ioTimeoutMs);
+
+    /** @brief FCUnpublish + deleteStream (best effort), then closes the socket */
+    void unpublish();
+    void close();
+    bool isOpen() const { return socket_.isOpen(); }
+
+    /** @brief RTT and kernel send queue of the current connection; false when closed */
+    bool readTcpInfo(TcpInfo& info) const { return socket_.readInfo(info); }
+
+    /** @brief One message on the publish stream; false once the connection is unusable */
+    bool sendMessage(uint8_t type, uint32_t csid, uint32_t timestamp, const iovec* parts, size_t count);
+
+    /** @brief FlvTagSink: audio, video and script tags on their own chunk streams */
+    bool writeTag(uint8_t type, uint32_t timestampMs, const iovec* parts, size_t count) override;
+
+    uint64_t bytesWritten() const { return bytesWritten_; }
+
+    /** @brief Splits rtmp://host[:port]/app[/...]/stream; false for other schemes */
+    static bool parseUrl(const std::string& url, std::string& host, int& port, std::string& app,
+                         std::string& stream);
+
+private:
+    struct Message {
+        uint8_t type = 0;
+        uint32_t streamId = 0;
+        uint32_t timestamp = 0;
+        std::vector<uint8_t> payload;
+    };
+
+    struct InStream {
+        uint32_t timestamp = 0;
+        uint32_t delta = 0;
+        uint32_t length = 0;
+        uint32_t streamId = 0;
+        uint8_t type = 0;
+        bool extended = false;
+        std::vector<uint8_t> payload;
+    };
+
+    int handshake();
+    int command(const std::string& name, double transaction, uint32_t streamId,
+                const std::vector<uint8_t>& args);
+    int awaitResult(double transaction, double* number);
+    int awaitPublishStart();
+    int sendControl(uint8_t type, const std::vector<uint8_t>& payload);
+    bool writeMessage(uint8_t type, uint32_t csid, uint32_t streamId, uint32_t timestamp,
+                      const iovec* parts, size_t count);
+
+    bool writeAll(iovec* iov, size_t count);
+    /** @brief Bytes received, 0 on timeout, or a negative errno */
+    int readSome(int timeoutMs);
+    int readMessage(Message& msg, int timeoutMs);
+    bool parseChunk(Message& msg);
+    bool handleControl(const Message& msg);
+    void drainInput();
+
+    const std::atomic<bool>& abort_;
+    TcpSocket socket_;
+    TcpOptions tcpOptions_;
+    int ioTimeoutMs_;
+    std::string stream_;
+    std::vector<std::string> fourCcList_;
+    uint32_t streamId_;
+    double nextTransaction_;
+    int64_t lastDrainMs_;
+
+    uint32_t outChunkSize_;
+    std::vector<uint8_t> headers_;   // chunk headers of the message being sent
+    std::vector<iovec> iov_;
+
+    uint32_t inChunkSize_;
+    std::map<uint32_t, InStream> in_;
+    std::vector<uint8_t> inBuf_;
+    size_t inPos_;
+    uint32_t ackWindow_;
+    uint64_t bytesRead_;
+    uint64_t lastAck_;
+    uint64_t bytesWritten_;
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "AsyncFileWriter.h"
+#include "FlvTagSink.h"
+#include "FlvTagWriter.h"
+#include "H264Bitstream.h"
+#include "MediaFrame.h"
+
+struct SegmentRecorderStats {
+    uint64_t segments = 0;           // segments started since start()
+    uint64_t truncatedSegments = 0;  // cut short because the disk fell behind
+    uint64_t droppedFrames = 0;      // not recorded while waiting for the next keyframe after a cut
+    uint64_t diskBytes = 0;          // recordings currently kept in the directory
+    AsyncFileWriterStats writer;
+};
+
+/**
+ * SegmentRecorder: Local DVR of the encoded stream, fed from the same appsink
+ * frames as RTMPStreamer, so recording costs no second encode and keeps
+ * running through uplink outages. Writes FLV segments of roughly
+ * segmentSeconds; each one starts on a keyframe with its own metadata and
+ * sequence headers, so every file plays on its own. New parameter sets (a
+ * resolution change) start a new segment early.
+ *
+ * The calling (streaming) thread only parses the access unit and copies the
+ * tag into AsyncFileWriter buffers; the disk is written from the writer's
+ * thread. If those buffers are all still queued behind a slow disk, the
+ * current segment is closed early and recording resumes at the next keyframe
+ * instead of blocking the encoder. Whole old segments are deleted to keep
+ * the directory under maxBytes (plus the segment being written). The
+ * writer's buffers (bufferBytes * bufferCount) must hold the largest frame.
+ */
+class SegmentRecorder : private FlvTagSink {
+public:
+    struct Config {
+        std::string dir;
+        std::string prefix = "rec";
+        int segmentSeconds = 60;
+        uint64_t maxBytes = 512ull << 20;
+        AsyncFileWriter::Config io;
+    };
+
+    explicit SegmentRecorder(const Config& config);
+    ~SegmentRecorder();
+
+    /** @brief Set before start(); must match GstManager::setVideoCodec */
+    void setVideoCodec(VideoCodec codec) { videoCodec_ = codec; }
+
+    /** @brief sampleRate or channels of 0 records video only; the AAC caps override both */
+    bool start(int sampleRate = 48000, int channels = 1);
+    void stop();
+
+    /** @brief Called from the appsink threads; never waits for the disk */
+    void pushVideoFrame(const MediaFrame::Ptr& frame);
+    void pushAudioFrame(const MediaFrame::Ptr& frame);
+
+    SegmentRecorderStats getStats() const;
+
+private:
+    bool writeTag(uint8_t type, uint32_t timestampMs, const iovec* parts, size_t count) override;
+    bool writeFile(const iovec* parts, size_t count);
+
+    bool parseVideo(const MediaFrame::Ptr& frame);
+    bool openSegment(int64_t baseNs);
+    bool configChanged();
+    void closeSegment(bool truncated);
+    void enforceRetention();
+    void scanExisting();
+    std::string segmentPath() const;
+    void registerMetrics();
+
+    Config config_;
+    VideoCodec videoCodec_;
+    int sampleRate_, channels_;
+    bool hasAudio_;
+    bool isRunning_;
+
+    mutable std::mutex mutex_;
+    AsyncFileWriter writer_;
+    std::unique_ptr<FlvTagWriter> flv_;
+    H264::AccessUnit au_;
+    std::vector<uint8_t> videoConfig_;   // avcC/hvcC of the current segment
+    std::vector<uint8_t> configScratch_; // rebuilt from each keyframe to compare
+    std::vector<uint8_t> audioConfig_;   // AudioSpecificConfig from the encoder caps
+    int width_, height_;
+    std::vector<iovec> iov_;
+
+    bool segmentOpen_;
+    bool cut_;                  // last segment was truncated; frames are dropped until a keyframe
+    int64_t segmentBaseNs_;     // clock time at FLV timestamp 0 of the open segment
+    uint64_t segmentBytes_;
+    uint64_t segmentFrames_;
+    std::string segmentPath_;
+    std::deque<std::pair<std::string, uint64_t>> segments_;   // closed, oldest first
+    uint64_t diskBytes_;
+
+    uint64_t segmentsStarted_;
+    uint64_t truncated_;
+    uint64_t droppedFrames_;
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "PublisherSession.h"
+#include "WriterPool.h"
+
+/**
+ * SessionHost: Runs many PublisherSessions in one process, for relay boxes
+ * that would otherwise run one RtmpPublisher per stream. Sessions share one
+ * WriterPool for their RTMP writers and one event loop thread (run()) for
+ * everything periodic: ABR, end/failure handling and stats. Only the
+ * GStreamer streaming threads remain per session.
+ *
+ * Sessions file: one session per line (see PublisherSession::parseLine),
+ * blank lines and lines starting with '#' are ignored, e.g.
+ *   cam1  test             size=1280x720 kbps=2500   rtmp://ingest/live/key1
+ *   mp4   file:/srv/a.mp4  noabr                     rtmp://ingest/live/key2
+ *   enc3  udp:5004         noaudio native            rtmp://a/live/k3 rtmp://b/live/k3
+ */
+class SessionHost {
+public:
+    /** @brief 0 workers: one per online CPU, at least 2 */
+    explicit SessionHost(int workers = 0);
+    ~SessionHost();
+
+    /** @brief Each line starts from defaults (e.g. the command line's backend and TCP options) */
+    bool load(const std::string& path, const PublisherSession::Config& defaults);
+    void add(const PublisherSession::Config& config);
+
+    /** @brief Starts every session; false if none started */
+    bool start();
+
+    /** @brief Event loop; returns when exit is set or no session is left running */
+    void run(const std::atomic<bool>& exit);
+    void stop();
+
+    /** @brief Thread-safe; the event loop logs the stats on its next pass */
+    void requestStats() { statsRequested_ = true; }
+
+    size_t size() const { return sessions_.size(); }
+    PublisherSession& session(size_t i) { return *sessions_[i]; }
+
+private:
+    void logStats();
+
+    WriterPool pool_;
+    std::vector<std::unique_ptr<PublisherSession>> sessions_;
+    std::atomic<bool> statsRequested_{false};
+};
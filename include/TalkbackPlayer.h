@@ -0,0 +1,156 @@
+#pragma once
+#include <gst/gst.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <semaphore.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "Metrics.h"
+
+struct TalkbackStats {
+    uint64_t received = 0;      // RTP packets handed to push()
+    uint64_t played = 0;        // passed to the decoder
+    uint64_t late = 0;          // arrived after their playout time (or after their slot was given up)
+    uint64_t lost = 0;          // never arrived before their playout time
+    uint64_t duplicates = 0;
+    uint64_t dropped = 0;       // pool exhausted or not RTP
+    double jitterMs = 0;        // RFC 3550 interarrival jitter
+    int targetDelayMs = 0;      // current jitter buffer target
+    double bufferMs = 0;        // arrival to playout, mean of recent packets
+    double outputMs = 0;        // decoder and sink latency (pipeline latency query)
+    double mouthToEarMs = -1;   // capture to playout; -1 unless the sender sends abs-capture-time
+};
+
+/**
+ * TalkbackPlayer: Plays the far end's RTP/Opus audio (two-way talkback) with
+ * as little delay as the network allows.
+ *
+ * push() copies the packet into a preallocated slot and hands the slot index
+ * to the playout thread through a lock-free queue; it takes no lock and does
+ * not allocate. The playout thread reorders by sequence number and gives each
+ * packet a playout time from its RTP timestamp plus a target delay. The slot
+ * memory is wrapped into the GstBuffer as is and returns to the pool when
+ * the decoder releases it. The sink plays each packet at its PTS, which
+ * carries the jitter buffer delay, so there is no rtpjitterbuffer.
+ *
+ * The target delay follows the measured interarrival jitter (jitterFactor x
+ * jitter, within [minDelayMs, maxDelayMs]). The delay grows by the lateness
+ * as soon as a packet misses its playout time. It returns to the target at
+ * the start of a talkspurt or after a gap in the stream, where moving the
+ * playout point cannot be heard. During continuous speech it comes down by
+ * at most a frame per second, and only while every packet arrives with a
+ * frame to spare.
+ *
+ * push() may be called from one thread at a time.
+ */
+class TalkbackPlayer {
+public:
+    struct Config {
+        int minDelayMs = 20;
+        int maxDelayMs = 200;
+        double jitterFactor = 3.0;
+        size_t poolPackets = 128;       // reorder window, appsrc and decoder all hold slots
+        size_t packetBytes = 1500;
+        /** RTP header extension id of abs-capture-time (sender NTP capture time), 0 if not negotiated */
+        int absCaptureTimeExtId = 0;
+        std::string sink = "pulsesink buffer-time=40000 latency-time=10000";
+    };
+
+    explicit TalkbackPlayer(const Config& config, const Metrics::Labels& labels = {});
+    ~TalkbackPlayer();
+    TalkbackPlayer(const TalkbackPlayer&) = delete;
+    TalkbackPlayer& operator=(const TalkbackPlayer&) = delete;
+
+    bool start();
+    void stop();
+    bool isRunning() const { return running_.load(std::memory_order_acquire); }
+
+    /** @brief One RTP packet (12-byte header onwards); dropped and counted if the pool is empty */
+    void push(const uint8_t* data, size_t size);
+
+    TalkbackStats stats() const;
+
+private:
+    static constexpr uint16_t kWindow = 64;     // reorder window, packets
+
+    struct Slot {
+        TalkbackPlayer* owner;
+        uint32_t index;
+        uint32_t size;
+        int64_t arrivalNs;
+    };
+
+    struct Pending {
+        int32_t slot = -1;
+        uint32_t timestamp = 0;
+        int64_t captureWallNs = 0;     // 0 without abs-capture-time
+    };
+
+    void playoutLoop();
+    void receive(uint32_t index);
+    void release(int64_t nowNs);
+    /** @brief When release() has something to do next (in the past if now), or 0 if it waits for packets */
+    int64_t nextWakeNs() const;
+    void play(const Pending& p, int64_t playoutNs, int64_t nowNs);
+    void freeSlot(int32_t index);
+    void resync(uint16_t seq, uint32_t timestamp, int64_t arrivalNs);
+    int64_t playoutNs(uint32_t timestamp) const;
+    int targetDelayMs() const;
+    void queryOutputLatency();
+    void registerMetrics(const Metrics::Labels& labels);
+
+    static void onSlotReleased(gpointer data);
+
+    const Config config_;
+    std::unique_ptr<uint8_t[]> storage_;
+    std::vector<Slot> slots_;
+    BoundedQueue<uint32_t> free_;
+    BoundedQueue<uint32_t> ready_;
+    sem_t wake_;
+
+    GstElement* pipeline_ = nullptr;
+    GstElement* appsrc_ = nullptr;
+    GstClockTime baseTime_ = 0;
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+    std::atomic<int> pushing_{0};
+
+    // Playout thread only
+    bool synced_ = false;
+    uint32_t ssrc_ = 0;
+    uint16_t nextSeq_ = 0;
+    Pending window_[kWindow];
+    int buffered_ = 0;
+    int64_t baseNs_ = 0;            // arrival of the packet the timeline was anchored to
+    uint32_t baseTimestamp_ = 0;
+    int64_t delayNs_ = 0;           // applied target
+    bool discont_ = true;
+    int64_t lastPlayoutEndNs_ = 0;  // end of the last frame handed to the sink
+    int64_t minWaitNs_ = 0;         // shortest / longest arrival-to-playout wait this period
+    int64_t maxWaitNs_ = 0;
+    int64_t shrinkCheckNs_ = 0;
+    uint32_t lastTransit_ = 0;      // RTP units
+    bool haveTransit_ = false;
+    double jitter_ = 0;             // RTP units
+    int64_t nextLatencyQueryNs_ = 0;
+
+    // Published for stats()
+    std::atomic<uint64_t> received_{0};
+    std::atomic<uint64_t> played_{0};
+    std::atomic<uint64_t> late_{0};
+    std::atomic<uint64_t> lost_{0};
+    std::atomic<uint64_t> duplicates_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<int64_t> jitterUs_{0};
+    std::atomic<int64_t> delayUs_{0};
+    std::atomic<int64_t> bufferUs_{0};
+    std::atomic<int64_t> outputUs_{0};
+    std::atomic<int64_t> mouthToEarUs_{-1};
+
+    Metrics::Histogram* bufferHist_ = nullptr;
+    Metrics::Histogram* mouthToEarHist_ = nullptr;
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/** @brief Applied to every connection before it is used; 0 keeps the kernel default */
+struct TcpOptions {
+    bool noDelay = true;
+    int sendBufferBytes = 0;       // SO_SNDBUF; setting it disables send buffer autotuning
+    int notSentLowatBytes = 0;     // TCP_NOTSENT_LOWAT: cap on bytes queued in the kernel but not yet sent
+    int userTimeoutMs = 0;         // TCP_USER_TIMEOUT: unacknowledged data older than this resets the connection
+};
+
+/** @brief Kernel view of the connection (TCP_INFO and the send queue ioctls) */
+struct TcpInfo {
+    int64_t rttUs = 0;             // smoothed RTT
+    int64_t rttVarUs = 0;
+    uint32_t cwndSegments = 0;
+    uint32_t mss = 0;
+    uint32_t retransmits = 0;      // total for the connection
+    uint32_t unackedBytes = 0;     // sent, not yet acknowledged
+    uint32_t unsentBytes = 0;      // accepted by send() but still in the kernel queue
+};
+
+/**
+ * TcpSocket: Owns one non-blocking TCP connection for the native RTMP client.
+ * Unlike libavformat's tcp:// protocol it applies TcpOptions to the socket
+ * and can report TcpInfo, so senders see RTT and kernel backlog directly
+ * instead of inferring them from write latency.
+ */
+class TcpSocket {
+public:
+    TcpSocket() : fd_(-1) {}
+    ~TcpSocket() { close(); }
+    TcpSocket(const TcpSocket&) = delete;
+    TcpSocket& operator=(const TcpSocket&) = delete;
+
+    /**
+     * @brief Resolves and connects, trying every address in turn
+     * @return 0 or a negative errno (-EINTR once abort is set)
+     */
+    int connect(const std::string& host, int port, const TcpOptions& options, int timeoutMs,
+                const std::atomic<bool>& abort);
+    void close();
+
+    int fd() const { return fd_; }
+    bool isOpen() const { return fd_ >= 0; }
+
+    /** @brief Cheap enough to call after every write; false when not connected */
+    bool readInfo(TcpInfo& info) const;
+
+private:
+    void applyOptions(int fd, const TcpOptions& options);
+
+    int fd_;
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+struct ThreadSchedStats {
+    std::string name;
+    pid_t tid = 0;
+    std::string placement;          // what was applied, e.g. "fifo:50 @6"
+    uint64_t periods = 0;           // times scheduled in since the previous report
+    double avgWaitUs = 0;           // run-queue wait per period since the previous report
+    double maxAvgWaitUs = 0;        // worst avgWaitUs seen in any report
+    double cpuPercent = 0;          // of one core since the previous report
+};
+
+/**
+ * ThreadPolicy: CPU placement and scheduling class per named thread.
+ * Threads register with enter(name) from their own context (the app's
+ * threads at start, GStreamer streaming threads from their STREAM_STATUS
+ * ENTER message, named after the element that owns the task, e.g. vsrc,
+ * venc, enc_q, h264_q, asrc, aac_q). Rules are matched on that name and
+ * may be set before or after the threads start.
+ *
+ * Rule spec, ';' separated:  name=policy[:priority][@cpus]
+ *   policy   other | fifo | rr   (priority is the nice value for other)
+ *   cpus     "2", "2,3", "4-7"
+ * e.g. "vsrc=fifo:60@6;venc=fifo:55@6;rtmp-writer=rr:40@7;logger=other:5@0-3"
+ *
+ * Real-time classes need CAP_SYS_NICE or RLIMIT_RTPRIO; without them the
+ * affinity is still applied and the thread stays SCHED_OTHER.
+ *
+ * Scheduling latency is observed, not sampled: /proc/<tid>/schedstat gives
+ * the time each thread spent runnable but waiting for a CPU and the number
+ * of times it was scheduled in, so wait/periods is the mean wake-up delay.
+ */
+class ThreadPolicy {
+public:
+    struct Rule {
+        int policy = 0;                 // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+        int priority = 0;
+        std::vector<int> cpus;          // empty: any
+    };
+
+    static ThreadPolicy& instance();
+
+    /** @brief Parses and applies the spec (also to threads already registered); false on a syntax error */
+    bool setRules(const std::string& spec);
+
+    /** @brief Names the calling thread (first 15 chars), registers it and applies its rule */
+    void enter(const std::string& name);
+
+    /** @brief Unregisters the calling thread; call before it exits */
+    void leave();
+
+    /** @brief Per-thread figures since the previous call */
+    std::vector<ThreadSchedStats> report();
+    void logReport();
+
+private:
+    struct Thread {
+        std::string name;
+        std::string placement;
+        uint64_t lastRunNs = 0;
+        uint64_t lastWaitNs = 0;
+        uint64_t lastPeriods = 0;
+        int64_t lastReportNs = 0;
+        double maxAvgWaitUs = 0;
+    };
+
+    ThreadPolicy() = default;
+
+    std::string apply(pid_t tid, const std::string& name);
+    static bool parseRule(const std::string& text, std::string& name, Rule& rule);
+    static void registerMetrics(const Thread* owner, const std::string& name, pid_t tid);
+
+    std::mutex mutex_;
+    std::map<std::string, Rule> rules_;
+    std::map<pid_t, Thread> threads_;
+};
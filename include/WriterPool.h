@@ -0,0 +1,70 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * WriterPool: A fixed number of threads driving the RTMP writers of many
+ * streams, instead of one writer thread per destination. Each registered task
+ * is one writer's turn: drain what is queued, reconnect when due. A task runs
+ * on at most one thread at a time, so a writer keeps its single-threaded
+ * state; tasks with more work go to the back of the ready list, so one busy
+ * stream cannot starve the others.
+ *
+ * Tasks are queued by wake() (a packet was pushed) and, for timers such as
+ * reconnect backoff, by a sweep every kSweepMs. A turn that blocks (a connect
+ * handshake, a stalled socket up to the write timeout) holds its thread, so
+ * size the pool above the number of destinations expected to stall at once.
+ */
+class WriterPool {
+public:
+    /** @brief One turn; returns true if it left work behind and wants to run again right away */
+    using Task = std::function<bool()>;
+
+    static constexpr int kSweepMs = 100;
+
+    explicit WriterPool(int threads, const std::string& name = "rtmp-pool");
+    ~WriterPool();
+    WriterPool(const WriterPool&) = delete;
+    WriterPool& operator=(const WriterPool&) = delete;
+
+    /** @brief Registers a task; it first runs on the next sweep or wake() */
+    int add(Task task);
+
+    /** @brief Unregisters a task, waiting for a turn in progress to finish */
+    void remove(int id);
+
+    /** @brief Queues the task (or re-queues it after its current turn); cheap when already queued */
+    void wake(int id);
+
+    size_t threads() const { return workers_.size(); }
+
+private:
+    struct Slot {
+        std::shared_ptr<Task> task;
+        bool queued = false;
+        bool running = false;
+        bool rerun = false;     // woken while running
+    };
+
+    void workerLoop(int index);
+    void enqueue(int id, Slot& slot);
+
+    std::string name_;
+    std::mutex mutex_;
+    std::condition_variable readyCv_;
+    std::condition_variable idleCv_;
+    std::map<int, Slot> slots_;
+    std::deque<int> ready_;
+    int nextId_ = 1;
+    bool stopping_ = false;
+    int64_t nextSweepNs_ = 0;
+    std::vector<std::thread> workers_;
+};
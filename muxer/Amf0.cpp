@@ -0,0 +1,204 @@
+#include "Amf0.h"
+#include <cstring>
+
+namespace Amf0 {
+
+static void put_u16(std::vector<uint8_t>& out, uint16_t v) {
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+static void put_u32(std::vector<uint8_t>& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+static void put_key(std::vector<uint8_t>& out, const std::string& key) {
+    put_u16(out, static_cast<uint16_t>(key.size()));
+    out.insert(out.end(), key.begin(), key.end());
+}
+
+// ---------------- Writer ----------------
+void writeNumber(std::vector<uint8_t>& out, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    out.push_back(NUMBER);
+    for (int shift = 56; shift >= 0; shift -= 8) out.push_back(static_cast<uint8_t>(bits >> shift));
+}
+
+void writeBool(std::vector<uint8_t>& out, bool v) {
+    out.push_back(BOOLEAN);
+    out.push_back(v ? 1 : 0);
+}
+
+void writeString(std::vector<uint8_t>& out, const std::string& v) {
+    if (v.size() > 0xFFFF) {
+        out.push_back(LONG_STRING);
+        put_u32(out, static_cast<uint32_t>(v.size()));
+        out.insert(out.end(), v.begin(), v.end());
+        return;
+    }
+    out.push_back(STRING);
+    put_key(out, v);
+}
+
+void writeNull(std::vector<uint8_t>& out) {
+    out.push_back(NULL_VALUE);
+}
+
+void writeObjectStart(std::vector<uint8_t>& out) {
+    out.push_back(OBJECT);
+}
+
+void writeEcmaArrayStart(std::vector<uint8_t>& out, uint32_t count) {
+    out.push_back(ECMA_ARRAY);
+    put_u32(out, count);
+}
+
+void writeObjectEnd(std::vector<uint8_t>& out) {
+    put_u16(out, 0);
+    out.push_back(OBJECT_END);
+}
+
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, double v) {
+    put_key(out, key);
+    writeNumber(out, v);
+}
+
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, bool v) {
+    put_key(out, key);
+    writeBool(out, v);
+}
+
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, const std::string& v) {
+    put_key(out, key);
+    writeString(out, v);
+}
+
+void writeProperty(std::vector<uint8_t>& out, const std::string& key, const std::vector<std::string>& v) {
+    put_key(out, key);
+    out.push_back(STRICT_ARRAY);
+    put_u32(out, static_cast<uint32_t>(v.size()));
+    for (const std::string& s : v) writeString(out, s);
+}
+
+// ---------------- Reader ----------------
+bool Reader::readNumber(double& v) {
+    if (end_ - p_ < 9 || p_[0] != NUMBER) return false;
+    uint64_t bits = 0;
+    for (int i = 1; i <= 8; ++i) bits = (bits << 8) | p_[i];
+    memcpy(&v, &bits, sizeof(v));
+    p_ += 9;
+    return true;
+}
+
+bool Reader::readString(std::string& v) {
+    if (end_ - p_ < 3) return false;
+    size_t len, hdr;
+    if (p_[0] == STRING) {
+        len = (p_[1] << 8) | p_[2];
+        hdr = 3;
+    } else if (p_[0] == LONG_STRING && end_ - p_ >= 5) {
+        len = ((size_t)p_[1] << 24) | (p_[2] << 16) | (p_[3] << 8) | p_[4];
+        hdr = 5;
+    } else {
+        return false;
+    }
+    if ((size_t)(end_ - p_) < hdr + len) return false;
+    v.assign(reinterpret_cast<const char*>(p_ + hdr), len);
+    p_ += hdr + len;
+    return true;
+}
+
+bool Reader::readKey(std::string& key) {
+    if (end_ - p_ < 2) return false;
+    size_t len = (p_[0] << 8) | p_[1];
+    if ((size_t)(end_ - p_) < 2 + len) return false;
+    key.assign(reinterpret_cast<const char*>(p_ + 2), len);
+    p_ += 2 + len;
+    return true;
+}
+
+/** Properties up to and including the empty-key end marker */
+bool Reader::skipProperties() {
+    std::string key;
+    for (;;) {
+        if (end_ - p_ >= 3 && p_[0] == 0 && p_[1] == 0 && p_[2] == OBJECT_END) {
+            p_ += 3;
+            return true;
+        }
+        if (!readKey(key) || !skip()) return false;
+    }
+}
+
+bool Reader::skip() {
+    if (p_ >= end_) return false;
+    std::string s;
+    double d;
+    switch (p_[0]) {
+    case NUMBER:
+        return readNumber(d);
+    case BOOLEAN:
+        if (end_ - p_ < 2) return false;
+        p_ += 2;
+        return true;
+    case STRING:
+    case LONG_STRING:
+        return readString(s);
+    case NULL_VALUE:
+    case UNDEFINED:
+        ++p_;
+        return true;
+    case OBJECT:
+        ++p_;
+        return skipProperties();
+    case ECMA_ARRAY:
+        if (end_ - p_ < 5) return false;
+        p_ += 5;
+        return skipProperties();
+    case STRICT_ARRAY: {
+        if (end_ - p_ < 5) return false;
+        uint32_t count = ((uint32_t)p_[1] << 24) | (p_[2] << 16) | (p_[3] << 8) | p_[4];
+        p_ += 5;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!skip()) return false;
+        }
+        return true;
+    }
+    case DATE:
+        if (end_ - p_ < 11) return false;
+        p_ += 11;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Reader::findString(const std::string& key, std::string& value) {
+    if (p_ >= end_) return false;
+    if (p_[0] == OBJECT) {
+        ++p_;
+    } else if (p_[0] == ECMA_ARRAY && end_ - p_ >= 5) {
+        p_ += 5;
+    } else {
+        skip();
+        return false;
+    }
+
+    bool found = false;
+    std::string name;
+    for (;;) {
+        if (end_ - p_ >= 3 && p_[0] == 0 && p_[1] == 0 && p_[2] == OBJECT_END) {
+            p_ += 3;
+            return found;
+        }
+        if (!readKey(name)) return false;
+        if (!found && name == key && p_ < end_ && (p_[0] == STRING || p_[0] == LONG_STRING)) {
+            found = readString(value);
+            if (!found) return false;
+        } else if (!skip()) {
+            return false;
+        }
+    }
+}
+
+} // namespace Amf0
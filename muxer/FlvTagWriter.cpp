@@ -0,0 +1,131 @@
+#include "FlvTagWriter.h"
+#include "Amf0.h"
+#include "H265Bitstream.h"
+#include <cstring>
+
+static const uint8_t kCodecAvc = 7;
+// AVCPacketType and the Enhanced RTMP PacketType agree on 0 and 1
+static const uint8_t kPacketSequenceStart = 0;
+static const uint8_t kPacketCodedFrames = 1;
+static const uint8_t kPacketCodedFramesX = 3;   // Enhanced RTMP only: no composition time
+static const uint8_t kExHeader = 0x80;
+static const uint8_t kFourCcHevc[4] = {'h', 'v', 'c', '1'};
+static const uint8_t kFrameKey = 1;
+static const uint8_t kFrameInter = 2;
+// AAC, 44 kHz, 16 bit, stereo: fixed for AAC, the real format is in the ASC
+static const uint8_t kAacTagHeader = 0xAF;
+static const uint8_t kAacSequenceHeader = 0;
+static const uint8_t kAacRaw = 1;
+
+bool FlvTagWriter::buildVideoConfig(VideoCodec codec, const H264::AccessUnit& au, std::vector<uint8_t>& config,
+                                    int& width, int& height) {
+    if (!au.sps() || !au.pps()) return false;
+    if (codec == VideoCodec::H265) {
+        if (!au.vps() || !H265::buildHvcC(*au.vps(), *au.sps(), *au.pps(), config)) return false;
+        H265::SpsInfo sps;
+        if (H265::parseSps(*au.sps(), sps)) {
+            width = sps.width;
+            height = sps.height;
+        }
+        return true;
+    }
+    if (!H264::buildAvcC(*au.sps(), *au.pps(), config)) return false;
+    H264::SpsInfo sps;
+    if (H264::parseSps(*au.sps(), sps)) {
+        width = sps.width;
+        height = sps.height;
+    }
+    return true;
+}
+
+bool FlvTagWriter::writeMetadata(int width, int height, bool hasAudio, int sampleRate, int channels, int64_t dtsMs) {
+    std::vector<uint8_t> body;
+    Amf0::writeString(body, "@setDataFrame");
+    Amf0::writeString(body, "onMetaData");
+    Amf0::writeEcmaArrayStart(body, hasAudio ? 9 : 4);
+    Amf0::writeProperty(body, "width", (double)width);
+    Amf0::writeProperty(body, "height", (double)height);
+    // Enhanced RTMP carries the FourCC as the codec id
+    const double hvc1 = (double)(((uint32_t)'h' << 24) | ((uint32_t)'v' << 16) | ((uint32_t)'c' << 8) | '1');
+    Amf0::writeProperty(body, "videocodecid", codec_ == VideoCodec::H265 ? hvc1 : (double)kCodecAvc);
+    if (hasAudio) {
+        Amf0::writeProperty(body, "audiocodecid", 10.0);
+        Amf0::writeProperty(body, "audiosamplerate", (double)sampleRate);
+        Amf0::writeProperty(body, "audiosamplesize", 16.0);
+        Amf0::writeProperty(body, "audiochannels", (double)channels);
+        Amf0::writeProperty(body, "stereo", channels > 1);
+    }
+    Amf0::writeProperty(body, "encoder", "RtmpPublisher");
+    Amf0::writeObjectEnd(body);
+
+    iovec iov = {body.data(), body.size()};
+    return sink_.writeTag(FlvTagSink::TAG_SCRIPT, static_cast<uint32_t>(dtsMs), &iov, 1);
+}
+
+size_t FlvTagWriter::videoHeader(uint8_t* out, int frameType, int packetType, int32_t ctsMs) const {
+    if (codec_ != VideoCodec::H265) {
+        out[0] = static_cast<uint8_t>((frameType << 4) | kCodecAvc);
+        out[1] = static_cast<uint8_t>(packetType);
+        out[2] = static_cast<uint8_t>(ctsMs >> 16);
+        out[3] = static_cast<uint8_t>(ctsMs >> 8);
+        out[4] = static_cast<uint8_t>(ctsMs);
+        return 5;
+    }
+    if (packetType == kPacketCodedFrames && ctsMs == 0) packetType = kPacketCodedFramesX;
+    out[0] = static_cast<uint8_t>(kExHeader | (frameType << 4) | packetType);
+    memcpy(out + 1, kFourCcHevc, 4);
+    if (packetType != kPacketCodedFrames) return 5;
+    out[5] = static_cast<uint8_t>(ctsMs >> 16);
+    out[6] = static_cast<uint8_t>(ctsMs >> 8);
+    out[7] = static_cast<uint8_t>(ctsMs);
+    return 8;
+}
+
+bool FlvTagWriter::writeVideoHeader(const std::vector<uint8_t>& config, int64_t dtsMs) {
+    uint8_t header[8];
+    size_t len = videoHeader(header, kFrameKey, kPacketSequenceStart, 0);
+    iovec iov[2] = {{header, len}, {const_cast<uint8_t*>(config.data()), config.size()}};
+    return sink_.writeTag(FlvTagSink::TAG_VIDEO, static_cast<uint32_t>(dtsMs), iov, 2);
+}
+
+bool FlvTagWriter::writeAudioHeader(const std::vector<uint8_t>& asc) {
+    uint8_t header[2] = {kAacTagHeader, kAacSequenceHeader};
+    iovec iov[2] = {{header, sizeof(header)}, {const_cast<uint8_t*>(asc.data()), asc.size()}};
+    return sink_.writeTag(FlvTagSink::TAG_AUDIO, 0, iov, 2);
+}
+
+bool FlvTagWriter::writeVideo(const H264::AccessUnit& au, bool keyframe, int64_t dtsMs, int32_t ctsMs) {
+    uint8_t header[8];
+    size_t headerLen = videoHeader(header, keyframe ? kFrameKey : kFrameInter, kPacketCodedFrames, ctsMs);
+
+    // Sized up front: iov_ points into lengths_
+    lengths_.resize(au.count * 4);
+    iov_.clear();
+    iov_.push_back({header, headerLen});
+    for (size_t i = 0; i < au.count; ++i) {
+        const H264::Nal& nal = au.nals[i];
+        if (au.isAud(nal)) continue;
+        uint8_t* len = &lengths_[i * 4];
+        len[0] = static_cast<uint8_t>(nal.size >> 24);
+        len[1] = static_cast<uint8_t>(nal.size >> 16);
+        len[2] = static_cast<uint8_t>(nal.size >> 8);
+        len[3] = static_cast<uint8_t>(nal.size);
+        iov_.push_back({len, 4});
+        iov_.push_back({const_cast<uint8_t*>(nal.data), nal.size});
+    }
+    return sink_.writeTag(FlvTagSink::TAG_VIDEO, static_cast<uint32_t>(dtsMs),
+                               iov_.data(), iov_.size());
+}
+
+bool FlvTagWriter::writeAudio(const uint8_t* data, size_t size, int64_t dtsMs) {
+    // ADTS: 12-bit sync word, 7-byte header or 9 with CRC (protection_absent == 0)
+    if (size >= 7 && data[0] == 0xFF && (data[1] & 0xF0) == 0xF0) {
+        size_t header = (data[1] & 0x01) ? 7 : 9;
+        if (size <= header) return true;
+        data += header;
+        size -= header;
+    }
+    uint8_t tag[2] = {kAacTagHeader, kAacRaw};
+    iovec iov[2] = {{tag, sizeof(tag)}, {const_cast<uint8_t*>(data), size}};
+    return sink_.writeTag(FlvTagSink::TAG_AUDIO, static_cast<uint32_t>(dtsMs), iov, 2);
+}
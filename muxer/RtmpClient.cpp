@@ -0,0 +1,582 @@
+#include "RtmpClient.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Amf0.h"
+#include "Logger.h"
+
+static const size_t kHandshakeSize = 1536;
+static const uint32_t kOutChunkSize = 4096;
+static const size_t kMaxChunkHeader = 3 + 11 + 4;
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void put_u24(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v >> 16);
+    p[1] = static_cast<uint8_t>(v >> 8);
+    p[2] = static_cast<uint8_t>(v);
+}
+
+static void put_u32(uint8_t* p, uint32_t v) {
+    p[0] = static_cast<uint8_t>(v >> 24);
+    put_u24(p + 1, v);
+}
+
+static uint32_t get_u24(const uint8_t* p) {
+    return ((uint32_t)p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | get_u24(p + 1);
+}
+
+/** Chunk basic header; returns its size */
+static size_t put_basic_header(uint8_t* p, uint8_t fmt, uint32_t csid) {
+    if (csid < 64) {
+        p[0] = static_cast<uint8_t>((fmt << 6) | csid);
+        return 1;
+    }
+    if (csid < 320) {
+        p[0] = static_cast<uint8_t>(fmt << 6);
+        p[1] = static_cast<uint8_t>(csid - 64);
+        return 2;
+    }
+    p[0] = static_cast<uint8_t>((fmt << 6) | 1);
+    p[1] = static_cast<uint8_t>((csid - 64) & 0xFF);
+    p[2] = static_cast<uint8_t>((csid - 64) >> 8);
+    return 3;
+}
+
+RtmpClient::RtmpClient(const std::atomic<bool>& abort)
+    : abort_(abort), ioTimeoutMs_(5000), streamId_(0), nextTransaction_(1), lastDrainMs_(0),
+      outChunkSize_(128), inChunkSize_(128), inPos_(0), ackWindow_(0), bytesRead_(0), lastAck_(0),
+      bytesWritten_(0) {}
+
+RtmpClient::~RtmpClient() {
+    close();
+}
+
+bool RtmpClient::parseUrl(const std::string& url, std::string& host, int& port, std::string& app,
+                          std::string& stream) {
+    static const std::string scheme = "rtmp://";
+    if (url.compare(0, scheme.size(), scheme) != 0) return false;
+    size_t hostEnd = url.find('/', scheme.size());
+    size_t last = url.rfind('/');
+    if (hostEnd == std::string::npos || last <= hostEnd || last + 1 >= url.size()) return false;
+
+    std::string authority = url.substr(scheme.size(), hostEnd - scheme.size());
+    port = 1935;
+    size_t colon = authority.rfind(':');
+    if (!authority.empty() && authority[0] == '[') {
+        size_t bracket = authority.find(']');
+        if (bracket == std::string::npos) return false;
+        host = authority.substr(1, bracket - 1);
+        if (bracket + 1 < authority.size() && authority[bracket + 1] == ':') port = atoi(authority.c_str() + bracket + 2);
+    } else if (colon != std::string::npos) {
+        host = authority.substr(0, colon);
+        port = atoi(authority.c_str() + colon + 1);
+    } else {
+        host = authority;
+    }
+    app = url.substr(hostEnd + 1, last - hostEnd - 1);
+    stream = url.substr(last + 1);
+    return !host.empty() && !app.empty() && port > 0 && port < 65536;
+}
+
+// ---------------- Session setup ----------------
+int RtmpClient::connect(const std::string& url, int ioTimeoutMs) {
+    close();
+    std::string host, app;
+    int port = 0;
+    if (!parseUrl(url, host, port, app, stream_)) {
+        logWithTime(LEVEL_ERROR, "[RTMP] Native client only handles rtmp://host[:port]/app/stream: " + url);
+        return -EINVAL;
+    }
+    ioTimeoutMs_ = ioTimeoutMs > 0 ? ioTimeoutMs : 5000;
+    streamId_ = 0;
+    nextTransaction_ = 1;
+    outChunkSize_ = inChunkSize_ = 128;
+    in_.clear();
+    inBuf_.clear();
+    inPos_ = 0;
+    ackWindow_ = 0;
+    bytesRead_ = lastAck_ = bytesWritten_ = 0;
+    lastDrainMs_ = now_ms();
+
+    int ret = socket_.connect(host, port, tcpOptions_, ioTimeoutMs_, abort_);
+    if (ret < 0) return ret;
+    if ((ret = handshake()) < 0) {
+        close();
+        return ret;
+    }
+
+    // Fewer chunk headers per frame; servers accept it ahead of connect
+    std::vector<uint8_t> size(4);
+    put_u32(size.data(), kOutChunkSize);
+    if ((ret = sendControl(SET_CHUNK_SIZE, size)) < 0) {
+        close();
+        return ret;
+    }
+    outChunkSize_ = kOutChunkSize;
+
+    std::vector<uint8_t> args;
+    Amf0::writeObjectStart(args);
+    Amf0::writeProperty(args, "app", app);
+    Amf0::writeProperty(args, "type", "nonprivate");
+    Amf0::writeProperty(args, "flashVer", "FMLE/3.0 (compatible; RtmpPublisher)");
+    Amf0::writeProperty(args, "tcUrl", url.substr(0, url.size() - stream_.size() - 1));
+    if (!fourCcList_.empty()) Amf0::writeProperty(args, "fourCcList", fourCcList_);
+    Amf0::writeObjectEnd(args);
+    double txn = nextTransaction_++;
+    if ((ret = command("connect", txn, 0, args)) < 0 || (ret = awaitResult(txn, nullptr)) < 0) {
+        close();
+        return ret;
+    }
+
+    // Replies to these two are not needed; awaitResult() skips them
+    args.clear();
+    Amf0::writeNull(args);
+    Amf0::writeString(args, stream_);
+    command("releaseStream", nextTransaction_++, 0, args);
+    command("FCPublish", nextTransaction_++, 0, args);
+
+    args.clear();
+    Amf0::writeNull(args);
+    txn = nextTransaction_++;
+    double streamId = 0;
+    if ((ret = command("createStream", txn, 0, args)) < 0 || (ret = awaitResult(txn, &streamId)) < 0) {
+        close();
+        return ret;
+    }
+    streamId_ = static_cast<uint32_t>(streamId);
+
+    args.clear();
+    Amf0::writeNull(args);
+    Amf0::writeString(args, stream_);
+    Amf0::writeString(args, "live");
+    if ((ret = command("publish", nextTransaction_++, streamId_, args)) < 0 || (ret = awaitPublishStart()) < 0) {
+        close();
+        return ret;
+    }
+    return 0;
+}
+
+/**
+ * Simple (non-digest) handshake: C0+C1, then S0+S1+S2, then C2 echoing S1.
+ */
+int RtmpClient::handshake() {
+    std::vector<uint8_t> c0c1(1 + kHandshakeSize, 0);
+    c0c1[0] = 3;
+    uint32_t seed = static_cast<uint32_t>(now_ms()) | 1;
+    for (size_t i = 9; i < c0c1.size(); ++i) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        c0c1[i] = static_cast<uint8_t>(seed);
+    }
+    iovec iov = {c0c1.data(), c0c1.size()};
+    if (!writeAll(&iov, 1)) return -EIO;
+
+    const size_t reply = 1 + 2 * kHandshakeSize;
+    int64_t deadline = now_ms() + ioTimeoutMs_;
+    while (inBuf_.size() - inPos_ < reply) {
+        int64_t left = deadline - now_ms();
+        if (left <= 0) return -ETIMEDOUT;
+        int ret = readSome(static_cast<int>(left));
+        if (ret < 0) return ret;
+    }
+    if (inBuf_[inPos_] != 3) {
+        logWithTime(LEVEL_WARN, "[RTMP] Unsupported handshake version " + std::to_string(inBuf_[inPos_]));
+        return -EPROTO;
+    }
+
+    iov = {&inBuf_[inPos_ + 1], kHandshakeSize};
+    if (!writeAll(&iov, 1)) return -EIO;
+    inPos_ += reply;
+    return 0;
+}
+
+int RtmpClient::command(const std::string& name, double transaction, uint32_t streamId,
+                        const std::vector<uint8_t>& args) {
+    std::vector<uint8_t> payload;
+    Amf0::writeString(payload, name);
+    Amf0::writeNumber(payload, transaction);
+    payload.insert(payload.end(), args.begin(), args.end());
+    iovec iov = {payload.data(), payload.size()};
+    return writeMessage(COMMAND_AMF0, CS_COMMAND, streamId, 0, &iov, 1) ? 0 : -EIO;
+}
+
+int RtmpClient::sendControl(uint8_t type, const std::vector<uint8_t>& payload) {
+    iovec iov = {const_cast<uint8_t*>(payload.data()), payload.size()};
+    return writeMessage(type, CS_CONTROL, 0, 0, &iov, 1) ? 0 : -EIO;
+}
+
+/**
+ * Waits for _result/_error of one transaction; other commands (onBWDone,
+ * replies to releaseStream/FCPublish) are skipped. number receives the first
+ * number after the command object, i.e. the stream id of createStream.
+ */
+int RtmpClient::awaitResult(double transaction, double* number) {
+    int64_t deadline = now_ms() + ioTimeoutMs_;
+    Message msg;
+    for (;;) {
+        int64_t left = deadline - now_ms();
+        int ret = left > 0 ? readMessage(msg, static_cast<int>(left)) : -ETIMEDOUT;
+        if (ret < 0) return ret;
+        if (msg.type != COMMAND_AMF0 && msg.type != COMMAND_AMF3) continue;
+
+        size_t skip = msg.type == COMMAND_AMF3 && !msg.payload.empty() ? 1 : 0;
+        Amf0::Reader r(msg.payload.data() + skip, msg.payload.size() - skip);
+        std::string name;
+        double txn = -1;
+        if (!r.readString(name) || !r.readNumber(txn) || txn != transaction) continue;
+
+        if (name == "_error") {
+            std::string description;
+            r.skip();
+            r.findString("description", description);
+            logWithTime(LEVEL_WARN, "[RTMP] Server rejected the request: " + description);
+            return -ECONNREFUSED;
+        }
+        if (name != "_result") continue;
+        if (number && !(r.skip() && r.readNumber(*number))) return -EPROTO;
+        return 0;
+    }
+}
+
+int RtmpClient::awaitPublishStart() {
+    int64_t deadline = now_ms() + ioTimeoutMs_;
+    Message msg;
+    for (;;) {
+        int64_t left = deadline - now_ms();
+        int ret = left > 0 ? readMessage(msg, static_cast<int>(left)) : -ETIMEDOUT;
+        if (ret < 0) return ret;
+        if (msg.type != COMMAND_AMF0 && msg.type != COMMAND_AMF3) continue;
+
+        size_t skip = msg.type == COMMAND_AMF3 && !msg.payload.empty() ? 1 : 0;
+        Amf0::Reader r(msg.payload.data() + skip, msg.payload.size() - skip);
+        std::string name, code;
+        double txn = 0;
+        if (!r.readString(name) || !r.readNumber(txn)) continue;
+        if (name == "_error") return -ECONNREFUSED;
+        if (name != "onStatus" || !r.skip() || !r.findString("code", code)) continue;
+
+        if (code == "NetStream.Publish.Start") return 0;
+        if (code.compare(0, 18, "NetStream.Publish.") == 0) {
+            logWithTime(LEVEL_WARN, "[RTMP] Publish refused: " + code);
+            return -ECONNREFUSED;
+        }
+    }
+}
+
+void RtmpClient::unpublish() {
+    if (socket_.isOpen()) {
+        std::vector<uint8_t> args;
+        Amf0::writeNull(args);
+        Amf0::writeString(args, stream_);
+        command("FCUnpublish", nextTransaction_++, 0, args);
+        args.clear();
+        Amf0::writeNull(args);
+        Amf0::writeNumber(args, streamId_);
+        command("deleteStream", nextTransaction_++, 0, args);
+    }
+    close();
+}
+
+void RtmpClient::close() {
+    socket_.close();
+}
+
+// ---------------- Sending ----------------
+bool RtmpClient::sendMessage(uint8_t type, uint32_t csid, uint32_t timestamp, const iovec* parts, size_t count) {
+    // The server only talks back for acks and pings; look every 100 ms
+    int64_t now = now_ms();
+    if (now - lastDrainMs_ >= 100) {
+        lastDrainMs_ = now;
+        drainInput();
+    }
+    return writeMessage(type, csid, streamId_, timestamp, parts, count);
+}
+
+bool RtmpClient::writeTag(uint8_t type, uint32_t timestampMs, const iovec* parts, size_t count) {
+    uint32_t csid = type == TAG_VIDEO ? CS_VIDEO : type == TAG_AUDIO ? CS_AUDIO : CS_DATA;
+    return sendMessage(type, csid, timestampMs, parts, count);
+}
+
+/**
+ * The first chunk carries a full (type 0) header, every continuation a
+ * one-byte type 3 header (plus the extended timestamp when in use). Payload
+ * slices point into the caller's buffers.
+ */
+bool RtmpClient::writeMessage(uint8_t type, uint32_t csid, uint32_t streamId, uint32_t timestamp,
+                              const iovec* parts, size_t count) {
+    if (!socket_.isOpen()) return false;
+    size_t length = 0;
+    for (size_t i = 0; i < count; ++i) length += parts[i].iov_len;
+    if (length > 0xFFFFFF) return false;
+
+    const bool extended = timestamp >= 0xFFFFFF;
+    const size_t chunks = length > 0 ? (length + outChunkSize_ - 1) / outChunkSize_ : 1;
+    headers_.resize(chunks * kMaxChunkHeader);
+    iov_.clear();
+
+    uint8_t* h = headers_.data();
+    size_t n = put_basic_header(h, 0, csid);
+    put_u24(h + n, extended ? 0xFFFFFF : timestamp);
+    put_u24(h + n + 3, static_cast<uint32_t>(length));
+    h[n + 6] = type;
+    // Message stream id is the one little-endian field
+    h[n + 7] = static_cast<uint8_t>(streamId);
+    h[n + 8] = static_cast<uint8_t>(streamId >> 8);
+    h[n + 9] = static_cast<uint8_t>(streamId >> 16);
+    h[n + 10] = static_cast<uint8_t>(streamId >> 24);
+    n += 11;
+    if (extended) {
+        put_u32(h + n, timestamp);
+        n += 4;
+    }
+    iov_.push_back({h, n});
+    h += n;
+
+    size_t part = 0, offset = 0, inChunk = 0;
+    for (size_t sent = 0; sent < length;) {
+        if (inChunk == outChunkSize_) {
+            n = put_basic_header(h, 3, csid);
+            if (extended) {
+                put_u32(h + n, timestamp);
+                n += 4;
+            }
+            iov_.push_back({h, n});
+            h += n;
+            inChunk = 0;
+        }
+        while (offset == parts[part].iov_len) {
+            ++part;
+            offset = 0;
+        }
+        size_t take = std::min(parts[part].iov_len - offset, outChunkSize_ - inChunk);
+        iov_.push_back({static_cast<uint8_t*>(parts[part].iov_base) + offset, take});
+        offset += take;
+        inChunk += take;
+        sent += take;
+    }
+
+    if (!writeAll(iov_.data(), iov_.size())) {
+        logWithTime(LEVEL_WARN, std::string("[RTMP] Send failed: ") + (abort_ ? "aborted" : strerror(errno)));
+        close();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * sendmsg() rather than writev() only for MSG_NOSIGNAL: a reset connection
+ * must fail the write, not raise SIGPIPE.
+ */
+bool RtmpClient::writeAll(iovec* iov, size_t count) {
+    int64_t deadline = now_ms() + ioTimeoutMs_;
+    size_t idx = 0;
+    while (idx < count) {
+        msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov + idx;
+        mh.msg_iovlen = std::min<size_t>(count - idx, IOV_MAX);
+        ssize_t n = sendmsg(socket_.fd(), &mh, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+            if (abort_) return false;
+            if (now_ms() >= deadline) {
+                errno = ETIMEDOUT;
+                return false;
+            }
+            pollfd pfd = {socket_.fd(), POLLOUT, 0};
+            poll(&pfd, 1, 100);
+            continue;
+        }
+
+        bytesWritten_ += static_cast<uint64_t>(n);
+        size_t left = static_cast<size_t>(n);
+        while (idx < count && left >= iov[idx].iov_len) {
+            left -= iov[idx].iov_len;
+            ++idx;
+        }
+        if (left > 0) {
+            iov[idx].iov_base = static_cast<uint8_t*>(iov[idx].iov_base) + left;
+            iov[idx].iov_len -= left;
+        }
+        // Progress restarts the stall timer
+        deadline = now_ms() + ioTimeoutMs_;
+    }
+    return true;
+}
+
+// ---------------- Receiving ----------------
+int RtmpClient::readSome(int timeoutMs) {
+    if (!socket_.isOpen()) return -ENOTCONN;
+    if (inPos_ == inBuf_.size()) {
+        inBuf_.clear();
+        inPos_ = 0;
+    } else if (inPos_ > (64 << 10)) {
+        inBuf_.erase(inBuf_.begin(), inBuf_.begin() + inPos_);
+        inPos_ = 0;
+    }
+
+    int64_t deadline = now_ms() + timeoutMs;
+    pollfd pfd = {socket_.fd(), POLLIN, 0};
+    while (timeoutMs > 0 && poll(&pfd, 1, 100) == 0) {
+        if (abort_) return -EINTR;
+        if (now_ms() >= deadline) return 0;
+    }
+
+    const size_t old = inBuf_.size();
+    inBuf_.resize(old + 16384);
+    ssize_t n = recv(socket_.fd(), &inBuf_[old], 16384, MSG_DONTWAIT);
+    inBuf_.resize(old + (n > 0 ? n : 0));
+    if (n == 0) return -ECONNRESET;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -errno;
+
+    bytesRead_ += static_cast<uint64_t>(n);
+    if (ackWindow_ > 0 && bytesRead_ - lastAck_ >= ackWindow_) {
+        std::vector<uint8_t> ack(4);
+        put_u32(ack.data(), static_cast<uint32_t>(bytesRead_));
+        lastAck_ = bytesRead_;
+        sendControl(ACKNOWLEDGEMENT, ack);
+    }
+    return static_cast<int>(n);
+}
+
+/** Next non-control message; control messages are handled on the way */
+int RtmpClient::readMessage(Message& msg, int timeoutMs) {
+    int64_t deadline = now_ms() + timeoutMs;
+    for (;;) {
+        while (parseChunk(msg)) {
+            if (!handleControl(msg)) return 0;
+        }
+        int64_t left = deadline - now_ms();
+        if (left <= 0) return -ETIMEDOUT;
+        int ret = readSome(static_cast<int>(left));
+        if (ret < 0) return ret;
+    }
+}
+
+/**
+ * Consumes buffered chunks; true once one completes a message. A chunk is
+ * only consumed when it is complete, so a partial one simply waits for the
+ * next read.
+ */
+bool RtmpClient::parseChunk(Message& msg) {
+    static const size_t kMessageHeader[4] = {11, 7, 3, 0};
+    for (;;) {
+        const uint8_t* p = inBuf_.data() + inPos_;
+        const size_t avail = inBuf_.size() - inPos_;
+        if (avail < 1) return false;
+
+        const uint8_t fmt = p[0] >> 6;
+        uint32_t csid = p[0] & 0x3F;
+        size_t pos = 1;
+        if (csid == 0) {
+            if (avail < 2) return false;
+            csid = 64 + p[1];
+            pos = 2;
+        } else if (csid == 1) {
+            if (avail < 3) return false;
+            csid = 64 + p[1] + (p[2] << 8);
+            pos = 3;
+        }
+        if (avail < pos + kMessageHeader[fmt]) return false;
+
+        InStream& s = in_[csid];
+        const uint8_t* h = p + pos;
+        uint32_t tsField = 0, length = s.length, streamId = s.streamId;
+        uint8_t type = s.type;
+        if (fmt <= 2) tsField = get_u24(h);
+        if (fmt <= 1) {
+            length = get_u24(h + 3);
+            type = h[6];
+        }
+        if (fmt == 0) streamId = h[7] | (h[8] << 8) | (h[9] << 16) | ((uint32_t)h[10] << 24);
+        pos += kMessageHeader[fmt];
+
+        const bool extended = fmt == 3 ? s.extended : tsField == 0xFFFFFF;
+        if (extended) {
+            if (avail < pos + 4) return false;
+            tsField = get_u32(p + pos);
+            pos += 4;
+        }
+
+        // A new header in the middle of a message abandons the partial one
+        const bool starting = fmt != 3 || s.payload.empty();
+        const size_t have = starting ? 0 : s.payload.size();
+        const size_t chunk = std::min<size_t>(inChunkSize_, length - have);
+        if (avail < pos + chunk) return false;
+
+        if (starting) {
+            if (fmt == 0) {
+                s.timestamp = tsField;
+                s.delta = tsField;
+            } else if (fmt == 3) {
+                s.timestamp += s.delta;
+            } else {
+                s.delta = tsField;
+                s.timestamp += tsField;
+            }
+            s.length = length;
+            s.type = type;
+            s.streamId = streamId;
+            s.extended = extended;
+            s.payload.clear();
+        }
+        s.payload.insert(s.payload.end(), p + pos, p + pos + chunk);
+        inPos_ += pos + chunk;
+
+        if (s.payload.size() == s.length) {
+            msg.type = s.type;
+            msg.streamId = s.streamId;
+            msg.timestamp = s.timestamp;
+            msg.payload.swap(s.payload);
+            s.payload.clear();
+            return true;
+        }
+    }
+}
+
+bool RtmpClient::handleControl(const Message& msg) {
+    const std::vector<uint8_t>& d = msg.payload;
+    switch (msg.type) {
+    case SET_CHUNK_SIZE:
+        if (d.size() >= 4 && (get_u32(d.data()) & 0x7FFFFFFF) > 0) inChunkSize_ = get_u32(d.data()) & 0x7FFFFFFF;
+        return true;
+    case WINDOW_ACK_SIZE:
+        if (d.size() >= 4) ackWindow_ = get_u32(d.data());
+        return true;
+    case USER_CONTROL:
+        // PingRequest (6) must be answered with PingResponse (7) and the same timestamp
+        if (d.size() >= 6 && d[0] == 0 && d[1] == 6) {
+            std::vector<uint8_t> pong(d.begin(), d.begin() + 6);
+            pong[1] = 7;
+            sendControl(USER_CONTROL, pong);
+        }
+        return true;
+    case ACKNOWLEDGEMENT:
+    case SET_PEER_BANDWIDTH:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void RtmpClient::drainInput() {
+    Message msg;
+    while (socket_.isOpen() && readSome(0) > 0) {
+        while (parseChunk(msg)) handleControl(msg);
+    }
+}
@@ -0,0 +1,107 @@
+#include "TcpSocket.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <linux/sockios.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Logger.h"
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int TcpSocket::connect(const std::string& host, int port, const TcpOptions& options, int timeoutMs,
+                       const std::atomic<bool>& abort) {
+    close();
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || !res) {
+        logWithTime(LEVEL_WARN, "[TCP] Cannot resolve " + host);
+        return -EHOSTUNREACH;
+    }
+
+    int err = ECONNREFUSED;
+    for (addrinfo* ai = res; ai && fd_ < 0 && !abort; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        // SO_SNDBUF must be set before the handshake to size the window scale
+        applyOptions(fd, options);
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+            err = errno;
+            ::close(fd);
+            continue;
+        }
+
+        int64_t deadline = now_ms() + timeoutMs;
+        pollfd pfd = {fd, POLLOUT, 0};
+        int ready = 0;
+        while (!abort && now_ms() < deadline && (ready = poll(&pfd, 1, 100)) == 0) {}
+        socklen_t len = sizeof(err);
+        if (ready <= 0 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            if (ready == 0) err = ETIMEDOUT;
+            ::close(fd);
+            continue;
+        }
+        fd_ = fd;
+    }
+    freeaddrinfo(res);
+    if (fd_ < 0) return abort ? -EINTR : -err;
+    return 0;
+}
+
+/**
+ * Failures are logged and otherwise ignored: an option the kernel does not
+ * know (TCP_NOTSENT_LOWAT before 3.12) must not prevent streaming.
+ */
+void TcpSocket::applyOptions(int fd, const TcpOptions& options) {
+    auto set = [fd](int level, int name, int value, const char* what) {
+        if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+            logWithTime(LEVEL_WARN, std::string("[TCP] Cannot set ") + what + ": " + strerror(errno));
+        }
+    };
+    if (options.noDelay) set(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    if (options.sendBufferBytes > 0) set(SOL_SOCKET, SO_SNDBUF, options.sendBufferBytes, "SO_SNDBUF");
+    if (options.notSentLowatBytes > 0) set(IPPROTO_TCP, TCP_NOTSENT_LOWAT, options.notSentLowatBytes, "TCP_NOTSENT_LOWAT");
+    if (options.userTimeoutMs > 0) set(IPPROTO_TCP, TCP_USER_TIMEOUT, options.userTimeoutMs, "TCP_USER_TIMEOUT");
+}
+
+void TcpSocket::close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+}
+
+/**
+ * SIOCOUTQ counts unsent plus unacknowledged bytes, SIOCOUTQNSD only the
+ * unsent ones; both exist since Linux 2.6.38, unlike tcpi_notsent_bytes.
+ */
+bool TcpSocket::readInfo(TcpInfo& info) const {
+    if (fd_ < 0) return false;
+    tcp_info ti;
+    socklen_t len = sizeof(ti);
+    memset(&ti, 0, sizeof(ti));
+    if (getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) return false;
+    info.rttUs = ti.tcpi_rtt;
+    info.rttVarUs = ti.tcpi_rttvar;
+    info.cwndSegments = ti.tcpi_snd_cwnd;
+    info.mss = ti.tcpi_snd_mss;
+    info.retransmits = ti.tcpi_total_retrans;
+
+    int queued = 0, unsent = 0;
+    if (ioctl(fd_, SIOCOUTQ, &queued) < 0 || ioctl(fd_, SIOCOUTQNSD, &unsent) < 0) return false;
+    info.unsentBytes = static_cast<uint32_t>(unsent);
+    info.unackedBytes = static_cast<uint32_t>(queued > unsent ? queued - unsent : 0);
+    return true;
+}